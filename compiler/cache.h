@@ -0,0 +1,632 @@
+#ifndef CACHE
+#define CACHE
+
+#include "includes.h"
+
+
+// What a compile works out can be kept on disk for the next compile of the same program, with --cache. The cache
+// holds the IR of each routine that lowered without errors, under a fingerprint of the routine and of everything it
+// could see of the rest of the program, and the machine code of each function, under a fingerprint of the function
+// after optimization. So when a few routines of a large program change, only they are lowered and only the
+// functions that change because of them are generated again.
+
+
+/* Fingerprints */
+
+// Results are compared by fingerprint rather than by value. These are 64 bit FNV-1a hashes, like the keys of
+// generic instantiations, built up one field at a time.
+typedef unsigned long long Fingerprint;
+
+const Fingerprint NO_FINGERPRINT = 14695981039346656037ULL;
+
+Fingerprint fingerprint(const void *data, size_t size, Fingerprint hash = NO_FINGERPRINT) {
+	const unsigned char *bytes = (const unsigned char*) data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+Fingerprint fingerprint(unsigned long long n, Fingerprint hash) {
+	return fingerprint(&n, sizeof(n), hash);
+}
+
+// Strings have their length put in first, so that one field can't run into the next.
+Fingerprint fingerprint(const std::string &s, Fingerprint hash = NO_FINGERPRINT) {
+	return fingerprint(s.data(), s.size(), fingerprint((unsigned long long) s.size(), hash));
+}
+
+// The symbols a function refers to are taken by name, since their numbers depend on the module it is in.
+Fingerprint fingerprint(const IRModule &module, const Function *f, Fingerprint hash) {
+	hash = fingerprint(f->name, hash);
+	hash = fingerprint((unsigned long long) f->returnType * 2 + f->pure, hash);
+	for (IRType t : f->params) {
+		hash = fingerprint((unsigned long long) t, hash);
+	}
+	for (const StackSlot &s : f->slots) {
+		hash = fingerprint(((unsigned long long) s.size << 32) | s.align, hash);
+	}
+	for (const BasicBlock &b : f->blocks) {
+		hash = fingerprint((unsigned long long) b.code.size(), hash);
+		for (ValueId v : b.code) {
+			const Instruction &i = f->values[v];
+			hash = fingerprint(((unsigned long long) v << 32) | ((unsigned long long) i.op << 16) | ((unsigned long long) i.type << 8) | i.flags, hash);
+			hash = i.op == OP_SYMBOL ? fingerprint(module.symbols[i.imm].name, hash) : fingerprint((unsigned long long) i.imm, hash);
+			hash = fingerprint(((unsigned long long) i.targets[0] << 32) | i.targets[1], hash);
+			hash = fingerprint(i.operands, i.count * sizeof(ValueId), fingerprint((unsigned long long) i.count, hash));
+			if (i.op == OP_PHI) {
+				hash = fingerprint(i.incoming, i.count * sizeof(unsigned), hash);
+			}
+		}
+		hash = fingerprint(b.preds.data(), b.preds.size() * sizeof(unsigned), fingerprint((unsigned long long) b.preds.size(), hash));
+	}
+	return hash;
+}
+
+Fingerprint fingerprint(const IRModule &module, Fingerprint hash = NO_FINGERPRINT) {
+	for (const DataObject *d : module.data) {
+		hash = fingerprint(d->name, hash);
+		hash = fingerprint(((unsigned long long) d->align << 1) | d->readOnly, hash);
+		hash = fingerprint(d->bytes.data(), d->bytes.size(), fingerprint((unsigned long long) d->bytes.size(), hash));
+		for (const Relocation &r : d->relocations) {
+			hash = fingerprint(module.symbols[r.symbol].name, fingerprint((unsigned long long) r.offset, hash));
+			hash = fingerprint((unsigned long long) r.addend, hash);
+		}
+	}
+	for (const Function *f : module.functions) {
+		hash = fingerprint(module, f, hash);
+	}
+	return hash;
+}
+
+// The fingerprint that the machine code for a function is kept under. Code generation only looks at the function
+// and at the kind of each symbol it refers to, which decides how the symbol is reached.
+Fingerprint codeFingerprint(const IRModule &module, const Function *f, bool fast) {
+	Fingerprint hash = fingerprint(module, f, fingerprint((unsigned long long) fast, NO_FINGERPRINT));
+	hash = fingerprint((unsigned long long) f->values.size(), hash);
+	for (const Instruction &i : f->values) {
+		hash = fingerprint(((unsigned long long) i.op << 32) | ((unsigned long long) i.type << 24) | (i.flags << 16) | i.count, hash);
+		if (i.op == OP_SYMBOL) {
+			hash = fingerprint((unsigned long long) module.symbols[i.imm].kind, fingerprint(module.symbols[i.imm].name, hash));
+		}
+		else {
+			hash = fingerprint(i.operands, i.count * sizeof(ValueId), fingerprint((unsigned long long) i.imm, hash));
+		}
+	}
+	return hash;
+}
+
+
+/* Serialization */
+
+// Appends numbers as varints, zigzag encoded if they are signed, and strings as their length and bytes.
+class ByteWriter {
+
+	public:
+
+		std::vector<unsigned char> &out;
+
+		ByteWriter(std::vector<unsigned char> &o) : out(o) {}
+
+		void varint(unsigned long long n) {
+			while (n >= 0x80) {
+				out.push_back((unsigned char) (n | 0x80));
+				n >>= 7;
+			}
+			out.push_back((unsigned char) n);
+		}
+
+		void signedVarint(long long n) {
+			varint(((unsigned long long) n << 1) ^ (unsigned long long) (n >> 63));
+		}
+
+		void bytes(const void *data, size_t size) {
+			varint(size);
+			out.insert(out.end(), (const unsigned char*) data, (const unsigned char*) data + size);
+		}
+
+		void string(const std::string &s) {
+			bytes(s.data(), s.size());
+		}
+};
+
+// Reads what a ByteWriter wrote. Reading past the end, or a count that can't fit in what is left, sets failed and
+// gives zeros, so a caller only needs to check failed once it is done.
+class ByteReader {
+
+	public:
+
+		bool failed;
+
+		ByteReader(const unsigned char *data, size_t size) : failed(false), at(data), end(data + size) {}
+
+		bool done() const {
+			return at == end;
+		}
+
+		unsigned long long varint() {
+			unsigned long long ret = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				if (at == end) {
+					failed = true;
+					return 0;
+				}
+				unsigned char b = *at++;
+				ret |= (unsigned long long) (b & 0x7f) << shift;
+				if (b < 0x80) {
+					return ret;
+				}
+			}
+			failed = true;
+			return 0;
+		}
+
+		long long signedVarint() {
+			unsigned long long n = varint();
+			return (long long) (n >> 1) ^ -(long long) (n & 1);
+		}
+
+		// A count of things that each take at least a byte, so there can't be more than there are bytes left.
+		unsigned count() {
+			return atMost(end - at);
+		}
+
+		unsigned atMost(unsigned long long limit) {
+			return below(limit + 1);
+		}
+
+		unsigned below(unsigned long long limit) {
+			unsigned long long n = varint();
+			if (n >= limit) {
+				failed = true;
+				return 0;
+			}
+			return (unsigned) n;
+		}
+
+		std::string string() {
+			size_t size = count();
+			if (failed) {
+				return std::string();
+			}
+			std::string ret((const char*) at, size);
+			at += size;
+			return ret;
+		}
+
+		void bytes(std::vector<unsigned char> &out) {
+			size_t size = count();
+			if (!failed) {
+				out.assign(at, at + size);
+				at += size;
+			}
+		}
+
+	private:
+
+		const unsigned char *at;
+		const unsigned char *end;
+};
+
+
+// Write a module: its symbols by name and kind, then its data objects and functions, each of which refers to
+// symbols by their numbers.
+void writeModule(ByteWriter &out, const IRModule &module) {
+	out.varint(module.symbols.size());
+	for (const Symbol &s : module.symbols) {
+		out.string(s.name);
+		out.varint(s.kind);
+	}
+	out.varint(module.data.size());
+	for (const DataObject *d : module.data) {
+		out.varint(d->symbol);
+		out.varint(d->align);
+		out.varint(d->readOnly);
+		out.bytes(d->bytes.data(), d->bytes.size());
+		out.varint(d->relocations.size());
+		for (const Relocation &r : d->relocations) {
+			out.varint(r.offset);
+			out.varint(r.symbol);
+			out.signedVarint(r.addend);
+		}
+	}
+	out.varint(module.functions.size());
+	for (const Function *f : module.functions) {
+		out.varint(f->symbol);
+		out.varint(f->returnType);
+		out.varint(f->pure);
+		out.varint(f->params.size());
+		for (IRType t : f->params) {
+			out.varint(t);
+		}
+		out.varint(f->slots.size());
+		for (const StackSlot &s : f->slots) {
+			out.varint(s.size);
+			out.varint(s.align);
+		}
+		// Block numbers that are ~0u are written as 0 and the rest one higher.
+		out.varint(f->values.size());
+		for (const Instruction &i : f->values) {
+			out.varint(i.op);
+			out.varint(i.type);
+			out.varint(i.flags);
+			out.varint(i.block + 1);
+			out.signedVarint(i.imm);
+			out.varint(i.targets[0] + 1);
+			out.varint(i.targets[1] + 1);
+			out.varint(i.count);
+			for (unsigned j = 0; j < i.count; j++) {
+				out.varint(i.operands[j]);
+			}
+			out.varint(i.incoming != nullptr);
+			for (unsigned j = 0; i.incoming != nullptr && j < i.count; j++) {
+				out.varint(i.incoming[j]);
+			}
+		}
+		out.varint(f->blocks.size());
+		for (const BasicBlock &b : f->blocks) {
+			out.varint(b.code.size());
+			for (ValueId v : b.code) {
+				out.varint(v);
+			}
+			out.varint(b.preds.size());
+			for (unsigned p : b.preds) {
+				out.varint(p);
+			}
+		}
+	}
+}
+
+// Read a module that writeModule wrote into an empty one. Returns false if it isn't one, though a module that
+// reads without error is only as sound as the one that was written.
+bool readModule(ByteReader &in, IRModule *module) {
+	unsigned symbols = in.count();
+	std::vector<SymbolKind> kinds;
+	for (unsigned s = 0; s < symbols && !in.failed; s++) {
+		if (module->symbol(in.string()) != s) {
+			return false;
+		}
+		kinds.push_back((SymbolKind) in.below(EXTERNAL_SYMBOL + 1));
+	}
+	unsigned data = in.count();
+	for (unsigned k = 0; k < data && !in.failed; k++) {
+		unsigned symbol = in.below(symbols);
+		if (in.failed || module->symbols[symbol].kind != EXTERNAL_SYMBOL) {
+			return false;
+		}
+		unsigned align = in.atMost(1 << 16);
+		bool readOnly = in.varint() != 0;
+		DataObject *d = module->addData(module->symbols[symbol].name, align, readOnly);
+		in.bytes(d->bytes);
+		unsigned relocations = in.count();
+		for (unsigned r = 0; r < relocations && !in.failed; r++) {
+			Relocation relocation;
+			relocation.offset = in.below(d->bytes.size() < 8 ? 0 : d->bytes.size() - 7);
+			relocation.symbol = in.below(symbols);
+			relocation.addend = in.signedVarint();
+			d->relocations.push_back(relocation);
+		}
+	}
+	unsigned functions = in.count();
+	for (unsigned k = 0; k < functions && !in.failed; k++) {
+		unsigned symbol = in.below(symbols);
+		if (in.failed || module->symbols[symbol].kind != EXTERNAL_SYMBOL) {
+			return false;
+		}
+		Function *f = module->addFunction(module->symbols[symbol].name);
+		f->returnType = (IRType) in.below(IR_V2F64 + 1);
+		f->pure = in.varint() != 0;
+		unsigned params = in.count();
+		for (unsigned p = 0; p < params && !in.failed; p++) {
+			f->params.push_back((IRType) in.below(IR_V2F64 + 1));
+		}
+		unsigned slots = in.count();
+		for (unsigned s = 0; s < slots && !in.failed; s++) {
+			unsigned size = in.atMost(UINT_MAX);
+			unsigned align = in.atMost(1 << 16);
+			f->addSlot(size, align);
+		}
+		unsigned values = in.count();
+		f->values.resize(in.failed ? 0 : values);
+		for (Instruction &i : f->values) {
+			i.op = (Opcode) in.below(OP_TRAP + 1);
+			i.type = (IRType) in.below(IR_V2F64 + 1);
+			i.flags = in.atMost(UINT_MAX);
+			i.block = in.atMost(UINT_MAX) - 1;
+			i.imm = in.signedVarint();
+			i.targets[0] = in.atMost(UINT_MAX) - 1;
+			i.targets[1] = in.atMost(UINT_MAX) - 1;
+			i.count = in.count();
+			i.operands = in.failed || i.count == 0 ? nullptr : f->arena.allocate<ValueId>(i.count);
+			for (unsigned j = 0; i.operands != nullptr && j < i.count; j++) {
+				i.operands[j] = in.below(values);
+			}
+			bool incoming = in.varint() != 0;
+			i.incoming = in.failed || !incoming || i.count == 0 ? nullptr : f->arena.allocate<unsigned>(i.count);
+			for (unsigned j = 0; i.incoming != nullptr && j < i.count; j++) {
+				i.incoming[j] = in.atMost(UINT_MAX);
+			}
+			if (in.failed) {
+				i.count = 0;
+				break;
+			}
+		}
+		unsigned blocks = in.count();
+		for (unsigned b = 0; b < blocks && !in.failed; b++) {
+			f->addBlock();
+			unsigned code = in.count();
+			for (unsigned c = 0; c < code && !in.failed; c++) {
+				f->blocks[b].code.push_back(in.below(values));
+			}
+			unsigned preds = in.count();
+			for (unsigned p = 0; p < preds && !in.failed; p++) {
+				f->blocks[b].preds.push_back(in.atMost(UINT_MAX));
+			}
+		}
+		for (const Instruction &i : f->values) {
+			bool blockOk = i.block == ~0u || i.block < blocks;
+			bool targetsOk = (i.targets[0] == ~0u || i.targets[0] < blocks) && (i.targets[1] == ~0u || i.targets[1] < blocks);
+			if (!blockOk || !targetsOk || (i.op == OP_SYMBOL && (i.imm < 0 || i.imm >= symbols))) {
+				return false;
+			}
+			for (unsigned j = 0; i.incoming != nullptr && j < i.count; j++) {
+				if (i.incoming[j] >= blocks) {
+					return false;
+				}
+			}
+		}
+		for (const BasicBlock &b : f->blocks) {
+			for (unsigned p : b.preds) {
+				if (p >= blocks) {
+					return false;
+				}
+			}
+		}
+	}
+	for (unsigned s = 0; s < symbols && !in.failed; s++) {
+		if (module->symbols[s].kind != kinds[s]) {
+			return false;
+		}
+	}
+	return !in.failed;
+}
+
+// The build of what the compiler makes, which goes up by one with every change to the lowering, the optimizer, the
+// backend or the way IR and code are written out that could change them. IR and code from another build might not
+// be what this one would make of them. Unlike the time of compiling it, this is the same for everyone building the
+// same sources, so their caches can be shared and a rebuild without changes keeps them.
+const unsigned COMPILER_BUILD = 1;
+
+std::string compilerBuild() {
+	return "build " + std::to_string(COMPILER_BUILD);
+}
+
+
+/* The build cache */
+
+// A cache file starts with "CACHE", a version byte, the build of the compiler that wrote it, which is also part
+// of the fingerprint of its contents, and that fingerprint. The contents are the lowered units, as a count and
+// then for each its routine's symbol, its fingerprint and its module, then the machine code, as a count and then
+// for each its fingerprint, its bytes, its relocations and the names they refer to.
+class BuildCache {
+
+	public:
+
+		std::string path;
+		unsigned long long unitsFound;
+		unsigned long long unitsMissed;
+		unsigned long long codeFound;
+		unsigned long long codeMissed;
+
+		BuildCache(const std::string &p) : path(p), unitsFound(0), unitsMissed(0), codeFound(0), codeMissed(0), unitsAsked(false), codeAsked(false) {}
+
+		// Read the cache. A cache that is missing, was written by another build of the compiler or is damaged is
+		// just empty.
+		void load() {
+			TraceScope trace("load cache", path.c_str());
+			std::vector<unsigned char> contents;
+			FILE *f = fopen(path.c_str(), "rb");
+			if (f == nullptr) {
+				return;
+			}
+			unsigned char buffer[1 << 16];
+			size_t n;
+			while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+				contents.insert(contents.end(), buffer, buffer + n);
+			}
+			fclose(f);
+			trace.bytes = contents.size();
+			std::string build = compilerBuild();
+			size_t headerSize = 5 + 1 + 1 + build.size() + 8;
+			if (contents.size() < headerSize || memcmp(contents.data(), "CACHE", 5) != 0 || contents[5] != VERSION ||
+				contents[6] != build.size() || memcmp(contents.data() + 7, build.data(), build.size()) != 0) {
+				return;
+			}
+			Fingerprint stored;
+			memcpy(&stored, contents.data() + headerSize - 8, 8);
+			if (stored != fingerprint(contents.data() + headerSize, contents.size() - headerSize, fingerprint(build))) {
+				return;
+			}
+			ByteReader in(contents.data() + headerSize, contents.size() - headerSize);
+			unsigned count = in.count();
+			for (unsigned k = 0; k < count && !in.failed; k++) {
+				std::string symbol = in.string();
+				UnitEntry &e = units[symbol];
+				e.key = in.varint();
+				in.bytes(e.ir);
+			}
+			count = in.count();
+			for (unsigned k = 0; k < count && !in.failed; k++) {
+				CodeEntry &e = code[in.varint()];
+				in.bytes(e.code.code);
+				unsigned relocations = in.count();
+				for (unsigned r = 0; r < relocations && !in.failed; r++) {
+					CodeRelocation relocation;
+					relocation.offset = in.below(e.code.code.size() < 4 ? 0 : e.code.code.size() - 3);
+					relocation.symbol = in.atMost(UINT_MAX);
+					relocation.kind = (CodeRelocationKind) in.below(RELOC_GOTPCREL + 1);
+					relocation.addend = in.signedVarint();
+					e.code.relocations.push_back(relocation);
+				}
+				unsigned names = in.count();
+				for (unsigned s = 0; s < names && !in.failed; s++) {
+					e.code.names.push_back(in.string());
+				}
+				for (const CodeRelocation &r : e.code.relocations) {
+					in.failed = in.failed || r.symbol >= e.code.names.size();
+				}
+			}
+			if (in.failed || !in.done()) {
+				units.clear();
+				code.clear();
+			}
+		}
+
+		// Write the cache back, replacing it. Of the units and code that this compile asked for, only what it used
+		// is kept; if it got no further than asking for one kind, or none, everything of the other kinds is kept.
+		// Returns false if the file couldn't be written.
+		bool save() {
+			TraceScope trace("save cache", path.c_str());
+			std::vector<unsigned char> contents;
+			ByteWriter out(contents);
+			std::vector<const std::pair<const std::string, UnitEntry>*> keptUnits;
+			for (const auto &u : units) {
+				if (u.second.used || !unitsAsked) {
+					keptUnits.push_back(&u);
+				}
+			}
+			out.varint(keptUnits.size());
+			for (const auto *u : keptUnits) {
+				out.string(u->first);
+				out.varint(u->second.key);
+				out.bytes(u->second.ir.data(), u->second.ir.size());
+			}
+			std::vector<const std::pair<const Fingerprint, CodeEntry>*> keptCode;
+			for (const auto &c : code) {
+				if (c.second.used || !codeAsked) {
+					keptCode.push_back(&c);
+				}
+			}
+			out.varint(keptCode.size());
+			for (const auto *c : keptCode) {
+				const FunctionCode &fc = c->second.code;
+				out.varint(c->first);
+				out.bytes(fc.code.data(), fc.code.size());
+				out.varint(fc.relocations.size());
+				for (const CodeRelocation &r : fc.relocations) {
+					out.varint(r.offset);
+					out.varint(r.symbol);
+					out.varint(r.kind);
+					out.signedVarint(r.addend);
+				}
+				out.varint(fc.names.size());
+				for (const std::string &name : fc.names) {
+					out.string(name);
+				}
+			}
+
+			std::string build = compilerBuild();
+			std::vector<unsigned char> header((const unsigned char*) "CACHE", (const unsigned char*) "CACHE" + 5);
+			header.push_back((unsigned char) VERSION);
+			header.push_back((unsigned char) build.size());
+			header.insert(header.end(), build.begin(), build.end());
+			Fingerprint sum = fingerprint(contents.data(), contents.size(), fingerprint(build));
+			header.insert(header.end(), (const unsigned char*) &sum, (const unsigned char*) &sum + 8);
+
+			// The cache is written beside itself and then moved into place, so that a compile that is killed
+			// while writing it leaves the old one. The copy is named for the process, since the children of a
+			// compile server may write the same cache at once.
+			std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+			FILE *f = fopen(temporary.c_str(), "wb");
+			if (f == nullptr) {
+				return false;
+			}
+			bool ok = fwrite(header.data(), 1, header.size(), f) == header.size() && fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+			ok = fclose(f) == 0 && ok;
+			trace.bytes = header.size() + contents.size();
+			if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+				unlink(temporary.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		// The unit of a routine, as it was lowered under the same fingerprint before, or nullptr. The unit is the
+		// caller's to free.
+		LoweredUnit* findUnit(const std::string &symbol, Fingerprint key) {
+			unitsAsked = true;
+			auto found = units.find(symbol);
+			if (found == units.end() || found->second.key != key) {
+				unitsMissed++;
+				return nullptr;
+			}
+			LoweredUnit *ret = new LoweredUnit();
+			ByteReader in(found->second.ir.data(), found->second.ir.size());
+			if (!readModule(in, ret->module) || !in.done()) {
+				delete ret;
+				units.erase(found);
+				unitsMissed++;
+				return nullptr;
+			}
+			ret->ok = true;
+			found->second.used = true;
+			unitsFound++;
+			return ret;
+		}
+
+		// Keep the unit of a routine, which must have lowered without errors, for the next compile.
+		void keepUnit(const std::string &symbol, Fingerprint key, const LoweredUnit *unit) {
+			unitsAsked = true;
+			UnitEntry &e = units[symbol];
+			if (e.key != key || e.ir.empty()) {
+				e.key = key;
+				e.ir.clear();
+				ByteWriter out(e.ir);
+				writeModule(out, *unit->module);
+			}
+			e.used = true;
+		}
+
+		// The code generated for a function under the same fingerprint before, or nullptr.
+		const FunctionCode* findCode(Fingerprint key) {
+			codeAsked = true;
+			auto found = code.find(key);
+			if (found == code.end()) {
+				codeMissed++;
+				return nullptr;
+			}
+			found->second.used = true;
+			codeFound++;
+			return &found->second.code;
+		}
+
+		void keepCode(Fingerprint key, const FunctionCode &generated) {
+			codeAsked = true;
+			CodeEntry &e = code[key];
+			e.code = generated;
+			e.used = true;
+		}
+
+	private:
+
+		static const unsigned char VERSION = 1;
+
+		struct UnitEntry {
+			Fingerprint key = 0;
+			std::vector<unsigned char> ir;
+			bool used = false;
+		};
+
+		struct CodeEntry {
+			FunctionCode code;
+			bool used = false;
+		};
+
+		std::map<std::string, UnitEntry> units;
+		std::map<Fingerprint, CodeEntry> code;
+		bool unitsAsked;
+		bool codeAsked;
+};
+
+#endif
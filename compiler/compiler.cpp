@@ -1,8 +1,33 @@
 #include "includes.h"
 
 int main(int argc,  char **argv) {
-	if (argc > 1) {
-		std::string filename(argv[1]);
-		Program *ast = parse(&filename);
+
+	// Run as a compile server, which keeps what it has parsed from one compile to the next.
+	if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+		CompileServer server(argv[2]);
+		if (!server.listen()) {
+			return 1;
+		}
+		server.serve();
+		return 1;
+	}
+
+	// Answer an editor's questions about the programs it has open, over the language server protocol.
+	if (argc == 2 && strcmp(argv[1], "--lsp") == 0) {
+		LanguageServer server;
+		return server.serve();
+	}
+
+	// Have the compile server at the path do the rest of the command line, or do it here if there isn't one.
+	if (argc >= 3 && strcmp(argv[1], "--connect") == 0) {
+		const char *path = argv[2];
+		argv[2] = argv[0];
+		argc -= 2;
+		argv += 2;
+		int status;
+		if (forwardToServer(path, argc, argv, status)) {
+			return status;
+		}
 	}
+	return compile(readOptions(argc, argv));
 }
@@ -0,0 +1,341 @@
+#ifndef DRIVER
+#define DRIVER
+
+#include "includes.h"
+
+
+// What a command line asks the compiler to do.
+// The strings point into the command line, so it must outlive the options.
+struct Options {
+	bool emitIR = false;
+	bool optimize = true;
+	bool timePasses = false;
+	bool reportVectorization = false;
+	bool reportLayout = false;
+	std::vector<std::string> structOfArrays;
+	bool verifyIR = false;
+	const char *cacheFile = nullptr;
+	unsigned jobs = 0;						// The threads to share work out between, or 0 for one per core.
+	bool lto = false;
+	bool ltoLink = false;
+	bool thinLTO = false;
+	const char *traceFile = nullptr;
+	double traceGranularity = 500;
+	bool stats = false;
+	bool dumpTokensOnly = false;
+	bool dumpAst = false;
+	bool dumpBinary = false;
+	const char *file = nullptr;
+	std::vector<std::string> inputs;		// Every file named, for a link, of which file is the last.
+	const char *output = nullptr;
+	bool run = false;
+	std::vector<std::string> programArgs;
+};
+
+// Read a command line, skipping the program name.
+Options readOptions(int argc, char **argv) {
+	Options ret;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			ret.output = argv[++i];
+		}
+		else if (strcmp(argv[i], "-O0") == 0) {
+			ret.optimize = false;
+		}
+		// Everything after the file to run is passed to its main.
+		else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
+			ret.run = true;
+			ret.file = argv[++i];
+			ret.programArgs.assign(argv + i, argv + argc);
+			break;
+		}
+		else if (strcmp(argv[i], "--emit-ir") == 0) {
+			ret.emitIR = true;
+		}
+		else if (strcmp(argv[i], "--report-vectorization") == 0) {
+			ret.reportVectorization = true;
+		}
+		else if (strcmp(argv[i], "--report-layout") == 0) {
+			ret.reportLayout = true;
+		}
+		// Lay out the arrays of a class as a struct of arrays.
+		else if (strcmp(argv[i], "--soa") == 0 && i + 1 < argc) {
+			ret.structOfArrays.push_back(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--time-passes") == 0) {
+			ret.timePasses = true;
+		}
+		// Write where the time goes as a Chrome trace, and a summary of it to stderr.
+		else if (strcmp(argv[i], "--time-trace") == 0 && i + 1 < argc) {
+			ret.traceFile = argv[++i];
+		}
+		// Spans shorter than this many microseconds are left out of the trace, but not the summary.
+		else if (strcmp(argv[i], "--time-trace-granularity") == 0 && i + 1 < argc) {
+			ret.traceGranularity = atof(argv[++i]);
+		}
+		// Say how much memory each part of the compiler used, and whether any of it leaked.
+		else if (strcmp(argv[i], "--stats") == 0) {
+			ret.stats = true;
+		}
+		// Write the tokens or syntax trees of the file to stdout instead of compiling it.
+		else if (strcmp(argv[i], "--dump-tokens") == 0) {
+			ret.dumpTokensOnly = true;
+		}
+		else if (strcmp(argv[i], "--dump-ast") == 0) {
+			ret.dumpAst = true;
+		}
+		else if (strcmp(argv[i], "--dump-binary") == 0) {
+			ret.dumpBinary = true;
+		}
+		else if (strcmp(argv[i], "--verify-ir") == 0) {
+			ret.verifyIR = true;
+		}
+		// Keep the IR and machine code of each routine in a file, so that the next compile of the program only
+		// lowers and generates code for the routines that changed.
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			ret.cacheFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			ret.jobs = atoi(argv[++i]);
+		}
+		// Put the IR in the object too, so that it can be optimized with the other objects of the program when
+		// they are linked.
+		else if (strcmp(argv[i], "--lto") == 0) {
+			ret.lto = true;
+		}
+		// Link the objects named, which were compiled with --lto, into one, optimizing them as a whole program.
+		else if (strcmp(argv[i], "--lto-link") == 0) {
+			ret.ltoLink = true;
+		}
+		// The same, but optimizing a partition for each object on its own thread.
+		else if (strcmp(argv[i], "--thin-lto-link") == 0) {
+			ret.ltoLink = true;
+			ret.thinLTO = true;
+		}
+		else {
+			ret.file = argv[i];
+			ret.inputs.push_back(argv[i]);
+		}
+	}
+	return ret;
+}
+
+// Start tracing, if the options ask for it.
+void startReport(const Options &options) {
+	if (options.traceFile != nullptr) {
+		tracer = new Tracer(options.traceGranularity);
+	}
+}
+
+// Report on the compilation, whether or not it succeeded, once everything it made has been freed. A compile server
+// says that it keeps the syntax trees it has parsed, so that they aren't taken for leaks.
+int finishReport(const Options &options, int status, bool treesKept = false) {
+	if (tracer != nullptr) {
+		tracer->printSummary(stderr);
+		if (!tracer->write(options.traceFile)) {
+			printf("Error: could not write %s.\n", options.traceFile);
+			status = 1;
+		}
+		delete tracer;
+		tracer = nullptr;
+	}
+	if (options.stats) {
+		printMemoryStats(stderr, treesKept);
+	}
+	return status;
+}
+
+// Write the tokens or syntax trees of the file, as --dump-tokens and --dump-ast ask. Returns the exit status.
+int dump(const Options &options) {
+	std::string filename(options.file);
+	DumpWriter writer(stdout, options.dumpBinary);
+	std::string diagnostics;
+	bool ok = options.dumpTokensOnly ? dumpTokens(&filename, writer, diagnostics) : dumpSyntaxTrees(&filename, writer, diagnostics);
+	fputs(diagnostics.c_str(), stdout);
+	if (!writer.flush()) {
+		fprintf(stderr, "Error: could not write the dump.\n");
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
+
+// Lower the file to a module, having checked and recorded the layouts that the options ask for. Returns nullptr,
+// having said why, if the program has errors. The module belongs to the database.
+const IRModule* lowerFile(const Options &options, CompilationDatabase &db) {
+	std::string diagnostics;
+	const Program *ast = db.program(options.file, diagnostics);
+	bool ok = ast != nullptr && db.interfaces(options.file, diagnostics);
+	fputs(diagnostics.c_str(), stdout);
+	if (!ok) {
+		return nullptr;
+	}
+	for (const std::string &name : options.structOfArrays) {
+		const TypeDeclaration *t = findClass(ast, name);
+		if (t == nullptr || t->kind == UNION_DECL) {
+			printf("Error: %s isn't a class or struct, so it can't be laid out as a struct of arrays.\n", name.c_str());
+			return nullptr;
+		}
+	}
+	db.setStructOfArrays(options.file, std::set<std::string>(options.structOfArrays.begin(), options.structOfArrays.end()));
+	diagnostics.clear();
+	ast = db.program(options.file, diagnostics);
+	if (options.reportLayout) {
+		reportLayouts(ast, ast, stderr);
+	}
+	diagnostics.clear();
+	const IRModule *lowered = db.module(options.file, diagnostics);
+	fputs(diagnostics.c_str(), stdout);
+	return lowered;
+}
+
+// The threads to do work on that can be shared out.
+unsigned jobs(const Options &options) {
+	return options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Generate code for an optimized module, and write or run it as the options say. Returns the exit status.
+// With a build cache, the code of functions that are the same as in an earlier compile is taken from it, and an
+// object file that is already there is patched. main is given the entry point that the C runtime calls, after the
+// IR for --lto is taken, so that the program it is linked into gets one.
+int emit(const Options &options, IRModule *module, BuildCache *cache) {
+	int status = 0;
+	if (options.output != nullptr || options.run) {
+		std::vector<unsigned char> ir;
+		if (options.output != nullptr && options.lto) {
+			ir = embeddedIR(*module);
+		}
+		if (!addEntryPoint(module)) {
+			return 1;
+		}
+		X86CodeGenerator generator(module, !options.optimize);
+		std::vector<Fingerprint> keys;
+		std::vector<const FunctionCode*> reuse;
+		if (cache != nullptr) {
+			for (const Function *f : module->functions) {
+				keys.push_back(codeFingerprint(*module, f, !options.optimize));
+				reuse.push_back(cache->findCode(keys.back()));
+			}
+		}
+		generator.generate(reuse, jobs(options));
+		for (unsigned k = 0; k < reuse.size(); k++) {
+			if (reuse[k] == nullptr) {
+				cache->keepCode(keys[k], generator.codeOf(k));
+			}
+		}
+		if (options.output != nullptr) {
+			ElfWriter writer(module, &generator);
+			writer.ir.swap(ir);
+			if (!writer.write(options.output, cache != nullptr)) {
+				printf("Error: could not write %s.\n", options.output);
+				status = 1;
+			}
+		}
+		if (options.run && status == 0) {
+			Jit jit(module, &generator);
+			if (!jit.load() || !jit.run(options.programArgs, status)) {
+				status = 1;
+			}
+		}
+	}
+	return status;
+}
+
+// Optimize a lowered module and write or run it as the options say. Returns the exit status.
+// The passes work on a copy, so the lowered module can be kept for the next compile.
+int generate(const Options &options, const IRModule *lowered, BuildCache *cache) {
+	IRModule *module = new IRModule();
+	module->link(*lowered);
+	PassManager passes;
+	passes.verifyEach = options.verifyIR;
+	if (options.optimize) {
+		addStandardPasses(passes, options.reportVectorization ? stderr : nullptr);
+	}
+	if (!passes.run(module)) {
+		delete module;
+		return 1;
+	}
+	if (options.timePasses) {
+		passes.printTimings(stderr);
+	}
+	if (options.emitIR) {
+		module->print(stdout);
+	}
+	int status = emit(options, module, cache);
+	delete module;
+	return status;
+}
+
+// Link objects compiled with --lto into one, as --lto-link and --thin-lto-link ask. Returns the exit status.
+int linkObjects(const Options &options) {
+	LinkTimeOptimizer lto(options.optimize, options.reportVectorization ? stderr : nullptr);
+	lto.passes.verifyEach = options.verifyIR;
+	if (!lto.load(options.inputs)) {
+		return 1;
+	}
+	IRModule *module = options.thinLTO ? lto.linkPartitioned(jobs(options)) : lto.link();
+	if (module == nullptr) {
+		return 1;
+	}
+	if (options.timePasses) {
+		lto.passes.printTimings(stderr);
+	}
+	if (options.emitIR) {
+		module->print(stdout);
+	}
+	int status = emit(options, module, nullptr);
+	delete module;
+	return status;
+}
+
+// Load the build cache that the options name, if any, and have the database look in it.
+BuildCache* openCache(const Options &options, CompilationDatabase &db) {
+	if (options.cacheFile == nullptr) {
+		return nullptr;
+	}
+	BuildCache *ret = new BuildCache(options.cacheFile);
+	ret->load();
+	db.setCache(ret);
+	return ret;
+}
+
+// Write the build cache back and free it, returning the exit status.
+int closeCache(const Options &options, BuildCache *cache, int status) {
+	if (cache == nullptr) {
+		return status;
+	}
+	if (options.stats) {
+		fprintf(stderr, "cache: %llu of %llu routines lowered, %llu of %llu functions generated\n", cache->unitsMissed,
+			cache->unitsFound + cache->unitsMissed, cache->codeMissed, cache->codeFound + cache->codeMissed);
+	}
+	if (!cache->save()) {
+		printf("Error: could not write %s.\n", cache->path.c_str());
+		status = 1;
+	}
+	delete cache;
+	return status;
+}
+
+// Do everything a command line asks, returning the exit status.
+int compile(const Options &options) {
+	if (options.file == nullptr) {
+		return 0;
+	}
+	startReport(options);
+	if (options.dumpTokensOnly || options.dumpAst) {
+		return finishReport(options, dump(options));
+	}
+	if (options.ltoLink) {
+		return finishReport(options, linkObjects(options));
+	}
+	int status;
+	{
+		CompilationDatabase db;
+		BuildCache *cache = openCache(options, db);
+		const IRModule *lowered = lowerFile(options, db);
+		status = lowered == nullptr ? 1 : generate(options, lowered, cache);
+		status = closeCache(options, cache, status);
+	}
+	return finishReport(options, status);
+}
+
+#endif
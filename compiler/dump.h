@@ -0,0 +1,544 @@
+#ifndef DUMP
+#define DUMP
+
+#include "includes.h"
+
+
+// Writes the tokens or syntax trees of a file for --dump-tokens and --dump-ast, as text or in a binary form.
+// Everything goes through one large buffer that is written out whenever it fills, so a dump takes the same memory
+// however large the input is.
+//
+// Both forms are a sequence of nodes, each with a kind, named attributes and child nodes.
+// The text form writes a node as "(kind name=value ...", then its children indented on the lines that follow, then
+// ")". Each node at the top level is on lines of its own. Indenting stops at MAX_INDENT levels, since a chain like
+// a + b + c is as deep as it is long and would otherwise make the text quadratic in its length.
+// The binary form starts with "DUMP" and a version byte. A node is 1 and its kind, then its attributes and children,
+// then 0. An attribute is 2, a name and a string; 3, a name and a zigzag encoded integer; or 4, a name and the 8 bytes
+// of a double. A name, kind or string is its length as a varint followed by its bytes.
+class DumpWriter {
+
+	public:
+
+		DumpWriter(FILE *o, bool b) : out(o), binary(b), used(0), depth(0), failed(false) {
+			buffer = new char[BUFFER_SIZE];
+			if (binary) {
+				raw("DUMP", 4);
+				byte(VERSION);
+			}
+		}
+
+		~DumpWriter() {
+			flush();
+			delete[] buffer;
+		}
+
+		void begin(const char *kind) {
+			if (binary) {
+				byte(1);
+				counted(kind);
+			}
+			else {
+				if (depth > 0) {
+					byte('\n');
+					for (unsigned i = 0; i < depth && i < MAX_INDENT; i++) {
+						raw("  ", 2);
+					}
+				}
+				byte('(');
+				raw(kind, strlen(kind));
+			}
+			depth++;
+		}
+
+		void end() {
+			depth--;
+			if (binary) {
+				byte(0);
+			}
+			else {
+				byte(')');
+				if (depth == 0) {
+					byte('\n');
+				}
+			}
+		}
+
+		void attribute(const char *name, const std::string &value) {
+			attribute(name, value.data(), value.size());
+		}
+
+		void attribute(const char *name, const char *value) {
+			attribute(name, value, strlen(value));
+		}
+
+		void attribute(const char *name, const char *value, size_t length) {
+			if (binary) {
+				byte(2);
+				counted(name);
+				varint(length);
+				raw(value, length);
+				return;
+			}
+			key(name);
+			byte('"');
+			for (size_t i = 0; i < length; i++) {
+				char c = value[i];
+				unsigned char u = (unsigned char) c;
+				if (c == '"' || c == '\\') {
+					byte('\\');
+					byte(c);
+				}
+				else if (c == '\n') {
+					raw("\\n", 2);
+				}
+				else if (c == '\t') {
+					raw("\\t", 2);
+				}
+				else if (u < 0x20 || u == 0x7f) {
+					char hex[5];
+					snprintf(hex, sizeof(hex), "\\x%02x", u);
+					raw(hex, 4);
+				}
+				else {
+					byte(c);
+				}
+			}
+			byte('"');
+		}
+
+		void attribute(const char *name, long long value) {
+			if (binary) {
+				byte(3);
+				counted(name);
+				varint(((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63));
+				return;
+			}
+			key(name);
+			if (value < 0) {
+				byte('-');
+			}
+			decimal(value < 0 ? 0 - (unsigned long long) value : (unsigned long long) value);
+		}
+
+		void attribute(const char *name, double value) {
+			if (binary) {
+				byte(4);
+				counted(name);
+				char bytes[8];
+				memcpy(bytes, &value, 8);
+				raw(bytes, 8);
+				return;
+			}
+			key(name);
+			char text[32];
+			raw(text, snprintf(text, sizeof(text), "%.17g", value));
+		}
+
+		// Write out what is buffered. Returns false if anything couldn't be written.
+		bool flush() {
+			if (used > 0 && fwrite(buffer, 1, used, out) != used) {
+				failed = true;
+			}
+			used = 0;
+			return !failed && fflush(out) == 0;
+		}
+
+	private:
+
+		static const unsigned BUFFER_SIZE = 1 << 20;
+		static const unsigned char VERSION = 1;
+		static const unsigned MAX_INDENT = 256;
+
+		FILE *out;
+		bool binary;
+		char *buffer;
+		unsigned used;
+		unsigned depth;			// How many nodes are open.
+		bool failed;
+
+		void byte(char c) {
+			if (used == BUFFER_SIZE) {
+				flush();
+			}
+			buffer[used++] = c;
+		}
+
+		void raw(const char *bytes, size_t n) {
+			if (used + n > BUFFER_SIZE) {
+				flush();
+				if (n > BUFFER_SIZE) {
+					failed = fwrite(bytes, 1, n, out) != n || failed;
+					return;
+				}
+			}
+			memcpy(buffer + used, bytes, n);
+			used += n;
+		}
+
+		void varint(unsigned long long v) {
+			while (v >= 0x80) {
+				byte((char) (v | 0x80));
+				v >>= 7;
+			}
+			byte((char) v);
+		}
+
+		void decimal(unsigned long long v) {
+			char digits[20];
+			unsigned n = 0;
+			do {
+				digits[n++] = '0' + v % 10;
+				v /= 10;
+			} while (v != 0);
+			while (n > 0) {
+				byte(digits[--n]);
+			}
+		}
+
+		void counted(const char *s) {
+			size_t n = strlen(s);
+			varint(n);
+			raw(s, n);
+		}
+
+		// The start of an attribute in the text form.
+		void key(const char *name) {
+			byte(' ');
+			raw(name, strlen(name));
+			byte('=');
+		}
+};
+
+
+// A token, with its value if it has one.
+void dumpToken(DumpWriter &w, const Token *t) {
+	const char *spelling = tokenSpelling(t->type);
+	switch (t->type) {
+		case (IDENTIFIER) : {
+			w.begin("identifier");
+			break;
+		}
+		case (INTEGER) : {
+			w.begin("integer");
+			break;
+		}
+		case (FLOAT) : {
+			w.begin("float");
+			break;
+		}
+		case (CHARACTER_LITERAL) : {
+			w.begin("character");
+			break;
+		}
+		case (STRING_LITERAL) : {
+			w.begin("string");
+			break;
+		}
+		case (LINE_COMMENT) :
+		case (BLOCK_COMMENT) :
+		case (OPEN_COMMENT) : {
+			w.begin("comment");
+			break;
+		}
+		case (END_OF_FILE) : {
+			w.begin("end");
+			break;
+		}
+		case (ERROR) : {
+			w.begin("error");
+			break;
+		}
+		default : {
+			w.begin("token");
+		}
+	}
+	w.attribute("line", (long long) t->startLinenum);
+	w.attribute("col", (long long) t->startColnum);
+	if (t->data != nullptr) {
+		switch (t->type) {
+			case (INTEGER) : {
+				w.attribute("value", (long long) *(unsigned long long*) t->data);
+				break;
+			}
+			case (FLOAT) : {
+				w.attribute("value", *(double*) t->data);
+				break;
+			}
+			case (CHARACTER_LITERAL) : {
+				w.attribute("value", (long long) *(unsigned*) t->data);
+				break;
+			}
+			default : {
+				w.attribute("text", *(std::string*) t->data);
+			}
+		}
+	}
+	else if (spelling != nullptr && t->type != END_OF_FILE) {
+		w.attribute("text", spelling);
+	}
+	w.end();
+}
+
+// Lex a file, writing each token as it is read. Returns false if the file has a lexical error. Warnings are added to
+// diagnostics.
+bool dumpTokens(std::string *filename, DumpWriter &w, std::string &diagnostics) {
+	Lexer lex(filename, diagnostics);
+	while (true) {
+		Token *t = lex.nextToken;
+		bool last = t->type == END_OF_FILE || t->type == ERROR;
+		if (!last) {
+			lex.getNextToken();
+		}
+		dumpToken(w, t);
+		bool ok = t->type != ERROR;
+		delete t;
+		if (last) {
+			return ok;
+		}
+	}
+}
+
+
+const char* const typeKindNames[] = {"named", "array", "pointer", "routine", "impl", "inferred"};
+const char* const expressionKindNames[] = {"integer", "float", "character", "string", "name", "unary", "postfix", "binary", "assign", "call", "index", "member", "cast", "if", "routine", "array"};
+const char* const statementKindNames[] = {"block", "expression", "declaration", "if", "while", "for", "foreach", "switch", "return", "break", "continue"};
+const char* const foreachKindNames[] = {"ind", "val", "ref"};
+const char* const typeDeclarationKindNames[] = {"class", "struct", "union", "enum", "alias", "interface", "instance"};
+
+void dumpExpression(DumpWriter &w, const Expression *e);
+void dumpStatement(DumpWriter &w, const Statement *s);
+void dumpRoutine(DumpWriter &w, const Routine *r);
+
+void dumpType(DumpWriter &w, const TypeName *t) {
+	if (t == nullptr) {
+		return;
+	}
+	w.begin("type");
+	w.attribute("kind", typeKindNames[t->kind]);
+	if (!t->name.empty()) {
+		w.attribute("name", t->name);
+	}
+	if (!t->constraint.empty()) {
+		w.attribute("as", t->constraint);
+	}
+	if (t->kind == ARRAY_TYPE) {
+		w.attribute("length", t->length);
+	}
+	if (t->kind == ROUTINE_TYPE) {
+		w.attribute("pure", (long long) t->pure);
+	}
+	dumpType(w, t->element);
+	dumpExpression(w, t->lengthExpr);
+	for (const Parameter *p : t->params) {
+		w.begin("parameter");
+		if (!p->name.empty()) {
+			w.attribute("name", p->name);
+		}
+		dumpType(w, p->type);
+		w.end();
+	}
+	dumpType(w, t->returnType);
+	w.end();
+}
+
+// Begin an expression and write everything in it but its operands.
+void dumpExpressionStart(DumpWriter &w, const Expression *e) {
+	w.begin(expressionKindNames[e->kind]);
+	w.attribute("line", (long long) e->linenum);
+	w.attribute("col", (long long) e->colnum);
+	if (e->op != ERROR && tokenSpelling(e->op) != nullptr) {
+		w.attribute("op", tokenSpelling(e->op));
+	}
+	switch (e->kind) {
+		case (INTEGER_EXPR) :
+		case (CHARACTER_EXPR) : {
+			w.attribute("value", (long long) e->intValue);
+			break;
+		}
+		case (FLOAT_EXPR) : {
+			w.attribute("value", e->floatValue);
+			break;
+		}
+		case (STRING_EXPR) : {
+			w.attribute("value", e->name);
+			break;
+		}
+		case (NAME_EXPR) :
+		case (MEMBER_EXPR) : {
+			w.attribute("name", e->name);
+			break;
+		}
+		default : {}
+	}
+	dumpType(w, e->type);
+	if (e->routine != nullptr) {
+		dumpRoutine(w, e->routine);
+	}
+}
+
+// Operator chains like a + b + c nest to the left as deep as they are long, so the expressions down the first operands
+// are begun in a loop, and the rest of each is written and it is ended on the way back up.
+void dumpExpression(DumpWriter &w, const Expression *e) {
+	std::vector<const Expression*> chain;
+	for (; e != nullptr; e = e->operands.empty() ? nullptr : e->operands[0]) {
+		dumpExpressionStart(w, e);
+		chain.push_back(e);
+	}
+	for (unsigned k = chain.size(); k-- > 0;) {
+		for (unsigned j = 1; j < chain[k]->operands.size(); j++) {
+			dumpExpression(w, chain[k]->operands[j]);
+		}
+		w.end();
+	}
+}
+
+void dumpVariable(DumpWriter &w, const VariableDeclaration *v) {
+	if (v == nullptr) {
+		return;
+	}
+	w.begin("variable");
+	w.attribute("name", v->name);
+	w.attribute("line", (long long) v->linenum);
+	w.attribute("col", (long long) v->colnum);
+	if (v->isConst) {
+		w.attribute("const", 1LL);
+	}
+	if (v->isStatic) {
+		w.attribute("static", 1LL);
+	}
+	dumpType(w, v->type);
+	dumpExpression(w, v->initializer);
+	w.end();
+}
+
+// The parts of a statement that could be confused with each other are each wrapped in a node naming what they are.
+void dumpStatementPart(DumpWriter &w, const char *part, const Statement *s, const Expression *e) {
+	if (s == nullptr && e == nullptr) {
+		return;
+	}
+	w.begin(part);
+	dumpStatement(w, s);
+	dumpExpression(w, e);
+	w.end();
+}
+
+void dumpStatement(DumpWriter &w, const Statement *s) {
+	if (s == nullptr) {
+		return;
+	}
+	w.begin(statementKindNames[s->kind]);
+	w.attribute("line", (long long) s->linenum);
+	w.attribute("col", (long long) s->colnum);
+	if (s->kind == FOREACH_STMT) {
+		w.attribute("binds", foreachKindNames[s->foreach]);
+	}
+	dumpVariable(w, s->decl);
+	dumpStatementPart(w, "init", s->init, nullptr);
+	dumpStatementPart(w, "value", nullptr, s->expr);
+	dumpStatementPart(w, "step", nullptr, s->step);
+	dumpStatementPart(w, "then", s->then, nullptr);
+	dumpStatementPart(w, "else", s->otherwise, nullptr);
+	if (s->kind == SWITCH_STMT) {
+		for (unsigned i = 0; i < s->body.size(); i++) {
+			w.begin("case");
+			dumpExpression(w, i < s->cases.size() ? s->cases[i] : nullptr);
+			dumpStatement(w, s->body[i]);
+			w.end();
+		}
+	}
+	else {
+		for (const Statement *b : s->body) {
+			dumpStatement(w, b);
+		}
+	}
+	w.end();
+}
+
+void dumpRoutine(DumpWriter &w, const Routine *r) {
+	w.begin(r->pure ? "func" : "proc");
+	if (!r->name.empty()) {
+		w.attribute("name", r->name);
+	}
+	w.attribute("line", (long long) r->linenum);
+	w.attribute("col", (long long) r->colnum);
+	for (const Parameter *p : r->params) {
+		w.begin("parameter");
+		if (!p->name.empty()) {
+			w.attribute("name", p->name);
+		}
+		dumpType(w, p->type);
+		w.end();
+	}
+	if (r->returnType != nullptr) {
+		w.begin("returns");
+		dumpType(w, r->returnType);
+		w.end();
+	}
+	dumpStatement(w, r->body);
+	dumpExpression(w, r->value);
+	w.end();
+}
+
+void dumpTypeDeclaration(DumpWriter &w, const TypeDeclaration *t) {
+	w.begin(typeDeclarationKindNames[t->kind]);
+	w.attribute("name", t->name);
+	if (!t->interfaceName.empty()) {
+		w.attribute("interface", t->interfaceName);
+	}
+	w.attribute("line", (long long) t->linenum);
+	w.attribute("col", (long long) t->colnum);
+	for (const std::string &e : t->enumerators) {
+		w.begin("enumerator");
+		w.attribute("name", e);
+		w.end();
+	}
+	dumpType(w, t->aliased);
+	for (const VariableDeclaration *v : t->fields) {
+		dumpVariable(w, v);
+	}
+	for (const Routine *r : t->routines) {
+		dumpRoutine(w, r);
+	}
+	w.end();
+}
+
+void dumpProgram(DumpWriter &w, const Program *p) {
+	for (const Import *i : p->imports) {
+		w.begin("import");
+		w.attribute("module", i->module);
+		w.attribute("alias", i->alias);
+		w.attribute("source", i->source);
+		if (i->global) {
+			w.attribute("globally", 1LL);
+		}
+		w.end();
+	}
+	for (const Namespace *n : p->namespaces) {
+		w.begin(n->isModule ? "module" : "namespace");
+		w.attribute("name", n->name);
+		if (n->contents != nullptr) {
+			dumpProgram(w, n->contents);
+		}
+		w.end();
+	}
+	for (const TypeDeclaration *t : p->typeDecls) {
+		dumpTypeDeclaration(w, t);
+	}
+	for (const VariableDeclaration *v : p->varDecls) {
+		dumpVariable(w, v);
+	}
+	for (const Routine *r : p->routines) {
+		dumpRoutine(w, r);
+	}
+}
+
+// Parse a file, writing each global declaration as soon as it is parsed and freeing it afterwards.
+// Returns false if the file has a syntax error, which is added to diagnostics.
+bool dumpSyntaxTrees(std::string *filename, DumpWriter &w, std::string &diagnostics) {
+	Parser parser(filename, diagnostics);
+	return parser.parseEach([&](const Program *p) {
+		dumpProgram(w, p);
+	});
+}
+
+#endif
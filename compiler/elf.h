@@ -0,0 +1,371 @@
+#ifndef ELF
+#define ELF
+
+#include "includes.h"
+
+
+// Writes machine code and data as an ELF relocatable object file for x86-64, ready for the system linker.
+// Functions and globals are visible to other objects; string literals and witness tables, whose names start
+// with a dot or two underscores, are kept local.
+// The IR of the module can be put in the object as well, for link-time optimization, in an .ir section that the
+// system linker leaves out of what it links.
+class ElfWriter {
+
+	public:
+
+		std::vector<unsigned char> ir;			// The IR to put in the object, if any.
+
+		ElfWriter(const IRModule *m, const X86CodeGenerator *g) : module(m), generator(g) {}
+
+		// Returns false if the file couldn't be written. With patch set, a file of the same size that is already
+		// there only has the blocks that differ written, which is most of the work of an incremental build whose
+		// functions kept their sizes.
+		bool write(const std::string &path, bool patch = false) {
+			TraceScope trace("write object", path.c_str());
+			layOutData();
+			buildSymbols();
+
+			std::vector<unsigned char> rela[SECTION_COUNT];
+			for (const CodeRelocation &r : generator->code.relocations) {
+				static const unsigned types[] = {R_X86_64_64, R_X86_64_PC32, R_X86_64_PLT32, R_X86_64_GOTPCREL};
+				relocation(rela[TEXT], r.offset, r.symbol, types[r.kind], r.addend);
+			}
+			for (unsigned d = 0; d < module->data.size(); d++) {
+				for (const Relocation &r : module->data[d]->relocations) {
+					relocation(rela[dataSection[d]], dataOffset[d] + r.offset, r.symbol, R_X86_64_64, r.addend);
+				}
+			}
+
+			std::vector<unsigned char> symtab;
+			for (const Sym &s : symbols) {
+				put32(symtab, s.name);
+				symtab.push_back(s.info);
+				symtab.push_back(0);
+				put16(symtab, s.section);
+				put64(symtab, s.value);
+				put64(symtab, s.size);
+			}
+
+			// The contents of each section, then the section headers.
+			std::vector<unsigned char> out(64, 0);
+			unsigned count = ir.empty() ? EMBEDDED_IR : SECTION_COUNT;
+			std::vector<Section> sections(count);
+			sections[TEXT] = section(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16, 0, &generator->code.code);
+			sections[RODATA] = section(".rodata", SHT_PROGBITS, SHF_ALLOC, 16, 0, &contents[RODATA]);
+			sections[RELRO] = section(".data.rel.ro", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 16, 0, &contents[RELRO]);
+			sections[DATA] = section(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 16, 0, &contents[DATA]);
+			sections[RELA_TEXT] = section(".rela.text", SHT_RELA, SHF_INFO_LINK, 8, 24, &rela[TEXT]);
+			sections[RELA_RELRO] = section(".rela.data.rel.ro", SHT_RELA, SHF_INFO_LINK, 8, 24, &rela[RELRO]);
+			sections[RELA_DATA] = section(".rela.data", SHT_RELA, SHF_INFO_LINK, 8, 24, &rela[DATA]);
+			sections[SYMTAB] = section(".symtab", SHT_SYMTAB, 0, 8, 24, &symtab);
+			sections[STRTAB] = section(".strtab", SHT_STRTAB, 0, 1, 0, &strings);
+			sections[SHSTRTAB] = section(".shstrtab", SHT_STRTAB, 0, 1, 0, &sectionNames);
+			sections[NOTE_STACK] = section(".note.GNU-stack", SHT_PROGBITS, 0, 1, 0, nullptr);
+			if (!ir.empty()) {
+				sections[EMBEDDED_IR] = section(".ir", SHT_PROGBITS, SHF_EXCLUDE, 1, 0, &ir);
+			}
+			sections[RELA_TEXT].link = sections[RELA_RELRO].link = sections[RELA_DATA].link = SYMTAB;
+			sections[RELA_TEXT].info = TEXT;
+			sections[RELA_RELRO].info = RELRO;
+			sections[RELA_DATA].info = DATA;
+			sections[SYMTAB].link = STRTAB;
+			sections[SYMTAB].info = firstGlobal;
+
+			for (unsigned s = 1; s < count; s++) {
+				while (out.size() % sections[s].align != 0) {
+					out.push_back(0);
+				}
+				sections[s].offset = out.size();
+				if (sections[s].contents != nullptr) {
+					out.insert(out.end(), sections[s].contents->begin(), sections[s].contents->end());
+				}
+			}
+			while (out.size() % 8 != 0) {
+				out.push_back(0);
+			}
+			unsigned long long headers = out.size();
+			for (const Section &s : sections) {
+				put32(out, s.name);
+				put32(out, s.type);
+				put64(out, s.flags);
+				put64(out, 0);
+				put64(out, s.offset);
+				put64(out, s.contents == nullptr ? 0 : s.contents->size());
+				put32(out, s.link);
+				put32(out, s.info);
+				put64(out, s.align);
+				put64(out, s.entrySize);
+			}
+
+			std::vector<unsigned char> header;
+			const unsigned char ident[16] = {0x7f, 'E', 'L', 'F', 2, 1, 1, 0};
+			header.insert(header.end(), ident, ident + 16);
+			put16(header, 1);					// A relocatable file
+			put16(header, 62);					// for x86-64.
+			put32(header, 1);
+			put64(header, 0);
+			put64(header, 0);
+			put64(header, headers);
+			put32(header, 0);
+			put16(header, 64);
+			put16(header, 0);
+			put16(header, 0);
+			put16(header, 64);
+			put16(header, count);
+			put16(header, SHSTRTAB);
+			std::copy(header.begin(), header.end(), out.begin());
+
+			if (patch && patchFile(path, out, trace)) {
+				return true;
+			}
+			FILE *file = fopen(path.c_str(), "wb");
+			if (file == nullptr) {
+				return false;
+			}
+			trace.bytes = out.size();
+			bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+			return fclose(file) == 0 && ok;
+		}
+
+	private:
+
+		enum SectionIndex {
+			NULL_SECTION, TEXT, RODATA, RELRO, DATA, RELA_TEXT, RELA_RELRO, RELA_DATA, SYMTAB, STRTAB, SHSTRTAB, NOTE_STACK, EMBEDDED_IR,
+			SECTION_COUNT
+		};
+
+		static const unsigned SHT_PROGBITS = 1;
+		static const unsigned SHT_SYMTAB = 2;
+		static const unsigned SHT_STRTAB = 3;
+		static const unsigned SHT_RELA = 4;
+		static const unsigned SHF_WRITE = 1;
+		static const unsigned SHF_ALLOC = 2;
+		static const unsigned SHF_EXECINSTR = 4;
+		static const unsigned SHF_INFO_LINK = 0x40;
+		static const unsigned SHF_EXCLUDE = 0x80000000;
+		static const unsigned R_X86_64_64 = 1;
+		static const unsigned R_X86_64_PC32 = 2;
+		static const unsigned R_X86_64_PLT32 = 4;
+		static const unsigned R_X86_64_GOTPCREL = 9;
+
+		struct Section {
+			unsigned name;
+			unsigned type;
+			unsigned long long flags;
+			unsigned long long offset;
+			unsigned link;
+			unsigned info;
+			unsigned long long align;
+			unsigned long long entrySize;
+			const std::vector<unsigned char> *contents;
+		};
+
+		struct Sym {
+			unsigned name;
+			unsigned char info;
+			unsigned short section;
+			unsigned long long value;
+			unsigned long long size;
+		};
+
+		const IRModule *module;
+		const X86CodeGenerator *generator;
+		std::vector<unsigned char> contents[SECTION_COUNT];
+		std::vector<unsigned> dataSection;
+		std::vector<unsigned> dataOffset;
+		std::vector<Sym> symbols;
+		std::vector<unsigned> symbolIndex;			// The ELF symbol of each module symbol.
+		unsigned firstGlobal;
+		std::vector<unsigned char> strings;
+		std::vector<unsigned char> sectionNames;
+
+		static const unsigned PATCH_BLOCK = 4096;
+
+		// Write the blocks of an object that differ from the file at path, if it is an object of the same size.
+		// Returns false if it isn't, or if a block couldn't be written, in which case the whole file is written.
+		static bool patchFile(const std::string &path, const std::vector<unsigned char> &out, TraceScope &trace) {
+			int fd = open(path.c_str(), O_RDWR);
+			if (fd < 0) {
+				return false;
+			}
+			struct stat status;
+			std::vector<unsigned char> old(out.size());
+			if (fstat(fd, &status) != 0 || (size_t) status.st_size != out.size() || pread(fd, old.data(), old.size(), 0) != (ssize_t) old.size() ||
+				memcmp(old.data(), "\x7f" "ELF", 4) != 0) {
+				close(fd);
+				return false;
+			}
+			bool ok = true;
+			trace.bytes = 0;
+			for (size_t at = 0; at < out.size() && ok; at += PATCH_BLOCK) {
+				size_t size = std::min((size_t) PATCH_BLOCK, out.size() - at);
+				if (memcmp(old.data() + at, out.data() + at, size) != 0) {
+					ok = pwrite(fd, out.data() + at, size, at) == (ssize_t) size;
+					trace.bytes += size;
+				}
+			}
+			return close(fd) == 0 && ok;
+		}
+
+		static void put16(std::vector<unsigned char> &out, unsigned v) {
+			out.push_back(v & 0xff);
+			out.push_back((v >> 8) & 0xff);
+		}
+
+		static void put32(std::vector<unsigned char> &out, unsigned v) {
+			put16(out, v & 0xffff);
+			put16(out, v >> 16);
+		}
+
+		static void put64(std::vector<unsigned char> &out, unsigned long long v) {
+			put32(out, (unsigned) v);
+			put32(out, (unsigned) (v >> 32));
+		}
+
+		static unsigned addString(std::vector<unsigned char> &table, const std::string &s) {
+			if (table.empty()) {
+				table.push_back(0);
+			}
+			unsigned ret = table.size();
+			table.insert(table.end(), s.begin(), s.end());
+			table.push_back(0);
+			return ret;
+		}
+
+		Section section(const char *name, unsigned type, unsigned long long flags, unsigned align, unsigned entrySize, const std::vector<unsigned char> *contents) {
+			Section s;
+			s.name = addString(sectionNames, name);
+			s.type = type;
+			s.flags = flags;
+			s.offset = 0;
+			s.link = 0;
+			s.info = 0;
+			s.align = align;
+			s.entrySize = entrySize;
+			s.contents = contents;
+			return s;
+		}
+
+		// Read-only data that holds addresses goes in .data.rel.ro, which position independent executables can
+		// fix up at load time before making it read-only.
+		void layOutData() {
+			for (const DataObject *d : module->data) {
+				unsigned s = !d->readOnly ? DATA : (d->relocations.empty() ? RODATA : RELRO);
+				std::vector<unsigned char> &bytes = contents[s];
+				unsigned align = d->align == 0 ? 1 : d->align;
+				while (bytes.size() % align != 0) {
+					bytes.push_back(0);
+				}
+				dataSection.push_back(s);
+				dataOffset.push_back(bytes.size());
+				bytes.insert(bytes.end(), d->bytes.begin(), d->bytes.end());
+			}
+		}
+
+		// Local symbols have to come before global ones.
+		void buildSymbols() {
+			Sym none = {0, 0, 0, 0, 0};
+			symbols.push_back(none);
+			symbolIndex.assign(module->symbols.size(), 0);
+			for (unsigned pass = 0; pass < 2; pass++) {
+				if (pass == 1) {
+					firstGlobal = symbols.size();
+				}
+				for (unsigned i = 0; i < module->symbols.size(); i++) {
+					const Symbol &symbol = module->symbols[i];
+					bool local = symbol.kind != EXTERNAL_SYMBOL && IRModule::isLocal(symbol.name);
+					if (local != (pass == 0)) {
+						continue;
+					}
+					Sym s;
+					s.name = addString(strings, symbol.name);
+					unsigned char binding = local ? 0 : 1;
+					switch (symbol.kind) {
+						case (ROUTINE_SYMBOL) : {
+							s.info = (binding << 4) | 2;
+							s.section = TEXT;
+							s.value = generator->functionExtents[symbol.index].first;
+							s.size = generator->functionExtents[symbol.index].second;
+							break;
+						}
+						case (DATA_SYMBOL) : {
+							s.info = (binding << 4) | 1;
+							s.section = dataSection[symbol.index];
+							s.value = dataOffset[symbol.index];
+							s.size = module->data[symbol.index]->bytes.size();
+							break;
+						}
+						default : {
+							s.info = binding << 4;
+							s.section = 0;
+							s.value = 0;
+							s.size = 0;
+						}
+					}
+					symbolIndex[i] = symbols.size();
+					symbols.push_back(s);
+				}
+			}
+		}
+
+		void relocation(std::vector<unsigned char> &out, unsigned long long offset, unsigned symbol, unsigned type, long long addend) {
+			put64(out, offset);
+			put64(out, ((unsigned long long) symbolIndex[symbol] << 32) | type);
+			put64(out, (unsigned long long) addend);
+		}
+};
+
+
+// Read the contents of the named section of an ELF object. Returns false if the file can't be read, isn't a 64 bit
+// object or has no such section.
+bool readSection(const std::string &path, const std::string &name, std::vector<unsigned char> &contents) {
+	std::vector<unsigned char> file;
+	FILE *f = fopen(path.c_str(), "rb");
+	if (f == nullptr) {
+		return false;
+	}
+	unsigned char buffer[1 << 16];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+		file.insert(file.end(), buffer, buffer + n);
+	}
+	fclose(f);
+	auto get = [&](unsigned long long at, unsigned size) {
+		unsigned long long ret = 0;
+		for (unsigned k = 0; k < size && at + k < file.size(); k++) {
+			ret |= (unsigned long long) file[at + k] << (8 * k);
+		}
+		return ret;
+	};
+	if (file.size() < 64 || memcmp(file.data(), "\x7f" "ELF", 4) != 0 || file[4] != 2) {
+		return false;
+	}
+	unsigned long long headers = get(0x28, 8);
+	unsigned long long count = get(0x3c, 2);
+	unsigned long long names = get(0x3e, 2);
+	if (get(0x3a, 2) != 64 || headers > file.size() || count > (file.size() - headers) / 64 || names >= count) {
+		return false;
+	}
+	unsigned long long namesOffset = get(headers + 64 * names + 24, 8);
+	unsigned long long namesSize = get(headers + 64 * names + 32, 8);
+	if (namesOffset > file.size() || namesSize > file.size() - namesOffset) {
+		return false;
+	}
+	for (unsigned long long s = 0; s < count; s++) {
+		unsigned long long header = headers + 64 * s;
+		unsigned long long at = get(header, 4);
+		if (at >= namesSize || name.size() >= namesSize - at || memcmp(file.data() + namesOffset + at, name.c_str(), name.size() + 1) != 0) {
+			continue;
+		}
+		unsigned long long offset = get(header + 24, 8);
+		unsigned long long size = get(header + 32, 8);
+		if (offset > file.size() || size > file.size() - offset) {
+			return false;
+		}
+		contents.assign(file.begin() + offset, file.begin() + offset + size);
+		return true;
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef FUZZ
+#define FUZZ
+
+#include "../includes.h"
+
+
+// What the fuzz targets share. Each target is a libFuzzer entry point, built with something like
+//     clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address fuzz/parser.cpp -o parser-fuzzer
+// and run as it is; the syntax errors it finds are kept in a string rather than printed. Built with -DFUZZ_MAIN
+// instead, by any compiler, a target runs each file named on its command line once, which is how inputs that the
+// fuzzer saved are checked again after a fix.
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Open an input as a stream for the lexer, or return nullptr if it can't be.
+FILE* openInput(const uint8_t *data, size_t size) {
+	// The data of an empty input may be null, which fmemopen would take as asking it to allocate a buffer.
+	static char empty[1];
+	return fmemopen(size == 0 ? empty : (void*) data, size, "r");
+}
+
+// Lexing and parsing take time in proportion to the input, so an input that takes much longer than its size
+// allows has found something quadratic or worse. That aborts, so that the fuzzer keeps the input as a crash.
+class TimeBudget {
+
+	public:
+
+		TimeBudget(size_t size) : bytes(size), start(std::chrono::steady_clock::now()) {}
+
+		~TimeBudget() {
+			std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+			double allowed = FIXED_MICROSECONDS + PER_BYTE_MICROSECONDS * bytes;
+			if (elapsed.count() > allowed) {
+				fprintf(stderr, "Error: %zu bytes took %.0f us, more than the %.0f us they are allowed.\n", bytes, elapsed.count(), allowed);
+				abort();
+			}
+		}
+
+	private:
+
+		// Generous enough for a sanitized build on a loaded machine, and still far less than what a quadratic
+		// step takes on the inputs the fuzzer makes, which run to some kilobytes.
+		static constexpr double FIXED_MICROSECONDS = 20000;
+		static constexpr double PER_BYTE_MICROSECONDS = 20;
+
+		size_t bytes;
+		std::chrono::steady_clock::time_point start;
+};
+
+#ifdef FUZZ_MAIN
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		if (f == nullptr) {
+			fprintf(stderr, "Error: could not open %s.\n", argv[i]);
+			return 1;
+		}
+		std::vector<uint8_t> data;
+		int c;
+		while ((c = getc(f)) != EOF) {
+			data.push_back(c);
+		}
+		fclose(f);
+		LLVMFuzzerTestOneInput(data.data(), data.size());
+	}
+	return 0;
+}
+#endif
+
+#endif
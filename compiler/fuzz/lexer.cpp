@@ -0,0 +1,23 @@
+#include "fuzz.h"
+
+// Lex the input to the end or to the first error.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	TimeBudget budget(size);
+	FILE *in = openInput(data, size);
+	if (in == nullptr) {
+		return 0;
+	}
+	std::string diagnostics;
+	Lexer lex(in, "input", diagnostics);
+	while (true) {
+		Token *t = lex.nextToken;
+		bool last = t->type == END_OF_FILE || t->type == ERROR;
+		if (!last) {
+			lex.getNextToken();
+		}
+		delete t;
+		if (last) {
+			return 0;
+		}
+	}
+}
@@ -0,0 +1,14 @@
+#include "fuzz.h"
+
+// Parse the input as a program.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	TimeBudget budget(size);
+	FILE *in = openInput(data, size);
+	if (in == nullptr) {
+		return 0;
+	}
+	std::string diagnostics;
+	Parser parser(in, "input", diagnostics);
+	delete parser.parse();
+	return 0;
+}
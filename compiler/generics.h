@@ -0,0 +1,305 @@
+#ifndef GENERICS
+#define GENERICS
+
+#include "includes.h"
+
+
+// 64 bit FNV-1a hash.
+unsigned long long hashString(const std::string &s, unsigned long long hash = 14695981039346656037ULL) {
+	for (char c : s) {
+		hash ^= (unsigned char) c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+// A copy of a generic routine specialized for one set of type arguments.
+struct Instantiation {
+	const Routine *generic;
+	std::vector<std::string> typeParams;		// T in "T as Ord", in order of first appearance.
+	std::vector<TypeName*> typeArgs;			// What each type parameter is bound to.
+	Routine *routine;							// The specialized routine.
+	std::string key;							// Identifies the generic routine and type arguments, and names the instantiation.
+	unsigned long long hash;					// Hash of the key.
+
+	// Whether the instantiation stands in for every set of type arguments with the same layout.
+	// Calls to interface routines on a type parameter then go through witness tables passed as hidden parameters.
+	bool shared;
+
+	~Instantiation() {
+		delete routine;
+		for (TypeName *t : typeArgs) {
+			delete t;
+		}
+	}
+};
+
+
+// Instantiates generic routines for concrete type arguments.
+// Instantiations are cached by a hash of the routine and its type arguments, so asking for the same one again,
+// whether from the same module or another one that shares the Monomorphizer, returns the existing copy.
+class Monomorphizer {
+
+	public:
+
+		unsigned hits;			// Requests answered from the cache.
+		unsigned misses;		// Requests that created a new instantiation.
+
+		// If shareLayouts is set, type arguments with identical layouts share a single instantiation.
+		Monomorphizer(const Program *p, const InterfaceTables *i, bool shareLayouts = false) : hits(0), misses(0), program(p), interfaces(i), share(shareLayouts) {}
+
+		~Monomorphizer() {
+			for (Instantiation *i : instantiations) {
+				delete i;
+			}
+		}
+
+		// The type parameters of a routine: every named type introduced with an interface constraint, as in "T as Ord".
+		static std::vector<std::string> typeParameters(const Routine *routine) {
+			std::vector<std::string> ret;
+			for (const Parameter *p : routine->params) {
+				findTypeParameters(p->type, ret);
+			}
+			findTypeParameters(routine->returnType, ret);
+			return ret;
+		}
+
+		static bool isGeneric(const Routine *routine) {
+			return !typeParameters(routine).empty();
+		}
+
+		// Work out the type arguments of a call from the types of its arguments.
+		// Returns false if the arguments don't fit the parameters or leave a type parameter unbound.
+		bool infer(const Routine *routine, const std::vector<const TypeName*> &argTypes, std::vector<const TypeName*> &typeArgs) const {
+			std::vector<std::string> params = typeParameters(routine);
+			std::map<std::string, const TypeName*> bindings;
+			if (argTypes.size() != routine->params.size()) {
+				return false;
+			}
+			for (unsigned i = 0; i < argTypes.size(); i++) {
+				if (!unify(routine->params[i]->type, argTypes[i], bindings)) {
+					return false;
+				}
+			}
+			typeArgs.clear();
+			for (const std::string &p : params) {
+				auto b = bindings.find(p);
+				if (b == bindings.end()) {
+					return false;
+				}
+				typeArgs.push_back(b->second);
+			}
+			return true;
+		}
+
+		// Get the instantiation of a generic routine for the given type arguments, creating it if necessary.
+		// Returns nullptr and adds the problem to diagnostics if a type argument doesn't satisfy its constraint.
+		Instantiation* instantiate(const Routine *routine, const std::vector<const TypeName*> &typeArgs, std::string &diagnostics) {
+			std::vector<std::string> params = typeParameters(routine);
+			if (params.size() != typeArgs.size()) {
+				diagnose(diagnostics, "Semantic error: %s takes %zu type arguments but was given %zu (%u:%u).\n", routine->name.c_str(), params.size(), typeArgs.size(), routine->linenum, routine->colnum);
+				return nullptr;
+			}
+			std::map<std::string, std::string> constraints;
+			for (const Parameter *p : routine->params) {
+				findConstraints(p->type, constraints);
+			}
+			for (unsigned i = 0; i < params.size(); i++) {
+				if (!satisfies(typeArgs[i], constraints[params[i]])) {
+					diagnose(diagnostics, "Semantic error: %s does not implement %s, required by %s (%u:%u).\n", typeArgs[i]->spelling().c_str(), constraints[params[i]].c_str(), routine->name.c_str(), routine->linenum, routine->colnum);
+					return nullptr;
+				}
+			}
+
+			// Layout sharing keys on the layout of each argument instead of its name.
+			bool shared = share;
+			for (const TypeName *t : typeArgs) {
+				if (shared && layoutSignature(t, program).empty()) {
+					shared = false;
+				}
+			}
+			std::string args;
+			for (unsigned i = 0; i < typeArgs.size(); i++) {
+				if (i > 0) {
+					args += ",";
+				}
+				args += shared ? layoutSignature(typeArgs[i], program) : typeArgs[i]->spelling();
+			}
+			// Overloads share a name, so the key spells out the parameter types of the routine too.
+			std::string signature;
+			for (unsigned i = 0; i < routine->params.size(); i++) {
+				if (i > 0) {
+					signature += ",";
+				}
+				signature += routine->params[i]->type->spelling();
+			}
+			std::string key = routine->name + "(" + signature + ")<" + args + ">";
+			unsigned long long hash = hashString(key);
+
+			auto bucket = cache.find(hash);
+			if (bucket != cache.end()) {
+				for (Instantiation *i : bucket->second) {
+					if (i->key == key) {
+						hits++;
+						return i;
+					}
+				}
+			}
+
+			misses++;
+			Instantiation *ret = new Instantiation();
+			ret->generic = routine;
+			ret->typeParams = params;
+			ret->key = key;
+			ret->hash = hash;
+			ret->shared = shared;
+			std::map<std::string, const TypeName*> bindings;
+			for (unsigned i = 0; i < params.size(); i++) {
+				ret->typeArgs.push_back(typeArgs[i]->clone());
+				bindings[params[i]] = ret->typeArgs.back();
+			}
+			ret->routine = routine->clone();
+			ret->routine->name = routine->name + "<" + args + ">";
+			if (!shared) {
+				for (Parameter *p : ret->routine->params) {
+					substitute(p->type, bindings);
+				}
+				substitute(ret->routine->returnType, bindings);
+			}
+			instantiations.push_back(ret);
+			cache[hash].push_back(ret);
+			return ret;
+		}
+
+		// Every instantiation created so far, in the order they were created.
+		const std::vector<Instantiation*>& all() const {
+			return instantiations;
+		}
+
+	private:
+
+		const Program *program;
+		const InterfaceTables *interfaces;
+		bool share;
+
+		std::vector<Instantiation*> instantiations;
+		std::map<unsigned long long, std::vector<Instantiation*>> cache;
+
+		static void findTypeParameters(const TypeName *type, std::vector<std::string> &ret) {
+			if (type == nullptr) {
+				return;
+			}
+			if (type->kind == NAMED_TYPE && !type->constraint.empty()) {
+				for (const std::string &s : ret) {
+					if (s == type->name) {
+						return;
+					}
+				}
+				ret.push_back(type->name);
+			}
+			findTypeParameters(type->element, ret);
+			findTypeParameters(type->returnType, ret);
+			for (const Parameter *p : type->params) {
+				findTypeParameters(p->type, ret);
+			}
+		}
+
+		static void findConstraints(const TypeName *type, std::map<std::string, std::string> &ret) {
+			if (type == nullptr) {
+				return;
+			}
+			if (type->kind == NAMED_TYPE && !type->constraint.empty()) {
+				ret[type->name] = type->constraint;
+			}
+			findConstraints(type->element, ret);
+			findConstraints(type->returnType, ret);
+			for (const Parameter *p : type->params) {
+				findConstraints(p->type, ret);
+			}
+		}
+
+		// Match a parameter type against an argument type, binding type parameters as they are found.
+		bool unify(const TypeName *param, const TypeName *arg, std::map<std::string, const TypeName*> &bindings) const {
+			if (param == nullptr || arg == nullptr) {
+				return param == arg;
+			}
+			if (param->kind == NAMED_TYPE && !param->constraint.empty()) {
+				auto b = bindings.find(param->name);
+				if (b == bindings.end()) {
+					bindings[param->name] = arg;
+					return true;
+				}
+				return b->second->spelling() == arg->spelling();
+			}
+			if (param->kind == NAMED_TYPE) {
+				auto b = bindings.find(param->name);
+				if (b != bindings.end()) {
+					return b->second->spelling() == arg->spelling();
+				}
+			}
+			if (param->kind != arg->kind) {
+				return false;
+			}
+			switch (param->kind) {
+				case (NAMED_TYPE) : {
+					return param->name == arg->name;
+				}
+				case (ARRAY_TYPE) : {
+					// An array of any length can be passed where the length is left open.
+					if (param->length >= 0 && param->length != arg->length) {
+						return false;
+					}
+					return unify(param->element, arg->element, bindings);
+				}
+				case (POINTER_TYPE) : {
+					return unify(param->element, arg->element, bindings);
+				}
+				case (ROUTINE_TYPE) : {
+					if (param->pure != arg->pure || param->params.size() != arg->params.size()) {
+						return false;
+					}
+					for (unsigned i = 0; i < param->params.size(); i++) {
+						if (!unify(param->params[i]->type, arg->params[i]->type, bindings)) {
+							return false;
+						}
+					}
+					return unify(param->returnType, arg->returnType, bindings);
+				}
+				default : {
+					return true;
+				}
+			}
+		}
+
+		// Whether a type argument implements the interface a type parameter requires.
+		// Interfaces that aren't declared in this program, like Ord from stdlib, are checked where they are declared.
+		bool satisfies(const TypeName *type, const std::string &interfaceName) const {
+			if (interfaceName.empty() || interfaces == nullptr || !interfaces->isInterface(interfaceName)) {
+				return true;
+			}
+			return type->kind == NAMED_TYPE && interfaces->table(type->name, interfaceName) != nullptr;
+		}
+
+		// Replace the type parameters in a type with their bindings.
+		static void substitute(TypeName *&type, const std::map<std::string, const TypeName*> &bindings) {
+			if (type == nullptr) {
+				return;
+			}
+			if (type->kind == NAMED_TYPE) {
+				auto b = bindings.find(type->name);
+				if (b != bindings.end()) {
+					delete type;
+					type = b->second->clone();
+				}
+				return;
+			}
+			substitute(type->element, bindings);
+			substitute(type->returnType, bindings);
+			for (Parameter *p : type->params) {
+				substitute(p->type, bindings);
+			}
+		}
+};
+
+#endif
@@ -3,13 +3,58 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <string>
 #include <math.h>
 #include <iostream>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <string.h>
+#include <chrono>
+#include <limits.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <new>
+#include <functional>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unordered_map>
+#include <string_view>
+#include <strings.h>
+#include <thread>
+#include <atomic>
 
+#include "memory.h"
+#include "trace.h"
 #include "lexer.h"
 #include "parser.h"
+#include "dump.h"
+#include "types.h"
+#include "interfaces.h"
+#include "generics.h"
+#include "ir.h"
+#include "interpret.h"
+#include "lower.h"
+#include "optimize.h"
+#include "x86.h"
+#include "elf.h"
+#include "jit.h"
+#include "cache.h"
+#include "query.h"
+#include "lto.h"
+#include "driver.h"
+#include "server.h"
+#include "lsp.h"
 
 #endif
@@ -0,0 +1,206 @@
+#ifndef INTERFACES
+#define INTERFACES
+
+#include "includes.h"
+
+
+// The routines with which one class implements one interface.
+// The table is dense: slot i holds the implementation of the interface's i-th routine, so a call
+// through an interface is a single indexed load instead of a lookup by name.
+struct WitnessTable {
+	unsigned id;
+	std::string className;
+	std::string interfaceName;
+	std::vector<const Routine*> slots;
+
+	// The name of the statically allocated table in the object file.
+	std::string symbol() const {
+		return "__witness_" + className + "_" + interfaceName;
+	}
+
+	static bool isWitnessTable(const std::string &symbol) {
+		return symbol.compare(0, 10, "__witness_") == 0;
+	}
+};
+
+
+// How a call to an interface routine will be made.
+struct Dispatch {
+	const Routine *target;		// The routine to call directly, or nullptr if the call goes through a witness table.
+	int slot;					// The slot in the witness table holding the routine; -1 if it isn't an interface routine.
+};
+
+
+// Builds a witness table for every instance in a program and resolves calls to interface routines.
+// Values whose static type is an interface, or a generic "T as A", carry a pointer to their witness table
+// and call through it; when the concrete class is known the call is bound to the implementation directly.
+class InterfaceTables {
+
+	public:
+
+		std::vector<WitnessTable> tables;
+
+		// Build the tables for every instance in the program.
+		// Returns false and adds the problem to diagnostics if an instance doesn't implement its interface.
+		bool build(const Program *program, std::string &diagnostics) {
+			TraceScope trace("interfaces");
+			reported = &diagnostics;
+			bool ok = true;
+			collect(program);
+			for (const TypeDeclaration *instance : instances) {
+				ok = buildTable(instance) && ok;
+			}
+			return ok;
+		}
+
+		// The slot of the named routine in the interface's witness tables, or -1 if it has no such routine.
+		int slot(const std::string &interfaceName, const std::string &routine) const {
+			auto i = slots.find(interfaceName);
+			if (i == slots.end()) {
+				return -1;
+			}
+			auto j = i->second.find(routine);
+			return j == i->second.end() ? -1 : (int) j->second;
+		}
+
+		// The witness table for the class and interface, or nullptr if the class doesn't implement the interface.
+		const WitnessTable* table(const std::string &className, const std::string &interfaceName) const {
+			auto i = tableIndex.find(std::make_pair(className, interfaceName));
+			return i == tableIndex.end() ? nullptr : &tables[i->second];
+		}
+
+		bool isInterface(const std::string &name) const {
+			return interfaces.count(name) != 0;
+		}
+
+		// Decide how to call an interface routine on a value whose static type is receiverType.
+		// Calls on a concrete class are devirtualized; calls on an interface or a generic parameter use the slot.
+		Dispatch resolve(const std::string &receiverType, const std::string &interfaceName, const std::string &routine) const {
+			Dispatch ret;
+			ret.target = nullptr;
+			ret.slot = slot(interfaceName, routine);
+			if (ret.slot >= 0) {
+				const WitnessTable *t = table(receiverType, interfaceName);
+				if (t != nullptr) {
+					ret.target = t->slots[ret.slot];
+				}
+			}
+			return ret;
+		}
+
+	private:
+
+		std::map<std::string, const TypeDeclaration*> interfaces;
+		std::map<std::string, const TypeDeclaration*> classes;
+		std::vector<const TypeDeclaration*> instances;
+
+		// For each interface, the slot assigned to each of its routines.
+		std::map<std::string, std::map<std::string, unsigned>> slots;
+
+		std::map<std::pair<std::string, std::string>, unsigned> tableIndex;
+
+		std::string *reported;		// Where build adds problems.
+
+		// Find every type declaration, including those in namespaces, and assign interface slots in declaration order.
+		void collect(const Program *program) {
+			for (const TypeDeclaration *t : program->typeDecls) {
+				switch (t->kind) {
+					case (INTERFACE_DECL) : {
+						interfaces[t->name] = t;
+						std::map<std::string, unsigned> &s = slots[t->name];
+						for (const Routine *r : t->routines) {
+							unsigned next = s.size();
+							s.emplace(r->name, next);
+						}
+						break;
+					}
+					case (INSTANCE_DECL) : {
+						instances.push_back(t);
+						break;
+					}
+					case (CLASS_DECL) :
+					case (STRUCT_DECL) :
+					case (UNION_DECL) : {
+						classes[t->name] = t;
+						break;
+					}
+					default : {}
+				}
+			}
+			for (const Namespace *n : program->namespaces) {
+				if (n->contents != nullptr) {
+					collect(n->contents);
+				}
+			}
+		}
+
+		bool buildTable(const TypeDeclaration *instance) {
+			auto i = interfaces.find(instance->interfaceName);
+			if (i == interfaces.end()) {
+				error(instance, instance->interfaceName + " is not an interface");
+				return false;
+			}
+			if (classes.count(instance->name) == 0) {
+				error(instance, instance->name + " is not a class");
+				return false;
+			}
+			std::pair<std::string, std::string> key(instance->name, instance->interfaceName);
+			if (tableIndex.count(key) != 0) {
+				error(instance, instance->name + " implements " + instance->interfaceName + " more than once");
+				return false;
+			}
+
+			const TypeDeclaration *interface = i->second;
+			WitnessTable table;
+			table.id = tables.size();
+			table.className = instance->name;
+			table.interfaceName = instance->interfaceName;
+			table.slots.assign(interface->routines.size(), nullptr);
+
+			bool ok = true;
+			for (const Routine *r : instance->routines) {
+				int s = slot(interface->name, r->name);
+				if (s < 0) {
+					error(r, r->name + " is not a routine of interface " + interface->name);
+					ok = false;
+				}
+				else if (table.slots[s] != nullptr) {
+					error(r, r->name + " is implemented more than once for " + instance->name);
+					ok = false;
+				}
+				else if (r->params.size() != interface->routines[s]->params.size() || r->pure != interface->routines[s]->pure) {
+					error(r, r->name + " does not match its declaration in interface " + interface->name);
+					ok = false;
+				}
+				else {
+					table.slots[s] = r;
+				}
+			}
+
+			// Routines the instance leaves out fall back on the interface's own definition.
+			for (unsigned s = 0; s < table.slots.size(); s++) {
+				if (table.slots[s] == nullptr) {
+					const Routine *r = interface->routines[s];
+					if (r->hasBody) {
+						table.slots[s] = r;
+					}
+					else {
+						error(instance, instance->name + " does not implement " + r->name + " from interface " + interface->name);
+						ok = false;
+					}
+				}
+			}
+
+			if (ok) {
+				tableIndex[key] = table.id;
+				tables.push_back(table);
+			}
+			return ok;
+		}
+
+		template <class Node> void error(const Node *where, const std::string &message) {
+			diagnose(*reported, "Semantic error: %s (%u:%u).\n", message.c_str(), where->linenum, where->colnum);
+		}
+};
+
+#endif
@@ -0,0 +1,803 @@
+#ifndef INTERPRET
+#define INTERPRET
+
+#include "includes.h"
+
+
+/* Constant evaluation */
+
+// Integer constants are kept sign extended from the width of their type.
+long long normalize(long long v, IRType type) {
+	switch (type) {
+		case (IR_I8) : {
+			return (signed char) v;
+		}
+		case (IR_I16) : {
+			return (short) v;
+		}
+		case (IR_I32) : {
+			return (int) v;
+		}
+		default : {
+			return v;
+		}
+	}
+}
+
+unsigned long long zeroExtend(long long v, IRType type) {
+	switch (type) {
+		case (IR_I8) : {
+			return (unsigned char) v;
+		}
+		case (IR_I16) : {
+			return (unsigned short) v;
+		}
+		case (IR_I32) : {
+			return (unsigned) v;
+		}
+		default : {
+			return (unsigned long long) v;
+		}
+	}
+}
+
+// Floating point constants hold the bits of a double, whatever their type.
+double constantDouble(long long bits) {
+	double ret;
+	memcpy(&ret, &bits, sizeof(ret));
+	return ret;
+}
+
+long long doubleBits(double d, IRType type) {
+	if (type == IR_F32) {
+		d = (float) d;
+	}
+	long long ret;
+	memcpy(&ret, &d, sizeof(ret));
+	return ret;
+}
+
+// Work out what an instruction produces from constant operands.
+// operandType is the type of the operands, which differs from type for comparisons and conversions.
+// Returns false if it can't be done at compile time, as when dividing by zero.
+bool evaluate(Opcode op, IRType type, unsigned flags, IRType operandType, const long long *args, long long &result) {
+	if (op == OP_CONVERT) {
+		long long a = args[0];
+		if (irFloat(operandType) && irFloat(type)) {
+			result = doubleBits(constantDouble(a), type);
+		}
+		else if (irFloat(type)) {
+			double d = (flags & CONVERT_UNSIGNED) ? (double) zeroExtend(a, operandType) : (double) a;
+			result = doubleBits(d, type);
+		}
+		else if (irFloat(operandType)) {
+			double d = constantDouble(a);
+			if (!(d > -9.2e18 && d < 9.2e18)) {
+				return false;
+			}
+			result = normalize((long long) d, type);
+		}
+		else {
+			result = normalize((flags & CONVERT_UNSIGNED) ? (long long) zeroExtend(a, operandType) : a, type);
+		}
+		return true;
+	}
+
+	if (irFloat(operandType)) {
+		double a = constantDouble(args[0]);
+		double b = op == OP_NEG ? 0 : constantDouble(args[1]);
+		switch (op) {
+			case (OP_ADD) : {
+				result = doubleBits(a + b, type);
+				return true;
+			}
+			case (OP_SUB) : {
+				result = doubleBits(a - b, type);
+				return true;
+			}
+			case (OP_MUL) : {
+				result = doubleBits(a * b, type);
+				return true;
+			}
+			case (OP_DIV) : {
+				result = doubleBits(a / b, type);
+				return true;
+			}
+			case (OP_NEG) : {
+				result = doubleBits(-a, type);
+				return true;
+			}
+			case (OP_EQ) : {
+				result = a == b;
+				return true;
+			}
+			case (OP_NE) : {
+				result = a != b;
+				return true;
+			}
+			case (OP_LT) : {
+				result = a < b;
+				return true;
+			}
+			case (OP_LE) : {
+				result = a <= b;
+				return true;
+			}
+			case (OP_GT) : {
+				result = a > b;
+				return true;
+			}
+			case (OP_GE) : {
+				result = a >= b;
+				return true;
+			}
+			default : {
+				return false;
+			}
+		}
+	}
+
+	// Integer arithmetic wraps, so it is done unsigned and brought back to the type's width.
+	long long a = normalize(args[0], operandType);
+	long long b = op == OP_NEG || op == OP_NOT ? 0 : normalize(args[1], operandType);
+	unsigned long long ua = zeroExtend(a, operandType);
+	unsigned long long ub = zeroExtend(b, operandType);
+	unsigned width = irSize(operandType) * 8;
+	long long minimum = width == 64 ? (long long) (1ULL << 63) : -(1LL << (width - 1));
+	unsigned long long r;
+	switch (op) {
+		case (OP_ADD) : {
+			r = (unsigned long long) a + (unsigned long long) b;
+			break;
+		}
+		case (OP_SUB) : {
+			r = (unsigned long long) a - (unsigned long long) b;
+			break;
+		}
+		case (OP_MUL) : {
+			r = (unsigned long long) a * (unsigned long long) b;
+			break;
+		}
+		case (OP_DIV) :
+		case (OP_MOD) : {
+			if (b == 0 || (b == -1 && a == minimum)) {
+				return false;
+			}
+			r = op == OP_DIV ? a / b : a % b;
+			break;
+		}
+		case (OP_UDIV) :
+		case (OP_UMOD) : {
+			if (ub == 0) {
+				return false;
+			}
+			r = op == OP_UDIV ? ua / ub : ua % ub;
+			break;
+		}
+		case (OP_AND) : {
+			r = a & b;
+			break;
+		}
+		case (OP_OR) : {
+			r = a | b;
+			break;
+		}
+		case (OP_XOR) : {
+			r = a ^ b;
+			break;
+		}
+		case (OP_SHL) :
+		case (OP_SHR) :
+		case (OP_USHR) : {
+			// What the machine does with oversized shifts differs between widths, so those are left alone.
+			if (ub >= width) {
+				return false;
+			}
+			r = op == OP_SHL ? ua << ub : (op == OP_SHR ? (unsigned long long) (a >> ub) : ua >> ub);
+			break;
+		}
+		case (OP_NEG) : {
+			r = 0 - (unsigned long long) a;
+			break;
+		}
+		case (OP_NOT) : {
+			r = ~(unsigned long long) a;
+			break;
+		}
+		case (OP_EQ) : {
+			r = a == b;
+			break;
+		}
+		case (OP_NE) : {
+			r = a != b;
+			break;
+		}
+		case (OP_LT) : {
+			r = a < b;
+			break;
+		}
+		case (OP_LE) : {
+			r = a <= b;
+			break;
+		}
+		case (OP_GT) : {
+			r = a > b;
+			break;
+		}
+		case (OP_GE) : {
+			r = a >= b;
+			break;
+		}
+		case (OP_ULT) : {
+			r = ua < ub;
+			break;
+		}
+		case (OP_ULE) : {
+			r = ua <= ub;
+			break;
+		}
+		case (OP_UGT) : {
+			r = ua > ub;
+			break;
+		}
+		case (OP_UGE) : {
+			r = ua >= ub;
+			break;
+		}
+		default : {
+			return false;
+		}
+	}
+	result = normalize((long long) r, type);
+	return true;
+}
+
+// Whether an opcode computes its result from its operands alone, so it can be folded and numbered.
+bool isArithmetic(Opcode op) {
+	return (op >= OP_ADD && op <= OP_UGE) || op == OP_CONVERT;
+}
+
+bool isCommutative(Opcode op) {
+	return op == OP_ADD || op == OP_MUL || op == OP_AND || op == OP_OR || op == OP_XOR || op == OP_EQ || op == OP_NE;
+}
+
+
+/* Interpretation */
+
+// Runs functions at compile time, so that calls with constant arguments can be replaced by their results and
+// globals can start out holding the values of their initializers.
+// Only what is sure to behave the same as the compiled code is run; anything else, like dividing by zero or
+// running out of steps or memory, makes the evaluation fail and leaves the work for run time.
+class Interpreter {
+
+	public:
+
+		unsigned long long stepLimit;		// The most instructions one evaluation may run.
+		unsigned depthLimit;				// The deepest calls may nest.
+		size_t memoryLimit;					// The most bytes of memory one evaluation may use.
+		unsigned long long steps;			// Instructions run by the last evaluation.
+		size_t memoryUsed;					// Bytes of memory used by the last evaluation.
+		std::string failure;				// Why the last evaluation failed.
+
+		Interpreter(const IRModule *m, unsigned long long maxSteps = 100000, unsigned maxDepth = 64, size_t maxMemory = 1 << 20) : stepLimit(maxSteps), depthLimit(maxDepth), memoryLimit(maxMemory), steps(0), memoryUsed(0), module(m), target(nullptr), uninitialized(nullptr) {}
+
+		// Call a func with constant arguments.
+		// Only read-only data can be read, since anything else might have changed by the time the call is made.
+		// Read-only data is passed and returned by its symbol, as dataValue gives it.
+		bool call(const Function *f, const std::vector<long long> &args, long long &result) {
+			reset();
+			std::vector<long long> values = args;
+			for (long long &v : values) {
+				unsigned symbol = 0;
+				if (isData(v, symbol)) {
+					unsigned region = dataRegion(symbol);
+					if (region == ~0u) {
+						return fail("it uses too much memory");
+					}
+					v = address(region, 0);
+				}
+			}
+			if (!run(f, values, result, 0)) {
+				return false;
+			}
+			unsigned offset = 0;
+			const Region *r = find(result, 0, offset);
+			if (r != nullptr && r->symbol != ~0u && offset == 0) {
+				result = dataValue(r->symbol);
+			}
+			return true;
+		}
+
+		// Run a global's initializer, which stores the value through the address of the global's symbol, and
+		// make the global start out holding what was stored. Other globals can be read unless they are among
+		// those still waiting to be initialized.
+		bool initialize(const Function *init, DataObject *global, const std::set<unsigned> &waiting) {
+			reset();
+			target = global;
+			uninitialized = &waiting;
+			long long ignored = 0;
+			bool ok = run(init, std::vector<long long>(), ignored, 0) && writeBack(global);
+			target = nullptr;
+			uninitialized = nullptr;
+			return ok;
+		}
+
+		// A routine's address, as the interpreter represents it.
+		static long long routineValue(unsigned symbol) {
+			return ROUTINE_TAG | symbol;
+		}
+
+		// The address of a data object, as call takes and returns it.
+		static long long dataValue(unsigned symbol) {
+			return DATA_TAG | symbol;
+		}
+
+		static bool isData(long long v, unsigned &symbol) {
+			if ((v & TAG_MASK) != DATA_TAG) {
+				return false;
+			}
+			symbol = (unsigned) (v & ~TAG_MASK);
+			return true;
+		}
+
+		// Whether a value is a routine's address, and if so the routine's symbol.
+		static bool isRoutine(long long v, unsigned &symbol) {
+			if ((v & TAG_MASK) != ROUTINE_TAG) {
+				return false;
+			}
+			symbol = (unsigned) (v & ~TAG_MASK);
+			return true;
+		}
+
+	private:
+
+		// Addresses are kept apart from numbers by a tag in bits no real address has set. Routines are named by
+		// their symbols, while addresses of memory hold the number of a region and an offset into it. Data
+		// objects are named by their symbols only on the way in and out of call.
+		static const long long ROUTINE_TAG = 1LL << 56;
+		static const long long MEMORY_TAG = 2LL << 56;
+		static const long long DATA_TAG = 3LL << 56;
+		static const long long TAG_MASK = 0xffLL << 56;
+
+		// A piece of memory: a data object, or a stack slot of a call being run.
+		struct Region {
+			std::vector<unsigned char> bytes;
+			std::map<unsigned, long long> pointers;		// Addresses stored in the region by offset; their bytes are left 0.
+			unsigned symbol;							// The data object's symbol, or ~0u for a stack slot.
+			bool readable;
+			bool writable;
+		};
+
+		const IRModule *module;
+		DataObject *target;							// The global being initialized, if any.
+		const std::set<unsigned> *uninitialized;
+		std::vector<Region> regions;
+		std::map<unsigned, unsigned> dataRegions;		// The region holding each data object that has been used.
+
+		void reset() {
+			steps = 0;
+			memoryUsed = 0;
+			failure.clear();
+			regions.clear();
+			dataRegions.clear();
+		}
+
+		// Give up on the evaluation. The first reason given is the one kept.
+		bool fail(const char *why) {
+			if (failure.empty()) {
+				failure = why;
+			}
+			return false;
+		}
+
+		static long long address(unsigned region, unsigned offset) {
+			return MEMORY_TAG | ((long long) region << 32) | offset;
+		}
+
+		// Make a region of zeros, returning its number, or ~0u if there isn't enough memory left.
+		unsigned allocate(size_t size, unsigned symbol) {
+			if (memoryUsed + size > memoryLimit || regions.size() >= (1u << 24)) {
+				return ~0u;
+			}
+			memoryUsed += size;
+			regions.emplace_back();
+			Region &r = regions.back();
+			r.bytes.assign(size, 0);
+			r.symbol = symbol;
+			r.readable = true;
+			r.writable = symbol == ~0u;
+			return regions.size() - 1;
+		}
+
+		// Free the stack slots of a call that has returned. Their regions stay empty, so that any address of
+		// them that is left behind can't be used.
+		void release(const std::vector<unsigned> &frame) {
+			for (unsigned r : frame) {
+				if (r != ~0u) {
+					memoryUsed -= regions[r].bytes.size();
+					std::vector<unsigned char>().swap(regions[r].bytes);
+					regions[r].pointers.clear();
+				}
+			}
+		}
+
+		// The region holding a data object, which is copied in the first time it's used.
+		unsigned dataRegion(unsigned symbol) {
+			auto i = dataRegions.find(symbol);
+			if (i != dataRegions.end()) {
+				return i->second;
+			}
+			const DataObject *d = module->data[module->symbols[symbol].index];
+			unsigned ret = allocate(d->bytes.size(), symbol);
+			if (ret == ~0u) {
+				return ret;
+			}
+			dataRegions[symbol] = ret;
+			regions[ret].bytes = d->bytes;
+			if (uninitialized != nullptr) {
+				regions[ret].readable = d == target || uninitialized->count(symbol) == 0;
+			}
+			else {
+				regions[ret].readable = d->readOnly;
+			}
+			regions[ret].writable = d == target;
+			for (const Relocation &r : d->relocations) {
+				long long value = routineValue(r.symbol);
+				if (module->symbols[r.symbol].kind == DATA_SYMBOL) {
+					unsigned to = dataRegion(r.symbol);
+					if (to == ~0u) {
+						return ~0u;
+					}
+					value = address(to, 0) + r.addend;
+				}
+				regions[ret].pointers[r.offset] = value;
+			}
+			return ret;
+		}
+
+		// The region an address points into, or nullptr if it doesn't point to size bytes of one.
+		Region* find(long long p, unsigned size, unsigned &offset) {
+			if ((p & TAG_MASK) != MEMORY_TAG) {
+				return nullptr;
+			}
+			unsigned region = (unsigned) ((p >> 32) & 0xffffff);
+			offset = (unsigned) p;
+			if (region >= regions.size() || (unsigned long long) offset + size > regions[region].bytes.size()) {
+				return nullptr;
+			}
+			return &regions[region];
+		}
+
+		// Whether an address stored in a region overlaps the given bytes.
+		static bool overlapsPointer(const Region &r, unsigned offset, unsigned size) {
+			auto i = r.pointers.lower_bound(offset < 7 ? 0 : offset - 7);
+			return i != r.pointers.end() && i->first < offset + size;
+		}
+
+		static void forgetPointers(Region &r, unsigned offset, unsigned size) {
+			auto i = r.pointers.lower_bound(offset < 7 ? 0 : offset - 7);
+			while (i != r.pointers.end() && i->first < offset + size) {
+				i = r.pointers.erase(i);
+			}
+		}
+
+		bool load(long long p, IRType type, long long &result) {
+			unsigned offset = 0;
+			unsigned size = irSize(type);
+			Region *r = find(p, size, offset);
+			if (r == nullptr) {
+				return fail("it reads memory that isn't known at compile time");
+			}
+			if (!r->readable) {
+				return fail("it reads a global that may not hold its initial value");
+			}
+			auto i = r->pointers.find(offset);
+			if (type == IR_PTR && i != r->pointers.end()) {
+				result = i->second;
+				return true;
+			}
+			if (overlapsPointer(*r, offset, size)) {
+				return fail("it reads part of an address");
+			}
+			long long bits = 0;
+			memcpy(&bits, r->bytes.data() + offset, size);
+			if (type == IR_F32) {
+				float single;
+				memcpy(&single, &bits, sizeof(single));
+				result = doubleBits(single, IR_F64);
+			}
+			else {
+				result = irFloat(type) ? bits : normalize(bits, type);
+			}
+			return true;
+		}
+
+		bool store(long long p, IRType type, long long value) {
+			unsigned offset = 0;
+			unsigned size = irSize(type);
+			Region *r = find(p, size, offset);
+			if (r == nullptr) {
+				return fail("it writes to memory that isn't known at compile time");
+			}
+			if (!r->writable) {
+				return fail("it writes to a global");
+			}
+			forgetPointers(*r, offset, size);
+			long long bits = value;
+			if (type == IR_PTR && (value & TAG_MASK) != 0) {
+				r->pointers[offset] = value;
+				bits = 0;
+			}
+			else if (type == IR_F32) {
+				float single = (float) constantDouble(value);
+				bits = 0;
+				memcpy(&bits, &single, sizeof(single));
+			}
+			memcpy(r->bytes.data() + offset, &bits, size);
+			return true;
+		}
+
+		bool copy(long long to, long long from, unsigned size) {
+			unsigned d = 0;
+			unsigned s = 0;
+			Region *destination = find(to, size, d);
+			Region *source = find(from, size, s);
+			if (destination == nullptr || source == nullptr) {
+				return fail("it copies memory that isn't known at compile time");
+			}
+			if (!source->readable) {
+				return fail("it reads a global that may not hold its initial value");
+			}
+			if (!destination->writable) {
+				return fail("it writes to a global");
+			}
+			std::vector<std::pair<unsigned, long long>> moved;
+			for (auto i = source->pointers.lower_bound(s < 7 ? 0 : s - 7); i != source->pointers.end() && i->first < s + size; i++) {
+				if (i->first < s || i->first + 8 > s + size) {
+					return fail("it copies part of an address");
+				}
+				moved.push_back(std::make_pair(i->first - s + d, i->second));
+			}
+			memmove(destination->bytes.data() + d, source->bytes.data() + s, size);
+			forgetPointers(*destination, d, size);
+			for (const std::pair<unsigned, long long> &m : moved) {
+				destination->pointers[m.first] = m.second;
+			}
+			return true;
+		}
+
+		// Copy a global's region back into its data object, turning the addresses stored in it into relocations.
+		bool writeBack(DataObject *d) {
+			auto i = dataRegions.find(d->symbol);
+			if (i == dataRegions.end()) {
+				return true;
+			}
+			std::vector<Relocation> relocations;
+			for (const std::pair<const unsigned, long long> &p : regions[i->second].pointers) {
+				Relocation r;
+				r.offset = p.first;
+				r.addend = 0;
+				if (!isRoutine(p.second, r.symbol)) {
+					unsigned offset = 0;
+					const Region *to = find(p.second, 0, offset);
+					if (to == nullptr || to->symbol == ~0u) {
+						return fail("it keeps an address that only means something at compile time");
+					}
+					r.symbol = to->symbol;
+					r.addend = offset;
+				}
+				relocations.push_back(r);
+			}
+			d->bytes = regions[i->second].bytes;
+			d->relocations = relocations;
+			return true;
+		}
+
+		// Arithmetic on addresses is limited to what means the same at compile time as at run time: moving an
+		// address within its memory, and comparing addresses.
+		bool arithmetic(const Function *f, const Instruction &i, const long long *operands, long long &result) {
+			bool addresses = false;
+			bool routines = false;
+			for (unsigned j = 0; j < i.count && j < 2; j++) {
+				if (f->values[i.operands[j]].type == IR_PTR && (operands[j] & TAG_MASK) != 0) {
+					addresses = true;
+					routines = routines || (operands[j] & TAG_MASK) == ROUTINE_TAG;
+				}
+			}
+			if (addresses) {
+				switch (i.op) {
+					case (OP_EQ) :
+					case (OP_NE) : {
+						break;
+					}
+					case (OP_ADD) : {
+						if (routines || i.type != IR_PTR || f->values[i.operands[1]].type == IR_PTR) {
+							return fail("it does arithmetic on an address");
+						}
+						break;
+					}
+					case (OP_SUB) :
+					case (OP_LT) :
+					case (OP_LE) :
+					case (OP_GT) :
+					case (OP_GE) :
+					case (OP_ULT) :
+					case (OP_ULE) :
+					case (OP_UGT) :
+					case (OP_UGE) : {
+						// Only addresses in the same memory can be compared, since where memory ends up isn't known.
+						if (routines || ((operands[0] ^ operands[1]) & ~0xffffffffLL) != 0) {
+							return fail("it compares addresses of different memory");
+						}
+						break;
+					}
+					default : {
+						return fail("it does arithmetic on an address");
+					}
+				}
+			}
+			if (!evaluate(i.op, i.type, i.flags, f->values[i.operands[0]].type, operands, result)) {
+				return fail("it does arithmetic that can't be done at compile time");
+			}
+			return true;
+		}
+
+		bool run(const Function *f, const std::vector<long long> &args, long long &result, unsigned depth) {
+			if (depth > depthLimit) {
+				return fail("its calls nest too deeply");
+			}
+			// Closures that capture nothing ignore the environment they are passed.
+			if (!f->pure || f->blocks.empty() || args.size() < f->params.size()) {
+				return fail("it calls a routine that can't be run at compile time");
+			}
+			std::vector<long long> values(f->values.size(), 0);
+			std::vector<unsigned> frame(f->slots.size(), ~0u);
+			unsigned block = 0;
+			unsigned previous = ~0u;
+			while (true) {
+				const std::vector<ValueId> &code = f->blocks[block].code;
+
+				// Phis all read their operands before any of them are written.
+				unsigned k = 0;
+				std::vector<std::pair<ValueId, long long>> phis;
+				while (k < code.size() && f->values[code[k]].op == OP_PHI) {
+					const Instruction &phi = f->values[code[k]];
+					unsigned j = 0;
+					while (j < phi.count && phi.incoming[j] != previous) {
+						j++;
+					}
+					if (j == phi.count) {
+						return fail("it reaches a block from somewhere its phis don't expect");
+					}
+					phis.push_back(std::make_pair(code[k], values[phi.operands[j]]));
+					k++;
+				}
+				for (const std::pair<ValueId, long long> &p : phis) {
+					values[p.first] = p.second;
+				}
+
+				for (; k < code.size(); k++) {
+					if (++steps > stepLimit) {
+						return fail("it runs for too long");
+					}
+					ValueId v = code[k];
+					const Instruction &i = f->values[v];
+					if (irVector(i.type) || i.op == OP_REDUCE || (i.op == OP_STORE && irVector(f->values[i.operands[1]].type))) {
+						return fail("it uses vector instructions");
+					}
+					switch (i.op) {
+						case (OP_CONST) : {
+							values[v] = i.imm;
+							break;
+						}
+						case (OP_PARAM) : {
+							values[v] = args[i.imm];
+							break;
+						}
+						case (OP_SYMBOL) : {
+							if (module->symbols[i.imm].kind == DATA_SYMBOL) {
+								unsigned region = dataRegion(i.imm);
+								if (region == ~0u) {
+									return fail("it uses too much memory");
+								}
+								values[v] = address(region, 0);
+							}
+							else {
+								values[v] = routineValue(i.imm);
+							}
+							break;
+						}
+						case (OP_STACK) : {
+							if (frame[i.imm] == ~0u) {
+								frame[i.imm] = allocate(f->slots[i.imm].size, ~0u);
+								if (frame[i.imm] == ~0u) {
+									return fail("it uses too much memory");
+								}
+							}
+							values[v] = address(frame[i.imm], 0);
+							break;
+						}
+						case (OP_LOAD) : {
+							if (!load(values[i.operands[0]], i.type, values[v])) {
+								return false;
+							}
+							break;
+						}
+						case (OP_STORE) : {
+							if (!store(values[i.operands[0]], f->values[i.operands[1]].type, values[i.operands[1]])) {
+								return false;
+							}
+							break;
+						}
+						case (OP_COPY) : {
+							if (!copy(values[i.operands[0]], values[i.operands[1]], (unsigned) i.imm)) {
+								return false;
+							}
+							break;
+						}
+						case (OP_CALL) : {
+							unsigned symbol = 0;
+							const Function *callee = nullptr;
+							bool routine = isRoutine(values[i.operands[0]], symbol);
+							if (routine) {
+								callee = module->functionFor(symbol);
+							}
+							if (routine && callee == nullptr && module->symbols[symbol].name == "malloc" && i.count == 2) {
+								// Closures allocate their records.
+								long long size = values[i.operands[1]];
+								unsigned region = size < 0 || size > (long long) memoryLimit ? ~0u : allocate(size, ~0u);
+								if (region == ~0u) {
+									return fail("it uses too much memory");
+								}
+								values[v] = address(region, 0);
+								break;
+							}
+							if (callee == nullptr) {
+								return fail("it calls a routine that can't be run at compile time");
+							}
+							std::vector<long long> callArgs;
+							for (unsigned j = 1; j < i.count; j++) {
+								callArgs.push_back(values[i.operands[j]]);
+							}
+							if (!run(callee, callArgs, values[v], depth + 1)) {
+								return false;
+							}
+							break;
+						}
+						case (OP_JUMP) : {
+							previous = block;
+							block = i.targets[0];
+							break;
+						}
+						case (OP_BRANCH) : {
+							previous = block;
+							block = values[i.operands[0]] != 0 ? i.targets[0] : i.targets[1];
+							break;
+						}
+						case (OP_RETURN) : {
+							result = i.count > 0 ? values[i.operands[0]] : 0;
+							release(frame);
+							return true;
+						}
+						case (OP_TRAP) : {
+							return fail("it indexes outside an array");
+						}
+						default : {
+							if (!isArithmetic(i.op)) {
+								return fail("it does something that can't be done at compile time");
+							}
+							long long operands[2] = {values[i.operands[0]], i.count > 1 ? values[i.operands[1]] : 0};
+							if (!arithmetic(f, i, operands, values[v])) {
+								return false;
+							}
+						}
+					}
+					if (isTerminator(i.op)) {
+						break;
+					}
+				}
+			}
+		}
+};
+
+#endif
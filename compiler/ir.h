@@ -0,0 +1,907 @@
+#ifndef IR
+#define IR
+
+#include "includes.h"
+
+
+// A bump allocator.
+// Everything allocated from an arena is freed at once when the arena is destroyed.
+class Arena {
+
+	public:
+
+		size_t bytesAllocated;
+
+		Arena(size_t size = 4096) : bytesAllocated(0), next(nullptr), remaining(0), chunkSize(size) {}
+
+		~Arena() {
+			for (char *c : chunks) {
+				delete[] c;
+			}
+		}
+
+		// Allocate uninitialized space for n objects of type T.
+		template <class T> T* allocate(size_t n) {
+			size_t bytes = n * sizeof(T);
+			size_t padding = (alignof(T) - ((size_t) next & (alignof(T) - 1))) & (alignof(T) - 1);
+			if (bytes + padding > remaining) {
+				size_t size = bytes + alignof(T) > chunkSize ? bytes + alignof(T) : chunkSize;
+				next = new char[size];
+				chunks.push_back(next);
+				remaining = size;
+				padding = (alignof(T) - ((size_t) next & (alignof(T) - 1))) & (alignof(T) - 1);
+			}
+			T *ret = (T*)(next + padding);
+			next += padding + bytes;
+			remaining -= padding + bytes;
+			bytesAllocated += bytes;
+			return ret;
+		}
+
+	private:
+
+		std::vector<char*> chunks;
+		char *next;
+		size_t remaining;
+		size_t chunkSize;
+};
+
+
+// Values are numbered densely from 0 within each function.
+typedef unsigned ValueId;
+
+const ValueId NO_VALUE = ~0u;
+
+
+// The machine level types that IR values can have.
+// Aggregates live in memory and are handled through their addresses.
+enum IRType {
+	IR_VOID,
+	IR_I8,
+	IR_I16,
+	IR_I32,
+	IR_I64,
+	IR_F32,
+	IR_F64,
+	IR_PTR,
+
+	// 16 byte SSE vectors, which only the loop vectorizer makes.
+	IR_V4I32,
+	IR_V2I64,
+	IR_V4F32,
+	IR_V2F64
+};
+
+unsigned irSize(IRType type) {
+	switch (type) {
+		case (IR_I8) : {
+			return 1;
+		}
+		case (IR_I16) : {
+			return 2;
+		}
+		case (IR_I32) :
+		case (IR_F32) : {
+			return 4;
+		}
+		case (IR_VOID) : {
+			return 0;
+		}
+		case (IR_V4I32) :
+		case (IR_V2I64) :
+		case (IR_V4F32) :
+		case (IR_V2F64) : {
+			return 16;
+		}
+		default : {
+			return 8;
+		}
+	}
+}
+
+bool irFloat(IRType type) {
+	return type == IR_F32 || type == IR_F64;
+}
+
+bool irVector(IRType type) {
+	return type >= IR_V4I32;
+}
+
+// The type of each lane of a vector.
+IRType irLaneType(IRType vector) {
+	static const IRType lanes[] = {IR_I32, IR_I64, IR_F32, IR_F64};
+	return lanes[vector - IR_V4I32];
+}
+
+// The vector with lanes of a type, or IR_VOID if there isn't one.
+IRType irVectorOf(IRType lane) {
+	switch (lane) {
+		case (IR_I32) : {
+			return IR_V4I32;
+		}
+		case (IR_I64) : {
+			return IR_V2I64;
+		}
+		case (IR_F32) : {
+			return IR_V4F32;
+		}
+		case (IR_F64) : {
+			return IR_V2F64;
+		}
+		default : {
+			return IR_VOID;
+		}
+	}
+}
+
+const char* irTypeName(IRType type) {
+	static const char *names[] = {"void", "i8", "i16", "i32", "i64", "f32", "f64", "ptr", "v4i32", "v2i64", "v4f32", "v2f64"};
+	return names[type];
+}
+
+
+enum Opcode {
+	OP_NOP,				// A deleted instruction.
+
+	OP_CONST,			// imm, the bits of an integer or of a double.
+	OP_PARAM,			// imm, the index of the parameter.
+	OP_SYMBOL,			// The address of the module symbol numbered imm.
+	OP_STACK,			// The address of the function's stack slot numbered imm.
+
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_UDIV,
+	OP_MOD,
+	OP_UMOD,
+	OP_AND,
+	OP_OR,
+	OP_XOR,
+	OP_SHL,
+	OP_SHR,
+	OP_USHR,
+	OP_NEG,
+	OP_NOT,
+
+	// Comparisons produce an i8 that is 0 or 1.
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_ULT,
+	OP_ULE,
+	OP_UGT,
+	OP_UGE,
+
+	OP_CONVERT,			// Convert the operand to the instruction's type; flags has CONVERT_UNSIGNED if the operand is unsigned.
+	OP_SPLAT,			// A vector with the operand in every lane.
+	OP_REDUCE,			// The sum of the lanes of a vector.
+
+	OP_LOAD,			// [address]
+	OP_STORE,			// [address, value]
+	OP_COPY,			// [destination, source], copies imm bytes.
+
+	OP_CALL,			// [callee, arguments...]
+	OP_PHI,				// One operand for each incoming edge; incoming holds the block each one comes from.
+
+	// Terminators.
+	OP_JUMP,			// To targets[0].
+	OP_BRANCH,			// [condition], to targets[0] if the condition is nonzero and targets[1] otherwise.
+	OP_RETURN,			// [value], or no operands in a routine that returns nothing.
+	OP_TRAP				// Stops the program, as when an index is out of bounds.
+};
+
+const char* opcodeName(Opcode op) {
+	static const char *names[] = {
+		"nop", "const", "param", "symbol", "stack",
+		"add", "sub", "mul", "div", "udiv", "mod", "umod", "and", "or", "xor", "shl", "shr", "ushr", "neg", "not",
+		"eq", "ne", "lt", "le", "gt", "ge", "ult", "ule", "ugt", "uge",
+		"convert", "splat", "reduce", "load", "store", "copy", "call", "phi", "jump", "branch", "return", "trap"
+	};
+	return names[op];
+}
+
+bool isTerminator(Opcode op) {
+	return op == OP_JUMP || op == OP_BRANCH || op == OP_RETURN || op == OP_TRAP;
+}
+
+// Instruction flags.
+const unsigned CONVERT_UNSIGNED = 1;		// The operand of an OP_CONVERT is unsigned.
+const unsigned CALL_PURE = 2;				// The callee of an OP_CALL is a func, so the call has no side effects.
+const unsigned LOAD_INVARIANT = 4;			// An OP_LOAD reads memory that is written once, before anything can read it.
+const unsigned LOAD_WITNESS = 8;			// An OP_LOAD reads a routine from a slot of a witness table.
+
+
+struct Instruction {
+	Opcode op;
+	IRType type;
+	unsigned flags;
+	unsigned block;				// The block the instruction is in.
+	unsigned count;				// The number of operands.
+	ValueId *operands;			// Allocated from the function's arena.
+	unsigned *incoming;			// For phis, the predecessor each operand comes from.
+	long long imm;
+	unsigned targets[2];		// The blocks a terminator may transfer control to.
+};
+
+
+struct BasicBlock {
+	std::vector<ValueId> code;			// The block's instructions in order; a terminator, if any, is last.
+	std::vector<unsigned> preds;
+};
+
+
+struct StackSlot {
+	unsigned size;
+	unsigned align;
+};
+
+
+// A routine in SSA form.
+class Function {
+
+	public:
+
+		std::string name;
+		unsigned symbol;						// The function's symbol in its module.
+		IRType returnType;
+		std::vector<IRType> params;
+		bool pure;								// Generated from a func.
+
+		Arena arena;							// Holds the operand lists of the function's instructions.
+		std::vector<Instruction> values;		// Every instruction, indexed by the ValueId it defines.
+		std::vector<BasicBlock> blocks;			// Block 0 is the entry.
+		std::vector<StackSlot> slots;
+
+		Function() : symbol(0), returnType(IR_VOID), pure(false) {}
+
+		// A copy of the function for another module, in which the symbol each of this one's module is numbered
+		// symbols[s]. The copy's own symbol is left for the caller to set.
+		Function* relocated(const std::vector<unsigned> &symbols) const {
+			Function *ret = new Function();
+			ret->name = name;
+			ret->returnType = returnType;
+			ret->params = params;
+			ret->pure = pure;
+			ret->values = values;
+			ret->blocks = blocks;
+			ret->slots = slots;
+			for (Instruction &i : ret->values) {
+				ValueId *operands = i.operands;
+				unsigned *incoming = i.incoming;
+				i.operands = i.count == 0 ? nullptr : ret->arena.allocate<ValueId>(i.count);
+				i.incoming = incoming == nullptr || i.count == 0 ? nullptr : ret->arena.allocate<unsigned>(i.count);
+				for (unsigned j = 0; j < i.count; j++) {
+					i.operands[j] = operands[j];
+					if (i.incoming != nullptr) {
+						i.incoming[j] = incoming[j];
+					}
+				}
+				if (i.op == OP_SYMBOL) {
+					i.imm = symbols[i.imm];
+				}
+			}
+			return ret;
+		}
+
+		unsigned addBlock() {
+			blocks.push_back(BasicBlock());
+			return blocks.size() - 1;
+		}
+
+		unsigned addSlot(unsigned size, unsigned align) {
+			StackSlot s;
+			s.size = size;
+			s.align = align;
+			slots.push_back(s);
+			return slots.size() - 1;
+		}
+
+		// Create an instruction without putting it in a block.
+		ValueId create(Opcode op, IRType type, const ValueId *operands, unsigned count, long long imm = 0) {
+			Instruction i;
+			i.op = op;
+			i.type = type;
+			i.flags = 0;
+			i.block = ~0u;
+			i.count = count;
+			i.operands = count == 0 ? nullptr : arena.allocate<ValueId>(count);
+			i.incoming = nullptr;
+			i.imm = imm;
+			i.targets[0] = i.targets[1] = ~0u;
+			for (unsigned j = 0; j < count; j++) {
+				i.operands[j] = operands[j];
+			}
+			values.push_back(i);
+			return values.size() - 1;
+		}
+
+		// Append an instruction to the end of a block.
+		ValueId emit(unsigned block, Opcode op, IRType type, std::initializer_list<ValueId> operands = {}, long long imm = 0) {
+			return emit(block, op, type, operands.begin(), operands.size(), imm);
+		}
+
+		ValueId emit(unsigned block, Opcode op, IRType type, const std::vector<ValueId> &operands, long long imm = 0) {
+			return emit(block, op, type, operands.data(), operands.size(), imm);
+		}
+
+		ValueId emit(unsigned block, Opcode op, IRType type, const ValueId *operands, unsigned count, long long imm = 0) {
+			ValueId ret = create(op, type, operands, count, imm);
+			values[ret].block = block;
+			blocks[block].code.push_back(ret);
+			return ret;
+		}
+
+		// Put a phi with no operands at the start of a block.
+		ValueId emitPhi(unsigned block, IRType type) {
+			ValueId ret = create(OP_PHI, type, nullptr, 0);
+			values[ret].block = block;
+			std::vector<ValueId> &code = blocks[block].code;
+			unsigned i = 0;
+			while (i < code.size() && values[code[i]].op == OP_PHI) {
+				i++;
+			}
+			code.insert(code.begin() + i, ret);
+			return ret;
+		}
+
+		// Add an incoming value to a phi.
+		void addIncoming(ValueId phi, ValueId value, unsigned pred) {
+			Instruction &i = values[phi];
+			ValueId *operands = arena.allocate<ValueId>(i.count + 1);
+			unsigned *incoming = arena.allocate<unsigned>(i.count + 1);
+			for (unsigned j = 0; j < i.count; j++) {
+				operands[j] = i.operands[j];
+				incoming[j] = i.incoming[j];
+			}
+			operands[i.count] = value;
+			incoming[i.count] = pred;
+			i.operands = operands;
+			i.incoming = incoming;
+			i.count++;
+		}
+
+		// Replace an instruction's operands.
+		void setOperands(ValueId v, const std::vector<ValueId> &operands) {
+			Instruction &i = values[v];
+			if (operands.size() > i.count) {
+				i.operands = arena.allocate<ValueId>(operands.size());
+			}
+			for (unsigned j = 0; j < operands.size(); j++) {
+				i.operands[j] = operands[j];
+			}
+			i.count = operands.size();
+		}
+
+		// End a block with a jump.
+		void jump(unsigned from, unsigned to) {
+			ValueId v = emit(from, OP_JUMP, IR_VOID);
+			values[v].targets[0] = to;
+			blocks[to].preds.push_back(from);
+		}
+
+		// End a block with a conditional branch.
+		void branch(unsigned from, ValueId condition, unsigned ifTrue, unsigned ifFalse) {
+			ValueId v = emit(from, OP_BRANCH, IR_VOID, {condition});
+			values[v].targets[0] = ifTrue;
+			values[v].targets[1] = ifFalse;
+			blocks[ifTrue].preds.push_back(from);
+			blocks[ifFalse].preds.push_back(from);
+		}
+
+		// The last instruction of a block if it is a terminator, otherwise NO_VALUE.
+		ValueId terminator(unsigned block) const {
+			const std::vector<ValueId> &code = blocks[block].code;
+			if (code.empty() || !isTerminator(values[code.back()].op)) {
+				return NO_VALUE;
+			}
+			return code.back();
+		}
+
+		std::vector<unsigned> successors(unsigned block) const {
+			std::vector<unsigned> ret;
+			ValueId t = terminator(block);
+			if (t != NO_VALUE) {
+				const Instruction &i = values[t];
+				if (i.op == OP_JUMP) {
+					ret.push_back(i.targets[0]);
+				}
+				else if (i.op == OP_BRANCH) {
+					ret.push_back(i.targets[0]);
+					if (i.targets[1] != i.targets[0]) {
+						ret.push_back(i.targets[1]);
+					}
+				}
+			}
+			return ret;
+		}
+
+		// Rebuild every block's predecessor list from the terminators.
+		void recomputePredecessors() {
+			for (BasicBlock &b : blocks) {
+				b.preds.clear();
+			}
+			for (unsigned b = 0; b < blocks.size(); b++) {
+				for (unsigned s : successors(b)) {
+					blocks[s].preds.push_back(b);
+				}
+			}
+		}
+
+		// Blocks reachable from the entry, in reverse postorder.
+		std::vector<unsigned> reversePostorder() const {
+			std::vector<unsigned> order;
+			std::vector<bool> visited(blocks.size(), false);
+			std::vector<std::pair<unsigned, unsigned>> stack;
+			stack.push_back(std::make_pair(0u, 0u));
+			visited[0] = true;
+			while (!stack.empty()) {
+				unsigned b = stack.back().first;
+				std::vector<unsigned> succs = successors(b);
+				if (stack.back().second < succs.size()) {
+					unsigned s = succs[stack.back().second++];
+					if (!visited[s]) {
+						visited[s] = true;
+						stack.push_back(std::make_pair(s, 0u));
+					}
+				}
+				else {
+					order.push_back(b);
+					stack.pop_back();
+				}
+			}
+			std::reverse(order.begin(), order.end());
+			return order;
+		}
+
+		// Replace every use of one value with another.
+		void replaceUses(ValueId from, ValueId to) {
+			for (Instruction &i : values) {
+				for (unsigned j = 0; j < i.count; j++) {
+					if (i.operands[j] == from) {
+						i.operands[j] = to;
+					}
+				}
+			}
+		}
+
+		// Take an instruction out of its block.
+		void remove(ValueId v) {
+			Instruction &i = values[v];
+			if (i.block != ~0u) {
+				std::vector<ValueId> &code = blocks[i.block].code;
+				code.erase(std::find(code.begin(), code.end(), v));
+			}
+			i.op = OP_NOP;
+			i.count = 0;
+			i.block = ~0u;
+		}
+
+		bool isConstant(ValueId v) const {
+			return values[v].op == OP_CONST;
+		}
+
+		// Forget one edge from one block to another, along with the phi operands that came along it.
+		void removeEdge(unsigned from, unsigned to) {
+			std::vector<unsigned> &preds = blocks[to].preds;
+			auto p = std::find(preds.begin(), preds.end(), from);
+			if (p != preds.end()) {
+				preds.erase(p);
+			}
+			for (ValueId v : blocks[to].code) {
+				Instruction &i = values[v];
+				if (i.op != OP_PHI) {
+					break;
+				}
+				for (unsigned j = 0; j < i.count; j++) {
+					if (i.incoming[j] == from) {
+						for (unsigned k = j + 1; k < i.count; k++) {
+							i.operands[k - 1] = i.operands[k];
+							i.incoming[k - 1] = i.incoming[k];
+						}
+						i.count--;
+						break;
+					}
+				}
+			}
+		}
+
+		// Make the edges into a block from one predecessor come from another instead.
+		void replacePredecessor(unsigned block, unsigned from, unsigned to) {
+			for (unsigned &p : blocks[block].preds) {
+				if (p == from) {
+					p = to;
+				}
+			}
+			for (ValueId v : blocks[block].code) {
+				Instruction &i = values[v];
+				if (i.op != OP_PHI) {
+					break;
+				}
+				for (unsigned j = 0; j < i.count; j++) {
+					if (i.incoming[j] == from) {
+						i.incoming[j] = to;
+					}
+				}
+			}
+		}
+
+		// Rewrite every operand through a table of replacements, where replacement[v] is what v became or NO_VALUE.
+		// Chains of replacements are followed to the end.
+		void applyReplacements(std::vector<ValueId> &replacement) {
+			for (Instruction &i : values) {
+				for (unsigned j = 0; j < i.count; j++) {
+					i.operands[j] = resolve(replacement, i.operands[j]);
+				}
+			}
+		}
+
+		static ValueId resolve(std::vector<ValueId> &replacement, ValueId v) {
+			ValueId ret = v;
+			while (ret < replacement.size() && replacement[ret] != NO_VALUE) {
+				ret = replacement[ret];
+			}
+			while (v < replacement.size() && replacement[v] != NO_VALUE && replacement[v] != ret) {
+				ValueId next = replacement[v];
+				replacement[v] = ret;
+				v = next;
+			}
+			return ret;
+		}
+
+		// The number of instructions in the function's blocks.
+		unsigned size() const {
+			unsigned ret = 0;
+			for (const BasicBlock &b : blocks) {
+				ret += b.code.size();
+			}
+			return ret;
+		}
+};
+
+
+enum SymbolKind {
+	ROUTINE_SYMBOL,
+	DATA_SYMBOL,
+	EXTERNAL_SYMBOL			// Defined in another module or library.
+};
+
+
+struct Symbol {
+	std::string name;
+	SymbolKind kind;
+	unsigned index;			// The function or data object the symbol names.
+};
+
+
+// A pointer stored in a data object, to be filled in with the address of a symbol.
+struct Relocation {
+	unsigned offset;
+	unsigned symbol;
+	long long addend;		// Added to the symbol's address.
+};
+
+
+// Statically allocated data: string literals, globals and witness tables.
+struct DataObject {
+	std::string name;
+	unsigned symbol;
+	std::vector<unsigned char> bytes;
+	std::vector<Relocation> relocations;
+	unsigned align;
+	bool readOnly;
+};
+
+
+class IRModule {
+
+	public:
+
+		std::vector<Function*> functions;
+		std::vector<DataObject*> data;
+		std::vector<Symbol> symbols;
+
+		~IRModule() {
+			for (Function *f : functions) {
+				delete f;
+			}
+			for (DataObject *d : data) {
+				delete d;
+			}
+		}
+
+		// Find the symbol with the given name, creating an external one if there isn't one yet.
+		unsigned symbol(const std::string &name) {
+			auto i = symbolIndex.find(name);
+			if (i != symbolIndex.end()) {
+				return i->second;
+			}
+			Symbol s;
+			s.name = name;
+			s.kind = EXTERNAL_SYMBOL;
+			s.index = 0;
+			symbols.push_back(s);
+			symbolIndex[name] = symbols.size() - 1;
+			return symbols.size() - 1;
+		}
+
+		// The symbol with the given name, or ~0u if there isn't one.
+		unsigned findSymbol(const std::string &name) const {
+			auto i = symbolIndex.find(name);
+			return i == symbolIndex.end() ? ~0u : i->second;
+		}
+
+		// Give a symbol, and the function or data it names, a name that no other symbol has.
+		void rename(unsigned symbol, const std::string &name) {
+			Symbol &s = symbols[symbol];
+			symbolIndex.erase(s.name);
+			symbolIndex[name] = symbol;
+			s.name = name;
+			if (s.kind == ROUTINE_SYMBOL) {
+				functions[s.index]->name = name;
+			}
+			else if (s.kind == DATA_SYMBOL) {
+				data[s.index]->name = name;
+			}
+		}
+
+		Function* addFunction(const std::string &name) {
+			Function *ret = new Function();
+			ret->name = name;
+			ret->symbol = symbol(name);
+			symbols[ret->symbol].kind = ROUTINE_SYMBOL;
+			symbols[ret->symbol].index = functions.size();
+			functions.push_back(ret);
+			return ret;
+		}
+
+		DataObject* addData(const std::string &name, unsigned align, bool readOnly) {
+			DataObject *ret = new DataObject();
+			ret->name = name;
+			ret->align = align;
+			ret->readOnly = readOnly;
+			ret->symbol = symbol(name);
+			symbols[ret->symbol].kind = DATA_SYMBOL;
+			symbols[ret->symbol].index = data.size();
+			data.push_back(ret);
+			return ret;
+		}
+
+		// Add the functions and data that another module defines to this one, matching up symbols by name, as a
+		// linker does. A definition this module already has is kept: units that lower the same instantiation or
+		// closure record lower it the same way. String literals are named in the order a unit came across them, so
+		// they are matched by their contents instead. Returns the symbol in this module of each of the other's.
+		// With only given, just the functions of the other module that it marks are added, and the rest are left to
+		// be defined elsewhere; all of its data is added.
+		std::vector<unsigned> link(const IRModule &other, const std::vector<bool> *only = nullptr) {
+			std::vector<unsigned> ret(other.symbols.size());
+			for (unsigned s = 0; s < other.symbols.size(); s++) {
+				const Symbol &from = other.symbols[s];
+				if (from.kind != DATA_SYMBOL || !isStringLiteral(from.name)) {
+					ret[s] = symbol(from.name);
+					continue;
+				}
+				const DataObject *d = other.data[from.index];
+				std::string contents(d->bytes.begin(), d->bytes.end());
+				auto i = literals.find(contents);
+				if (i != literals.end()) {
+					ret[s] = i->second;
+					continue;
+				}
+				std::string name = ".str." + std::to_string(literals.size());
+				while (findSymbol(name) != ~0u) {
+					name += "_";
+				}
+				DataObject *copy = addData(name, d->align, d->readOnly);
+				copy->bytes = d->bytes;
+				literals[contents] = copy->symbol;
+				ret[s] = copy->symbol;
+			}
+			for (const DataObject *d : other.data) {
+				unsigned s = ret[d->symbol];
+				if (symbols[s].kind != EXTERNAL_SYMBOL) {
+					continue;
+				}
+				DataObject *copy = addData(d->name, d->align, d->readOnly);
+				copy->bytes = d->bytes;
+				copy->relocations = d->relocations;
+				for (Relocation &r : copy->relocations) {
+					r.symbol = ret[r.symbol];
+				}
+			}
+			for (unsigned k = 0; k < other.functions.size(); k++) {
+				const Function *f = other.functions[k];
+				unsigned s = ret[f->symbol];
+				if (symbols[s].kind != EXTERNAL_SYMBOL || (only != nullptr && !(*only)[k])) {
+					continue;
+				}
+				Function *copy = f->relocated(ret);
+				copy->symbol = s;
+				symbols[s].kind = ROUTINE_SYMBOL;
+				symbols[s].index = functions.size();
+				functions.push_back(copy);
+			}
+			return ret;
+		}
+
+		// Remove the functions and data whose symbols aren't live, and the symbols that aren't live with them. The
+		// symbols that are left keep their order, but are renumbered.
+		void strip(const std::vector<bool> &live) {
+			std::vector<unsigned> renumbered(symbols.size(), ~0u);
+			std::vector<Symbol> kept;
+			for (unsigned s = 0; s < symbols.size(); s++) {
+				if (live[s]) {
+					renumbered[s] = kept.size();
+					kept.push_back(symbols[s]);
+				}
+			}
+			std::vector<DataObject*> keptData;
+			for (DataObject *d : data) {
+				if (!live[d->symbol]) {
+					delete d;
+					continue;
+				}
+				d->symbol = renumbered[d->symbol];
+				for (Relocation &r : d->relocations) {
+					r.symbol = renumbered[r.symbol];
+				}
+				kept[d->symbol].index = keptData.size();
+				keptData.push_back(d);
+			}
+			std::vector<Function*> keptFunctions;
+			for (Function *f : functions) {
+				if (!live[f->symbol]) {
+					delete f;
+					continue;
+				}
+				f->symbol = renumbered[f->symbol];
+				for (Instruction &i : f->values) {
+					if (i.op == OP_SYMBOL) {
+						i.imm = renumbered[i.imm];
+					}
+				}
+				kept[f->symbol].index = keptFunctions.size();
+				keptFunctions.push_back(f);
+			}
+			symbols = kept;
+			data = keptData;
+			functions = keptFunctions;
+			symbolIndex.clear();
+			for (unsigned s = 0; s < symbols.size(); s++) {
+				symbolIndex[symbols[s].name] = s;
+			}
+			for (auto i = literals.begin(); i != literals.end();) {
+				if (renumbered[i->second] == ~0u) {
+					i = literals.erase(i);
+				}
+				else {
+					i->second = renumbered[i->second];
+					i++;
+				}
+			}
+		}
+
+		static bool isStringLiteral(const std::string &name) {
+			return name.compare(0, 5, ".str.") == 0;
+		}
+
+		// Whether a symbol is kept to the object that defines it: string literals and witness tables, whose names
+		// start with a dot or two underscores, are.
+		static bool isLocal(const std::string &name) {
+			return (!name.empty() && name[0] == '.') || name.compare(0, 2, "__") == 0;
+		}
+
+		// The function a symbol names, or nullptr if it doesn't name one in this module.
+		Function* functionFor(unsigned symbol) const {
+			if (symbol >= symbols.size() || symbols[symbol].kind != ROUTINE_SYMBOL) {
+				return nullptr;
+			}
+			return functions[symbols[symbol].index];
+		}
+
+		void print(FILE *out) const {
+			for (const DataObject *d : data) {
+				fprintf(out, "data %s [%zu bytes]", d->name.c_str(), d->bytes.size());
+				// Small objects, which is most globals, have their contents shown.
+				if (d->bytes.size() <= 32) {
+					for (unsigned char b : d->bytes) {
+						fprintf(out, " %02x", b);
+					}
+				}
+				fprintf(out, "\n");
+				for (const Relocation &r : d->relocations) {
+					fprintf(out, "\t+%u: @%s", r.offset, symbols[r.symbol].name.c_str());
+					if (r.addend != 0) {
+						fprintf(out, " + %lld", r.addend);
+					}
+					fprintf(out, "\n");
+				}
+			}
+			for (const Function *f : functions) {
+				print(out, f);
+			}
+		}
+
+		void print(FILE *out, const Function *f) const {
+			fprintf(out, "\n%s %s(", irTypeName(f->returnType), f->name.c_str());
+			for (unsigned i = 0; i < f->params.size(); i++) {
+				fprintf(out, "%s%s", i == 0 ? "" : ", ", irTypeName(f->params[i]));
+			}
+			fprintf(out, ")%s {\n", f->pure ? " pure" : "");
+			for (unsigned b = 0; b < f->blocks.size(); b++) {
+				// Blocks that optimization has emptied out are left in place so that block numbers stay put.
+				if (b != 0 && f->blocks[b].code.empty() && f->blocks[b].preds.empty()) {
+					continue;
+				}
+				fprintf(out, "b%u:", b);
+				if (!f->blocks[b].preds.empty()) {
+					fprintf(out, "\t\t\t\t; preds");
+					for (unsigned p : f->blocks[b].preds) {
+						fprintf(out, " b%u", p);
+					}
+				}
+				fprintf(out, "\n");
+				for (ValueId v : f->blocks[b].code) {
+					const Instruction &i = f->values[v];
+					fprintf(out, "\t");
+					if (i.type != IR_VOID) {
+						fprintf(out, "v%u = ", v);
+					}
+					fprintf(out, "%s", opcodeName(i.op));
+					if (i.type != IR_VOID) {
+						fprintf(out, ".%s", irTypeName(i.type));
+					}
+					for (unsigned j = 0; j < i.count; j++) {
+						fprintf(out, "%s v%u", j == 0 ? "" : ",", i.operands[j]);
+						if (i.op == OP_PHI) {
+							fprintf(out, " [b%u]", i.incoming[j]);
+						}
+					}
+					switch (i.op) {
+						case (OP_CONST) : {
+							if (irFloat(i.type)) {
+								double d;
+								memcpy(&d, &i.imm, sizeof(d));
+								fprintf(out, " %g", d);
+							}
+							else {
+								fprintf(out, " %lld", i.imm);
+							}
+							break;
+						}
+						case (OP_PARAM) :
+						case (OP_STACK) :
+						case (OP_COPY) : {
+							fprintf(out, " %lld", i.imm);
+							break;
+						}
+						case (OP_SYMBOL) : {
+							fprintf(out, " @%s", symbols[i.imm].name.c_str());
+							break;
+						}
+						case (OP_JUMP) : {
+							fprintf(out, " b%u", i.targets[0]);
+							break;
+						}
+						case (OP_BRANCH) : {
+							fprintf(out, ", b%u, b%u", i.targets[0], i.targets[1]);
+							break;
+						}
+						default : {}
+					}
+					fprintf(out, "\n");
+				}
+			}
+			fprintf(out, "}\n");
+		}
+
+	private:
+
+		std::map<std::string, unsigned> symbolIndex;
+		std::map<std::string, unsigned> literals;		// The string literals linked in, by their contents.
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef JIT
+#define JIT
+
+#include "includes.h"
+
+
+// Loads the code and data of a module into this process and runs them, doing the linker's job in memory.
+// Routines from outside the module are looked up among what the compiler itself links against, such as the C
+// library, and are reached through stubs and a global offset table, since they may be too far away for the
+// 32 bit displacements the code uses.
+class Jit {
+
+	public:
+
+		Jit(const IRModule *m, const X86CodeGenerator *g) : module(m), generator(g), image(nullptr), imageSize(0) {}
+
+		~Jit() {
+			if (image != nullptr) {
+				munmap(image, imageSize);
+			}
+		}
+
+		// Returns false, having said why, if the module can't be loaded.
+		bool load() {
+			TraceScope trace("load");
+			const std::vector<unsigned char> &text = generator->code.code;
+
+			// The image is the code, a stub and global offset table entry for each external symbol, then the data
+			// on pages of its own so that it can stay writable once the code is made executable.
+			std::vector<unsigned> gotEntry(module->symbols.size(), ~0u);
+			unsigned externals = 0;
+			for (unsigned s = 0; s < module->symbols.size(); s++) {
+				if (module->symbols[s].kind == EXTERNAL_SYMBOL) {
+					gotEntry[s] = externals++;
+				}
+			}
+			unsigned stubs = align(text.size(), 16);
+			unsigned got = align(stubs + STUB_SIZE * externals, 8);
+			unsigned long long page = sysconf(_SC_PAGESIZE);
+			unsigned long long data = align(got + 8 * externals, page);
+			std::vector<unsigned> dataOffset;
+			unsigned long long end = data;
+			for (const DataObject *d : module->data) {
+				end = align(end, d->align == 0 ? 1 : d->align);
+				dataOffset.push_back(end - data);
+				end += d->bytes.size();
+			}
+			imageSize = align(end, page) + (end == data ? page : 0);
+			void *mapping = mmap(nullptr, imageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mapping == MAP_FAILED) {
+				printf("Error: could not map memory for the program.\n");
+				return false;
+			}
+			image = (unsigned char*) mapping;
+			memcpy(image, text.data(), text.size());
+			for (unsigned d = 0; d < module->data.size(); d++) {
+				memcpy(image + data + dataOffset[d], module->data[d]->bytes.data(), module->data[d]->bytes.size());
+			}
+
+			std::vector<unsigned long long> address(module->symbols.size(), 0);
+			for (unsigned s = 0; s < module->symbols.size(); s++) {
+				const Symbol &symbol = module->symbols[s];
+				switch (symbol.kind) {
+					case (ROUTINE_SYMBOL) : {
+						address[s] = (unsigned long long) image + generator->functionExtents[symbol.index].first;
+						break;
+					}
+					case (DATA_SYMBOL) : {
+						address[s] = (unsigned long long) image + data + dataOffset[symbol.index];
+						break;
+					}
+					default : {
+						void *found = dlsym(RTLD_DEFAULT, symbol.name.c_str());
+						if (found == nullptr) {
+							printf("Error: undefined symbol %s.\n", symbol.name.c_str());
+							return false;
+						}
+						address[s] = (unsigned long long) found;
+
+						// jmp *entry(%rip)
+						unsigned char *stub = image + stubs + STUB_SIZE * gotEntry[s];
+						unsigned long long entry = got + 8 * gotEntry[s];
+						stub[0] = 0xff;
+						stub[1] = 0x25;
+						put32(stub + 2, entry - (stubs + STUB_SIZE * gotEntry[s] + 6));
+						stub[6] = stub[7] = 0xcc;
+						memcpy(image + entry, &address[s], 8);
+					}
+				}
+			}
+
+			for (const CodeRelocation &r : generator->code.relocations) {
+				unsigned long long field = (unsigned long long) image + r.offset;
+				unsigned long long target = address[r.symbol];
+				if (r.kind == RELOC_GOTPCREL || (r.kind == RELOC_PLT32 && gotEntry[r.symbol] != ~0u)) {
+					if (gotEntry[r.symbol] == ~0u) {
+						printf("Error: %s has no global offset table entry.\n", module->symbols[r.symbol].name.c_str());
+						return false;
+					}
+					unsigned long long at = r.kind == RELOC_GOTPCREL ? got + 8 * gotEntry[r.symbol] : stubs + STUB_SIZE * gotEntry[r.symbol];
+					target = (unsigned long long) image + at;
+				}
+				if (r.kind == RELOC_ABS64) {
+					unsigned long long value = target + r.addend;
+					memcpy(image + r.offset, &value, 8);
+				}
+				else {
+					put32(image + r.offset, target + r.addend - field);
+				}
+			}
+			for (unsigned d = 0; d < module->data.size(); d++) {
+				for (const Relocation &r : module->data[d]->relocations) {
+					unsigned long long value = address[r.symbol] + r.addend;
+					memcpy(image + data + dataOffset[d] + r.offset, &value, 8);
+				}
+			}
+
+			if (mprotect(image, data, PROT_READ | PROT_EXEC) != 0) {
+				printf("Error: could not make the program's code executable.\n");
+				return false;
+			}
+			entries = address;
+			return true;
+		}
+
+		// Runs main with the given arguments, as the C runtime would, and returns what it returns. main is the entry
+		// point that addEntryPoint gives a main which takes a [][]uchar, or takes no arguments itself, and a main
+		// without a result counts as returning 0.
+		bool run(const std::vector<std::string> &args, int &result) {
+			TraceScope trace("run");
+			const Function *main = module->functionFor(module->findSymbol("main"));
+			if (main == nullptr || main->blocks.empty()) {
+				printf("Error: the program has no main routine.\n");
+				return false;
+			}
+			bool takesArgs = main->params.size() == 2 && main->params[0] == IR_I32 && main->params[1] == IR_PTR;
+			if (!main->params.empty() && !takesArgs) {
+				printf("Error: main must take no arguments or a [][]uchar.\n");
+				return false;
+			}
+
+			std::vector<char*> argv;
+			for (const std::string &a : args) {
+				argv.push_back((char*) a.c_str());
+			}
+			argv.push_back(nullptr);
+			unsigned long long entry = entries[main->symbol];
+			signal(SIGILL, trapped);
+			long long ret = 0;
+			if (takesArgs) {
+				ret = ((int (*)(int, char**)) entry)(args.size(), argv.data());
+			}
+			else {
+				ret = ((long long (*)()) entry)();
+			}
+			fflush(stdout);
+			signal(SIGILL, SIG_DFL);
+			result = main->returnType == IR_VOID ? 0 : (int) ret;
+			return true;
+		}
+
+	private:
+
+		static const unsigned STUB_SIZE = 8;
+
+		const IRModule *module;
+		const X86CodeGenerator *generator;
+		unsigned char *image;
+		unsigned long long imageSize;
+		std::vector<unsigned long long> entries;		// The address of each module symbol once loaded.
+
+		// A failed bounds check runs ud2. What the program printed so far is kept, and the compiler exits with
+		// the status a shell gives a program killed by SIGILL.
+		static void trapped(int) {
+			printf("Error: the program indexed outside an array.\n");
+			fflush(stdout);
+			_exit(128 + SIGILL);
+		}
+
+		static unsigned long long align(unsigned long long n, unsigned long long to) {
+			return (n + to - 1) / to * to;
+		}
+
+		static void put32(unsigned char *at, unsigned long long v) {
+			unsigned bits = (unsigned) v;
+			memcpy(at, &bits, 4);
+		}
+};
+
+#endif
@@ -5,6 +5,23 @@
 
 #define TAB_WIDTH 4
 
+// Add a message to diagnostics, formatted as printf would print it. The compiler's passes report what they find
+// this way rather than printing it, so that whoever runs them decides where it goes.
+__attribute__((format(printf, 2, 3))) void diagnose(std::string &diagnostics, const char *format, ...) {
+	va_list args, copy;
+	va_start(args, format);
+	va_copy(copy, args);
+	int n = vsnprintf(nullptr, 0, format, args);
+	if (n > 0) {
+		size_t at = diagnostics.size();
+		diagnostics.resize(at + n + 1);
+		vsnprintf(&diagnostics[at], n + 1, format, copy);
+		diagnostics.resize(at + n);
+	}
+	va_end(copy);
+	va_end(args);
+}
+
 //#define DEBUG
 
 // Every type of token in the language
@@ -155,7 +172,7 @@ enum State {
 
 
 // Class to represent tokens.
-class Token {
+class Token : public AllocatedFrom<tokenMemory> {
 
 	public:
 
@@ -186,16 +203,16 @@ class Token {
 					case (BLOCK_COMMENT) :
 					case (OPEN_COMMENT) :
 					case (ERROR) :
-						delete (std::string*) data;
+						tokenMemory.destroy((std::string*) data);
 						break;
 					case (CHARACTER_LITERAL) :
-						delete (char*) data;
+						tokenMemory.destroy((unsigned*) data);
 						break;
 					case (INTEGER) :
-						delete (unsigned long long*) data;
+						tokenMemory.destroy((unsigned long long*) data);
 						break;
 					case (FLOAT) :
-						delete (double*) data;
+						tokenMemory.destroy((double*) data);
 						break;
 					default : {}
 				}
@@ -217,16 +234,35 @@ class Lexer {
 
 		unsigned colnum;	// The number of characters on the current line that have been lexed.
 
+		std::string &diagnostics;	// Where warnings are reported.
+
 		// Constructor.
-		Lexer(std::string *file) {
+		// A file named - is read from standard input, so that generated programs can be piped in.
+		Lexer(std::string *file, std::string &d) : diagnostics(d) {
 			filename = *file;
-			f = fopen(filename.c_str(), "r");
+			{
+				TraceScope trace("open file", filename.c_str());
+				f = filename == "-" ? stdin : fopen(filename.c_str(), "r");
+				if (tracer != nullptr && f != nullptr && fseek(f, 0, SEEK_END) == 0) {
+					trace.bytes = ftell(f);
+					rewind(f);
+				}
+			}
 			linenum = 0;
 			colnum = 0;
-			getNextToken();
 			if (f == nullptr) {
-				printf("Error: could not open %s\n", filename.c_str());
+				std::string *message = tokenMemory.make<std::string>("Error: could not open " + filename + "\n");
+				nextToken = new Token(ERROR, 0, 0, 0, 0, &filename, (void*)message);
 			}
+			else {
+				getNextToken();
+			}
+		}
+
+		// Lex a stream that is already open, such as a buffer opened with fmemopen(), under the given name.
+		// The lexer closes it.
+		Lexer(FILE *in, const std::string &name, std::string &d) : filename(name), linenum(0), colnum(0), diagnostics(d), f(in) {
+			getNextToken();
 		}
 
 		// Destructor.
@@ -240,6 +276,8 @@ class Lexer {
 
 		// Function to lex the next token.
 		Token* getNextToken() {
+			TraceScope trace("getNextToken");
+			long from = tracer != nullptr && f != nullptr ? ftell(f) : 0;
 
 			Token *ret = nextToken;
 
@@ -249,6 +287,7 @@ class Lexer {
 			unsigned long long intVal = 0;
 			unsigned charVal = 0;
 			double floatVal = 0.0;
+			double scale = 1.0;		// The place value of the last digit after the point in a float literal.
 
 			unsigned startLine = linenum;
 			unsigned startCol = colnum;
@@ -259,7 +298,7 @@ class Lexer {
 			while (state != done) {
 
 				bool repented = false;
-				char in = getc(f);
+				int in = getc(f);
 	
 
 				switch(state) {
@@ -376,7 +415,7 @@ class Lexer {
 								break;
 							}
 							case ('\"') : {
-								stringVal = new std::string();
+								stringVal = tokenMemory.make<std::string>();
 								state = stringLiteral;
 								break;
 							}
@@ -410,7 +449,7 @@ class Lexer {
 
 								// Any character that's not used for anything else can be in an identifier.
 								else {
-									stringVal = new std::string(1, in);
+									stringVal = tokenMemory.make<std::string>(1, in);
 									state = inId;
 								}
 								break;
@@ -457,7 +496,7 @@ class Lexer {
 							nextToken = new Token(GREATER_EQUAL, startLine, startCol, linenum, colnum, &filename);
 							state = done;
 						}
-						else if (in == '<') {
+						else if (in == '>') {
 							state = rightShift;
 						}
 						else {
@@ -537,11 +576,11 @@ class Lexer {
 					// /
 					case (haveSlash) : {
 						if (in == '/') {
-							stringVal = new std::string();
+							stringVal = tokenMemory.make<std::string>();
 							state = singleLineComment;
 						}
 						else if (in == '*') {
-							stringVal = new std::string();
+							stringVal = tokenMemory.make<std::string>();
 							state = blockComment;
 						}
 						else if (in == '=') {
@@ -628,12 +667,12 @@ class Lexer {
 							state = escapeCharLit;
 						}
 						else if (in == EOF) {
-							stringVal = new std::string("Lex Error: unterminated character literal in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: unterminated character literal in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if (in == '\'') {
-							stringVal = new std::string("Lex Error: empty character literal in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: empty character literal in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
@@ -671,7 +710,7 @@ class Lexer {
 						switch (in) {
 							case ('.') : {
 								state = inDecimalRight;
-								intVal = 1;
+								scale = 1.0;
 								ready = false;
 								break;
 							}
@@ -705,7 +744,7 @@ class Lexer {
 									state = startingExponent;
 								}
 								else {
-									unsigned long long *val = new unsigned long long(0);
+									unsigned long long *val = tokenMemory.make<unsigned long long>(0);
 									ungetc(in, f);
 									nextToken = new Token(INTEGER, startLine, startCol, linenum, colnum, &filename, (void*)val);
 									repented = true;
@@ -720,13 +759,13 @@ class Lexer {
 					// In what, so far, appears to be a decimal integer literal.
 					case (inDecimalLeft) : {
 						if (!(ready || isdigit(in))) {
-							stringVal = new std::string("Lex Error: Numeric literal missing integral part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing integral part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if (in == '.') {
 							floatVal = (double) intVal;
-							intVal = 1;
+							scale = 1.0;
 							ready = false;
 							state = inDecimalRight;
 						}
@@ -741,7 +780,7 @@ class Lexer {
 							ready = true;
 						}
 						else {
-							unsigned long long *val = new unsigned long long(intVal);
+							unsigned long long *val = tokenMemory.make<unsigned long long>(intVal);
 							nextToken = new Token(INTEGER, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -759,136 +798,136 @@ class Lexer {
 							in == '/' || in == '%' || in == '|' || in == '^' || in == '&' || in == '\'' || in == '\"' || in == EOF || isspace(in)) {
 
 							if (*stringVal == "CAST") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(CAST, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "return") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(RETURN, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "if") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(IF, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "else") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(ELSE, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "while") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(WHILE, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "for") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(FOR, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "foreach") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(FOREACH, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "in") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(IN, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "index") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(INDEX, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "switch") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(SWITCH, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "case") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(CASE, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "continue") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(CONT, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "break") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(BREAK, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "struct") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(STRUCT, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "class") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(CLASS, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "union") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(UNION, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "interface") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(INTERFACE, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "impl") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(IMPL, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "func") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(FUNC, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "proc") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(PROC, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "var") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(VAR, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "export") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(EXPORT, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "module") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(MODULE, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "import") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(IMPORT, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "from") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(FROM, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "globally") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(GLOBALLY, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "as") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(AS, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "namespace") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(NAMESPACE, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "alias") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(ALIAS, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "enum") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(ENUM, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "const") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(CONST, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "static") {
-								delete stringVal;
+								tokenMemory.destroy(stringVal);
 								nextToken = new Token(STATIC, startLine, startCol, linenum, colnum, &filename);
 							}
 							else if (*stringVal == "instance") {
-								delete stringVal;
-								nextToken = new Token(INSTANCE, startline, startCol, linenum, colnum, &filename);
+								tokenMemory.destroy(stringVal);
+								nextToken = new Token(INSTANCE, startLine, startCol, linenum, colnum, &filename);
 							}
 							else {
 								nextToken = new Token(IDENTIFIER, startLine, startCol, linenum, colnum, &filename, (void*)stringVal);
@@ -955,7 +994,7 @@ class Lexer {
 							state = leavingComment;
 						}
 						else if (in == EOF) {
-							printf("Warning: unterminated comment in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
+							diagnose(diagnostics, "Warning: unterminated comment in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
 							nextToken = new Token(OPEN_COMMENT, startLine, startCol, linenum, colnum, &filename, (void*)stringVal);
 							state = done;
 						}
@@ -985,7 +1024,7 @@ class Lexer {
 							state = escapeCharHex;
 						}
 						else if (in == EOF) {
-							stringVal = new std::string("Lex Error: unterminated character literal in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: unterminated character literal in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
@@ -999,12 +1038,12 @@ class Lexer {
 					// Wrapping up a character literal and need a closing '
 					case (haveCharLit) : {
 						if (in == '\'') {
-							unsigned *val = new unsigned(charVal);
+							unsigned *val = tokenMemory.make<unsigned>(charVal);
 							nextToken = new Token(CHARACTER_LITERAL, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							state = done;
 						}
 						else {
-							stringVal = new std::string("Lex Error: unterminated character literal in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: unterminated character literal in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
@@ -1056,21 +1095,21 @@ class Lexer {
 					// After the decimal point in a decimal floating point number
 					case (inDecimalRight) : {
 						if (!(ready || isdigit(in))) {
-							stringVal = new std::string("Lex Error: Numeric literal missing fractional part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing fractional part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if (isdigit(in)) {
 							ready = true;
-							floatVal += (double(in - '0')) / intVal;
-							intVal *= 10;
+							scale /= 10;
+							floatVal += (in - '0') * scale;
 						}
 						else if (in == 'e' || in == 'E') {
 							intVal = 0;
 							state = startingExponent;
 						}
 						else {
-							double *val = new double(floatVal);
+							double *val = tokenMemory.make<double>(floatVal);
 							nextToken = new Token(FLOAT, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1082,13 +1121,13 @@ class Lexer {
 					// In what, so far,  appears to be a binary integer
 					case (inBinaryLeft) : {
 						if (!(ready || in == '0' || in == '1')) {
-							stringVal = new std::string("Lex Error: Numeric literal missing integral part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing integral part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if (in == '.') {
 							floatVal = (double) intVal;
-							intVal = 1;
+							scale = 1.0;
 							ready = false;
 							state = inBinaryRight;
 						}
@@ -1098,7 +1137,7 @@ class Lexer {
 							intVal += (in - '0');
 						}
 						else {
-							unsigned long long *val = new unsigned long long(intVal);
+							unsigned long long *val = tokenMemory.make<unsigned long long>(intVal);
 							nextToken = new Token(INTEGER, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1110,14 +1149,14 @@ class Lexer {
 					// In what, so far, appears to be an octal integer
 					case (inOctalLeft) : {
 						if (!ready && (in < '0' || in > '7')) {
-							stringVal = new std::string("Lex Error: Numeric literal missing integral part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing integral part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if (in == '.') {
 							floatVal = (double) intVal;
 							ready = false;
-							intVal = 1;
+							scale = 1.0;
 							state = inOctalRight;
 						}
 						else if ('0' <= in && in  < '8') {
@@ -1126,7 +1165,7 @@ class Lexer {
 							intVal += (in - '0');
 						}
 						else {
-							unsigned long long *val = new unsigned long long(intVal);
+							unsigned long long *val = tokenMemory.make<unsigned long long>(intVal);
 							nextToken = new Token(INTEGER, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1138,14 +1177,14 @@ class Lexer {
 					// In what, so far, appears to be a hexadecimal integer
 					case (inHexLeft) : {
 						if (!(ready || isxdigit(in))) {
-							stringVal = new std::string("Lex Error: Numeric literal missing integral part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing integral part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
-						if (in == '.') {
+						else if (in == '.') {
 							floatVal = (double) intVal;
 							ready = false;
-							intVal = 1;
+							scale = 1.0;
 							state = inHexRight;
 						}
 						else if (isdigit(in)) {
@@ -1164,7 +1203,7 @@ class Lexer {
 							ready = true;
 						}
 						else {
-							unsigned long long *val = new unsigned long long(intVal);
+							unsigned long long *val = tokenMemory.make<unsigned long long>(intVal);
 							nextToken = new Token(INTEGER, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1192,7 +1231,7 @@ class Lexer {
 							intVal = in - '0';
 						}
 						else {
-							stringVal = new std::string("Lex Error: Numeric literal missing exponent in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing exponent in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
@@ -1202,7 +1241,7 @@ class Lexer {
 					// In the exponent of a float literal that uses scientific notation
 					case (inExponent) : {
 						if (!(ready || isdigit(in))) {
-							stringVal = new std::string("Lex Error: Numeric literal missing exponent in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing exponent in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
@@ -1212,10 +1251,8 @@ class Lexer {
 							intVal += (in - '0');
 						}
 						else {
-							if (negative) {
-								intVal = -intVal;
-							}
-							double *val = new double(pow(floatVal, (double)intVal));
+							double exponent = negative ? -(double)intVal : (double)intVal;
+							double *val = tokenMemory.make<double>(floatVal * pow(10.0, exponent));
 							nextToken = new Token(FLOAT, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1232,7 +1269,7 @@ class Lexer {
 							state = done;
 						}
 						else if (in == EOF) {
-							printf("Warning: unterminated comment in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
+							diagnose(diagnostics, "Warning: unterminated comment in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
 							nextToken = new Token(OPEN_COMMENT, startLine, startCol, linenum, colnum, &filename, (void*)stringVal);
 							state = done;
 						}
@@ -1250,7 +1287,7 @@ class Lexer {
 							intVal--;
 						}
 						else {
-							printf("Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
+							diagnose(diagnostics, "Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
 							intVal = 0;
 							ungetc(in, f);
 							repented = true;
@@ -1279,7 +1316,7 @@ class Lexer {
 							intVal--;
 						}
 						else {
-							printf("Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
+							diagnose(diagnostics, "Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
 							intVal = 0;
 							ungetc(in, f);
 							repented = true;
@@ -1298,13 +1335,13 @@ class Lexer {
 							intVal--;
 						}
 						else {
-							printf("Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
+							diagnose(diagnostics, "Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
 							intVal = 0;
 							ungetc(in, f);
 							repented = true;
 						}
 						if (intVal == 0) {
-							stringVal += (char)charVal;
+							*stringVal += (char)charVal;
 							state = stringLiteral;
 						}
 						break;
@@ -1328,19 +1365,19 @@ class Lexer {
 							intVal--;
 						}
 						else {
-							printf("Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
+							diagnose(diagnostics, "Warning: Non-standard escape character in %s: (%u:%u).\n", filename.c_str(), linenum, colnum);
 							intVal = 0;
 							ungetc(in, f);
 							repented = true;
 						}
 						if (intVal == 0) {
 							if (charVal > 0xff) {
-								stringVal += (char)((charVal & 0xff000000) >> 24);
-								stringVal += (char)((charVal & 0x00ff0000) >> 16);
-								stringVal += (char)((charVal & 0x0000ff00) >> 8);
+								*stringVal += (char)((charVal & 0xff000000) >> 24);
+								*stringVal += (char)((charVal & 0x00ff0000) >> 16);
+								*stringVal += (char)((charVal & 0x0000ff00) >> 8);
 							}
-							stringVal += (char)charVal;
-							state = haveCharLit;
+							*stringVal += (char)charVal;
+							state = stringLiteral;
 						}
 						break;
 					}
@@ -1348,17 +1385,17 @@ class Lexer {
 					// After the binary point in a binary float literal
 					case (inBinaryRight) : {
 						if (!(ready || in == '0' || in == '1')) {
-							stringVal = new std::string("Lex Error: Numeric literal missing fractional part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing fractional part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if (in == '0' || in == '1') {
 							ready = true;
-							floatVal += ((double)(in - '0')) / intVal;
-							intVal <<= 1;
+							scale /= 2;
+							floatVal += (in - '0') * scale;
 						}
 						else {
-							double *val = new double(floatVal);
+							double *val = tokenMemory.make<double>(floatVal);
 							nextToken = new Token(FLOAT, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1370,17 +1407,17 @@ class Lexer {
 					// After the octal point in an octal float literal
 					case (inOctalRight) : {
 						if (!ready && (in < '0' || in > '7')) {
-							stringVal = new std::string("Lex Error: Numeric literal missing fractional part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing fractional part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if ('0' <= in && in < '8') {
 							ready = true;
-							floatVal += ((double)(in - '0')) / intVal;
-							intVal <<= 3;
+							scale /= 8;
+							floatVal += (in - '0') * scale;
 						}
 						else {
-							double *val = new double(floatVal);
+							double *val = tokenMemory.make<double>(floatVal);
 							nextToken = new Token(FLOAT, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1392,27 +1429,27 @@ class Lexer {
 					// After the hexadecimal point in a hexadecimal float literal
 					case (inHexRight) : {
 						if (!(ready || isxdigit(in))) {
-							stringVal = new std::string("Lex Error: Numeric literal missing fractional part in ");
+							stringVal = tokenMemory.make<std::string>("Lex Error: Numeric literal missing fractional part in ");
 							makeError(stringVal, startLine, startCol);
 							state = done;
 						}
 						else if (isdigit(in)) {
 							ready = true;
-							floatVal += ((double)(in - '0')) / intVal;
-							intVal <<= 4;
+							scale /= 16;
+							floatVal += (in - '0') * scale;
 						}
 						else if ('a' <= in && in < 'g') {
 							ready = true;
-							floatVal += ((double)(in - 'a' + 0xa)) / intVal;
-							intVal <<= 4;
+							scale /= 16;
+							floatVal += (in - 'a' + 0xa) * scale;
 						}
 						else if ('A' <= in && in < 'G') {
 							ready = true;
-							floatVal += ((double)(in - 'A' + 0xA)) / intVal;
-							intVal <<= 4;
+							scale /= 16;
+							floatVal += (in - 'A' + 0xA) * scale;
 						}
 						else {
-							double *val = new double(floatVal);
+							double *val = tokenMemory.make<double>(floatVal);
 							nextToken = new Token(FLOAT, startLine, startCol, linenum, colnum, &filename, (void*)val);
 							ungetc(in, f);
 							repented = true;
@@ -1436,6 +1473,9 @@ class Lexer {
 					}
 				}
 			}
+			if (tracer != nullptr && f != nullptr) {
+				trace.bytes = ftell(f) - from;
+			}
 			return ret;
 		}
 
@@ -1486,351 +1526,288 @@ class Lexer {
 };
 
 
-void printToken(Token *t) {
-	switch(t->type) {
+// How a token that is always spelled the same way is written, or nullptr for tokens such as names and literals
+// that carry a value.
+const char* tokenSpelling(TokenType type) {
+	switch (type) {
 		case (LEFT_PAREN) : {
-			printf("(");
-			break;
+			return "(";
 		}
 		case (RIGHT_PAREN) : {
-			printf(")");
-			break;
+			return ")";
 		}
 		case (LEFT_BRACKET) : {
-			printf("[");
-			break;
+			return "[";
 		}
 		case (RIGHT_BRACKET) : {
-			printf("]");
-			break;
+			return "]";
 		}
 		case (LEFT_BRACE) : {
-			printf("{");
-			break;
+			return "{";
 		}
 		case (RIGHT_BRACE) : {
-			printf("}");
-			break;
+			return "}";
 		}
 		case (DOT) : {
-			printf(".");
-			break;
+			return ".";
 		}
 		case (COLON) : {
-			printf(":");
-			break;
+			return ":";
 		}
 		case (SEMI_COLON) : {
-			printf(";");
-			break;
+			return ";";
 		}
 		case (COMMA) : {
-			printf(",");
-			break;
+			return ",";
 		}
 		case (ASSIGNMENT) : {
-			printf("=");
-			break;
+			return "=";
 		}
 		case (LESS_THAN) : {
-			printf("<");
-			break;
+			return "<";
 		}
 		case (GREATER_THAN) : {
-			printf(">");
-			break;
+			return ">";
 		}
 		case (LOGICAL_NOT) : {
-			printf("!");
-			break;
+			return "!";
 		}
 		case (ADDITION) : {
-			printf("+");
-			break;
+			return "+";
 		}
 		case (SUBTRACT) : {
-			printf("-");
-			break;
+			return "-";
 		}
 		case (ASTERISK) : {
-			printf("*");
-			break;
+			return "*";
 		}
 		case (SLASH) : {
-			printf("/");
-			break;
+			return "/";
 		}
 		case (MODULO) : {
-			printf("%%");
-			break;
+			return "%";
 		}
 		case (BITWISE_NOT) : {
-			printf("~");
-			break;
+			return "~";
 		}
 		case (BITWISE_OR) : {
-			printf("|");
-			break;
+			return "|";
 		}
 		case (BITWISE_XOR) : {
-			printf("^");
-			break;
+			return "^";
 		}
 		case (AMPERSAND) : {
-			printf("&");
-			break;
+			return "&";
 		}
 		case (ARROW) : {
-			printf("->");
-			break;
+			return "->";
 		}
 		case (ADD_ASSIGN) : {
-			printf("+=");
-			break;
+			return "+=";
 		}
 		case (SUBTRACT_ASSIGN) : {
-			printf("-=");
-			break;
+			return "-=";
 		}
 		case (MULTIPLY_ASSIGN) : {
-			printf("*=");
-			break;
+			return "*=";
 		}
 		case (DIV_ASSIGN) : {
-			printf("/=");
-			break;
+			return "/=";
 		}
 		case (MOD_ASSIGN) : {
-			printf("%%=");
-			break;
+			return "%=";
 		}
 		case (OR_ASSIGN) : {
-			printf("|=");
-			break;
+			return "|=";
 		}
 		case (XOR_ASSIGN) : {
-			printf("^=");
-			break;
+			return "^=";
 		}
 		case (AND_ASSIGN) : {
-			printf("&=");
-			break;
+			return "&=";
 		}
 		case (INCREMENT) : {
-			printf("++");
-			break;
+			return "++";
 		}
 		case (DECREMENT) : {
-			printf("--");
-			break;
+			return "--";
 		}
 		case (LOGICAL_OR) : {
-			printf("||");
-			break;
+			return "||";
 		}
 		case (LOGICAL_XOR) : {
-			printf("^^");
-			break;
+			return "^^";
 		}
 		case (LOGICAL_AND) : {
-			printf("&&");
-			break;
+			return "&&";
 		}
 		case (LEFT_SHIFT) : {
-			printf("<<");
-			break;
+			return "<<";
 		}
 		case (RIGHT_SHIFT) : {
-			printf(">>");
-			break;
+			return ">>";
 		}
 		case (COMPARE) : {
-			printf("==");
-			break;
+			return "==";
 		}
 		case (NOT_EQUAL) : {
-			printf("!=");
-			break;
+			return "!=";
 		}
 		case (LESS_EQUAL) : {
-			printf("<=");
-			break;
+			return "<=";
 		}
 		case (GREATER_EQUAL) : {
-			printf(">=");
-			break;
+			return ">=";
 		}
 		case (LEFT_SHIFT_ASSIGN) : {
-			printf("<<=");
-			break;
+			return "<<=";
 		}
 		case (RIGHT_SHIFT_ASSIGN) : {
-			printf(">>=");
-			break;
+			return ">>=";
 		}
 		case (CAST) : {
-			printf("CAST");
-			break;
+			return "CAST";
 		}
 		case (RETURN) : {
-			printf("return");
-			break;
+			return "return";
 		}
 		case (IF) : {
-			printf("if");
-			break;
+			return "if";
 		}
 		case (ELSE) : {
-			printf("else");
-			break;
+			return "else";
 		}
 		case (WHILE) : {
-			printf("while");
-			break;
+			return "while";
 		}
 		case (FOR) : {
-			printf("for");
-			break;
+			return "for";
 		}
 		case (FOREACH) : {
-			printf("foreach");
-			break;
+			return "foreach";
 		}
 		case (IN) : {
-			printf("in");
-			break;
+			return "in";
 		}
 		case (INDEX) : {
-			printf("index");
-			break;
+			return "index";
 		}
 		case (SWITCH) : {
-			printf("switch");
-			break;
+			return "switch";
 		}
 		case (CASE) : {
-			printf("case");
-			break;
+			return "case";
 		}
 		case (CONT) : {
-			printf("continue");
-			break;
+			return "continue";
 		}
 		case (BREAK) : {
-			printf("break");
-			break;
+			return "break";
 		}
 		case (STRUCT) : {
-			printf("struct");
-			break;
+			return "struct";
 		}
 		case (CLASS) : {
-			printf("class");
-			break;
+			return "class";
 		}
 		case (UNION) : {
-			printf("union");
-			break;
+			return "union";
 		}
 		case (INTERFACE) : {
-			printf("interface");
-			break;
+			return "interface";
 		}
 		case (IMPL) : {
-			printf("impl");
-			break;
+			return "impl";
 		}
 		case (PROC) : {
-			printf("proc");
-			break;
+			return "proc";
 		}
 		case (FUNC) : {
-			printf("func");
-			break;
+			return "func";
 		}
 		case (VAR) : {
-			printf("var");
-			break;
+			return "var";
 		}
 		case (EXPORT) : {
-			printf("export");
-			break;
+			return "export";
 		}
 		case (MODULE) : {
-			printf("module");
-			break;
+			return "module";
 		}
 		case (IMPORT) : {
-			printf("import");
-			break;
+			return "import";
 		}
 		case (FROM) : {
-			printf("from");
-			break;
+			return "from";
 		}
 		case (GLOBALLY) : {
-			printf("globally");
-			break;
+			return "globally";
 		}
 		case (AS) : {
-			printf("as");
-			break;
+			return "as";
 		}
 		case (ALIAS) : {
-			printf("alias");
-			break;
+			return "alias";
 		}
 		case (ENUM) : {
-			printf("enum");
-			break;
+			return "enum";
 		}
 		case (CONST) : {
-			printf("const");
-			break;
+			return "const";
 		}
 		case (STATIC) : {
-			printf("static");
-			break;
+			return "static";
 		}
 		case (END_OF_FILE) : {
-			printf("EOF");
-			break;
+			return "EOF";
 		}
 		case (NAMESPACE) : {
-			printf("namespace");
-			break;
+			return "namespace";
 		}
 		case (INSTANCE) : {
-			printf("instance");
-			break;
+			return "instance";
 		}
+		default : {
+			return nullptr;
+		}
+	}
+}
+
+// Add how a token was written to text.
+void printToken(Token *t, std::string &text) {
+	const char *spelling = tokenSpelling(t->type);
+	if (spelling != nullptr) {
+		text += spelling;
+		return;
+	}
+	switch(t->type) {
 		case (STRING_LITERAL) : {
-			std::cout << '\"' << *(std::string*)(t->data) << '\"';
+			text += '\"' + *(std::string*)(t->data) + '\"';
 			break;
 		}
 		case (BLOCK_COMMENT) : {
-			std::cout << "/*" << *(std::string*)(t->data) << "*/";
+			text += "/*" + *(std::string*)(t->data) + "*/";
 			break;
 		}
 		case (OPEN_COMMENT) : {
-			std::cout << "/*" << *(std::string*)(t->data);
+			text += "/*" + *(std::string*)(t->data);
 			break;
 		}
 		case (LINE_COMMENT) : {
-			printf("//");
+			text += "//";
 		}
 		case (IDENTIFIER) :
 		case (ERROR) :
-			std::cout << *(std::string*)(t->data);
+			text += *(std::string*)(t->data);
 			break;
 		case (CHARACTER_LITERAL) :
-			printf("\'%c\'", *(char*)(t->data));
+			diagnose(text, "\'%c\'", *(char*)(t->data));
 			break;
 		case (INTEGER) :
-			printf("%llu", *(unsigned long long*)(t->data));
+			diagnose(text, "%llu", *(unsigned long long*)(t->data));
 			break;
 		case (FLOAT) :
-			printf("%lf", *(double*)(t->data));
+			diagnose(text, "%lf", *(double*)(t->data));
 			break;
 		default : {}
 	}
@@ -0,0 +1,2995 @@
+#ifndef LOWER
+#define LOWER
+
+#include "includes.h"
+
+
+// How values of a type are represented in IR.
+enum Representation {
+	NO_REPRESENTATION,		// void
+	SCALAR,					// A single IR value.
+	PAIR,					// Two words: a pointer and a length for arrays without a fixed length, or a pointer and a witness table for interface values.
+	AGGREGATE				// Lives in memory and is handled by its address: classes and arrays with a fixed length.
+};
+
+
+// The result of lowering an expression.
+struct Operand {
+	ValueId value;			// A scalar, the first word of a pair, or the address of an aggregate.
+	ValueId second;			// The second word of a pair. For a pointer into an array, how many elements are left, if known.
+	const TypeName *type;
+};
+
+
+// Somewhere a value can be stored.
+struct Place {
+	bool ssa;				// Held in SSA variables rather than in memory.
+	unsigned var;			// The first SSA variable; the second word of a pair is in var + 1.
+	ValueId address;
+	const TypeName *type;
+};
+
+
+// The names a program declares at global scope, which lowering looks up, collected once for all the units of the
+// program.
+class ProgramScope {
+
+	public:
+
+		std::map<std::string, std::vector<const Routine*>> routines;
+		std::map<std::string, const VariableDeclaration*> globalDecls;
+		std::vector<const VariableDeclaration*> globalOrder;
+		std::set<std::string> importAliases;
+		std::map<const Routine*, std::string> instanceClass;		// The class each instance routine belongs to.
+		std::map<const Routine*, std::string> instanceInterface;
+		std::vector<const Routine*> instanceRoutines;				// In the order they are declared.
+
+		ProgramScope(const Program *p) {
+			collect(p);
+		}
+
+		// The name a routine's function has in the module. Overloads are told apart by their position.
+		std::string symbolName(const Routine *r) const {
+			auto i = instanceClass.find(r);
+			if (i != instanceClass.end()) {
+				return i->second + "." + instanceInterface.at(r) + "." + r->name;
+			}
+			const std::vector<const Routine*> &overloads = routines.at(r->name);
+			for (unsigned j = 1; j < overloads.size(); j++) {
+				if (overloads[j] == r) {
+					return r->name + "." + std::to_string(j);
+				}
+			}
+			return r->name;
+		}
+
+		// The routines that are lowered as units of their own, with their symbols: every routine with a body that
+		// isn't generic, those of instances last.
+		std::vector<std::pair<std::string, const Routine*>> units() const {
+			std::vector<std::pair<std::string, const Routine*>> ret;
+			for (auto &r : routines) {
+				for (const Routine *routine : r.second) {
+					if (routine->hasBody && !Monomorphizer::isGeneric(routine)) {
+						ret.push_back(std::make_pair(symbolName(routine), routine));
+					}
+				}
+			}
+			for (const Routine *routine : instanceRoutines) {
+				if (routine->hasBody && !Monomorphizer::isGeneric(routine)) {
+					ret.push_back(std::make_pair(symbolName(routine), routine));
+				}
+			}
+			return ret;
+		}
+
+	private:
+
+		void collect(const Program *p) {
+			for (const Routine *r : p->routines) {
+				routines[r->name].push_back(r);
+			}
+			for (const VariableDeclaration *v : p->varDecls) {
+				globalDecls[v->name] = v;
+				globalOrder.push_back(v);
+			}
+			for (const Import *i : p->imports) {
+				importAliases.insert(i->alias);
+			}
+			for (const TypeDeclaration *t : p->typeDecls) {
+				if (t->kind == INSTANCE_DECL) {
+					for (const Routine *r : t->routines) {
+						instanceClass[r] = t->name;
+						instanceInterface[r] = t->interfaceName;
+						instanceRoutines.push_back(r);
+					}
+				}
+			}
+			for (const Namespace *n : p->namespaces) {
+				if (n->contents != nullptr) {
+					collect(n->contents);
+				}
+			}
+		}
+};
+
+
+// What lowering one unit of a program makes: a module, which refers to what other units define by their symbols,
+// and for the globals' unit, the functions that work out the initial values of globals once the units are linked.
+struct LoweredUnit {
+	IRModule *module;
+	std::vector<std::pair<const VariableDeclaration*, Function*>> initializers;		// Not part of the module.
+	bool ok;
+
+	LoweredUnit() : module(new IRModule()), ok(false) {}
+	LoweredUnit(const LoweredUnit&) = delete;
+	LoweredUnit& operator=(const LoweredUnit&) = delete;
+
+	~LoweredUnit() {
+		delete module;
+		for (auto &i : initializers) {
+			delete i.second;
+		}
+	}
+};
+
+
+// Lowers the routines of a program into SSA form.
+// Scalar locals whose address is never taken become SSA values directly as the body is lowered, using the
+// algorithm of Braun et al., "Simple and Efficient Construction of Static Single Assignment Form".
+// Everything else lives in stack slots.
+//
+// A program is lowered a unit at a time, so that a unit can be kept while others change: each routine is a unit,
+// with the closures it makes and the instantiations of generic routines it calls, and the globals are one more,
+// with the witness tables and the interface defaults they point to. Anything a unit uses from another is referred
+// to by its symbol, and the units are linked into one module afterwards.
+class Lowerer {
+
+	public:
+
+		// Lower the unit of the given routine, or if it is nullptr, the globals' unit. Errors are added to diagnostics.
+		Lowerer(const Program *p, const ProgramScope *s, const InterfaceTables *i, Monomorphizer *m, IRModule *out, const Routine *u, std::string &d) : program(p), scope(s), interfaces(i), generics(m), module(out), unit(u), diagnostics(d), failed(false), fn(nullptr), block(0), current(nullptr), callSite(nullptr), global(nullptr) {
+			voidType = named("void");
+			boolType = named("bool");
+			intType = named("int");
+			longType = named("long");
+			ulongType = named("ulong");
+			ucharType = named("uchar");
+			doubleType = named("double");
+			stringType = arrayOf(ucharType, -1);
+		}
+
+		~Lowerer() {
+			for (TypeName *t : pool) {
+				delete t;
+			}
+			for (Routine *r : madeRoutines) {
+				delete r;
+			}
+			for (const Initializer &i : initializers) {
+				delete i.fn;
+			}
+			for (Function *f : declarations) {
+				delete f;
+			}
+		}
+
+		// Lower the unit into the module. Returns false if there were errors, all of which are reported.
+		bool lower() {
+			if (unit != nullptr) {
+				functionFor(unit);
+			}
+			else {
+				for (const VariableDeclaration *v : scope->globalOrder) {
+					if (scope->globalDecls.at(v->name) == v) {
+						lowerGlobal(v);
+					}
+				}
+				for (Initializer &i : initializers) {
+					lowerInitializer(i);
+				}
+				for (const WitnessTable &t : interfaces->tables) {
+					DataObject *d = module->addData(t.symbol(), 8, true);
+					d->bytes.assign(8 * t.slots.size(), 0);
+					for (unsigned s = 0; s < t.slots.size(); s++) {
+						Function *f = witnessFunction(t, s);
+						if (f != nullptr) {
+							Relocation r;
+							r.offset = 8 * s;
+							r.symbol = f->symbol;
+							r.addend = 0;
+							d->relocations.push_back(r);
+						}
+					}
+				}
+			}
+			while (!pending.empty()) {
+				Pending p = pending.front();
+				pending.pop_front();
+				lowerFunction(p);
+			}
+			return !failed;
+		}
+
+		// Hand over the functions that work out the initial values of globals, in the order the globals are declared.
+		void takeInitializers(std::vector<std::pair<const VariableDeclaration*, Function*>> &out) {
+			for (Initializer &i : initializers) {
+				out.push_back(std::make_pair(i.decl, i.fn));
+				i.fn = nullptr;
+			}
+		}
+
+	private:
+
+		// A local of an enclosing routine that a closure uses, copied into its environment at offset.
+		struct Capture {
+			std::string name;
+			const TypeName *type;
+			unsigned offset;
+		};
+
+		// A routine waiting to be lowered into a function that has already been created.
+		struct Pending {
+			const Routine *signature;						// Gives the parameter and return types.
+			const Routine *body;							// Gives the body; differs from the signature for instantiations.
+			Function *fn;
+			std::map<std::string, const TypeName*> bindings;	// Type parameters and impl.
+			const TypeName *expected;						// For lambdas, the routine type they are used as.
+			std::vector<Capture> captures;					// For closures, the locals copied into the environment.
+		};
+
+		struct Local {
+			Place place;
+			bool captured;				// A closure's copy of a local of the routine that made it.
+		};
+
+		// A global whose initial value is worked out by running its initializer at compile time.
+		struct Initializer {
+			const VariableDeclaration *decl;
+			DataObject *data;
+			Function *fn;					// Stores the value into the global; not part of the module.
+		};
+
+		const Program *program;
+		const ProgramScope *scope;
+		const InterfaceTables *interfaces;
+		Monomorphizer *generics;
+		IRModule *module;
+		const Routine *unit;					// The routine being lowered, or nullptr for the globals.
+		std::string &diagnostics;
+		bool failed;
+		std::map<std::string, unsigned> anonymous;	// How many closures each function has made so far.
+
+		std::vector<TypeName*> pool;			// Types made up during lowering.
+		std::vector<Routine*> madeRoutines;		// Signatures made up for the routines that curried routines return.
+		std::deque<Pending> pending;
+
+		std::vector<Initializer> initializers;
+		std::map<std::string, unsigned> globals;
+
+		std::map<const Routine*, Function*> functions;
+		std::vector<Function*> declarations;		// Functions of other units that this one calls; not part of the module.
+		std::map<std::pair<unsigned, unsigned>, Function*> witnessFunctions;
+		std::map<std::pair<const Instantiation*, std::string>, Function*> instantiations;
+		std::map<std::string, unsigned> strings;
+		std::map<const Function*, unsigned> descriptors;
+
+		const TypeName *voidType;
+		const TypeName *boolType;
+		const TypeName *intType;
+		const TypeName *longType;
+		const TypeName *ulongType;
+		const TypeName *ucharType;
+		const TypeName *doubleType;
+		const TypeName *stringType;
+
+		// The state of the function being lowered.
+		Function *fn;
+		unsigned block;
+		const Pending *current;
+		const Expression *callSite;				// The call being lowered, for errors.
+		const VariableDeclaration *global;		// The global whose initializer is being lowered, if any.
+		std::map<std::string, const TypeName*> bindings;
+		std::vector<std::map<std::string, Local>> scopes;
+		std::set<std::string> addressTaken;
+		const TypeName *returnType;
+		ValueId sret;
+		unsigned trap;						// The block failed bounds checks go to, once there is one.
+		std::vector<unsigned> breakTargets;
+		std::vector<unsigned> continueTargets;
+
+		// SSA construction state.
+		std::vector<IRType> varTypes;
+		std::vector<std::map<unsigned, ValueId>> defs;
+		std::vector<std::map<unsigned, ValueId>> incomplete;
+		std::vector<bool> sealed;
+		std::vector<ValueId> replacement;			// What each trivial phi that was removed became.
+		std::map<ValueId, std::vector<ValueId>> phiUsers;	// The phis that each phi is an operand of.
+
+
+		/* Declarations */
+
+		// Globals are statically allocated. Literal initializers are written straight into the global's data;
+		// anything else is run at compile time once the program's units have been linked.
+		void lowerGlobal(const VariableDeclaration *v) {
+			const TypeName *type = resolve(v->type);
+			unsigned size = typeSize(type, program);
+			DataObject *d = module->addData(v->name, typeAlign(type, program), v->isConst);
+			d->bytes.assign(size == 0 ? 1 : size, 0);
+			globals[v->name] = d->symbol;
+			const Expression *init = v->initializer;
+			if (init == nullptr) {
+				return;
+			}
+			if (representation(type) == SCALAR && (init->kind == INTEGER_EXPR || init->kind == CHARACTER_EXPR || init->kind == FLOAT_EXPR)) {
+				long long bits = init->intValue;
+				if (isFloat(type)) {
+					double value = init->kind == FLOAT_EXPR ? init->floatValue : (double) init->intValue;
+					if (irType(type) == IR_F32) {
+						float f = (float) value;
+						memcpy(&bits, &f, sizeof(f));
+					}
+					else {
+						memcpy(&bits, &value, sizeof(value));
+					}
+				}
+				else if (init->kind == FLOAT_EXPR) {
+					bits = (long long) init->floatValue;
+				}
+				memcpy(d->bytes.data(), &bits, size);
+			}
+			else {
+				Initializer i;
+				i.decl = v;
+				i.data = d;
+				i.fn = nullptr;
+				initializers.push_back(i);
+			}
+		}
+
+		// Lower a global's initializer into a function of its own that stores the value into the global.
+		void lowerInitializer(Initializer &i) {
+			i.fn = new Function();
+			i.fn->name = i.decl->name + ".init";
+			i.fn->pure = true;
+			Pending p;
+			p.signature = nullptr;
+			p.body = nullptr;
+			p.fn = i.fn;
+			p.expected = nullptr;
+			begin(p);
+			global = i.decl;
+			returnType = voidType;
+			findAddressTaken(i.decl->initializer);
+			block = newBlock();
+			seal(block);
+			const TypeName *type = resolve(i.decl->type);
+			Operand value = convert(lowerExpr(i.decl->initializer, type), type, i.decl->initializer);
+			store(memoryPlace(emit(OP_SYMBOL, IR_PTR, {}, i.data->symbol), type), value);
+			emit(OP_RETURN, IR_VOID);
+			finish();
+			global = nullptr;
+		}
+
+		// The symbol of the global with the given name, or ~0u if there isn't one. The globals' own unit has made
+		// them all by the time it needs them; other units refer to them.
+		unsigned globalSymbol(const std::string &name) {
+			auto g = globals.find(name);
+			if (g != globals.end()) {
+				return g->second;
+			}
+			if (scope->globalDecls.count(name) == 0) {
+				return ~0u;
+			}
+			unsigned ret = module->symbol(name);
+			globals[name] = ret;
+			return ret;
+		}
+
+		// A function that another unit defines, which this one only refers to by its symbol.
+		Function* declare(const std::string &name, bool pure) {
+			Function *f = new Function();
+			f->name = name;
+			f->pure = pure;
+			f->symbol = module->symbol(name);
+			declarations.push_back(f);
+			return f;
+		}
+
+		// The function for a routine that isn't generic, queueing it to be lowered if it is this unit's routine and
+		// hasn't been yet.
+		Function* functionFor(const Routine *r) {
+			auto i = functions.find(r);
+			if (i != functions.end()) {
+				return i->second;
+			}
+			if (r != unit) {
+				Function *f = declare(scope->symbolName(r), r->pure);
+				functions[r] = f;
+				return f;
+			}
+			Function *f = module->addFunction(scope->symbolName(r));
+			f->pure = r->pure;
+			functions[r] = f;
+			Pending p;
+			p.signature = r;
+			p.body = r;
+			p.fn = f;
+			p.expected = nullptr;
+			auto c = scope->instanceClass.find(r);
+			if (c != scope->instanceClass.end()) {
+				p.bindings["impl"] = named(c->second);
+			}
+			pending.push_back(p);
+			return f;
+		}
+
+		// The function in a witness table slot, or nullptr if the routine there is generic and can't be called dynamically.
+		Function* witnessFunction(const WitnessTable &t, unsigned slot) {
+			std::pair<unsigned, unsigned> key(t.id, slot);
+			auto i = witnessFunctions.find(key);
+			if (i != witnessFunctions.end()) {
+				return i->second;
+			}
+			const Routine *r = t.slots[slot];
+			Function *f = nullptr;
+			if (!Monomorphizer::isGeneric(r)) {
+				if (scope->instanceClass.count(r) != 0) {
+					f = functionFor(r);
+				}
+				else if (unit != nullptr) {
+					f = declare(t.className + "." + t.interfaceName + "." + r->name, r->pure);
+				}
+				else {
+					// A default from the interface, specialized for this class.
+					f = module->addFunction(t.className + "." + t.interfaceName + "." + r->name);
+					f->pure = r->pure;
+					Pending p;
+					p.signature = r;
+					p.body = r;
+					p.fn = f;
+					p.expected = nullptr;
+					p.bindings["impl"] = named(t.className);
+					pending.push_back(p);
+				}
+			}
+			witnessFunctions[key] = f;
+			return f;
+		}
+
+		// The function for an instantiation of a generic routine.
+		// implementor is the class an interface routine is being specialized for, or empty.
+		Function* instantiationFor(const Instantiation *inst, const std::string &implementor) {
+			std::pair<const Instantiation*, std::string> key(inst, implementor);
+			auto i = instantiations.find(key);
+			if (i != instantiations.end()) {
+				return i->second;
+			}
+			std::string name = inst->routine->name;
+			if (!implementor.empty()) {
+				name = implementor + "." + instanceInterfaceOf(inst->generic) + "." + name;
+			}
+			else {
+				// Instantiations of overloads are told apart as the overloads themselves are.
+				name = scope->symbolName(inst->generic) + name.substr(inst->generic->name.size());
+			}
+			Function *f = module->addFunction(name);
+			f->pure = inst->generic->pure;
+			instantiations[key] = f;
+			Pending p;
+			p.signature = inst->routine;
+			p.body = inst->generic;
+			p.fn = f;
+			p.expected = nullptr;
+			for (unsigned j = 0; j < inst->typeParams.size(); j++) {
+				p.bindings[inst->typeParams[j]] = inst->typeArgs[j];
+			}
+			if (!implementor.empty()) {
+				p.bindings["impl"] = named(implementor);
+			}
+			pending.push_back(p);
+			return f;
+		}
+
+		std::string instanceInterfaceOf(const Routine *r) {
+			auto i = scope->instanceInterface.find(r);
+			if (i != scope->instanceInterface.end()) {
+				return i->second;
+			}
+			for (const TypeDeclaration *t : program->typeDecls) {
+				if (t->kind == INTERFACE_DECL) {
+					for (const Routine *m : t->routines) {
+						if (m == r) {
+							return t->name;
+						}
+					}
+				}
+			}
+			return "";
+		}
+
+
+		/* Types */
+
+		TypeName* keep(TypeName *t) {
+			pool.push_back(t);
+			return t;
+		}
+
+		const TypeName* named(const std::string &name) {
+			return keep(new TypeName(NAMED_TYPE, name));
+		}
+
+		const TypeName* arrayOf(const TypeName *element, long long length) {
+			TypeName *t = keep(new TypeName(ARRAY_TYPE));
+			t->element = element->clone();
+			t->length = length;
+			return t;
+		}
+
+		const TypeName* pointerTo(const TypeName *element) {
+			TypeName *t = keep(new TypeName(POINTER_TYPE));
+			t->element = element->clone();
+			return t;
+		}
+
+		// The type of a routine's value.
+		const TypeName* routineType(const Routine *r) {
+			TypeName *t = keep(new TypeName(ROUTINE_TYPE));
+			t->pure = r->pure;
+			for (const Parameter *p : r->params) {
+				Parameter *copy = new Parameter(resolve(p->type)->clone());
+				copy->name = p->name;
+				t->params.push_back(copy);
+			}
+			t->returnType = resolve(r->returnType)->clone();
+			return t;
+		}
+
+		// Whether a type refers to something that resolve() would replace.
+		bool mentionsBinding(const TypeName *t) {
+			if (t == nullptr) {
+				return false;
+			}
+			if (t->kind == IMPL_TYPE) {
+				return true;
+			}
+			if (t->kind == NAMED_TYPE) {
+				if (bindings.count(t->name) != 0) {
+					return true;
+				}
+				const TypeDeclaration *d = primitiveSize(t->name) == 0 ? findTypeDeclaration(program, t->name) : nullptr;
+				return d != nullptr && d->kind == ALIAS_DECL;
+			}
+			if (mentionsBinding(t->element) || mentionsBinding(t->returnType)) {
+				return true;
+			}
+			for (const Parameter *p : t->params) {
+				if (mentionsBinding(p->type)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Replace type parameters, impl and aliases in a type with what they stand for.
+		const TypeName* resolve(const TypeName *t) {
+			if (t == nullptr) {
+				return voidType;
+			}
+			if (!mentionsBinding(t)) {
+				return t;
+			}
+			TypeName *ret = t->clone();
+			substitute(ret);
+			return keep(ret);
+		}
+
+		void substitute(TypeName *&t) {
+			if (t == nullptr) {
+				return;
+			}
+			if (t->kind == IMPL_TYPE || t->kind == NAMED_TYPE) {
+				std::string name = t->kind == IMPL_TYPE ? "impl" : t->name;
+				auto b = bindings.find(name);
+				if (b != bindings.end()) {
+					delete t;
+					t = b->second->clone();
+					return;
+				}
+				const TypeDeclaration *d = t->kind == NAMED_TYPE && primitiveSize(t->name) == 0 ? findTypeDeclaration(program, t->name) : nullptr;
+				if (d != nullptr && d->kind == ALIAS_DECL) {
+					delete t;
+					t = d->aliased->clone();
+					substitute(t);
+				}
+				return;
+			}
+			substitute(t->element);
+			substitute(t->returnType);
+			for (Parameter *p : t->params) {
+				substitute(p->type);
+			}
+		}
+
+		Representation representation(const TypeName *t) {
+			switch (t->kind) {
+				case (NAMED_TYPE) : {
+					if (t->name == "void") {
+						return NO_REPRESENTATION;
+					}
+					if (primitiveSize(t->name) != 0) {
+						return SCALAR;
+					}
+					const TypeDeclaration *d = findTypeDeclaration(program, t->name);
+					if (d == nullptr || d->kind == ENUM_DECL) {
+						return SCALAR;
+					}
+					return d->kind == INTERFACE_DECL ? PAIR : AGGREGATE;
+				}
+				case (ARRAY_TYPE) : {
+					return t->length < 0 ? PAIR : AGGREGATE;
+				}
+				case (POINTER_TYPE) :
+				case (ROUTINE_TYPE) : {
+					return SCALAR;
+				}
+				default : {
+					return NO_REPRESENTATION;
+				}
+			}
+		}
+
+		IRType irType(const TypeName *t) {
+			if (t->kind == POINTER_TYPE || t->kind == ROUTINE_TYPE) {
+				return IR_PTR;
+			}
+			if (t->kind != NAMED_TYPE) {
+				return IR_I64;
+			}
+			if (t->name == "void") {
+				return IR_VOID;
+			}
+			if (t->name == "float") {
+				return IR_F32;
+			}
+			if (t->name == "double") {
+				return IR_F64;
+			}
+			switch (primitiveSize(t->name)) {
+				case (1) : {
+					return IR_I8;
+				}
+				case (2) : {
+					return IR_I16;
+				}
+				case (8) : {
+					return IR_I64;
+				}
+				default : {
+					return IR_I32;
+				}
+			}
+		}
+
+		bool isFloat(const TypeName *t) {
+			return t->kind == NAMED_TYPE && isFloatingPoint(t->name);
+		}
+
+		bool isUnsignedType(const TypeName *t) {
+			return t->kind == POINTER_TYPE || (t->kind == NAMED_TYPE && isUnsigned(t->name));
+		}
+
+		bool isNumeric(const TypeName *t) {
+			if (t->kind != NAMED_TYPE || t->name == "void") {
+				return false;
+			}
+			if (primitiveSize(t->name) != 0) {
+				return true;
+			}
+			const TypeDeclaration *d = findTypeDeclaration(program, t->name);
+			return d != nullptr && d->kind == ENUM_DECL;
+		}
+
+		bool sameType(const TypeName *a, const TypeName *b) {
+			return a->spelling() == b->spelling();
+		}
+
+		bool isInterfaceType(const TypeName *t) {
+			return t->kind == NAMED_TYPE && interfaces->isInterface(t->name);
+		}
+
+		// The type two numeric operands are converted to before an arithmetic operation.
+		const TypeName* commonType(const TypeName *a, const TypeName *b) {
+			if (isFloat(a) || isFloat(b)) {
+				return (a->kind == NAMED_TYPE && a->name == "double") || (b->kind == NAMED_TYPE && b->name == "double") || !isFloat(a) || !isFloat(b) ? doubleType : a;
+			}
+			unsigned sa = typeSize(a, program);
+			unsigned sb = typeSize(b, program);
+			if (sa < 4 && sb < 4) {
+				return intType;
+			}
+			if (sa != sb) {
+				return sa > sb ? a : b;
+			}
+			return isUnsignedType(b) ? b : a;
+		}
+
+		// The type of the elements of an array, or of what a pointer points to.
+		const TypeName* elementOf(const TypeName *t) {
+			return t->element == nullptr ? intType : resolve(t->element);
+		}
+
+
+		/* SSA construction */
+
+		unsigned newBlock() {
+			unsigned b = fn->addBlock();
+			defs.emplace_back();
+			incomplete.emplace_back();
+			sealed.push_back(false);
+			return b;
+		}
+
+		unsigned newVar(IRType type) {
+			varTypes.push_back(type);
+			return varTypes.size() - 1;
+		}
+
+		void writeVariable(unsigned var, unsigned b, ValueId value) {
+			defs[b][var] = value;
+		}
+
+		ValueId readVariable(unsigned var, unsigned b) {
+			auto i = defs[b].find(var);
+			if (i != defs[b].end()) {
+				return Function::resolve(replacement, i->second);
+			}
+			ValueId ret;
+			const std::vector<unsigned> &preds = fn->blocks[b].preds;
+			if (!sealed[b]) {
+				ret = fn->emitPhi(b, varTypes[var]);
+				incomplete[b][var] = ret;
+			}
+			else if (preds.size() == 1) {
+				ret = readVariable(var, preds[0]);
+			}
+			else if (preds.empty()) {
+				// Read before being written, so any value will do.
+				ret = fn->create(OP_CONST, varTypes[var], nullptr, 0, 0);
+				fn->values[ret].block = b;
+				std::vector<ValueId> &code = fn->blocks[b].code;
+				unsigned j = 0;
+				while (j < code.size() && fn->values[code[j]].op == OP_PHI) {
+					j++;
+				}
+				code.insert(code.begin() + j, ret);
+			}
+			else {
+				ret = fn->emitPhi(b, varTypes[var]);
+				writeVariable(var, b, ret);
+				ret = addPhiOperands(var, ret);
+			}
+			writeVariable(var, b, ret);
+			return ret;
+		}
+
+		// Give a phi an operand from each predecessor of its block, and return what it is once any that turns out
+		// to be trivial has been removed.
+		ValueId addPhiOperands(unsigned var, ValueId phi) {
+			unsigned b = fn->values[phi].block;
+			std::vector<unsigned> preds = fn->blocks[b].preds;
+			for (unsigned p : preds) {
+				ValueId value = readVariable(var, p);
+				fn->addIncoming(phi, value, p);
+				if (fn->values[value].op == OP_PHI) {
+					phiUsers[value].push_back(phi);
+				}
+			}
+			return removeTrivialPhi(phi);
+		}
+
+		// Declare that no more predecessors will be added to a block.
+		void seal(unsigned b) {
+			std::map<unsigned, ValueId> phis;
+			phis.swap(incomplete[b]);
+			sealed[b] = true;
+			for (auto &p : phis) {
+				addPhiOperands(p.first, p.second);
+			}
+		}
+
+		// Remove a phi whose operands are all the same value or the phi itself, and then the phis that used it if
+		// that makes them trivial too. Returns the value that stands for the phi. Uses of a removed phi are only
+		// rewritten once the function is finished; until then, reads of variables go through the replacements.
+		ValueId removeTrivialPhi(ValueId phi) {
+			const Instruction &i = fn->values[phi];
+			ValueId same = NO_VALUE;
+			for (unsigned j = 0; j < i.count; j++) {
+				ValueId op = Function::resolve(replacement, i.operands[j]);
+				if (op == phi || op == same) {
+					continue;
+				}
+				if (same != NO_VALUE) {
+					return phi;
+				}
+				same = op;
+			}
+			unsigned b = i.block;
+			IRType type = i.type;
+			fn->remove(phi);
+			if (same == NO_VALUE) {
+				same = fn->create(OP_CONST, type, nullptr, 0, 0);
+				fn->values[same].block = b;
+				fn->blocks[b].code.insert(fn->blocks[b].code.begin(), same);
+			}
+			if (replacement.size() <= phi) {
+				replacement.resize(fn->values.size(), NO_VALUE);
+			}
+			replacement[phi] = same;
+
+			std::vector<ValueId> users;
+			auto u = phiUsers.find(phi);
+			if (u != phiUsers.end()) {
+				users.swap(u->second);
+				phiUsers.erase(u);
+			}
+			if (fn->values[same].op == OP_PHI) {
+				std::vector<ValueId> &inherited = phiUsers[same];
+				inherited.insert(inherited.end(), users.begin(), users.end());
+			}
+			// A phi that is still being given its operands is looked at again once it has them all.
+			for (ValueId user : users) {
+				const Instruction &u = fn->values[user];
+				if (user != phi && u.op == OP_PHI && u.count == fn->blocks[u.block].preds.size()) {
+					removeTrivialPhi(user);
+				}
+			}
+			return Function::resolve(replacement, same);
+		}
+
+		/* Emitting */
+
+		ValueId emit(Opcode op, IRType type, std::initializer_list<ValueId> operands = {}, long long imm = 0) {
+			return fn->emit(block, op, type, operands, imm);
+		}
+
+		ValueId constant(IRType type, long long value) {
+			return emit(OP_CONST, type, {}, value);
+		}
+
+		ValueId constantFloat(IRType type, double value) {
+			long long bits = 0;
+			memcpy(&bits, &value, sizeof(value));
+			return emit(OP_CONST, type, {}, bits);
+		}
+
+		ValueId offsetAddress(ValueId base, long long offset) {
+			if (offset == 0) {
+				return base;
+			}
+			return emit(OP_ADD, IR_PTR, {base, constant(IR_I64, offset)});
+		}
+
+		bool terminated() {
+			return fn->terminator(block) != NO_VALUE;
+		}
+
+		// Whether nothing can reach the current block, as after a return. Dead blocks get no outgoing edges,
+		// so they add nothing to the phis of the code after them.
+		bool dead() {
+			return block != 0 && sealed[block] && fn->blocks[block].preds.empty();
+		}
+
+		void jumpTo(unsigned target) {
+			if (!terminated() && !dead()) {
+				fn->jump(block, target);
+			}
+		}
+
+		void branchTo(ValueId condition, unsigned ifTrue, unsigned ifFalse) {
+			if (!dead()) {
+				fn->branch(block, condition, ifTrue, ifFalse);
+			}
+		}
+
+		// Carry on in a block that nothing jumps to, after a return, break or continue.
+		void startUnreachable() {
+			block = newBlock();
+			seal(block);
+		}
+
+		ValueId stackSlot(const TypeName *type) {
+			unsigned size = typeSize(type, program);
+			unsigned slot = fn->addSlot(size == 0 ? 1 : size, typeAlign(type, program));
+			return emit(OP_STACK, IR_PTR, {}, slot);
+		}
+
+		Operand operand(ValueId value, const TypeName *type, ValueId second = NO_VALUE) {
+			Operand ret;
+			ret.value = value;
+			ret.second = second;
+			ret.type = type;
+			return ret;
+		}
+
+		// A placeholder result for an expression that couldn't be lowered.
+		Operand invalid() {
+			return operand(constant(IR_I32, 0), intType);
+		}
+
+		Place memoryPlace(ValueId address, const TypeName *type) {
+			Place p;
+			p.ssa = false;
+			p.var = 0;
+			p.address = address;
+			p.type = type;
+			return p;
+		}
+
+		Operand load(const Place &p) {
+			switch (representation(p.type)) {
+				case (SCALAR) : {
+					if (p.ssa) {
+						return operand(readVariable(p.var, block), p.type);
+					}
+					return operand(emit(OP_LOAD, irType(p.type), {p.address}), p.type);
+				}
+				case (PAIR) : {
+					if (p.ssa) {
+						return operand(readVariable(p.var, block), p.type, readVariable(p.var + 1, block));
+					}
+					ValueId first = emit(OP_LOAD, IR_PTR, {p.address});
+					ValueId second = emit(OP_LOAD, isInterfaceType(p.type) ? IR_PTR : IR_I64, {offsetAddress(p.address, 8)});
+					return operand(first, p.type, second);
+				}
+				case (AGGREGATE) : {
+					return operand(p.address, p.type);
+				}
+				default : {
+					return operand(NO_VALUE, voidType);
+				}
+			}
+		}
+
+		// Store a value that has already been converted to the place's type.
+		void store(const Place &p, const Operand &value) {
+			switch (representation(p.type)) {
+				case (SCALAR) : {
+					if (p.ssa) {
+						writeVariable(p.var, block, value.value);
+					}
+					else {
+						emit(OP_STORE, IR_VOID, {p.address, value.value});
+					}
+					break;
+				}
+				case (PAIR) : {
+					if (p.ssa) {
+						writeVariable(p.var, block, value.value);
+						writeVariable(p.var + 1, block, value.second);
+					}
+					else {
+						emit(OP_STORE, IR_VOID, {p.address, value.value});
+						emit(OP_STORE, IR_VOID, {offsetAddress(p.address, 8), value.second});
+					}
+					break;
+				}
+				case (AGGREGATE) : {
+					if (value.value != p.address) {
+						emit(OP_COPY, IR_VOID, {p.address, value.value}, typeSize(p.type, program));
+					}
+					break;
+				}
+				default : {}
+			}
+		}
+
+		// Make a local variable in the innermost scope.
+		Place declareLocal(const std::string &name, const TypeName *type) {
+			Place p;
+			p.type = type;
+			p.var = 0;
+			p.address = NO_VALUE;
+			Representation r = representation(type);
+			p.ssa = (r == SCALAR || r == PAIR) && addressTaken.count(name) == 0;
+			if (p.ssa) {
+				p.var = newVar(r == SCALAR ? irType(type) : IR_PTR);
+				if (r == PAIR) {
+					newVar(isInterfaceType(type) ? IR_PTR : IR_I64);
+				}
+			}
+			else {
+				p.address = stackSlot(type);
+			}
+			Local l;
+			l.place = p;
+			l.captured = false;
+			scopes.back()[name] = l;
+			return p;
+		}
+
+		Local* lookup(const std::string &name) {
+			for (unsigned i = scopes.size(); i > 0; i--) {
+				auto l = scopes[i - 1].find(name);
+				if (l != scopes[i - 1].end()) {
+					return &l->second;
+				}
+			}
+			return nullptr;
+		}
+
+		// Find the locals whose address is taken, which have to live in memory.
+		void findAddressTaken(const Statement *s) {
+			if (s == nullptr) {
+				return;
+			}
+			for (const Statement *b : s->body) {
+				findAddressTaken(b);
+			}
+			findAddressTaken(s->expr);
+			findAddressTaken(s->step);
+			findAddressTaken(s->init);
+			findAddressTaken(s->then);
+			findAddressTaken(s->otherwise);
+			if (s->decl != nullptr) {
+				findAddressTaken(s->decl->initializer);
+			}
+			for (const Expression *e : s->cases) {
+				findAddressTaken(e);
+			}
+		}
+
+		// Operator chains like a + b + c nest to the left as deep as they are long, so first operands are gone
+		// down in a loop.
+		void findAddressTaken(const Expression *e) {
+			for (; e != nullptr; e = e->operands.empty() ? nullptr : e->operands[0]) {
+				if (e->kind == UNARY_EXPR && e->op == AMPERSAND && e->operands[0]->kind == NAME_EXPR) {
+					addressTaken.insert(e->operands[0]->name);
+				}
+				for (unsigned j = 1; j < e->operands.size(); j++) {
+					findAddressTaken(e->operands[j]);
+				}
+			}
+		}
+
+		// Find the names a body refers to, including in the routines nested in it, which are what a closure
+		// may have to capture.
+		void findNames(const Statement *s, std::set<std::string> &names) {
+			if (s == nullptr) {
+				return;
+			}
+			for (const Statement *b : s->body) {
+				findNames(b, names);
+			}
+			findNames(s->expr, names);
+			findNames(s->step, names);
+			findNames(s->init, names);
+			findNames(s->then, names);
+			findNames(s->otherwise, names);
+			if (s->decl != nullptr) {
+				findNames(s->decl->initializer, names);
+				if (s->decl->type != nullptr) {
+					findNames(s->decl->type->lengthExpr, names);
+				}
+			}
+			for (const Expression *e : s->cases) {
+				findNames(e, names);
+			}
+		}
+
+		void findNames(const Expression *e, std::set<std::string> &names) {
+			for (; e != nullptr; e = e->operands.empty() ? nullptr : e->operands[0]) {
+				if (e->kind == NAME_EXPR) {
+					names.insert(e->name);
+				}
+				for (unsigned j = 1; j < e->operands.size(); j++) {
+					findNames(e->operands[j], names);
+				}
+				if (e->type != nullptr) {
+					findNames(e->type->lengthExpr, names);
+				}
+				if (e->routine != nullptr) {
+					findNames(e->routine->body, names);
+					findNames(e->routine->value, names);
+				}
+			}
+		}
+
+
+		/* Conversions */
+
+		ValueId convertScalar(ValueId v, const TypeName *from, const TypeName *to) {
+			IRType f = irType(from);
+			IRType t = irType(to);
+			if (f == t) {
+				return v;
+			}
+			ValueId ret = emit(OP_CONVERT, t, {v});
+			if (isUnsignedType(from)) {
+				fn->values[ret].flags |= CONVERT_UNSIGNED;
+			}
+			return ret;
+		}
+
+		// Convert a value to another type, reporting an error if that isn't allowed implicitly.
+		Operand convert(const Operand &v, const TypeName *to, const Expression *where, bool explicitCast = false) {
+			if (to->kind == INFERRED_TYPE || sameType(v.type, to)) {
+				return v;
+			}
+			Representation from = representation(v.type);
+			Representation target = representation(to);
+
+			if (from == SCALAR && target == SCALAR) {
+				bool numeric = isNumeric(v.type) && isNumeric(to);
+				bool pointers = (v.type->kind == POINTER_TYPE || v.type->kind == ROUTINE_TYPE) && (to->kind == POINTER_TYPE || to->kind == ROUTINE_TYPE);
+				if (numeric || pointers || explicitCast) {
+					return operand(convertScalar(v.value, v.type, to), to);
+				}
+			}
+
+			// Arrays can be viewed as arrays of a different length without copying, except that where each field of
+			// a struct of arrays starts depends on its length.
+			bool arrays = v.type->kind == ARRAY_TYPE && to->kind == ARRAY_TYPE;
+			if (arrays && (isStructOfArrays(v.type, program) || isStructOfArrays(to, program))) {
+				error(where, "cannot convert " + v.type->spelling() + " to " + to->spelling() + " since one is laid out as a struct of arrays");
+				return v;
+			}
+			if (arrays) {
+				if (explicitCast || sameType(elementOf(v.type), elementOf(to))) {
+					if (target == AGGREGATE) {
+						if (explicitCast || from == AGGREGATE) {
+							return operand(v.value, to);
+						}
+					}
+					else {
+						ValueId length = from == PAIR ? v.second : constant(IR_I64, v.type->length);
+						return operand(v.value, to, length);
+					}
+				}
+			}
+
+			// A class becomes an interface value by pairing its address with its witness table.
+			if (isInterfaceType(to) && v.type->kind == NAMED_TYPE) {
+				const WitnessTable *t = interfaces->table(v.type->name, to->name);
+				if (t != nullptr) {
+					ValueId table = emit(OP_SYMBOL, IR_PTR, {}, module->symbol(t->symbol()));
+					return operand(v.value, to, table);
+				}
+			}
+
+			error(where, "cannot convert " + v.type->spelling() + " to " + to->spelling());
+			return v;
+		}
+
+		// Lower an expression used as a condition into an i8 that is 0 or 1.
+		ValueId condition(const Expression *e) {
+			return condition(e, lowerExpr(e, boolType));
+		}
+
+		// The condition for e, which has been lowered to v.
+		ValueId condition(const Expression *e, Operand v) {
+			if (representation(v.type) != SCALAR) {
+				error(e, "a condition must be a number, a pointer or a bool");
+				return constant(IR_I8, 0);
+			}
+			if (v.type->kind == NAMED_TYPE && v.type->name == "bool") {
+				return v.value;
+			}
+			IRType t = irType(v.type);
+			ValueId zero = irFloat(t) ? constantFloat(t, 0.0) : constant(t, 0);
+			return emit(OP_NE, IR_I8, {v.value, zero});
+		}
+
+
+		/* Functions */
+
+		// Reset the state of the function being lowered.
+		void begin(const Pending &p) {
+			fn = p.fn;
+			current = &p;
+			bindings = p.bindings;
+			scopes.clear();
+			scopes.emplace_back();
+			addressTaken.clear();
+			breakTargets.clear();
+			continueTargets.clear();
+			varTypes.clear();
+			defs.clear();
+			incomplete.clear();
+			sealed.clear();
+			replacement.clear();
+			phiUsers.clear();
+			sret = NO_VALUE;
+			trap = ~0u;
+		}
+
+		void lowerFunction(const Pending &p) {
+			TraceScope trace("lowerFunction", p.fn->name.c_str());
+			begin(p);
+
+			const Routine *sig = p.signature;
+			const TypeName *expected = p.expected;
+			returnType = resolve(sig->returnType);
+			if (returnType->kind == INFERRED_TYPE) {
+				returnType = expected != nullptr ? resolve(expected->returnType) : voidType;
+			}
+			findAddressTaken(p.body->body);
+			findAddressTaken(p.body->value);
+
+			block = newBlock();
+			seal(block);
+
+			Representation r = representation(returnType);
+			fn->returnType = r == SCALAR ? irType(returnType) : IR_VOID;
+			if (r == PAIR || r == AGGREGATE) {
+				fn->params.push_back(IR_PTR);
+				sret = emit(OP_PARAM, IR_PTR, {}, 0);
+			}
+
+			for (unsigned i = 0; i < sig->params.size(); i++) {
+				const Parameter *param = sig->params[i];
+				const TypeName *type = resolve(param->type);
+				if (type->kind == INFERRED_TYPE) {
+					if (expected == nullptr || i >= expected->params.size()) {
+						error(sig, "the type of parameter " + param->name + " can't be inferred");
+						type = intType;
+					}
+					else {
+						type = resolve(expected->params[i]->type);
+					}
+				}
+				switch (representation(type)) {
+					case (SCALAR) : {
+						fn->params.push_back(irType(type));
+						ValueId v = emit(OP_PARAM, irType(type), {}, fn->params.size() - 1);
+						store(declareLocal(param->name, type), operand(v, type));
+						break;
+					}
+					case (PAIR) : {
+						fn->params.push_back(IR_PTR);
+						ValueId first = emit(OP_PARAM, IR_PTR, {}, fn->params.size() - 1);
+						IRType secondType = isInterfaceType(type) ? IR_PTR : IR_I64;
+						fn->params.push_back(secondType);
+						ValueId second = emit(OP_PARAM, secondType, {}, fn->params.size() - 1);
+						store(declareLocal(param->name, type), operand(first, type, second));
+						break;
+					}
+					case (AGGREGATE) : {
+						// The caller passes the address of a copy, which the callee can use as its own.
+						fn->params.push_back(IR_PTR);
+						ValueId address = emit(OP_PARAM, IR_PTR, {}, fn->params.size() - 1);
+						Local l;
+						l.place = memoryPlace(address, type);
+						l.captured = false;
+						scopes.back()[param->name] = l;
+						break;
+					}
+					default : {
+						error(sig, "parameter " + param->name + " can't have type " + type->spelling());
+					}
+				}
+			}
+
+			// A closure's environment comes last, so that routines that capture nothing can be called the same
+			// way and just ignore it.
+			if (!p.captures.empty()) {
+				fn->params.push_back(IR_PTR);
+				ValueId env = emit(OP_PARAM, IR_PTR, {}, fn->params.size() - 1);
+				for (const Capture &c : p.captures) {
+					Local l;
+					l.place = memoryPlace(offsetAddress(env, c.offset), c.type);
+					l.captured = true;
+					scopes.back()[c.name] = l;
+				}
+			}
+
+			// A curried routine has the body of the routine it returns.
+			if (curried(sig, p.body, returnType)) {
+				Routine *inner = new Routine();
+				madeRoutines.push_back(inner);
+				inner->name = sig->name;
+				inner->pure = returnType->pure;
+				for (const Parameter *param : returnType->params) {
+					Parameter *copy = new Parameter(param->type == nullptr ? nullptr : param->type->clone());
+					copy->name = param->name;
+					inner->params.push_back(copy);
+				}
+				inner->returnType = returnType->returnType == nullptr ? nullptr : returnType->returnType->clone();
+				emit(OP_RETURN, IR_VOID, {makeClosure(inner, p.body, returnType)});
+			}
+			else if (p.body->body != nullptr) {
+				lowerStatement(p.body->body);
+			}
+			else if (p.body->value != nullptr) {
+				emitReturn(p.body->value, p.body->value);
+			}
+
+			if (!terminated()) {
+				if (returnType->kind == NAMED_TYPE && returnType->name == "void") {
+					emit(OP_RETURN, IR_VOID);
+				}
+				else {
+					std::vector<unsigned> reachable = fn->reversePostorder();
+					if (std::find(reachable.begin(), reachable.end(), block) != reachable.end()) {
+						error(sig, symbolLabel() + " can reach its end without returning a value");
+					}
+				}
+			}
+
+			finish();
+		}
+
+		// Close off the function being lowered. Blocks that nothing reaches may have been left open.
+		void finish() {
+			for (unsigned b = 0; b < fn->blocks.size(); b++) {
+				if (fn->terminator(b) == NO_VALUE) {
+					block = b;
+					if (fn->returnType == IR_VOID) {
+						emit(OP_RETURN, IR_VOID);
+					}
+					else {
+						emit(OP_RETURN, IR_VOID, {irFloat(fn->returnType) ? constantFloat(fn->returnType, 0.0) : constant(fn->returnType, 0)});
+					}
+				}
+			}
+			fn->applyReplacements(replacement);
+			fn = nullptr;
+			current = nullptr;
+		}
+
+		std::string symbolLabel() {
+			return fn->name;
+		}
+
+		// Return the value of an expression, which may be nullptr in a routine that returns nothing.
+		void emitReturn(const Expression *value, const void *where) {
+			Representation r = representation(returnType);
+			if (value == nullptr) {
+				if (r != NO_REPRESENTATION) {
+					errorAt(where, "return without a value in " + symbolLabel());
+				}
+				emit(OP_RETURN, IR_VOID);
+				return;
+			}
+			Operand v = lowerExpr(value, returnType);
+			if (r == NO_REPRESENTATION) {
+				emit(OP_RETURN, IR_VOID);
+				return;
+			}
+			v = convert(v, returnType, value);
+			if (r == SCALAR) {
+				emit(OP_RETURN, IR_VOID, {v.value});
+			}
+			else {
+				store(memoryPlace(sret, returnType), v);
+				emit(OP_RETURN, IR_VOID);
+			}
+		}
+
+
+		/* Statements */
+
+		void lowerStatement(const Statement *s) {
+			switch (s->kind) {
+				case (BLOCK_STMT) : {
+					scopes.emplace_back();
+					for (const Statement *b : s->body) {
+						lowerStatement(b);
+					}
+					scopes.pop_back();
+					break;
+				}
+				case (EXPRESSION_STMT) : {
+					lowerExpr(s->expr);
+					break;
+				}
+				case (DECLARATION_STMT) : {
+					lowerDeclaration(s->decl);
+					break;
+				}
+				case (IF_STMT) : {
+					ValueId c = condition(s->expr);
+					unsigned thenBlock = newBlock();
+					unsigned elseBlock = s->otherwise != nullptr ? newBlock() : 0;
+					unsigned merge = newBlock();
+					branchTo(c, thenBlock, s->otherwise != nullptr ? elseBlock : merge);
+					seal(thenBlock);
+					block = thenBlock;
+					lowerScoped(s->then);
+					jumpTo(merge);
+					if (s->otherwise != nullptr) {
+						seal(elseBlock);
+						block = elseBlock;
+						lowerScoped(s->otherwise);
+						jumpTo(merge);
+					}
+					seal(merge);
+					block = merge;
+					break;
+				}
+				case (WHILE_STMT) : {
+					unsigned header = newBlock();
+					unsigned body = newBlock();
+					unsigned exit = newBlock();
+					jumpTo(header);
+					block = header;
+					branchTo(condition(s->expr), body, exit);
+					seal(body);
+					block = body;
+					lowerLoopBody(s->then, exit, header);
+					jumpTo(header);
+					seal(header);
+					seal(exit);
+					block = exit;
+					break;
+				}
+				case (FOR_STMT) : {
+					scopes.emplace_back();
+					if (s->init != nullptr) {
+						lowerStatement(s->init);
+					}
+					unsigned header = newBlock();
+					unsigned body = newBlock();
+					unsigned step = newBlock();
+					unsigned exit = newBlock();
+					jumpTo(header);
+					block = header;
+					if (s->expr != nullptr) {
+						branchTo(condition(s->expr), body, exit);
+					}
+					else {
+						jumpTo(body);
+					}
+					seal(body);
+					block = body;
+					lowerLoopBody(s->then, exit, step);
+					jumpTo(step);
+					seal(step);
+					block = step;
+					if (s->step != nullptr) {
+						lowerExpr(s->step);
+					}
+					jumpTo(header);
+					seal(header);
+					seal(exit);
+					block = exit;
+					scopes.pop_back();
+					break;
+				}
+				case (FOREACH_STMT) : {
+					lowerForeach(s);
+					break;
+				}
+				case (SWITCH_STMT) : {
+					lowerSwitch(s);
+					break;
+				}
+				case (RETURN_STMT) : {
+					emitReturn(s->expr, s);
+					startUnreachable();
+					break;
+				}
+				case (BREAK_STMT) :
+				case (CONTINUE_STMT) : {
+					std::vector<unsigned> &targets = s->kind == BREAK_STMT ? breakTargets : continueTargets;
+					if (targets.empty()) {
+						error(s, std::string(s->kind == BREAK_STMT ? "break" : "continue") + " outside of a loop");
+					}
+					else {
+						jumpTo(targets.back());
+					}
+					startUnreachable();
+					break;
+				}
+			}
+		}
+
+		// Lower a statement in its own scope, so that a declaration that is the whole body doesn't leak out.
+		void lowerScoped(const Statement *s) {
+			scopes.emplace_back();
+			lowerStatement(s);
+			scopes.pop_back();
+		}
+
+		void lowerLoopBody(const Statement *s, unsigned breakTarget, unsigned continueTarget) {
+			breakTargets.push_back(breakTarget);
+			continueTargets.push_back(continueTarget);
+			lowerScoped(s);
+			breakTargets.pop_back();
+			continueTargets.pop_back();
+		}
+
+		void lowerDeclaration(const VariableDeclaration *decl) {
+			const TypeName *type = resolve(decl->type);
+			if (type->kind == INFERRED_TYPE) {
+				if (decl->initializer == nullptr) {
+					error(decl, "the type of " + decl->name + " can't be inferred without an initializer");
+					return;
+				}
+				Operand v = lowerExpr(decl->initializer);
+				store(declareLocal(decl->name, v.type), v);
+				return;
+			}
+			if (type->kind == ARRAY_TYPE && type->length == -2 && decl->initializer == nullptr) {
+				error(decl, "an array whose length is only known at runtime needs an initializer");
+				return;
+			}
+			if (decl->initializer != nullptr && decl->initializer->kind == ARRAY_EXPR) {
+				Place p = declareLocal(decl->name, type);
+				if (representation(type) == AGGREGATE && type->kind == ARRAY_TYPE) {
+					initializeArray(p.address, type, decl->initializer);
+					return;
+				}
+				store(p, convert(lowerExpr(decl->initializer, type), type, decl->initializer));
+				return;
+			}
+			Operand v;
+			if (decl->initializer != nullptr) {
+				v = convert(lowerExpr(decl->initializer, type), type, decl->initializer);
+			}
+			Place p = declareLocal(decl->name, type);
+			if (decl->initializer != nullptr) {
+				store(p, v);
+			}
+		}
+
+		// Store the elements of an array literal into an array in memory.
+		void initializeArray(ValueId address, const TypeName *type, const Expression *e) {
+			if (isStructOfArrays(type, program)) {
+				error(e, "the elements of " + type->spelling() + " are laid out as a struct of arrays, so only their fields can be used");
+				return;
+			}
+			const TypeName *element = elementOf(type);
+			unsigned size = typeSize(element, program);
+			if ((long long) e->operands.size() > type->length) {
+				error(e, "too many elements for " + type->spelling());
+			}
+			for (unsigned i = 0; i < e->operands.size() && (long long) i < type->length; i++) {
+				ValueId a = offsetAddress(address, (long long) i * size);
+				if (e->operands[i]->kind == ARRAY_EXPR && element->kind == ARRAY_TYPE && representation(element) == AGGREGATE) {
+					initializeArray(a, element, e->operands[i]);
+				}
+				else {
+					store(memoryPlace(a, element), convert(lowerExpr(e->operands[i], element), element, e->operands[i]));
+				}
+			}
+		}
+
+		// Lower an array into a pointer to its first element and its length.
+		void arrayParts(const Operand &array, ValueId &pointer, ValueId &length) {
+			pointer = array.value;
+			if (representation(array.type) == PAIR) {
+				length = array.second;
+			}
+			else {
+				length = constant(IR_I64, array.type->length);
+			}
+		}
+
+		// ValueId of the address of element i of an array whose elements are size bytes.
+		ValueId elementAddress(ValueId pointer, ValueId index, unsigned size) {
+			ValueId offset = size == 1 ? index : emit(OP_MUL, IR_I64, {index, constant(IR_I64, size)});
+			return emit(OP_ADD, IR_PTR, {pointer, offset});
+		}
+
+		// Carry on only if index is less than length, or no more than it if inclusive, as the end of a view may be.
+		// Comparing unsigned catches negative indices too. The checks of a routine share one block that traps, and
+		// the optimizer removes the checks it can prove pass.
+		void checkBounds(ValueId index, ValueId length, bool inclusive = false) {
+			if (dead()) {
+				return;
+			}
+			if (trap == ~0u) {
+				unsigned from = block;
+				trap = newBlock();
+				seal(trap);
+				block = trap;
+				emit(OP_TRAP, IR_VOID);
+				block = from;
+			}
+			unsigned ok = newBlock();
+			branchTo(emit(inclusive ? OP_ULE : OP_ULT, IR_I8, {index, length}), ok, trap);
+			seal(ok);
+			block = ok;
+		}
+
+		// for (var i ind arr), for (var v val arr) and for (var r ref arr) all count an index up through the array.
+		void lowerForeach(const Statement *s) {
+			Operand array = lowerExpr(s->expr);
+			if (array.type->kind != ARRAY_TYPE) {
+				error(s->expr, "foreach needs an array, not " + array.type->spelling());
+				return;
+			}
+			if (s->foreach != FOREACH_INDEX && isStructOfArrays(array.type, program)) {
+				error(s->expr, "the elements of " + array.type->spelling() + " are laid out as a struct of arrays, so only their fields can be used");
+				return;
+			}
+			ValueId pointer;
+			ValueId length;
+			arrayParts(array, pointer, length);
+			const TypeName *element = elementOf(array.type);
+			unsigned size = typeSize(element, program);
+
+			unsigned index = newVar(IR_I64);
+			writeVariable(index, block, constant(IR_I64, 0));
+			unsigned header = newBlock();
+			unsigned body = newBlock();
+			unsigned step = newBlock();
+			unsigned exit = newBlock();
+			jumpTo(header);
+			block = header;
+			ValueId i = readVariable(index, block);
+			branchTo(emit(OP_ULT, IR_I8, {i, length}), body, exit);
+			seal(body);
+			block = body;
+
+			scopes.emplace_back();
+			const TypeName *declared = resolve(s->decl->type);
+			i = readVariable(index, block);
+			switch (s->foreach) {
+				case (FOREACH_INDEX) : {
+					const TypeName *type = declared->kind == INFERRED_TYPE ? ulongType : declared;
+					store(declareLocal(s->decl->name, type), convert(operand(i, ulongType), type, s->expr));
+					break;
+				}
+				case (FOREACH_VALUE) : {
+					const TypeName *type = declared->kind == INFERRED_TYPE ? element : declared;
+					Operand v = load(memoryPlace(elementAddress(pointer, i, size), element));
+					store(declareLocal(s->decl->name, type), convert(v, type, s->expr));
+					break;
+				}
+				case (FOREACH_REFERENCE) : {
+					const TypeName *type = declared->kind == INFERRED_TYPE ? pointerTo(element) : declared;
+					store(declareLocal(s->decl->name, type), convert(operand(elementAddress(pointer, i, size), pointerTo(element)), type, s->expr));
+					break;
+				}
+			}
+			lowerLoopBody(s->then, exit, step);
+			scopes.pop_back();
+			jumpTo(step);
+			seal(step);
+			block = step;
+			writeVariable(index, block, emit(OP_ADD, IR_I64, {readVariable(index, block), constant(IR_I64, 1)}));
+			jumpTo(header);
+			seal(header);
+			seal(exit);
+			block = exit;
+		}
+
+		// Each case compares the switched value in turn; the else case, if any, is taken when none match.
+		void lowerSwitch(const Statement *s) {
+			Operand subject = lowerExpr(s->expr);
+			if (representation(subject.type) != SCALAR) {
+				error(s->expr, "switch needs a number, not " + subject.type->spelling());
+				return;
+			}
+			unsigned exit = newBlock();
+			unsigned otherwise = exit;
+			std::vector<unsigned> bodies;
+			for (unsigned c = 0; c < s->cases.size(); c++) {
+				bodies.push_back(newBlock());
+				if (s->cases[c] == nullptr) {
+					otherwise = bodies.back();
+				}
+			}
+			for (unsigned c = 0; c < s->cases.size(); c++) {
+				if (s->cases[c] == nullptr) {
+					continue;
+				}
+				Operand value = convert(lowerExpr(s->cases[c], subject.type), subject.type, s->cases[c]);
+				unsigned next = newBlock();
+				branchTo(emit(OP_EQ, IR_I8, {subject.value, value.value}), bodies[c], next);
+				seal(next);
+				block = next;
+			}
+			jumpTo(otherwise);
+			breakTargets.push_back(exit);
+			for (unsigned c = 0; c < s->cases.size(); c++) {
+				seal(bodies[c]);
+				block = bodies[c];
+				lowerScoped(s->body[c]);
+				jumpTo(exit);
+			}
+			breakTargets.pop_back();
+			seal(exit);
+			block = exit;
+		}
+
+
+		/* Expressions */
+
+		// Lower an expression. expected, if given, is the type the value is wanted as, which decides the type of
+		// literals and the parameter types of lambdas; the result still has to be converted to it.
+		Operand lowerExpr(const Expression *e, const TypeName *expected = nullptr) {
+			switch (e->kind) {
+				case (INTEGER_EXPR) :
+				case (CHARACTER_EXPR) : {
+					const TypeName *type = e->kind == CHARACTER_EXPR ? ucharType : (e->intValue > 0x7fffffff ? longType : intType);
+					if (expected != nullptr && isNumeric(expected)) {
+						type = expected;
+					}
+					if (isFloat(type)) {
+						return operand(constantFloat(irType(type), (double) e->intValue), type);
+					}
+					return operand(constant(irType(type), (long long) e->intValue), type);
+				}
+				case (FLOAT_EXPR) : {
+					const TypeName *type = expected != nullptr && isFloat(expected) ? expected : doubleType;
+					return operand(constantFloat(irType(type), e->floatValue), type);
+				}
+				case (STRING_EXPR) : {
+					return operand(emit(OP_SYMBOL, IR_PTR, {}, stringSymbol(e->name)), stringType, constant(IR_I64, e->name.size()));
+				}
+				case (NAME_EXPR) : {
+					return lowerName(e, expected);
+				}
+				case (UNARY_EXPR) : {
+					return lowerUnary(e, expected);
+				}
+				case (POSTFIX_EXPR) : {
+					Place p;
+					if (!changeable(e->operands[0]) || !lowerPlace(e->operands[0], p)) {
+						return invalid();
+					}
+					Operand old = load(p);
+					store(p, increment(old, e->op == INCREMENT ? 1 : -1, e));
+					return old;
+				}
+				case (BINARY_EXPR) : {
+					return lowerBinary(e, expected);
+				}
+				case (ASSIGN_EXPR) : {
+					return lowerAssignment(e);
+				}
+				case (CALL_EXPR) : {
+					return lowerCall(e, expected);
+				}
+				case (INDEX_EXPR) :
+				case (MEMBER_EXPR) : {
+					if (e->kind == MEMBER_EXPR) {
+						Operand v;
+						if (lowerSpecialMember(e, v)) {
+							return v;
+						}
+					}
+					Place p;
+					if (!lowerPlace(e, p)) {
+						return invalid();
+					}
+					return load(p);
+				}
+				case (CAST_EXPR) : {
+					return lowerCast(e);
+				}
+				case (IF_EXPR) : {
+					return lowerIf(e, expected);
+				}
+				case (ROUTINE_EXPR) : {
+					return lowerRoutineExpr(e, expected);
+				}
+				case (ARRAY_EXPR) : {
+					if (expected == nullptr || expected->kind != ARRAY_TYPE || expected->length < 0) {
+						error(e, "the type of an array literal can't be inferred");
+						return invalid();
+					}
+					ValueId address = stackSlot(expected);
+					initializeArray(address, expected, e);
+					return operand(address, expected);
+				}
+			}
+			return invalid();
+		}
+
+		unsigned stringSymbol(const std::string &s) {
+			auto i = strings.find(s);
+			if (i != strings.end()) {
+				return i->second;
+			}
+			DataObject *d = module->addData(".str." + std::to_string(strings.size()), 1, true);
+			d->bytes.assign(s.begin(), s.end());
+			d->bytes.push_back(0);
+			strings[s] = d->symbol;
+			return d->symbol;
+		}
+
+		Operand lowerName(const Expression *e, const TypeName *expected) {
+			Local *l = lookup(e->name);
+			if (l != nullptr) {
+				return load(l->place);
+			}
+			unsigned g = globalSymbol(e->name);
+			if (g != ~0u) {
+				const TypeName *type = resolve(scope->globalDecls.at(e->name)->type);
+				return load(memoryPlace(emit(OP_SYMBOL, IR_PTR, {}, g), type));
+			}
+			if (e->name == "true" || e->name == "false") {
+				return operand(constant(IR_I8, e->name == "true"), boolType);
+			}
+			auto r = scope->routines.find(e->name);
+			if (r != scope->routines.end()) {
+				const Routine *chosen = nullptr;
+				for (const Routine *candidate : r->second) {
+					if (Monomorphizer::isGeneric(candidate)) {
+						continue;
+					}
+					if (chosen == nullptr || (expected != nullptr && sameType(routineType(candidate), expected))) {
+						chosen = candidate;
+					}
+				}
+				if (chosen != nullptr) {
+					return operand(emit(OP_SYMBOL, IR_PTR, {}, descriptor(functionFor(chosen))), routineType(chosen));
+				}
+				error(e, "the generic routine " + e->name + " can't be used as a value");
+				return invalid();
+			}
+			error(e, "unknown name " + e->name);
+			return invalid();
+		}
+
+		// Add or subtract one, or one element for pointers.
+		Operand increment(const Operand &v, int amount, const Expression *where) {
+			if (v.type->kind == POINTER_TYPE) {
+				unsigned size = typeSize(elementOf(v.type), program);
+				return operand(emit(OP_ADD, IR_PTR, {v.value, constant(IR_I64, (long long) amount * size)}), v.type);
+			}
+			if (!isNumeric(v.type)) {
+				error(where, "can't increment " + v.type->spelling());
+				return v;
+			}
+			IRType t = irType(v.type);
+			ValueId one = irFloat(t) ? constantFloat(t, amount) : constant(t, amount);
+			return operand(emit(OP_ADD, t, {v.value, one}), v.type);
+		}
+
+		Operand lowerUnary(const Expression *e, const TypeName *expected) {
+			const Expression *inner = e->operands[0];
+			switch (e->op) {
+				case (SUBTRACT) : {
+					if (inner->kind == INTEGER_EXPR || inner->kind == FLOAT_EXPR) {
+						Operand v = lowerExpr(inner, expected);
+						Instruction &i = fn->values[v.value];
+						if (irFloat(i.type)) {
+							double d;
+							memcpy(&d, &i.imm, sizeof(d));
+							d = -d;
+							memcpy(&i.imm, &d, sizeof(d));
+						}
+						else {
+							i.imm = -i.imm;
+						}
+						return v;
+					}
+					Operand v = lowerExpr(inner, expected);
+					if (!isNumeric(v.type)) {
+						error(e, "can't negate " + v.type->spelling());
+						return v;
+					}
+					return operand(emit(OP_NEG, irType(v.type), {v.value}), v.type);
+				}
+				case (LOGICAL_NOT) : {
+					ValueId c = condition(inner);
+					return operand(emit(OP_XOR, IR_I8, {c, constant(IR_I8, 1)}), boolType);
+				}
+				case (BITWISE_NOT) : {
+					Operand v = lowerExpr(inner, expected);
+					if (!isNumeric(v.type) || isFloat(v.type)) {
+						error(e, "can't complement " + v.type->spelling());
+						return v;
+					}
+					return operand(emit(OP_NOT, irType(v.type), {v.value}), v.type);
+				}
+				case (AMPERSAND) : {
+					Place p;
+					if (!changeable(inner) || !lowerPlace(inner, p)) {
+						return invalid();
+					}
+					if (p.ssa) {
+						error(e, "can't take the address of this");
+						return invalid();
+					}
+					return operand(p.address, pointerTo(p.type));
+				}
+				case (ASTERISK) : {
+					Place p;
+					if (!lowerPlace(e, p)) {
+						return invalid();
+					}
+					return load(p);
+				}
+				default : {
+					Place p;
+					if (!changeable(inner) || !lowerPlace(inner, p)) {
+						return invalid();
+					}
+					Operand v = increment(load(p), e->op == INCREMENT ? 1 : -1, e);
+					store(p, v);
+					return v;
+				}
+			}
+		}
+
+		bool isLiteral(const Expression *e) {
+			return e->kind == INTEGER_EXPR || e->kind == FLOAT_EXPR || e->kind == CHARACTER_EXPR || (e->kind == UNARY_EXPR && e->op == SUBTRACT && isLiteral(e->operands[0]));
+		}
+
+		// One operator of a chain like a + b + c, which nests to the left as deep as the chain is long.
+		struct ChainLink {
+			const Expression *e;
+			const TypeName *expected;
+			unsigned result;				// The variable for the value of && and ||.
+		};
+
+		// The chain of operators down the left of an expression is followed in a loop, not by recursion, so that a
+		// long one doesn't run out of stack. The type each operator expects of its left operand is worked out on
+		// the way down, then the operand at the bottom is lowered and each operator applied on the way back up,
+		// which gives the same code as lowering each operator's operands in turn.
+		Operand lowerBinary(const Expression *e, const TypeName *expected) {
+			std::vector<ChainLink> chain;
+			while (e->kind == BINARY_EXPR && (isLogical(e->op) || !isLiteral(e->operands[0]) || isLiteral(e->operands[1]))) {
+				ChainLink link;
+				link.e = e;
+				link.expected = expected;
+				link.result = e->op == LOGICAL_AND || e->op == LOGICAL_OR ? newVar(IR_I8) : 0;
+				chain.push_back(link);
+				expected = isLogical(e->op) ? boolType : (isLiteral(e->operands[1]) && !isComparison(e->op) ? expected : nullptr);
+				e = e->operands[0];
+			}
+			Operand l;
+			if (e->kind == BINARY_EXPR) {
+				// Literals take the type of the other side, so a literal on the left of something that isn't one
+				// comes after it.
+				Operand r = lowerExpr(e->operands[1]);
+				l = combine(e, lowerExpr(e->operands[0], r.type), r);
+			}
+			else {
+				l = lowerExpr(e, expected);
+			}
+			for (unsigned k = chain.size(); k-- > 0;) {
+				l = applyBinary(chain[k], l);
+			}
+			return l;
+		}
+
+		static bool isLogical(TokenType op) {
+			return op == LOGICAL_AND || op == LOGICAL_OR || op == LOGICAL_XOR;
+		}
+
+		static bool isComparison(TokenType op) {
+			return op == COMPARE || op == NOT_EQUAL || op == LESS_THAN || op == GREATER_THAN || op == LESS_EQUAL || op == GREATER_EQUAL;
+		}
+
+		// Apply an operator to its left operand, which has been lowered already.
+		Operand applyBinary(const ChainLink &link, Operand left) {
+			const Expression *e = link.e;
+			const Expression *right = e->operands[1];
+
+			if (e->op == LOGICAL_AND || e->op == LOGICAL_OR) {
+				// Short circuit: the right side is only evaluated if the left doesn't decide the result.
+				unsigned result = link.result;
+				ValueId l = condition(e->operands[0], left);
+				writeVariable(result, block, l);
+				unsigned rightBlock = newBlock();
+				unsigned merge = newBlock();
+				if (e->op == LOGICAL_AND) {
+					branchTo(l, rightBlock, merge);
+				}
+				else {
+					branchTo(l, merge, rightBlock);
+				}
+				seal(rightBlock);
+				block = rightBlock;
+				writeVariable(result, block, condition(right));
+				jumpTo(merge);
+				seal(merge);
+				block = merge;
+				return operand(readVariable(result, block), boolType);
+			}
+			if (e->op == LOGICAL_XOR) {
+				ValueId l = condition(e->operands[0], left);
+				ValueId r = condition(right);
+				return operand(emit(OP_XOR, IR_I8, {l, r}), boolType);
+			}
+			return combine(e, left, lowerExpr(right, isNumeric(left.type) ? left.type : nullptr));
+		}
+
+		// Apply an arithmetic or comparison operator to its lowered operands.
+		Operand combine(const Expression *e, Operand l, Operand r) {
+			bool comparison = isComparison(e->op);
+
+			// Pointer arithmetic: arrays and pointers plus or minus a number give a pointer to an element.
+			if ((e->op == ADDITION || e->op == SUBTRACT) && (l.type->kind == ARRAY_TYPE || l.type->kind == POINTER_TYPE) && isNumeric(r.type) && !isFloat(r.type)) {
+				if (isStructOfArrays(l.type, program)) {
+					error(e, "can't point into " + l.type->spelling() + ", which is laid out as a struct of arrays");
+					return invalid();
+				}
+				const TypeName *element = elementOf(l.type);
+				ValueId index = convertScalar(r.value, r.type, longType);
+				if (e->op == SUBTRACT) {
+					index = emit(OP_NEG, IR_I64, {index});
+				}
+				Operand ret = operand(elementAddress(l.value, index, typeSize(element, program)), pointerTo(element));
+
+				// Stepping forward through an array keeps track of what is left of it, none if it steps past the
+				// end, so that CAST can make a view of the rest. Nothing is computed that CAST doesn't use.
+				ValueId left = l.second;
+				if (l.type->kind == ARRAY_TYPE) {
+					ValueId pointer;
+					arrayParts(l, pointer, left);
+				}
+				if (e->op == ADDITION && left != NO_VALUE) {
+					ValueId within = emit(OP_CONVERT, IR_I64, {emit(OP_ULE, IR_I8, {index, left})});
+					fn->values[within].flags |= CONVERT_UNSIGNED;
+					ret.second = emit(OP_MUL, IR_I64, {emit(OP_SUB, IR_I64, {left, index}), within});
+				}
+				return ret;
+			}
+			if (e->op == SUBTRACT && l.type->kind == POINTER_TYPE && r.type->kind == POINTER_TYPE) {
+				ValueId difference = emit(OP_SUB, IR_I64, {l.value, r.value});
+				unsigned size = typeSize(elementOf(l.type), program);
+				return operand(size > 1 ? emit(OP_DIV, IR_I64, {difference, constant(IR_I64, size)}) : difference, longType);
+			}
+
+			if (comparison && representation(l.type) == SCALAR && (l.type->kind == POINTER_TYPE || l.type->kind == ROUTINE_TYPE) && sameType(l.type, r.type)) {
+				return operand(emit(compareOpcode(e->op, true), IR_I8, {l.value, r.value}), boolType);
+			}
+			if (!isNumeric(l.type) || !isNumeric(r.type)) {
+				error(e, "operator " + operatorSpelling(e->op) + " can't be applied to " + l.type->spelling() + " and " + r.type->spelling());
+				return invalid();
+			}
+
+			const TypeName *type = commonType(l.type, r.type);
+			ValueId a = convertScalar(l.value, l.type, type);
+			ValueId b = convertScalar(r.value, r.type, type);
+			IRType t = irType(type);
+			bool isUnsignedOp = isUnsignedType(type);
+			if (comparison) {
+				return operand(emit(compareOpcode(e->op, isUnsignedOp && !irFloat(t)), IR_I8, {a, b}), boolType);
+			}
+			Opcode op = arithmeticOpcode(e->op, isUnsignedOp);
+			if (irFloat(t) && (op == OP_MOD || op == OP_UMOD || op == OP_AND || op == OP_OR || op == OP_XOR || op == OP_SHL || op == OP_SHR || op == OP_USHR)) {
+				error(e, "operator " + operatorSpelling(e->op) + " can't be applied to floating point numbers");
+				return invalid();
+			}
+			return operand(emit(op, t, {a, b}), type);
+		}
+
+		static Opcode compareOpcode(TokenType op, bool isUnsignedOp) {
+			switch (op) {
+				case (COMPARE) : {
+					return OP_EQ;
+				}
+				case (NOT_EQUAL) : {
+					return OP_NE;
+				}
+				case (LESS_THAN) : {
+					return isUnsignedOp ? OP_ULT : OP_LT;
+				}
+				case (LESS_EQUAL) : {
+					return isUnsignedOp ? OP_ULE : OP_LE;
+				}
+				case (GREATER_THAN) : {
+					return isUnsignedOp ? OP_UGT : OP_GT;
+				}
+				default : {
+					return isUnsignedOp ? OP_UGE : OP_GE;
+				}
+			}
+		}
+
+		// The opcode for a binary operator or the operator of a compound assignment.
+		static Opcode arithmeticOpcode(TokenType op, bool isUnsignedOp) {
+			switch (op) {
+				case (ADDITION) :
+				case (ADD_ASSIGN) : {
+					return OP_ADD;
+				}
+				case (SUBTRACT) :
+				case (SUBTRACT_ASSIGN) : {
+					return OP_SUB;
+				}
+				case (ASTERISK) :
+				case (MULTIPLY_ASSIGN) : {
+					return OP_MUL;
+				}
+				case (SLASH) :
+				case (DIV_ASSIGN) : {
+					return isUnsignedOp ? OP_UDIV : OP_DIV;
+				}
+				case (MODULO) :
+				case (MOD_ASSIGN) : {
+					return isUnsignedOp ? OP_UMOD : OP_MOD;
+				}
+				case (AMPERSAND) :
+				case (AND_ASSIGN) : {
+					return OP_AND;
+				}
+				case (BITWISE_OR) :
+				case (OR_ASSIGN) : {
+					return OP_OR;
+				}
+				case (BITWISE_XOR) :
+				case (XOR_ASSIGN) : {
+					return OP_XOR;
+				}
+				case (LEFT_SHIFT) :
+				case (LEFT_SHIFT_ASSIGN) : {
+					return OP_SHL;
+				}
+				default : {
+					return isUnsignedOp ? OP_USHR : OP_SHR;
+				}
+			}
+		}
+
+		static std::string operatorSpelling(TokenType op) {
+			switch (op) {
+				case (ADDITION) : {
+					return "+";
+				}
+				case (SUBTRACT) : {
+					return "-";
+				}
+				case (ASTERISK) : {
+					return "*";
+				}
+				case (SLASH) : {
+					return "/";
+				}
+				case (MODULO) : {
+					return "%";
+				}
+				case (COMPARE) : {
+					return "==";
+				}
+				case (NOT_EQUAL) : {
+					return "!=";
+				}
+				case (LESS_THAN) : {
+					return "<";
+				}
+				case (GREATER_THAN) : {
+					return ">";
+				}
+				case (LESS_EQUAL) : {
+					return "<=";
+				}
+				case (GREATER_EQUAL) : {
+					return ">=";
+				}
+				default : {
+					return "operator";
+				}
+			}
+		}
+
+		Operand lowerAssignment(const Expression *e) {
+			Place p;
+			if (!changeable(e->operands[0]) || !lowerPlace(e->operands[0], p)) {
+				return invalid();
+			}
+			const Expression *value = e->operands[1];
+			if (e->op == ASSIGNMENT) {
+				if (value->kind == ARRAY_EXPR && representation(p.type) == AGGREGATE && p.type->kind == ARRAY_TYPE) {
+					initializeArray(p.address, p.type, value);
+					return load(p);
+				}
+				Operand v = convert(lowerExpr(value, p.type), p.type, value);
+				store(p, v);
+				return v;
+			}
+
+			Operand old = load(p);
+			Operand r = lowerExpr(value, isNumeric(p.type) ? p.type : nullptr);
+			if (p.type->kind == POINTER_TYPE && (e->op == ADD_ASSIGN || e->op == SUBTRACT_ASSIGN) && isNumeric(r.type)) {
+				ValueId index = convertScalar(r.value, r.type, longType);
+				if (e->op == SUBTRACT_ASSIGN) {
+					index = emit(OP_NEG, IR_I64, {index});
+				}
+				Operand v = operand(elementAddress(old.value, index, typeSize(elementOf(p.type), program)), p.type);
+				store(p, v);
+				return v;
+			}
+			if (!isNumeric(p.type) || !isNumeric(r.type)) {
+				error(e, "compound assignment can't be applied to " + p.type->spelling() + " and " + r.type->spelling());
+				return invalid();
+			}
+			const TypeName *type = commonType(p.type, r.type);
+			IRType t = irType(type);
+			Opcode op = arithmeticOpcode(e->op, isUnsignedType(type));
+			ValueId v = emit(op, t, {convertScalar(old.value, p.type, type), convertScalar(r.value, r.type, type)});
+			Operand result = operand(convertScalar(v, type, p.type), p.type);
+			store(p, result);
+			return result;
+		}
+
+		// Lower the array and the index of a[i], checking the index against the length of an array.
+		bool lowerIndex(const Expression *e, Operand &array, ValueId &i) {
+			array = lowerExpr(e->operands[0]);
+			if (array.type->kind != ARRAY_TYPE && array.type->kind != POINTER_TYPE) {
+				error(e, "can't index " + array.type->spelling());
+				return false;
+			}
+			Operand index = lowerExpr(e->operands[1], ulongType);
+			if (!isNumeric(index.type) || isFloat(index.type)) {
+				error(e, "an index must be an integer, not " + index.type->spelling());
+				return false;
+			}
+			i = convertScalar(index.value, index.type, isUnsignedType(index.type) ? ulongType : longType);
+			if (array.type->kind == ARRAY_TYPE) {
+				ValueId pointer;
+				ValueId length;
+				arrayParts(array, pointer, length);
+				checkBounds(i, length);
+			}
+			return true;
+		}
+
+		// Lower an expression that refers to somewhere a value can be stored.
+		// Whether what an expression names may be assigned to, or have its address taken. A closure's captured
+		// locals are copies, so changing one would be lost to the routine it came from; that is an error. What
+		// a captured pointer or dynamic array refers to is shared, and may be changed.
+		bool changeable(const Expression *e) {
+			const Expression *root = e;
+			const Expression *step = nullptr;
+			while (root->kind == MEMBER_EXPR || root->kind == INDEX_EXPR) {
+				step = root;
+				root = root->operands[0];
+			}
+			Local *l = root->kind == NAME_EXPR ? lookup(root->name) : nullptr;
+			if (l == nullptr || !l->captured) {
+				return true;
+			}
+			const TypeName *type = l->place.type;
+			if (step != nullptr && (type->kind == POINTER_TYPE || (type->kind == ARRAY_TYPE && type->length < 0 && step->kind == INDEX_EXPR))) {
+				return true;
+			}
+			error(e, "can't change " + root->name + " here, since the closure has its own copy of it");
+			return false;
+		}
+
+		bool lowerPlace(const Expression *e, Place &p) {
+			switch (e->kind) {
+				case (NAME_EXPR) : {
+					Local *l = lookup(e->name);
+					if (l != nullptr) {
+						p = l->place;
+						return true;
+					}
+					unsigned g = globalSymbol(e->name);
+					if (g != ~0u) {
+						p = memoryPlace(emit(OP_SYMBOL, IR_PTR, {}, g), resolve(scope->globalDecls.at(e->name)->type));
+						return true;
+					}
+					error(e, "unknown name " + e->name);
+					return false;
+				}
+				case (INDEX_EXPR) : {
+					Operand array;
+					ValueId i;
+					if (!lowerIndex(e, array, i)) {
+						return false;
+					}
+					if (isStructOfArrays(array.type, program)) {
+						error(e, "the elements of " + array.type->spelling() + " are laid out as a struct of arrays, so only their fields can be used");
+						return false;
+					}
+					const TypeName *element = elementOf(array.type);
+					p = memoryPlace(elementAddress(array.value, i, typeSize(element, program)), element);
+					return true;
+				}
+				case (MEMBER_EXPR) : {
+					// A field of an element of a struct of arrays is in the array for that field.
+					Operand object;
+					if (e->operands[0]->kind == INDEX_EXPR) {
+						Operand array;
+						ValueId i;
+						if (!lowerIndex(e->operands[0], array, i)) {
+							return false;
+						}
+						const TypeName *element = elementOf(array.type);
+						if (isStructOfArrays(array.type, program)) {
+							const TypeDeclaration *decl = findClass(program, element->name);
+							for (unsigned f = 0; f < decl->fields.size(); f++) {
+								if (decl->fields[f]->name == e->name) {
+									ValueId start = offsetAddress(array.value, fieldArrayOffset(decl, f, array.type->length, program));
+									p = memoryPlace(elementAddress(start, i, typeSize(decl->fields[f]->type, program)), resolve(decl->fields[f]->type));
+									return true;
+								}
+							}
+							error(e, element->spelling() + " has no member " + e->name);
+							return false;
+						}
+						object = load(memoryPlace(elementAddress(array.value, i, typeSize(element, program)), element));
+					}
+					else {
+						object = lowerExpr(e->operands[0]);
+					}
+					const TypeName *type = object.type;
+					if (type->kind == POINTER_TYPE) {
+						type = elementOf(type);
+					}
+					const TypeDeclaration *decl = type->kind == NAMED_TYPE ? findClass(program, type->name) : nullptr;
+					if (decl == nullptr) {
+						error(e, object.type->spelling() + " has no member " + e->name);
+						return false;
+					}
+					ClassLayout layout = classLayout(decl, program);
+					for (unsigned f = 0; f < decl->fields.size(); f++) {
+						if (decl->fields[f]->name == e->name) {
+							p = memoryPlace(offsetAddress(object.value, layout.offsets[f]), resolve(decl->fields[f]->type));
+							return true;
+						}
+					}
+					error(e, type->spelling() + " has no member " + e->name);
+					return false;
+				}
+				case (UNARY_EXPR) : {
+					if (e->op == ASTERISK) {
+						Operand pointer = lowerExpr(e->operands[0]);
+						if (pointer.type->kind != POINTER_TYPE) {
+							error(e, "can't dereference " + pointer.type->spelling());
+							return false;
+						}
+						p = memoryPlace(pointer.value, elementOf(pointer.type));
+						return true;
+					}
+					break;
+				}
+				default : {}
+			}
+			error(e, "this can't be assigned to");
+			return false;
+		}
+
+		// Members that aren't fields: the length of an array and the enumerators of an enum.
+		bool lowerSpecialMember(const Expression *e, Operand &v) {
+			const Expression *object = e->operands[0];
+			if (object->kind == NAME_EXPR && lookup(object->name) == nullptr) {
+				const TypeDeclaration *d = findTypeDeclaration(program, object->name);
+				if (d != nullptr && d->kind == ENUM_DECL) {
+					for (unsigned i = 0; i < d->enumerators.size(); i++) {
+						if (d->enumerators[i] == e->name) {
+							v = operand(constant(IR_I32, i), named(d->name));
+							return true;
+						}
+					}
+					error(e, d->name + " has no enumerator " + e->name);
+					v = invalid();
+					return true;
+				}
+			}
+			if (e->name != "length") {
+				return false;
+			}
+			Operand array = lowerExpr(object);
+			if (array.type->kind != ARRAY_TYPE) {
+				error(e, array.type->spelling() + " has no length");
+				v = invalid();
+				return true;
+			}
+			ValueId pointer;
+			ValueId length;
+			arrayParts(array, pointer, length);
+			v = operand(length, ulongType);
+			return true;
+		}
+
+		// CAST(type, value)
+		// Casting to an array type makes a view: a pointer and a length into the same elements, with nothing
+		// copied. A view of an array, or of a pointer into one, is checked to fit within what it views.
+		Operand lowerCast(const Expression *e) {
+			const TypeName *to = resolve(e->type);
+			Operand v = lowerExpr(e->operands[0], isNumeric(to) ? to : nullptr);
+			if (isStructOfArrays(v.type, program) && !sameType(v.type, to)) {
+				error(e, "can't view " + v.type->spelling() + ", which is laid out as a struct of arrays");
+				return invalid();
+			}
+			bool bounded = v.type->kind == ARRAY_TYPE;
+			if (to->kind == ARRAY_TYPE && v.type->kind == POINTER_TYPE) {
+				// A pointer into an array can be reinterpreted as the start of a shorter one. Without knowing how
+				// much of the array is left, the view is empty unless its type gives a length.
+				bounded = v.second != NO_VALUE;
+				v = operand(v.value, arrayOf(elementOf(v.type), -1), bounded ? v.second : constant(IR_I64, 0));
+			}
+			if (to->kind == ARRAY_TYPE && v.type->kind == ARRAY_TYPE) {
+				ValueId pointer;
+				ValueId length;
+				arrayParts(v, pointer, length);
+				if (e->type->lengthExpr != nullptr) {
+					Operand n = lowerExpr(e->type->lengthExpr, ulongType);
+					if (!isNumeric(n.type)) {
+						error(e, "an array length must be an integer");
+						return invalid();
+					}
+					ValueId count = convertScalar(n.value, n.type, ulongType);
+					if (bounded) {
+						checkBounds(count, length, true);
+					}
+					return operand(pointer, to, count);
+				}
+				if (to->length < 0) {
+					return operand(pointer, to, length);
+				}
+				if (bounded && v.type->length >= 0 && to->length > v.type->length) {
+					error(e, "can't view " + std::to_string(to->length) + " elements of " + v.type->spelling());
+				}
+				else if (bounded) {
+					checkBounds(constant(IR_I64, to->length), length, true);
+				}
+				return operand(pointer, to);
+			}
+			return convert(v, to, e, true);
+		}
+
+		// if (a) {b} else {c}
+		Operand lowerIf(const Expression *e, const TypeName *expected) {
+			ValueId c = condition(e->operands[0]);
+			unsigned thenBlock = newBlock();
+			unsigned elseBlock = newBlock();
+			unsigned merge = newBlock();
+			branchTo(c, thenBlock, elseBlock);
+			seal(thenBlock);
+			seal(elseBlock);
+
+			block = thenBlock;
+			Operand a = lowerExpr(e->operands[1], expected);
+			const TypeName *type = expected != nullptr && expected->kind != INFERRED_TYPE ? expected : a.type;
+			a = convert(a, type, e->operands[1]);
+			Representation r = representation(type);
+			unsigned var = newVar(r == SCALAR ? irType(type) : IR_PTR);
+			unsigned second = r == PAIR ? newVar(isInterfaceType(type) ? IR_PTR : IR_I64) : 0;
+			writeVariable(var, block, a.value);
+			if (r == PAIR) {
+				writeVariable(second, block, a.second);
+			}
+			jumpTo(merge);
+
+			block = elseBlock;
+			Operand b = convert(lowerExpr(e->operands[2], type), type, e->operands[2]);
+			writeVariable(var, block, b.value);
+			if (r == PAIR) {
+				writeVariable(second, block, b.second);
+			}
+			jumpTo(merge);
+
+			seal(merge);
+			block = merge;
+			if (r == NO_REPRESENTATION) {
+				return operand(NO_VALUE, voidType);
+			}
+			return operand(readVariable(var, block), type, r == PAIR ? readVariable(second, block) : NO_VALUE);
+		}
+
+		// Anonymous procs and lambdas become functions of their own.
+		Operand lowerRoutineExpr(const Expression *e, const TypeName *expected) {
+			const Routine *r = e->routine;
+			if (expected != nullptr && expected->kind != ROUTINE_TYPE) {
+				expected = nullptr;
+			}
+
+			// The value's type comes from the lambda where it is explicit and from where it is used otherwise.
+			TypeName *type = keep(new TypeName(ROUTINE_TYPE));
+			type->pure = r->pure;
+			for (unsigned i = 0; i < r->params.size(); i++) {
+				const TypeName *t = resolve(r->params[i]->type);
+				if (t->kind == INFERRED_TYPE && expected != nullptr && i < expected->params.size()) {
+					t = resolve(expected->params[i]->type);
+				}
+				type->params.push_back(new Parameter(t->clone()));
+			}
+			const TypeName *ret = resolve(r->returnType);
+			if (ret->kind == INFERRED_TYPE && expected != nullptr) {
+				ret = resolve(expected->returnType);
+			}
+			type->returnType = ret->clone();
+			if (expected != nullptr) {
+				type->pure = expected->pure;
+			}
+			return operand(makeClosure(r, r, expected), type);
+		}
+
+		// A routine value is a pointer to a closure record whose first word is the code. Routines that capture
+		// nothing share a record in read-only data. Otherwise the record is allocated on the heap when the
+		// closure is made, with copies of the captured locals after the code; the code finds them through a
+		// hidden last parameter. Being copies, they can't be assigned to in the closure (see changeable).
+		// The optimizer moves records that don't escape onto the stack.
+		ValueId makeClosure(const Routine *signature, const Routine *body, const TypeName *expected) {
+			Function *f = module->addFunction(fn->name + ".anon" + std::to_string(anonymous[fn->name]++));
+			f->pure = signature->pure;
+			Pending p;
+			p.signature = signature;
+			p.body = body;
+			p.fn = f;
+			p.bindings = bindings;
+			p.expected = expected;
+
+			std::set<std::string> names;
+			findNames(body->body, names);
+			findNames(body->value, names);
+			for (const Parameter *param : signature->params) {
+				names.erase(param->name);
+			}
+			unsigned size = 8;
+			for (const std::string &name : names) {
+				Local *l = lookup(name);
+				if (l == nullptr) {
+					continue;
+				}
+				Capture c;
+				c.name = name;
+				c.type = l->place.type;
+				unsigned align = typeAlign(c.type, program);
+				c.offset = (size + align - 1) / align * align;
+				size = c.offset + typeSize(c.type, program);
+				p.captures.push_back(c);
+			}
+			pending.push_back(p);
+
+			if (p.captures.empty()) {
+				return emit(OP_SYMBOL, IR_PTR, {}, descriptor(f));
+			}
+			ValueId record = emit(OP_CALL, IR_PTR, {emit(OP_SYMBOL, IR_PTR, {}, module->symbol("malloc")), constant(IR_I64, (size + 7) / 8 * 8)});
+			emit(OP_STORE, IR_VOID, {record, emit(OP_SYMBOL, IR_PTR, {}, f->symbol)});
+			for (const Capture &c : p.captures) {
+				store(memoryPlace(offsetAddress(record, c.offset), c.type), load(lookup(c.name)->place));
+			}
+			return record;
+		}
+
+		// The shared closure record of a routine that captures nothing.
+		unsigned descriptor(const Function *f) {
+			auto i = descriptors.find(f);
+			if (i != descriptors.end()) {
+				return i->second;
+			}
+			DataObject *d = module->addData("__closure." + f->name, 8, true);
+			d->bytes.assign(8, 0);
+			Relocation r;
+			r.offset = 0;
+			r.symbol = f->symbol;
+			r.addend = 0;
+			d->relocations.push_back(r);
+			descriptors[f] = d->symbol;
+			return d->symbol;
+		}
+
+		// Whether a routine that returns a routine with named parameters, like
+		// "func(func(int)->int f, func(int)->int g) -> (func(int x)->int) compose = f(g(x))", has the body of the
+		// routine it returns, which captures its own parameters.
+		bool curried(const Routine *signature, const Routine *body, const TypeName *ret) {
+			if (ret->kind != ROUTINE_TYPE || ret->params.empty()) {
+				return false;
+			}
+			std::set<std::string> names;
+			findNames(body->body, names);
+			findNames(body->value, names);
+			for (const Parameter *param : signature->params) {
+				names.erase(param->name);
+			}
+			for (const Parameter *param : ret->params) {
+				if (param->name.empty()) {
+					return false;
+				}
+			}
+			for (const Parameter *param : ret->params) {
+				if (names.count(param->name) != 0) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+
+		/* Calls */
+
+		Operand lowerCall(const Expression *e, const TypeName *expected) {
+			const Expression *outer = callSite;
+			callSite = e;
+			Operand ret = dispatchCall(e, expected);
+			callSite = outer;
+			return ret;
+		}
+
+		Operand dispatchCall(const Expression *e, const TypeName *expected) {
+			const Expression *callee = e->operands[0];
+			std::vector<const Expression*> args(e->operands.begin() + 1, e->operands.end());
+
+			if (callee->kind == NAME_EXPR && lookup(callee->name) == nullptr && scope->globalDecls.count(callee->name) == 0) {
+				const std::string &name = callee->name;
+				auto r = scope->routines.find(name);
+				if (r != scope->routines.end()) {
+					return callRoutine(e, r->second, args);
+				}
+				Operand v;
+				if (callInterfaceRoutine(e, name, args, v)) {
+					return v;
+				}
+				return callExternal(name, args, expected);
+			}
+
+			// Routines from an imported module, like p.swap.
+			if (callee->kind == MEMBER_EXPR && callee->operands[0]->kind == NAME_EXPR && lookup(callee->operands[0]->name) == nullptr && scope->importAliases.count(callee->operands[0]->name) != 0) {
+				return callExternal(callee->name, args, expected);
+			}
+
+			Operand target = lowerExpr(callee);
+			if (target.type->kind != ROUTINE_TYPE) {
+				error(e, target.type->spelling() + " can't be called");
+				return invalid();
+			}
+			if (target.type->params.size() != args.size()) {
+				error(e, "wrong number of arguments");
+				return invalid();
+			}
+			std::vector<ValueId> words;
+			for (unsigned i = 0; i < args.size(); i++) {
+				const TypeName *type = resolve(target.type->params[i]->type);
+				passArgument(convert(lowerExpr(args[i], type), type, args[i]), words);
+			}
+			words.push_back(target.value);
+			return emitCall(closureCode(target.value), resolve(target.type->returnType), words, target.type->pure);
+		}
+
+		// Pick an overload by the number and types of the arguments and call it, instantiating it if it is generic.
+		Operand callRoutine(const Expression *e, const std::vector<const Routine*> &overloads, const std::vector<const Expression*> &args) {
+			std::vector<const Routine*> candidates;
+			for (const Routine *r : overloads) {
+				if (r->params.size() == args.size()) {
+					candidates.push_back(r);
+				}
+			}
+			if (candidates.empty()) {
+				error(e, "no version of " + overloads[0]->name + " takes " + std::to_string(args.size()) + " arguments");
+				return invalid();
+			}
+
+			if (candidates.size() == 1 && !Monomorphizer::isGeneric(candidates[0])) {
+				const Routine *r = candidates[0];
+				std::vector<ValueId> words;
+				for (unsigned i = 0; i < args.size(); i++) {
+					const TypeName *type = resolve(r->params[i]->type);
+					passArgument(convert(lowerExpr(args[i], type), type, args[i]), words);
+				}
+				Function *f = functionFor(r);
+				return emitCall(emit(OP_SYMBOL, IR_PTR, {}, f->symbol), resolve(r->returnType), words, r->pure);
+			}
+
+			// Otherwise the argument types decide.
+			std::vector<Operand> values;
+			std::vector<const TypeName*> types;
+			for (const Expression *a : args) {
+				values.push_back(lowerExpr(a));
+				types.push_back(values.back().type);
+			}
+			for (const Routine *r : candidates) {
+				std::vector<const TypeName*> typeArgs;
+				if (Monomorphizer::isGeneric(r)) {
+					if (!generics->infer(r, types, typeArgs)) {
+						continue;
+					}
+					Instantiation *inst = generics->instantiate(r, typeArgs, diagnostics);
+					if (inst == nullptr) {
+						failed = true;
+						return invalid();
+					}
+					std::string implementor;
+					auto c = scope->instanceClass.find(r);
+					if (c != scope->instanceClass.end()) {
+						implementor = c->second;
+					}
+					Function *f = instantiationFor(inst, implementor);
+					return callWith(f, inst->routine, values, args, r->pure);
+				}
+				bool fits = true;
+				for (unsigned i = 0; i < args.size() && fits; i++) {
+					const TypeName *type = resolve(r->params[i]->type);
+					fits = sameType(type, types[i]) || (isNumeric(type) && isNumeric(types[i]));
+				}
+				if (fits) {
+					return callWith(functionFor(r), r, values, args, r->pure);
+				}
+			}
+			error(e, "no version of " + overloads[0]->name + " fits these arguments");
+			return invalid();
+		}
+
+		Operand callWith(Function *f, const Routine *signature, const std::vector<Operand> &values, const std::vector<const Expression*> &args, bool pure) {
+			std::vector<ValueId> words;
+			for (unsigned i = 0; i < values.size(); i++) {
+				const TypeName *type = resolve(signature->params[i]->type);
+				passArgument(convert(values[i], type, args[i]), words);
+			}
+			const TypeName *ret = resolve(signature->returnType);
+			return emitCall(emit(OP_SYMBOL, IR_PTR, {}, f->symbol), ret, words, pure);
+		}
+
+		// A call to an interface routine by name, dispatched on the first argument that implements the interface.
+		// When that argument's class is known the call goes straight to the implementation; when all that is known
+		// is that it is an interface value, the implementation is loaded from its witness table.
+		bool callInterfaceRoutine(const Expression *e, const std::string &name, const std::vector<const Expression*> &args, Operand &result) {
+			std::vector<std::string> candidates;
+			for (const TypeDeclaration *t : program->typeDecls) {
+				if (t->kind == INTERFACE_DECL && interfaces->slot(t->name, name) >= 0) {
+					candidates.push_back(t->name);
+				}
+			}
+			if (candidates.empty()) {
+				return false;
+			}
+
+			std::vector<Operand> values;
+			for (const Expression *a : args) {
+				values.push_back(lowerExpr(a));
+			}
+			for (const std::string &interfaceName : candidates) {
+				for (unsigned i = 0; i < values.size(); i++) {
+					const TypeName *type = values[i].type;
+					if (type->kind != NAMED_TYPE) {
+						continue;
+					}
+					Dispatch d = interfaces->resolve(type->name, interfaceName, name);
+					if (d.target != nullptr) {
+						const WitnessTable *t = interfaces->table(type->name, interfaceName);
+						std::map<std::string, const TypeName*> saved = bindings;
+						bindings["impl"] = named(type->name);
+						if (Monomorphizer::isGeneric(d.target)) {
+							std::vector<const TypeName*> types;
+							std::vector<const TypeName*> typeArgs;
+							for (const Operand &v : values) {
+								types.push_back(v.type);
+							}
+							Instantiation *inst = generics->infer(d.target, types, typeArgs) ? generics->instantiate(d.target, typeArgs, diagnostics) : nullptr;
+							if (inst == nullptr) {
+								bindings = saved;
+								error(e, "can't work out the type arguments of " + name);
+								return true;
+							}
+							result = callWith(instantiationFor(inst, type->name), inst->routine, values, args, d.target->pure);
+						}
+						else {
+							result = callWith(witnessFunction(*t, d.slot), d.target, values, args, d.target->pure);
+						}
+						bindings = saved;
+						return true;
+					}
+					if (type->name == interfaceName) {
+						int slot = interfaces->slot(interfaceName, name);
+						const Routine *declared = nullptr;
+						for (const TypeDeclaration *t : program->typeDecls) {
+							if (t->kind == INTERFACE_DECL && t->name == interfaceName) {
+								declared = t->routines[slot];
+							}
+						}
+						ValueId entry = emit(OP_LOAD, IR_PTR, {offsetAddress(values[i].second, 8 * slot)});
+						fn->values[entry].flags |= LOAD_WITNESS;
+						std::vector<ValueId> words;
+						for (unsigned j = 0; j < values.size(); j++) {
+							if (j == i) {
+								words.push_back(values[j].value);
+							}
+							else {
+								passArgument(values[j], words);
+							}
+						}
+						const TypeName *ret = declared->returnType;
+						if (ret->kind == IMPL_TYPE) {
+							error(e, name + " returns impl, so it can only be called on a known class");
+							result = invalid();
+							return true;
+						}
+						result = emitCall(entry, resolve(ret), words, declared->pure);
+						return true;
+					}
+				}
+			}
+			error(e, "none of the arguments to " + name + " implement an interface with that routine");
+			result = invalid();
+			return true;
+		}
+
+		// A routine that isn't defined here, such as one from an imported library. It is assumed to return an int
+		// unless the call is used where another type is expected.
+		Operand callExternal(const std::string &name, const std::vector<const Expression*> &args, const TypeName *expected) {
+			std::vector<ValueId> words;
+			for (const Expression *a : args) {
+				Operand v = lowerExpr(a);
+				if (v.type->kind == ROUTINE_TYPE) {
+					// C expects the address of the code. Closures that capture something can't be called that way.
+					v.value = closureCode(v.value);
+				}
+				passArgument(v, words);
+			}
+			const TypeName *ret = expected != nullptr && expected->kind != INFERRED_TYPE && representation(expected) == SCALAR ? expected : intType;
+			return emitCall(emit(OP_SYMBOL, IR_PTR, {}, module->symbol(name)), ret, words, false);
+		}
+
+		// The code of a closure, which never changes once the closure is made.
+		ValueId closureCode(ValueId closure) {
+			ValueId ret = emit(OP_LOAD, IR_PTR, {closure});
+			fn->values[ret].flags |= LOAD_INVARIANT;
+			return ret;
+		}
+
+		// Add the IR arguments that pass a value.
+		void passArgument(const Operand &v, std::vector<ValueId> &words) {
+			switch (representation(v.type)) {
+				case (SCALAR) : {
+					words.push_back(v.value);
+					break;
+				}
+				case (PAIR) : {
+					words.push_back(v.value);
+					words.push_back(v.second);
+					break;
+				}
+				case (AGGREGATE) : {
+					// Aggregates are passed by the address of a copy that the callee is free to modify.
+					ValueId copy = stackSlot(v.type);
+					emit(OP_COPY, IR_VOID, {copy, v.value}, typeSize(v.type, program));
+					words.push_back(copy);
+					break;
+				}
+				default : {}
+			}
+		}
+
+		// Emit a call. Pairs and aggregates are returned through a hidden pointer to space the caller provides.
+		Operand emitCall(ValueId callee, const TypeName *ret, const std::vector<ValueId> &args, bool pure) {
+			std::vector<ValueId> operands;
+			operands.push_back(callee);
+			Representation r = representation(ret);
+			ValueId space = NO_VALUE;
+			if (r == PAIR || r == AGGREGATE) {
+				space = stackSlot(ret);
+				operands.push_back(space);
+			}
+			operands.insert(operands.end(), args.begin(), args.end());
+			if (fn->pure && !pure) {
+				// The optimizer counts on funcs having no side effects, and initializers are run at compile time.
+				error(callSite, global != nullptr ? "the initializer of global " + global->name + " can only call funcs" : "func " + fn->name + " can only call other funcs");
+			}
+			ValueId call = fn->emit(block, OP_CALL, r == SCALAR ? irType(ret) : IR_VOID, operands);
+			if (pure) {
+				fn->values[call].flags |= CALL_PURE;
+			}
+			switch (r) {
+				case (SCALAR) : {
+					return operand(call, ret);
+				}
+				case (PAIR) : {
+					return load(memoryPlace(space, ret));
+				}
+				case (AGGREGATE) : {
+					return operand(space, ret);
+				}
+				default : {
+					return operand(NO_VALUE, voidType);
+				}
+			}
+		}
+
+
+		/* Errors */
+
+		template <class Node> void error(const Node *where, const std::string &message) {
+			diagnose(diagnostics, "Semantic error: %s (%u:%u).\n", message.c_str(), where->linenum, where->colnum);
+			failed = true;
+		}
+
+		void errorAt(const void *where, const std::string &message) {
+			const Statement *s = (const Statement*) where;
+			error(s, message);
+		}
+};
+
+
+// Lower one unit of a program: the routine's, or if it is nullptr, the globals'. Errors are added to diagnostics.
+LoweredUnit* lowerUnit(const Program *program, const ProgramScope *scope, const InterfaceTables *interfaces, Monomorphizer *generics, const Routine *routine, std::string &diagnostics) {
+	LoweredUnit *ret = new LoweredUnit();
+	Lowerer l(program, scope, interfaces, generics, ret->module, routine, diagnostics);
+	ret->ok = l.lower();
+	l.takeInitializers(ret->initializers);
+	return ret;
+}
+
+// Run the initializers of globals at compile time, in the order the globals are declared, so that each can use the
+// values of the ones before it. Returns false if any of them can't be run, having added which to diagnostics.
+bool initializeGlobals(IRModule *module, const std::vector<std::pair<const VariableDeclaration*, Function*>> &initializers, std::string &diagnostics) {
+	std::set<unsigned> waiting;
+	for (auto &i : initializers) {
+		waiting.insert(module->findSymbol(i.first->name));
+	}
+	bool ok = true;
+	Interpreter interpreter(module, 1000000, 256, 16 << 20);
+	for (auto &i : initializers) {
+		unsigned symbol = module->findSymbol(i.first->name);
+		waiting.erase(symbol);
+		if (!interpreter.initialize(i.second, module->data[module->symbols[symbol].index], waiting)) {
+			diagnose(diagnostics, "Semantic error: the initializer of global %s can't be run at compile time: %s (%u:%u).\n", i.first->name.c_str(), interpreter.failure.c_str(), i.first->linenum, i.first->colnum);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// Link the units of a program into a new module and initialize its globals. The globals' unit comes first.
+// Returns nullptr, having added why to diagnostics, if an initializer can't be run.
+IRModule* linkUnits(const std::vector<const LoweredUnit*> &units, std::string &diagnostics) {
+	TraceScope trace("link");
+	IRModule *ret = new IRModule();
+	std::vector<std::pair<const VariableDeclaration*, Function*>> initializers;
+	for (const LoweredUnit *u : units) {
+		std::vector<unsigned> symbols = ret->link(*u->module);
+		for (auto &i : u->initializers) {
+			initializers.push_back(std::make_pair(i.first, i.second->relocated(symbols)));
+		}
+	}
+	bool ok = initializeGlobals(ret, initializers, diagnostics);
+	for (auto &i : initializers) {
+		delete i.second;
+	}
+	if (!ok) {
+		delete ret;
+		return nullptr;
+	}
+	return ret;
+}
+
+// The C runtime calls main(argc, argv), but a main that takes a [][]uchar is lowered to take a pointer to the
+// arguments, each a pointer and a length, and how many there are. Such a main is given the symbol __main, and main
+// becomes a routine that makes the [][]uchar out of argv and calls it. A main that takes no arguments can be called
+// as it is. Returns false, having said why, if main takes anything else.
+bool addEntryPoint(IRModule *module) {
+	Function *main = module->functionFor(module->findSymbol("main"));
+	if (main == nullptr || main->params.empty()) {
+		return true;
+	}
+	if (main->params.size() != 2 || main->params[0] != IR_PTR || main->params[1] != IR_I64) {
+		printf("Error: main must take no arguments or a [][]uchar.\n");
+		return false;
+	}
+	IRType returnType = main->returnType;
+	module->rename(main->symbol, "__main");
+
+	Function *entry = module->addFunction("main");
+	entry->params = {IR_I32, IR_PTR};
+	entry->returnType = IR_I32;
+	auto constant = [&](unsigned block, long long value) {
+		return entry->emit(block, OP_CONST, IR_I64, nullptr, 0, value);
+	};
+	auto address = [&](unsigned block, const char *name) {
+		return entry->emit(block, OP_SYMBOL, IR_PTR, nullptr, 0, module->symbol(name));
+	};
+	unsigned start = entry->addBlock(), head = entry->addBlock(), body = entry->addBlock(), exit = entry->addBlock();
+	ValueId argv = entry->emit(start, OP_PARAM, IR_PTR, nullptr, 0, 1);
+	ValueId count = entry->emit(start, OP_CONVERT, IR_I64, {entry->emit(start, OP_PARAM, IR_I32, nullptr, 0, 0)});
+	ValueId bytes = entry->emit(start, OP_MUL, IR_I64, {count, constant(start, 16)});
+	ValueId args = entry->emit(start, OP_CALL, IR_PTR, {address(start, "malloc"), bytes});
+	ValueId first = constant(start, 0);
+	entry->jump(start, head);
+
+	ValueId i = entry->emitPhi(head, IR_I64);
+	entry->addIncoming(i, first, start);
+	entry->branch(head, entry->emit(head, OP_LT, IR_I8, {i, count}), body, exit);
+
+	ValueId string = entry->emit(body, OP_LOAD, IR_PTR, {entry->emit(body, OP_ADD, IR_PTR, {argv, entry->emit(body, OP_MUL, IR_I64, {i, constant(body, 8)})})});
+	ValueId length = entry->emit(body, OP_CALL, IR_I64, {address(body, "strlen"), string});
+	ValueId arg = entry->emit(body, OP_ADD, IR_PTR, {args, entry->emit(body, OP_MUL, IR_I64, {i, constant(body, 16)})});
+	entry->emit(body, OP_STORE, IR_VOID, {arg, string});
+	entry->emit(body, OP_STORE, IR_VOID, {entry->emit(body, OP_ADD, IR_PTR, {arg, constant(body, 8)}), length});
+	entry->addIncoming(i, entry->emit(body, OP_ADD, IR_I64, {i, constant(body, 1)}), body);
+	entry->jump(body, head);
+
+	ValueId status = entry->emit(exit, OP_CALL, returnType, {address(exit, "__main"), args, count});
+	entry->emit(exit, OP_CALL, IR_VOID, {address(exit, "free"), args});
+	if (returnType == IR_VOID) {
+		status = entry->emit(exit, OP_CONST, IR_I32, nullptr, 0, 0);
+	}
+	else if (returnType != IR_I32) {
+		status = entry->emit(exit, OP_CONVERT, IR_I32, {status});
+	}
+	entry->emit(exit, OP_RETURN, IR_VOID, {status});
+	return true;
+}
+
+#endif
@@ -0,0 +1,1122 @@
+#ifndef LSP
+#define LSP
+
+#include "includes.h"
+
+
+// The kinds of JSON value.
+enum JsonKind {
+	JSON_NULL,
+	JSON_BOOLEAN,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+};
+
+// A JSON value, which is what the messages of the language server protocol are made of.
+struct Json {
+	JsonKind kind = JSON_NULL;
+	bool boolean = false;
+	double number = 0;
+	std::string string;
+	std::vector<Json> elements;
+	std::vector<std::pair<std::string, Json>> members;
+
+	// The member with the given name, or null if there isn't one.
+	const Json& operator[](const char *key) const {
+		static const Json missing;
+		for (const auto &m : members) {
+			if (m.first == key) {
+				return m.second;
+			}
+		}
+		return missing;
+	}
+
+	// A number that counts something, such as a line, which is 0 if it isn't one.
+	unsigned count() const {
+		return kind == JSON_NUMBER && number >= 0 && number < UINT_MAX ? (unsigned) number : 0;
+	}
+
+	void write(std::string &out) const;
+};
+
+// s as a JSON string.
+std::string jsonQuote(const std::string &s) {
+	std::string ret = "\"";
+	for (char c : s) {
+		switch (c) {
+			case ('"') : {
+				ret += "\\\"";
+				break;
+			}
+			case ('\\') : {
+				ret += "\\\\";
+				break;
+			}
+			case ('\n') : {
+				ret += "\\n";
+				break;
+			}
+			case ('\t') : {
+				ret += "\\t";
+				break;
+			}
+			default : {
+				if ((unsigned char) c < 0x20) {
+					char escape[8];
+					snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char) c);
+					ret += escape;
+				}
+				else {
+					ret += c;
+				}
+			}
+		}
+	}
+	return ret + "\"";
+}
+
+void Json::write(std::string &out) const {
+	switch (kind) {
+		case (JSON_NULL) : {
+			out += "null";
+			break;
+		}
+		case (JSON_BOOLEAN) : {
+			out += boolean ? "true" : "false";
+			break;
+		}
+		case (JSON_NUMBER) : {
+			char text[32];
+			if (number == (double) (long long) number) {
+				snprintf(text, sizeof(text), "%lld", (long long) number);
+			}
+			else {
+				snprintf(text, sizeof(text), "%.17g", number);
+			}
+			out += text;
+			break;
+		}
+		case (JSON_STRING) : {
+			out += jsonQuote(string);
+			break;
+		}
+		case (JSON_ARRAY) : {
+			out += "[";
+			for (unsigned i = 0; i < elements.size(); i++) {
+				if (i > 0) {
+					out += ",";
+				}
+				elements[i].write(out);
+			}
+			out += "]";
+			break;
+		}
+		case (JSON_OBJECT) : {
+			out += "{";
+			for (unsigned i = 0; i < members.size(); i++) {
+				if (i > 0) {
+					out += ",";
+				}
+				out += jsonQuote(members[i].first) + ":";
+				members[i].second.write(out);
+			}
+			out += "}";
+			break;
+		}
+	}
+}
+
+
+// Reads JSON text. Like the compiler's parser it limits nesting, so that no message can overflow the stack.
+class JsonReader {
+
+	public:
+
+		JsonReader(const std::string &text) : at(text.c_str()), end(text.c_str() + text.size()) {}
+
+		// Returns false if the text isn't a single JSON value.
+		bool read(Json &out) {
+			bool ok = value(out, 0);
+			space();
+			return ok && at == end;
+		}
+
+	private:
+
+		static const unsigned MAX_DEPTH = 256;
+
+		const char *at;
+		const char *end;
+
+		void space() {
+			while (at < end && (*at == ' ' || *at == '\t' || *at == '\n' || *at == '\r')) {
+				at++;
+			}
+		}
+
+		bool literal(const char *word) {
+			size_t length = strlen(word);
+			if ((size_t) (end - at) < length || memcmp(at, word, length) != 0) {
+				return false;
+			}
+			at += length;
+			return true;
+		}
+
+		bool value(Json &out, unsigned depth) {
+			space();
+			if (at == end || depth > MAX_DEPTH) {
+				return false;
+			}
+			switch (*at) {
+				case ('{') : {
+					out.kind = JSON_OBJECT;
+					at++;
+					space();
+					if (at < end && *at == '}') {
+						at++;
+						return true;
+					}
+					while (true) {
+						space();
+						std::pair<std::string, Json> member;
+						if (at == end || *at != '"' || !string(member.first)) {
+							return false;
+						}
+						space();
+						if (at == end || *at++ != ':' || !value(member.second, depth + 1)) {
+							return false;
+						}
+						out.members.push_back(std::move(member));
+						space();
+						if (at < end && *at == ',') {
+							at++;
+						}
+						else {
+							break;
+						}
+					}
+					return at < end && *at++ == '}';
+				}
+				case ('[') : {
+					out.kind = JSON_ARRAY;
+					at++;
+					space();
+					if (at < end && *at == ']') {
+						at++;
+						return true;
+					}
+					while (true) {
+						out.elements.emplace_back();
+						if (!value(out.elements.back(), depth + 1)) {
+							return false;
+						}
+						space();
+						if (at < end && *at == ',') {
+							at++;
+						}
+						else {
+							break;
+						}
+					}
+					return at < end && *at++ == ']';
+				}
+				case ('"') : {
+					out.kind = JSON_STRING;
+					return string(out.string);
+				}
+				case ('t') : {
+					out.kind = JSON_BOOLEAN;
+					out.boolean = true;
+					return literal("true");
+				}
+				case ('f') : {
+					out.kind = JSON_BOOLEAN;
+					return literal("false");
+				}
+				case ('n') : {
+					return literal("null");
+				}
+				default : {
+					if (*at != '-' && !isdigit((unsigned char) *at)) {
+						return false;
+					}
+
+					// The text ends in a NUL, so strtod can't run off it.
+					char *after;
+					out.kind = JSON_NUMBER;
+					out.number = strtod(at, &after);
+					at = after;
+					return true;
+				}
+			}
+		}
+
+		// A string, starting at its opening quote.
+		bool string(std::string &out) {
+			at++;
+			while (at < end && *at != '"') {
+				if (*at != '\\') {
+					out += *at++;
+					continue;
+				}
+				if (++at == end) {
+					return false;
+				}
+				switch (*at++) {
+					case ('b') : {
+						out += '\b';
+						break;
+					}
+					case ('f') : {
+						out += '\f';
+						break;
+					}
+					case ('n') : {
+						out += '\n';
+						break;
+					}
+					case ('r') : {
+						out += '\r';
+						break;
+					}
+					case ('t') : {
+						out += '\t';
+						break;
+					}
+					case ('u') : {
+						unsigned code;
+						if (!hex(code)) {
+							return false;
+						}
+
+						// A character outside the basic multilingual plane comes as a pair of surrogates.
+						unsigned low;
+						if (code >= 0xd800 && code < 0xdc00 && end - at >= 6 && at[0] == '\\' && at[1] == 'u') {
+							at += 2;
+							if (!hex(low)) {
+								return false;
+							}
+							code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+						}
+						utf8(code, out);
+						break;
+					}
+					default : {
+						out += at[-1];
+					}
+				}
+			}
+			return at < end && *at++ == '"';
+		}
+
+		bool hex(unsigned &code) {
+			if (end - at < 4) {
+				return false;
+			}
+			code = 0;
+			for (unsigned i = 0; i < 4; i++) {
+				char c = *at++;
+				if (!isxdigit((unsigned char) c)) {
+					return false;
+				}
+				code = code * 16 + (isdigit((unsigned char) c) ? c - '0' : (tolower(c) - 'a' + 10));
+			}
+			return true;
+		}
+
+		static void utf8(unsigned code, std::string &out) {
+			if (code < 0x80) {
+				out += (char) code;
+			}
+			else if (code < 0x800) {
+				out += (char) (0xc0 | (code >> 6));
+				out += (char) (0x80 | (code & 0x3f));
+			}
+			else if (code < 0x10000) {
+				out += (char) (0xe0 | (code >> 12));
+				out += (char) (0x80 | ((code >> 6) & 0x3f));
+				out += (char) (0x80 | (code & 0x3f));
+			}
+			else {
+				out += (char) (0xf0 | (code >> 18));
+				out += (char) (0x80 | ((code >> 12) & 0x3f));
+				out += (char) (0x80 | ((code >> 6) & 0x3f));
+				out += (char) (0x80 | (code & 0x3f));
+			}
+		}
+};
+
+
+// A problem found in a document. Positions are counted as the lexer counts them, from 0, with a tab going to the
+// next tab stop.
+struct Diagnostic {
+	unsigned line;
+	unsigned column;
+	bool warning;
+	std::string message;
+};
+
+// Read the diagnostics back out of what the compiler reported about the named file. They all end with the position
+// they are about, as in "Syntax error: expected ';' but found 'x' in f.c (3:12).", which is left off, along with
+// the name of the file.
+std::vector<Diagnostic> readDiagnostics(const std::string &printed, const std::string &filename) {
+	static const char* const kinds[] = {"Syntax error: ", "Lex Error: ", "Semantic error: ", "Warning: ", "Error: "};
+	std::vector<Diagnostic> ret;
+	size_t start = 0;
+	while (start < printed.size()) {
+		size_t newline = printed.find('\n', start);
+		std::string line = printed.substr(start, newline == std::string::npos ? std::string::npos : newline - start);
+		start = newline == std::string::npos ? printed.size() : newline + 1;
+		bool known = false;
+		for (const char *kind : kinds) {
+			known = known || line.compare(0, strlen(kind), kind) == 0;
+		}
+		size_t paren = line.rfind('(');
+		Diagnostic d;
+		if (!known || paren == std::string::npos || sscanf(line.c_str() + paren, "(%u:%u)", &d.line, &d.column) != 2) {
+			continue;
+		}
+		d.warning = line.compare(0, 9, "Warning: ") == 0;
+		d.message = line.substr(0, paren);
+		while (!d.message.empty() && (d.message.back() == ' ' || d.message.back() == ':')) {
+			d.message.pop_back();
+		}
+		size_t in = d.message.rfind(" in " + filename);
+		if (in != std::string::npos && in + 4 + filename.size() == d.message.size()) {
+			d.message.erase(in);
+		}
+		ret.push_back(d);
+	}
+	return ret;
+}
+
+
+// A declaration that a name can refer to, and what hovering over the name shows.
+struct Definition {
+	unsigned line;
+	unsigned column;
+	std::string description;
+	std::string owner;			// The class that a field belongs to; empty for anything else.
+	const TypeName *type;		// The type of a variable or field; nullptr for anything else.
+};
+
+std::string describe(const VariableDeclaration *v) {
+	return std::string(v->isConst ? "const " : "") + (v->isStatic ? "static " : "") + v->type->spelling() + " " + v->name;
+}
+
+std::string describe(const Routine *r) {
+	std::string ret = r->pure ? "func(" : "proc(";
+	for (unsigned i = 0; i < r->params.size(); i++) {
+		if (i > 0) {
+			ret += ", ";
+		}
+		ret += r->params[i]->type == nullptr ? "" : r->params[i]->type->spelling();
+		if (!r->params[i]->name.empty()) {
+			ret += (r->params[i]->type == nullptr ? "" : " ") + r->params[i]->name;
+		}
+	}
+	return ret + ") -> " + (r->returnType == nullptr ? "void" : r->returnType->spelling()) + " " + r->name;
+}
+
+std::string describe(const TypeDeclaration *t) {
+	static const char* const keywords[] = {"class", "struct", "union", "enum", "alias", "interface", "instance"};
+	std::string ret = std::string(keywords[t->kind]) + " " + t->name;
+	switch (t->kind) {
+		case (ALIAS_DECL) : {
+			return ret + " = " + t->aliased->spelling();
+		}
+		case (INSTANCE_DECL) : {
+			return t->name + " : " + t->interfaceName;
+		}
+		case (ENUM_DECL) : {
+			ret += " {";
+			for (unsigned i = 0; i < t->enumerators.size(); i++) {
+				ret += (i > 0 ? ", " : " ") + t->enumerators[i];
+			}
+			return ret + " }";
+		}
+		case (INTERFACE_DECL) : {
+			return ret;
+		}
+		default : {
+			ret += " {";
+			for (const VariableDeclaration *f : t->fields) {
+				ret += "\n\t" + describe(f) + ";";
+			}
+			return ret + "\n}";
+		}
+	}
+}
+
+// The declarations in a program that can be referred to from anywhere: routines, globals, types and their fields
+// and methods, with the names they are found by.
+void collectDefinitions(const Program *program, std::vector<std::pair<std::string, Definition>> &out) {
+	for (const Routine *r : program->routines) {
+		out.push_back(std::make_pair(r->name, Definition{r->linenum, r->colnum, describe(r), "", nullptr}));
+	}
+	for (const VariableDeclaration *v : program->varDecls) {
+		out.push_back(std::make_pair(v->name, Definition{v->linenum, v->colnum, describe(v), "", v->type}));
+	}
+	for (const TypeDeclaration *t : program->typeDecls) {
+		if (t->kind != INSTANCE_DECL) {
+			out.push_back(std::make_pair(t->name, Definition{t->linenum, t->colnum, describe(t), "", nullptr}));
+		}
+		for (const VariableDeclaration *f : t->fields) {
+			out.push_back(std::make_pair(f->name, Definition{f->linenum, f->colnum, describe(f), t->name, f->type}));
+		}
+		for (const Routine *r : t->routines) {
+			out.push_back(std::make_pair(r->name, Definition{r->linenum, r->colnum, describe(r), "", nullptr}));
+		}
+	}
+	for (const Namespace *n : program->namespaces) {
+		if (n->contents != nullptr) {
+			collectDefinitions(n->contents, out);
+		}
+	}
+}
+
+
+// Finds the local variable or parameter that a name refers to at a position in a routine.
+// Statements only record where they start, so a statement is taken to run until the next one starts.
+class LocalScope {
+
+	public:
+
+		bool parameter;		// Whether what was found is a parameter, which is given the position of its routine.
+
+		const Definition* find(const Routine *routine, const std::string &n, unsigned line, unsigned column) {
+			name = n;
+			at = std::make_pair(line, column);
+			found = false;
+			for (const Parameter *p : routine->params) {
+				if (p->name == name) {
+					definition = Definition{routine->linenum, routine->colnum, (p->type == nullptr ? "" : p->type->spelling() + " ") + p->name, "", p->type};
+					found = true;
+				}
+			}
+			parameter = found;
+			statement(routine->body, END);
+			return found ? &definition : nullptr;
+		}
+
+	private:
+
+		typedef std::pair<unsigned, unsigned> Position;
+
+		const Position END = std::make_pair(UINT_MAX, UINT_MAX);
+
+		std::string name;
+		Position at;
+		bool found;
+		Definition definition;
+
+		static Position start(const Statement *s) {
+			return std::make_pair(s->linenum, s->colnum);
+		}
+
+		void declared(const VariableDeclaration *v) {
+			if (v != nullptr && v->name == name && std::make_pair(v->linenum, v->colnum) <= at) {
+				definition = Definition{v->linenum, v->colnum, describe(v), "", v->type};
+				found = true;
+				parameter = false;
+			}
+		}
+
+		// Statements in a block, which ends where end is.
+		void block(const std::vector<Statement*> &body, Position end) {
+			if (at >= end) {
+				return;
+			}
+			for (unsigned i = 0; i < body.size(); i++) {
+				Position next = i + 1 < body.size() ? start(body[i + 1]) : end;
+				if (body[i]->kind == DECLARATION_STMT) {
+					declared(body[i]->decl);
+				}
+				if (start(body[i]) <= at && at < next) {
+					statement(body[i], next);
+				}
+			}
+		}
+
+		void statement(const Statement *s, Position end) {
+			if (s == nullptr || at < start(s) || at >= end) {
+				return;
+			}
+			switch (s->kind) {
+				case (BLOCK_STMT) :
+				case (SWITCH_STMT) : {
+					block(s->body, end);
+					break;
+				}
+				case (IF_STMT) : {
+					statement(s->then, s->otherwise == nullptr ? end : start(s->otherwise));
+					statement(s->otherwise, end);
+					break;
+				}
+				case (WHILE_STMT) : {
+					statement(s->then, end);
+					break;
+				}
+				case (FOR_STMT) : {
+					if (s->init != nullptr && s->init->kind == DECLARATION_STMT) {
+						declared(s->init->decl);
+					}
+					statement(s->then, end);
+					break;
+				}
+				case (FOREACH_STMT) : {
+					declared(s->decl);
+					statement(s->then, end);
+					break;
+				}
+				default : {}
+			}
+		}
+};
+
+
+// An open document.
+struct Document {
+	std::string uri;
+	std::string path;							// The name diagnostics are printed with.
+	std::string text;
+	std::vector<size_t> lines;					// Where each line starts in the text.
+	std::vector<Piece*> pieces;					// From the compilation database, which keeps them.
+	unsigned revision = 0;						// Goes up with every edit.
+
+	// What is worked out from the pieces when it is first asked for, and kept until the next edit.
+	unsigned indexed = UINT_MAX;				// The revision the index is for.
+	std::unordered_multimap<std::string, Definition> index;
+
+	// The global names of each piece, by the piece's id, with the line the piece was on when they were found.
+	std::unordered_map<unsigned long long, std::pair<unsigned, std::vector<std::pair<std::string, Definition>>>> definitions;
+
+	std::vector<Diagnostic> semantic;			// From checking the whole document when it was opened or saved.
+};
+
+
+// A language server, which an editor runs to ask about the programs it has open. It talks the language server
+// protocol on standard input and output, and answers with diagnostics, the declarations names refer to, and what
+// they are when the mouse is over them.
+//
+// Answers are worked out on demand, and only from what an edit has changed. The documents are kept in a
+// compilation database, which splits each into pieces of whole declarations that are parsed on their own and kept
+// by their text, so an edit parses just the pieces it touched; what is built from all of them, like the index of
+// global names, is built when a question first needs it after an edit. Syntax errors are found as the document
+// changes, one for each piece. Semantic errors need the program lowered, so that is only done when the document is
+// opened or saved, and the database then lowers again just the routines an edit has affected.
+class LanguageServer {
+
+	public:
+
+		// Diagnostics come back as strings, but standard output is where the protocol goes, so anything else the
+		// compiler prints is sent to a temporary file to be dropped, and the protocol goes to a copy of it.
+		LanguageServer() : shuttingDown(false) {
+			out = fdopen(dup(1), "w");
+			capture = tmpfile();
+			if (capture != nullptr) {
+				dup2(fileno(capture), 1);
+			}
+		}
+
+		~LanguageServer() {
+			for (auto &d : documents) {
+				delete d.second;
+			}
+			if (capture != nullptr) {
+				fclose(capture);
+			}
+			if (out != nullptr) {
+				fclose(out);
+			}
+		}
+
+		// Answer messages until the client says to exit. Returns the exit status, which is only 0 if the client
+		// asked the server to shut down first.
+		int serve() {
+			if (out == nullptr || capture == nullptr) {
+				fprintf(stderr, "Error: the language server could not set up its output.\n");
+				return 1;
+			}
+			std::string body;
+			while (receive(body)) {
+				Json message;
+				if (!JsonReader(body).read(message)) {
+					fail(Json(), -32700, "The message isn't valid JSON.");
+					continue;
+				}
+				const std::string &method = message["method"].string;
+				const Json &id = message["id"];
+				const Json &params = message["params"];
+				if (method == "exit") {
+					return shuttingDown ? 0 : 1;
+				}
+				else if (method == "initialize") {
+					respond(id, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2,\"save\":true},"
+						"\"hoverProvider\":true,\"definitionProvider\":true},\"serverInfo\":{\"name\":\"compiler\"}}");
+				}
+				else if (method == "shutdown") {
+					shuttingDown = true;
+					respond(id, "null");
+				}
+				else if (method == "textDocument/didOpen") {
+					open(params["textDocument"]);
+				}
+				else if (method == "textDocument/didChange") {
+					change(params["textDocument"]["uri"].string, params["contentChanges"]);
+				}
+				else if (method == "textDocument/didSave") {
+					save(params["textDocument"]["uri"].string);
+				}
+				else if (method == "textDocument/didClose") {
+					close(params["textDocument"]["uri"].string);
+				}
+				else if (method == "textDocument/hover") {
+					respond(id, hover(params));
+				}
+				else if (method == "textDocument/definition") {
+					respond(id, definition(params));
+				}
+				else if (id.kind != JSON_NULL) {
+					fail(id, -32601, "The language server doesn't handle " + method + ".");
+				}
+			}
+			return 1;
+		}
+
+	private:
+
+		static const long long MAX_MESSAGE = 1 << 30;
+
+		FILE *out;
+		FILE *capture;
+		bool shuttingDown;
+		std::map<std::string, Document*> documents;
+		CompilationDatabase db;						// Which knows documents by their paths.
+
+
+		/* Messages */
+
+		// Read the body of the next message. Returns false at the end of the input.
+		bool receive(std::string &body) {
+			long long length = -1;
+			std::string header;
+			while (true) {
+				int c = getchar();
+				if (c == EOF) {
+					return false;
+				}
+				if (c != '\n') {
+					header += (char) c;
+					continue;
+				}
+				if (!header.empty() && header.back() == '\r') {
+					header.pop_back();
+				}
+				if (header.empty()) {
+					break;
+				}
+				if (strncasecmp(header.c_str(), "Content-Length:", 15) == 0) {
+					length = atoll(header.c_str() + 15);
+				}
+				header.clear();
+			}
+			if (length < 0 || length > MAX_MESSAGE) {
+				return false;
+			}
+			body.resize(length);
+			return fread(&body[0], 1, length, stdin) == (size_t) length;
+		}
+
+		void send(const std::string &json) {
+			fprintf(out, "Content-Length: %zu\r\n\r\n", json.size());
+			fwrite(json.data(), 1, json.size(), out);
+			fflush(out);
+		}
+
+		void respond(const Json &id, const std::string &result) {
+			std::string message = "{\"jsonrpc\":\"2.0\",\"id\":";
+			id.write(message);
+			send(message + ",\"result\":" + result + "}");
+		}
+
+		void fail(const Json &id, int code, const std::string &why) {
+			std::string message = "{\"jsonrpc\":\"2.0\",\"id\":";
+			id.write(message);
+			send(message + ",\"error\":{\"code\":" + std::to_string(code) + ",\"message\":" + jsonQuote(why) + "}}");
+		}
+
+		// What the compiler has printed since this was last called.
+		std::string captured() {
+			fflush(stdout);
+			std::cout.flush();
+			std::string ret;
+			int fd = fileno(capture);
+			struct stat status;
+			if (fstat(fd, &status) == 0 && status.st_size > 0) {
+				ret.resize(status.st_size);
+				ssize_t n = pread(fd, &ret[0], ret.size(), 0);
+				ret.resize(n < 0 ? 0 : n);
+			}
+			if (ftruncate(fd, 0) == 0) {
+				lseek(1, 0, SEEK_SET);
+			}
+			return ret;
+		}
+
+
+		/* Documents */
+
+		void open(const Json &item) {
+			const std::string &uri = item["uri"].string;
+			close(uri);
+			Document *d = new Document();
+			d->uri = uri;
+			d->path = pathOf(uri);
+			d->text = item["text"].string;
+			documents[uri] = d;
+			update(d);
+			d->semantic = check(d);
+			publish(d);
+		}
+
+		// Apply edits, each of which either replaces a range or, without one, the whole text.
+		void change(const std::string &uri, const Json &changes) {
+			auto i = documents.find(uri);
+			if (i == documents.end()) {
+				return;
+			}
+			Document *d = i->second;
+			for (const Json &c : changes.elements) {
+				const Json &range = c["range"];
+				if (range.kind == JSON_NULL) {
+					d->text = c["text"].string;
+				}
+				else {
+					size_t from = offset(d, range["start"]);
+					size_t to = offset(d, range["end"]);
+					d->text.replace(from, to < from ? 0 : to - from, c["text"].string);
+				}
+				findLines(d);
+			}
+
+			// What the last check found no longer lines up with the text.
+			d->semantic.clear();
+			update(d);
+			publish(d);
+		}
+
+		void save(const std::string &uri) {
+			auto i = documents.find(uri);
+			if (i != documents.end()) {
+				i->second->semantic = check(i->second);
+				publish(i->second);
+			}
+		}
+
+		void close(const std::string &uri) {
+			auto i = documents.find(uri);
+			if (i == documents.end()) {
+				return;
+			}
+			db.forget(i->second->path);
+			send("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":" + jsonQuote(uri) + ",\"diagnostics\":[]}}");
+			delete i->second;
+			documents.erase(i);
+		}
+
+		// Split the document into pieces again, parsing only the ones that are new.
+		void update(Document *d) {
+			findLines(d);
+			db.setText(d->path, d->text);
+			d->pieces = db.pieces(d->path);
+			d->revision++;
+		}
+
+		// Lower the whole document, and return the errors that aren't syntax errors, which the pieces have already
+		// found. Lowering runs the initializers of globals, which the interpreter stops if they run for too long.
+		std::vector<Diagnostic> check(const Document *d) {
+			std::string printed;
+			std::string ignored;
+			if (db.program(d->path, ignored) != nullptr && db.interfaces(d->path, printed)) {
+				db.module(d->path, printed);
+			}
+
+			// Anything else the compiler printed is dropped.
+			captured();
+			std::vector<Diagnostic> ret;
+			for (const Diagnostic &found : readDiagnostics(printed, d->path)) {
+				if (!found.warning) {
+					ret.push_back(found);
+				}
+			}
+			return ret;
+		}
+
+		void publish(const Document *d) {
+			std::string list;
+			auto add = [&](const Diagnostic &diagnostic, unsigned line) {
+				unsigned character = characterOf(d, line, diagnostic.column);
+				std::string position = "{\"line\":" + std::to_string(line) + ",\"character\":" + std::to_string(character) + "}";
+				list += list.empty() ? "" : ",";
+				list += "{\"range\":{\"start\":" + position + ",\"end\":" + position + "},\"severity\":" + (diagnostic.warning ? "2" : "1") +
+					",\"source\":\"compiler\",\"message\":" + jsonQuote(diagnostic.message) + "}";
+			};
+			for (const Piece *p : d->pieces) {
+				for (const Diagnostic &diagnostic : readDiagnostics(p->diagnostics, d->path)) {
+					add(diagnostic, diagnostic.line);
+				}
+			}
+			for (const Diagnostic &diagnostic : d->semantic) {
+				add(diagnostic, diagnostic.line);
+			}
+			send("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":" + jsonQuote(d->uri) + ",\"diagnostics\":[" + list + "]}}");
+		}
+
+
+		/* Questions */
+
+		std::string hover(const Json &params) {
+			std::vector<Definition> found;
+			resolve(params, found);
+			if (found.empty()) {
+				return "null";
+			}
+			return "{\"contents\":{\"kind\":\"markdown\",\"value\":" + jsonQuote("```\n" + found[0].description + "\n```") + "}}";
+		}
+
+		std::string definition(const Json &params) {
+			std::vector<Definition> found;
+			const Document *d = resolve(params, found);
+			std::string ret;
+			for (const Definition &s : found) {
+				std::string position = "{\"line\":" + std::to_string(s.line) + ",\"character\":" + std::to_string(characterOf(d, s.line, s.column)) + "}";
+				ret += ret.empty() ? "[" : ",";
+				ret += "{\"uri\":" + jsonQuote(d->uri) + ",\"range\":{\"start\":" + position + ",\"end\":" + position + "}}";
+			}
+			return ret.empty() ? "null" : ret + "]";
+		}
+
+		// Find the declarations that the name at a position in a document could refer to, with their positions in
+		// the document. Returns the document, or nullptr if it isn't open.
+		Document* resolve(const Json &params, std::vector<Definition> &found) {
+			auto i = documents.find(params["textDocument"]["uri"].string);
+			if (i == documents.end()) {
+				return nullptr;
+			}
+			Document *d = i->second;
+			unsigned line = params["position"]["line"].count();
+			if (line >= d->lines.size()) {
+				return d;
+			}
+
+			// The name under the cursor, and for a member the name it is selected from.
+			size_t at = offset(d, params["position"]);
+			size_t first = at;
+			size_t last = at;
+			while (first > d->lines[line] && nameCharacter(d->text[first - 1])) {
+				first--;
+			}
+			while (last < d->text.size() && nameCharacter(d->text[last])) {
+				last++;
+			}
+			if (first == last) {
+				return d;
+			}
+			std::string name = d->text.substr(first, last - first);
+			unsigned column = columnOf(d, line, first - d->lines[line]);
+			buildIndex(d);
+			if (first == d->lines[line] || d->text[first - 1] != '.') {
+				lookup(d, name, line, column, found);
+				return d;
+			}
+
+			// A field, of the class the object's declared type names if it can be told, or else of any class.
+			size_t dot = first - 1;
+			size_t object = dot;
+			while (object > d->lines[line] && nameCharacter(d->text[object - 1])) {
+				object--;
+			}
+			std::vector<Definition> objects;
+			if (object < dot) {
+				lookup(d, d->text.substr(object, dot - object), line, columnOf(d, line, object - d->lines[line]), objects);
+			}
+			const TypeName *type = objects.empty() ? nullptr : objects[0].type;
+			while (type != nullptr && type->kind == POINTER_TYPE) {
+				type = type->element;
+			}
+			auto range = d->index.equal_range(name);
+			for (auto s = range.first; s != range.second; s++) {
+				if (!s->second.owner.empty() && (type == nullptr || type->kind != NAMED_TYPE || s->second.owner == type->name)) {
+					found.push_back(s->second);
+				}
+			}
+			return d;
+		}
+
+		// The local variable or parameter a name refers to at a position, or if there isn't one, the globals.
+		void lookup(Document *d, const std::string &name, unsigned line, unsigned column, std::vector<Definition> &found) {
+			auto p = std::upper_bound(d->pieces.begin(), d->pieces.end(), line, [](unsigned l, const Piece *piece) {
+				return l < piece->line;
+			});
+			const Piece *piece = p == d->pieces.begin() ? nullptr : *(p - 1);
+			const Routine *routine = piece == nullptr || piece->ast == nullptr ? nullptr : enclosingRoutine(piece->ast, line, column);
+			if (routine != nullptr) {
+				LocalScope scope;
+				const Definition *local = scope.find(routine, name, line, column);
+				if (local != nullptr) {
+					found.push_back(*local);
+					if (scope.parameter) {
+						findParameter(d, name, found.back());
+					}
+					return;
+				}
+			}
+			auto range = d->index.equal_range(name);
+			for (auto s = range.first; s != range.second; s++) {
+				if (s->second.owner.empty()) {
+					found.push_back(s->second);
+				}
+			}
+		}
+
+		// Parameters don't record where they are, so move a parameter's definition from the start of its routine to
+		// the first time its name appears after that, which is in the routine's signature.
+		static void findParameter(const Document *d, const std::string &name, Definition &parameter) {
+			size_t at = d->lines[parameter.line] + characterOf(d, parameter.line, parameter.column);
+			while ((at = d->text.find(name, at)) != std::string::npos) {
+				if ((at == 0 || !nameCharacter(d->text[at - 1])) && (at + name.size() == d->text.size() || !nameCharacter(d->text[at + name.size()]))) {
+					parameter.line = std::upper_bound(d->lines.begin(), d->lines.end(), at) - d->lines.begin() - 1;
+					parameter.column = columnOf(d, parameter.line, at - d->lines[parameter.line]);
+					return;
+				}
+				at += name.size();
+			}
+		}
+
+		// The global names of every piece, where they are in the document now.
+		void buildIndex(Document *d) {
+			if (d->indexed == d->revision) {
+				return;
+			}
+			d->index.clear();
+			std::unordered_map<unsigned long long, std::pair<unsigned, std::vector<std::pair<std::string, Definition>>>> kept;
+			for (const Piece *p : d->pieces) {
+				auto &found = kept[p->id];
+				auto before = d->definitions.find(p->id);
+				if (before != d->definitions.end()) {
+					found.swap(before->second);
+				}
+				else {
+					found.first = p->line;
+					if (p->ast != nullptr) {
+						collectDefinitions(p->ast, found.second);
+					}
+				}
+				for (const auto &s : found.second) {
+					auto added = d->index.insert(s);
+					added->second.line += p->line - found.first;
+				}
+			}
+			d->definitions.swap(kept);
+			d->indexed = d->revision;
+		}
+
+		// The routine with a body that is declared last before a position.
+		static const Routine* enclosingRoutine(const Program *program, unsigned line, unsigned column) {
+			const Routine *ret = nullptr;
+			auto consider = [&](const Routine *r) {
+				if (r->hasBody && std::make_pair(r->linenum, r->colnum) <= std::make_pair(line, column) &&
+					(ret == nullptr || std::make_pair(ret->linenum, ret->colnum) < std::make_pair(r->linenum, r->colnum))) {
+					ret = r;
+				}
+			};
+			for (const Routine *r : program->routines) {
+				consider(r);
+			}
+			for (const TypeDeclaration *t : program->typeDecls) {
+				for (const Routine *r : t->routines) {
+					consider(r);
+				}
+			}
+			for (const Namespace *n : program->namespaces) {
+				if (n->contents != nullptr) {
+					const Routine *inner = enclosingRoutine(n->contents, line, column);
+					if (inner != nullptr) {
+						consider(inner);
+					}
+				}
+			}
+			return ret;
+		}
+
+
+		/* Positions */
+
+		static bool nameCharacter(char c) {
+			return isalnum((unsigned char) c) || c == '_' || (unsigned char) c >= 0x80;
+		}
+
+		static std::string pathOf(const std::string &uri) {
+			std::string ret;
+			size_t i = uri.compare(0, 7, "file://") == 0 ? 7 : 0;
+			for (; i < uri.size(); i++) {
+				if (uri[i] == '%' && i + 2 < uri.size() && isxdigit((unsigned char) uri[i + 1]) && isxdigit((unsigned char) uri[i + 2])) {
+					ret += (char) strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16);
+					i += 2;
+				}
+				else {
+					ret += uri[i];
+				}
+			}
+			return ret;
+		}
+
+		static void findLines(Document *d) {
+			d->lines.assign(1, 0);
+			for (size_t i = 0; i < d->text.size(); i++) {
+				if (d->text[i] == '\n') {
+					d->lines.push_back(i + 1);
+				}
+			}
+		}
+
+		// The offset in the text of a position from the client.
+		// Characters are counted as bytes, which is right as long as the text is ASCII.
+		static size_t offset(const Document *d, const Json &position) {
+			unsigned line = position["line"].count();
+			if (line >= d->lines.size()) {
+				return d->text.size();
+			}
+			size_t end = line + 1 < d->lines.size() ? d->lines[line + 1] : d->text.size();
+			return std::min(d->lines[line] + (size_t) position["character"].count(), end);
+		}
+
+		// The lexer's column for the character at an index in a line, and the other way around.
+		static unsigned columnOf(const Document *d, unsigned line, size_t character) {
+			unsigned column = 0;
+			for (size_t i = d->lines[line]; i < d->lines[line] + character && i < d->text.size(); i++) {
+				column += d->text[i] == '\t' ? TAB_WIDTH - (column & (TAB_WIDTH - 1)) : 1;
+			}
+			return column;
+		}
+
+		static unsigned characterOf(const Document *d, unsigned line, unsigned column) {
+			if (line >= d->lines.size()) {
+				return 0;
+			}
+			unsigned character = 0;
+			unsigned at = 0;
+			for (size_t i = d->lines[line]; at < column && i < d->text.size() && d->text[i] != '\n'; i++) {
+				at += d->text[i] == '\t' ? TAB_WIDTH - (at & (TAB_WIDTH - 1)) : 1;
+				character++;
+			}
+			return character;
+		}
+};
+
+#endif
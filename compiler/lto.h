@@ -0,0 +1,226 @@
+#ifndef LTO
+#define LTO
+
+#include "includes.h"
+
+
+// The IR that --lto puts in an object: the build of the compiler that wrote it, which has to be the one that links
+// it, and then the module as writeModule writes it.
+std::vector<unsigned char> embeddedIR(const IRModule &module) {
+	std::vector<unsigned char> ret;
+	ByteWriter out(ret);
+	out.string(compilerBuild());
+	writeModule(out, module);
+	return ret;
+}
+
+
+// Link-time optimization. Objects compiled with --lto carry their IR, and linking them with --lto-link reads it
+// back, links it into one module and optimizes that as the whole program, before one object is generated for it.
+// Calls to routines in other objects can then be inlined, calls through interfaces that only have one routine they
+// could go to are made straight to it, and routines that nothing reaches are dropped.
+// Linking with --thin-lto-link splits the optimizing into a partition for each object, and optimizes as many at
+// once as there are jobs. Only the whole-program passes, which are cheap, see the whole program. Each partition has
+// copies of the small routines from other objects that its routines call, so that they can be inlined, and keeps
+// only its own routines once it has been optimized.
+class LinkTimeOptimizer {
+
+	public:
+
+		PassManager passes;				// The passes run on the whole program.
+
+		LinkTimeOptimizer(bool o, FILE *report) : optimize(o), vectorizeReport(report) {}
+
+		~LinkTimeOptimizer() {
+			for (IRModule *m : objects) {
+				delete m;
+			}
+		}
+
+		// Read the IR of each object. Returns false, having said why, if one of them has none that can be used.
+		bool load(const std::vector<std::string> &paths) {
+			TraceScope trace("load IR");
+			for (const std::string &path : paths) {
+				std::vector<unsigned char> contents;
+				if (!readSection(path, ".ir", contents)) {
+					printf("Error: %s has no IR to link; compile it with --lto.\n", path.c_str());
+					return false;
+				}
+				trace.bytes += contents.size();
+				IRModule *module = new IRModule();
+				objects.push_back(module);
+				ByteReader in(contents.data(), contents.size());
+				if (in.string() != compilerBuild()) {
+					printf("Error: %s was compiled by another build of the compiler, so it has to be compiled again.\n", path.c_str());
+					return false;
+				}
+				if (!readModule(in, module) || !in.done()) {
+					printf("Error: the IR in %s is damaged.\n", path.c_str());
+					return false;
+				}
+			}
+
+			// Like the system linker, only local symbols can be defined by more than one object.
+			std::map<std::string, unsigned> definedIn;
+			for (unsigned p = 0; p < objects.size(); p++) {
+				for (const Symbol &s : objects[p]->symbols) {
+					if (s.kind == EXTERNAL_SYMBOL || IRModule::isLocal(s.name)) {
+						continue;
+					}
+					auto found = definedIn.insert(std::make_pair(s.name, p));
+					if (!found.second) {
+						printf("Error: %s is defined in both %s and %s.\n", s.name.c_str(), paths[found.first->second].c_str(), paths[p].c_str());
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		// Link the objects into one module and optimize it as a whole. Returns nullptr if verification found a pass
+		// that broke the IR. The module is the caller's to free.
+		IRModule* link() {
+			IRModule *ret = new IRModule();
+			for (const IRModule *m : objects) {
+				ret->link(*m);
+			}
+			if (optimize) {
+				passes.add(new Devirtualization());
+				addStandardPasses(passes, vectorizeReport);
+			}
+			passes.add(new DeadRoutineElimination());
+			if (!passes.run(ret)) {
+				delete ret;
+				return nullptr;
+			}
+			return ret;
+		}
+
+		// Link the objects as link does, but optimize a partition for each object, on as many threads as jobs says.
+		// The result is the same whatever the number of threads.
+		IRModule* linkPartitioned(unsigned jobs) {
+			IRModule *whole = new IRModule();
+			std::map<std::string, unsigned> owner;			// The object that each routine was taken from.
+			for (unsigned p = 0; p < objects.size(); p++) {
+				unsigned before = whole->functions.size();
+				whole->link(*objects[p]);
+				for (unsigned k = before; k < whole->functions.size(); k++) {
+					owner[whole->functions[k]->name] = p;
+				}
+			}
+			if (optimize) {
+				passes.add(new Devirtualization());
+			}
+			passes.add(new DeadRoutineElimination());
+			if (!passes.run(whole)) {
+				delete whole;
+				return nullptr;
+			}
+			if (!optimize) {
+				return whole;
+			}
+
+			std::vector<IRModule*> partitions;
+			std::vector<std::vector<bool>> own;
+			{
+				TraceScope trace("partition");
+				for (unsigned p = 0; p < objects.size(); p++) {
+					std::vector<bool> chosen(whole->functions.size(), false);
+					std::vector<unsigned> work;
+					for (unsigned k = 0; k < whole->functions.size(); k++) {
+						if (owner[whole->functions[k]->name] == p) {
+							chosen[k] = true;
+							work.push_back(k);
+						}
+					}
+					while (!work.empty()) {
+						const Function *f = whole->functions[work.back()];
+						work.pop_back();
+						for (const BasicBlock &b : f->blocks) {
+							for (ValueId v : b.code) {
+								const Function *callee = Inliner::directCallee(whole, f, v);
+								unsigned k = callee == nullptr ? 0 : whole->symbols[callee->symbol].index;
+								if (callee != nullptr && !chosen[k] && Inliner::cost(callee) <= IMPORT_LIMIT) {
+									chosen[k] = true;
+									work.push_back(k);
+								}
+							}
+						}
+					}
+					IRModule *partition = new IRModule();
+					partition->link(*whole, &chosen);
+					own.push_back(std::vector<bool>());
+					for (const Function *f : partition->functions) {
+						own.back().push_back(owner[f->name] == p);
+					}
+					partitions.push_back(partition);
+				}
+			}
+			delete whole;
+
+			// What the vectorizer says about each partition is kept until they are all done, so that it comes out in
+			// the same order every time.
+			std::vector<std::string> reports(partitions.size());
+			std::vector<char> ok(partitions.size(), 1);
+			std::atomic<unsigned> next(0);
+			auto work = [&]() {
+				for (unsigned p = next++; p < partitions.size(); p = next++) {
+					char *buffer = nullptr;
+					size_t size = 0;
+					FILE *report = vectorizeReport == nullptr ? nullptr : open_memstream(&buffer, &size);
+					PassManager partitionPasses;
+					partitionPasses.verifyEach = passes.verifyEach;
+					addStandardPasses(partitionPasses, report);
+					ok[p] = partitionPasses.run(partitions[p]);
+					if (report != nullptr) {
+						fclose(report);
+						reports[p].assign(buffer, size);
+						free(buffer);
+					}
+				}
+			};
+			{
+				TraceScope trace("optimize partitions");
+				jobs = std::max(1u, std::min(jobs, (unsigned) partitions.size()));
+				std::vector<std::thread> threads;
+				for (unsigned t = 1; t < jobs; t++) {
+					threads.push_back(std::thread(work));
+				}
+				work();
+				for (std::thread &t : threads) {
+					t.join();
+				}
+			}
+
+			IRModule *ret = new IRModule();
+			bool verified = true;
+			for (unsigned p = 0; p < partitions.size(); p++) {
+				if (vectorizeReport != nullptr) {
+					fputs(reports[p].c_str(), vectorizeReport);
+				}
+				verified = verified && ok[p];
+				ret->link(*partitions[p], &own[p]);
+				delete partitions[p];
+			}
+			// Routines that were inlined everywhere they were called from aren't needed any more.
+			DeadRoutineElimination strip;
+			strip.run(ret);
+			if (!verified) {
+				delete ret;
+				return nullptr;
+			}
+			return ret;
+		}
+
+	private:
+
+		// The largest routine copied into another partition, in instructions. It is more than the inliner takes,
+		// other than for routines with constant arguments, so that what it would take is there to be taken.
+		static const unsigned IMPORT_LIMIT = 48;
+
+		bool optimize;
+		FILE *vectorizeReport;
+		std::vector<IRModule*> objects;
+};
+
+#endif
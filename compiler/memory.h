@@ -0,0 +1,119 @@
+#ifndef MEMORY
+#define MEMORY
+
+#include "includes.h"
+
+
+// The number of allocations made with new over the whole run, and how many bytes they asked for. Code generation
+// allocates from several threads at once, so these are atomic, though nothing orders one count against another.
+std::atomic<unsigned long long> allocationCount(0);
+std::atomic<unsigned long long> allocationBytes(0);
+
+// These are never inlined, so that every caller sees new matched with delete. Inlined, they would show GCC a
+// pointer from new reaching free and warn under -Wmismatched-new-delete, though each new here pairs with a delete.
+__attribute__((noinline)) void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	void *p = malloc(size == 0 ? 1 : size);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+__attribute__((noinline)) void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	return malloc(size == 0 ? 1 : size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+
+// Where a subsystem of the compiler gets its memory from, keeping count of what it has taken so that --stats can
+// show how much each one uses and whether it gave everything back. It allocates with the global new, so that it is
+// counted in the totals too. Each subsystem has one global allocator, which its classes name at compile time by
+// inheriting from AllocatedFrom, so objects can be made and freed anywhere without carrying an allocator around.
+class Allocator {
+
+	public:
+
+		const char *name;
+		unsigned long long allocations;
+		unsigned long long bytes;		// The total asked for over the whole run.
+		unsigned long long live;		// The bytes allocated and not yet freed.
+		unsigned long long peak;		// The most that was live at once.
+
+		Allocator(const char *n) : name(n), allocations(0), bytes(0), live(0), peak(0) {}
+
+		void* allocate(size_t size) {
+			allocations++;
+			bytes += size;
+			live += size;
+			peak = live > peak ? live : peak;
+			return ::operator new(size);
+		}
+
+		void deallocate(void *p, size_t size) {
+			if (p != nullptr) {
+				live -= size;
+				::operator delete(p);
+			}
+		}
+
+		// Make an object of a type that doesn't choose its own allocator, such as the value of a token.
+		template <typename T, typename... Args>
+		T* make(Args&&... args) {
+			return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+		}
+
+		// Destroy an object that came from make.
+		template <typename T>
+		void destroy(T *p) {
+			if (p != nullptr) {
+				p->~T();
+				deallocate(p, sizeof(T));
+			}
+		}
+};
+
+// Tokens and their values, which the lexer makes and the parser frees once it has used them.
+Allocator tokenMemory("tokens");
+
+// The syntax tree: the declarations, statements, expressions and types that the parser builds.
+Allocator syntaxMemory("syntax trees");
+
+// Inheriting from this makes new and delete of a class go through an allocator, wherever the objects are made.
+// Neither is inlined either, or GCC would see the class's delete given a pointer from the global new underneath.
+template <Allocator &memory>
+struct AllocatedFrom {
+	__attribute__((noinline)) static void* operator new(size_t size) {
+		return memory.allocate(size);
+	}
+
+	__attribute__((noinline)) static void operator delete(void *p, size_t size) {
+		memory.deallocate(p, size);
+	}
+};
+
+
+// Print what each subsystem allocated, and everything allocated with new, theirs included, for comparison. Memory still
+// live once everything has been freed was leaked, except that a compile server keeps the syntax trees it has
+// parsed for the next compile, which treesKept says.
+void printMemoryStats(FILE *out, bool treesKept) {
+	const Allocator *subsystems[] = {&tokenMemory, &syntaxMemory};
+	fprintf(out, "%-14s %12s %14s %12s %12s\n", "memory", "allocations", "bytes", "peak", "live");
+	for (const Allocator *a : subsystems) {
+		fprintf(out, "%-14s %12llu %14llu %12llu %12llu%s\n", a->name, a->allocations, a->bytes, a->peak, a->live,
+			treesKept && a == &syntaxMemory ? " (kept for the next compile)" : "");
+	}
+	fprintf(out, "%-14s %12llu %14llu\n", "all", allocationCount.load(), allocationBytes.load());
+}
+
+#endif
@@ -0,0 +1,2910 @@
+#ifndef OPTIMIZE
+#define OPTIMIZE
+
+#include "includes.h"
+
+
+/* Analyses */
+
+// The immediate dominator of each block, or ~0u for blocks that can't be reached. The entry is its own.
+// Uses the iterative algorithm of Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+std::vector<unsigned> immediateDominators(const Function *f) {
+	std::vector<unsigned> order = f->reversePostorder();
+	std::vector<unsigned> position(f->blocks.size(), ~0u);
+	for (unsigned i = 0; i < order.size(); i++) {
+		position[order[i]] = i;
+	}
+	std::vector<unsigned> idom(f->blocks.size(), ~0u);
+	idom[0] = 0;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (unsigned i = 1; i < order.size(); i++) {
+			unsigned b = order[i];
+			unsigned newIdom = ~0u;
+			for (unsigned p : f->blocks[b].preds) {
+				if (idom[p] == ~0u) {
+					continue;
+				}
+				if (newIdom == ~0u) {
+					newIdom = p;
+					continue;
+				}
+				unsigned x = p;
+				unsigned y = newIdom;
+				while (x != y) {
+					while (position[x] > position[y]) {
+						x = idom[x];
+					}
+					while (position[y] > position[x]) {
+						y = idom[y];
+					}
+				}
+				newIdom = x;
+			}
+			if (newIdom != idom[b]) {
+				idom[b] = newIdom;
+				changed = true;
+			}
+		}
+	}
+	return idom;
+}
+
+// Whether block a dominates block b.
+bool dominates(const std::vector<unsigned> &idom, unsigned a, unsigned b) {
+	if (idom[b] == ~0u) {
+		return false;
+	}
+	while (b != a && b != 0) {
+		b = idom[b];
+	}
+	return b == a;
+}
+
+// Whether removing an instruction whose value isn't used would change what the program does.
+bool hasSideEffects(const Instruction &i) {
+	return i.op == OP_STORE || i.op == OP_COPY || i.op == OP_CALL || isTerminator(i.op);
+}
+
+// Whether the address of any of a function's stack slots can get anywhere but its own loads and stores, so
+// that something may still use the slot after the function is done with it. Addresses can be offset, chosen
+// between and compared, but not stored, passed, returned or turned into numbers.
+bool frameEscapes(const Function *f) {
+	std::vector<std::vector<ValueId>> users(f->values.size());
+	std::vector<ValueId> work;
+	for (const BasicBlock &b : f->blocks) {
+		for (ValueId v : b.code) {
+			const Instruction &i = f->values[v];
+			for (unsigned j = 0; j < i.count; j++) {
+				users[i.operands[j]].push_back(v);
+			}
+			if (i.op == OP_STACK) {
+				work.push_back(v);
+			}
+		}
+	}
+	std::vector<bool> seen(f->values.size(), false);
+	while (!work.empty()) {
+		ValueId address = work.back();
+		work.pop_back();
+		if (seen[address]) {
+			continue;
+		}
+		seen[address] = true;
+		for (ValueId u : users[address]) {
+			const Instruction &i = f->values[u];
+			if (i.op == OP_ADD || i.op == OP_PHI) {
+				work.push_back(u);
+			}
+			else if (i.op == OP_STORE && i.operands[1] == address) {
+				return true;
+			}
+			else if (i.op != OP_LOAD && i.op != OP_STORE && i.op != OP_COPY && !(i.op >= OP_EQ && i.op <= OP_UGE)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Whether all that is left after a call is to return its result, or nothing: the call is followed by a
+// return, or by a jump to a block that does nothing but return, perhaps through a phi.
+bool returnsCall(const Function *f, ValueId call) {
+	const std::vector<ValueId> &code = f->blocks[f->values[call].block].code;
+	auto at = std::find(code.begin(), code.end(), call);
+	if (at == code.end() || at + 1 == code.end()) {
+		return false;
+	}
+	ValueId result = call;
+	const Instruction *next = &f->values[*(at + 1)];
+	if (next->op == OP_JUMP) {
+		const std::vector<ValueId> &target = f->blocks[next->targets[0]].code;
+		if (target.size() == 2 && f->values[target[0]].op == OP_PHI) {
+			const Instruction &phi = f->values[target[0]];
+			for (unsigned j = 0; j < phi.count; j++) {
+				if (phi.incoming[j] == f->values[call].block && phi.operands[j] != call) {
+					return false;
+				}
+			}
+			result = target[0];
+		}
+		else if (target.size() != 1) {
+			return false;
+		}
+		next = &f->values[target.back()];
+	}
+	return next->op == OP_RETURN && (next->count == 0 || next->operands[0] == result);
+}
+
+// Whether what a symbol names never changes: a routine, or read-only data.
+bool isConstantSymbol(const IRModule *module, unsigned symbol) {
+	const Symbol &s = module->symbols[symbol];
+	return s.kind == ROUTINE_SYMBOL || (s.kind == DATA_SYMBOL && module->data[s.index]->readOnly);
+}
+
+// Whether a call is to a func and passes nothing but numbers, routines and read-only data such as the records
+// of closures that capture nothing, so that it depends on nothing but its arguments and does nothing but
+// produce its result. Such calls can be removed, merged, moved out of loops and run at compile time.
+bool isPureCall(const IRModule *module, const Function *f, const Instruction &i) {
+	if (i.op != OP_CALL || (i.flags & CALL_PURE) == 0 || i.type == IR_VOID) {
+		return false;
+	}
+	for (unsigned j = 1; j < i.count; j++) {
+		const Instruction &a = f->values[i.operands[j]];
+		if (a.type == IR_PTR && !(a.op == OP_SYMBOL && isConstantSymbol(module, a.imm))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Whether a call passes what a function takes and expects what it returns, as it might not when the function is
+// linked in from another module that the call's module only knew it by name.
+bool signatureMatches(const Function *f, const Instruction &call, const Function *callee) {
+	if (callee->params.size() + 1 > call.count) {
+		return false;
+	}
+	for (unsigned j = 0; j < callee->params.size(); j++) {
+		if (f->values[call.operands[j + 1]].type != callee->params[j]) {
+			return false;
+		}
+	}
+	return call.type == callee->returnType || call.type == IR_VOID || callee->returnType == IR_VOID;
+}
+
+// Check that a function is well formed, reporting anything wrong to out.
+bool verifyFunction(const Function *f, FILE *out) {
+	bool ok = true;
+	std::vector<unsigned> reachable = f->reversePostorder();
+	for (unsigned b : reachable) {
+		const std::vector<ValueId> &code = f->blocks[b].code;
+		if (f->terminator(b) == NO_VALUE) {
+			fprintf(out, "%s: b%u has no terminator\n", f->name.c_str(), b);
+			ok = false;
+		}
+		for (unsigned k = 0; k < code.size(); k++) {
+			const Instruction &i = f->values[code[k]];
+			if (i.block != b) {
+				fprintf(out, "%s: v%u is in b%u but thinks it is in b%u\n", f->name.c_str(), code[k], b, i.block);
+				ok = false;
+			}
+			if (isTerminator(i.op) && k + 1 != code.size()) {
+				fprintf(out, "%s: terminator v%u isn't at the end of b%u\n", f->name.c_str(), code[k], b);
+				ok = false;
+			}
+			if (i.op == OP_PHI && (k > 0 && f->values[code[k - 1]].op != OP_PHI)) {
+				fprintf(out, "%s: phi v%u comes after other instructions in b%u\n", f->name.c_str(), code[k], b);
+				ok = false;
+			}
+			if (i.op == OP_PHI && i.count != f->blocks[b].preds.size()) {
+				fprintf(out, "%s: phi v%u has %u operands but b%u has %zu predecessors\n", f->name.c_str(), code[k], i.count, b, f->blocks[b].preds.size());
+				ok = false;
+			}
+			for (unsigned j = 0; j < i.count; j++) {
+				ValueId o = i.operands[j];
+				if (o >= f->values.size() || f->values[o].op == OP_NOP || f->values[o].block == ~0u) {
+					fprintf(out, "%s: v%u uses v%u, which doesn't exist\n", f->name.c_str(), code[k], o);
+					ok = false;
+				}
+			}
+		}
+	}
+	for (unsigned b : reachable) {
+		for (unsigned s : f->successors(b)) {
+			const std::vector<unsigned> &preds = f->blocks[s].preds;
+			if (std::find(preds.begin(), preds.end(), b) == preds.end()) {
+				fprintf(out, "%s: b%u jumps to b%u but isn't one of its predecessors\n", f->name.c_str(), b, s);
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+
+
+/* Passes */
+
+// A transformation of a module.
+class Pass {
+
+	public:
+
+		virtual ~Pass() {}
+
+		virtual const char* name() const = 0;
+
+		// Returns whether anything was changed.
+		virtual bool run(IRModule *module) = 0;
+};
+
+
+// A pass that works on one function at a time.
+class FunctionPass : public Pass {
+
+	public:
+
+		bool run(IRModule *m) {
+			module = m;
+			bool changed = false;
+			for (Function *f : module->functions) {
+				if (!f->blocks.empty()) {
+					changed = runOnFunction(f) || changed;
+				}
+			}
+			return changed;
+		}
+
+		virtual bool runOnFunction(Function *f) = 0;
+
+	protected:
+
+		IRModule *module;
+
+		FunctionPass() : module(nullptr) {}
+};
+
+
+// Constant propagation and folding.
+// Arithmetic on constants is done at compile time, algebraic identities like x + 0 are simplified, phis whose
+// operands all agree are replaced by that operand, and branches on constants become jumps. Working in reverse
+// postorder lets constants flow forward through a whole function in one sweep.
+class ConstantFolding : public FunctionPass {
+
+	public:
+
+		const char* name() const {
+			return "fold";
+		}
+
+		bool runOnFunction(Function *f) {
+			bool changed = false;
+			std::vector<ValueId> replacement(f->values.size(), NO_VALUE);
+			for (unsigned b : f->reversePostorder()) {
+				std::vector<ValueId> code = f->blocks[b].code;
+				for (ValueId v : code) {
+					if (f->values[v].op == OP_NOP) {
+						continue;
+					}
+					for (unsigned j = 0; j < f->values[v].count; j++) {
+						f->values[v].operands[j] = Function::resolve(replacement, f->values[v].operands[j]);
+					}
+					replacement.resize(f->values.size(), NO_VALUE);
+					ValueId to = NO_VALUE;
+					if (simplify(f, v, to)) {
+						changed = true;
+						if (to != NO_VALUE) {
+							replacement.resize(f->values.size(), NO_VALUE);
+							replacement[v] = to;
+						}
+					}
+				}
+			}
+			if (changed) {
+				f->applyReplacements(replacement);
+				for (ValueId v = 0; v < replacement.size(); v++) {
+					if (replacement[v] != NO_VALUE && f->values[v].block != ~0u) {
+						f->remove(v);
+					}
+				}
+			}
+			return changed;
+		}
+
+	private:
+
+		// Make an instruction into a constant.
+		static void becomeConstant(Function *f, ValueId v, long long value) {
+			Instruction &i = f->values[v];
+			i.op = OP_CONST;
+			i.count = 0;
+			i.flags = 0;
+			i.imm = value;
+		}
+
+		// Put a new constant just before an instruction, or after the phis if the instruction is one.
+		static ValueId insertConstant(Function *f, ValueId before, IRType type, long long value) {
+			unsigned b = f->values[before].block;
+			ValueId ret = f->create(OP_CONST, type, nullptr, 0, value);
+			f->values[ret].block = b;
+			std::vector<ValueId> &code = f->blocks[b].code;
+			unsigned k = std::find(code.begin(), code.end(), before) - code.begin();
+			while (k < code.size() && f->values[code[k]].op == OP_PHI) {
+				k++;
+			}
+			code.insert(code.begin() + k, ret);
+			return ret;
+		}
+
+		// Try to simplify one instruction. Sets to if the instruction should be replaced by another value.
+		bool simplify(Function *f, ValueId v, ValueId &to) {
+			Instruction &i = f->values[v];
+			if (i.op == OP_PHI) {
+				return simplifyPhi(f, v, to);
+			}
+			if (i.op == OP_BRANCH) {
+				if (!f->isConstant(i.operands[0]) && i.targets[0] != i.targets[1]) {
+					return false;
+				}
+				unsigned taken = !f->isConstant(i.operands[0]) || f->values[i.operands[0]].imm != 0 ? i.targets[0] : i.targets[1];
+				unsigned other = taken == i.targets[0] ? i.targets[1] : i.targets[0];
+				i.op = OP_JUMP;
+				i.count = 0;
+				i.targets[0] = taken;
+				i.targets[1] = ~0u;
+				f->removeEdge(i.block, other);
+				return true;
+			}
+			if (i.op == OP_LOAD) {
+				return simplifyLoad(f, v);
+			}
+			if (!isArithmetic(i.op)) {
+				return false;
+			}
+
+			IRType operandType = f->values[i.operands[0]].type;
+			bool allConstant = true;
+			long long args[2] = {0, 0};
+			for (unsigned j = 0; j < i.count && j < 2; j++) {
+				allConstant = allConstant && f->isConstant(i.operands[j]);
+				args[j] = f->values[i.operands[j]].imm;
+			}
+			if (allConstant) {
+				long long result;
+				if (evaluate(i.op, i.type, i.flags, operandType, args, result)) {
+					becomeConstant(f, v, result);
+					return true;
+				}
+				return false;
+			}
+			if (i.count != 2 || irFloat(operandType) || irVector(operandType)) {
+				return false;
+			}
+
+			// Constants go on the right of commutative operations.
+			if (isCommutative(i.op) && f->isConstant(i.operands[0])) {
+				std::swap(i.operands[0], i.operands[1]);
+			}
+			ValueId x = i.operands[0];
+			ValueId y = i.operands[1];
+			if (x == y) {
+				switch (i.op) {
+					case (OP_SUB) :
+					case (OP_XOR) :
+					case (OP_NE) :
+					case (OP_LT) :
+					case (OP_GT) :
+					case (OP_ULT) :
+					case (OP_UGT) : {
+						becomeConstant(f, v, 0);
+						return true;
+					}
+					case (OP_EQ) :
+					case (OP_LE) :
+					case (OP_GE) :
+					case (OP_ULE) :
+					case (OP_UGE) : {
+						becomeConstant(f, v, 1);
+						return true;
+					}
+					case (OP_AND) :
+					case (OP_OR) : {
+						to = x;
+						return true;
+					}
+					default : {
+						return false;
+					}
+				}
+			}
+			if (!f->isConstant(y)) {
+				return false;
+			}
+			long long c = normalize(f->values[y].imm, operandType);
+			switch (i.op) {
+				case (OP_ADD) :
+				case (OP_SUB) : {
+					if (c == 0) {
+						to = x;
+						return true;
+					}
+					// (x + c1) + c2 is x + (c1 + c2), which keeps chains of address arithmetic short.
+					const Instruction &inner = f->values[x];
+					if (i.op == OP_ADD && inner.op == OP_ADD && inner.type == i.type && f->isConstant(inner.operands[1])) {
+						long long sum = normalize(f->values[inner.operands[1]].imm + c, operandType);
+						ValueId base = inner.operands[0];
+						ValueId k = insertConstant(f, v, f->values[y].type, sum);
+						Instruction &self = f->values[v];
+						self.operands[0] = base;
+						self.operands[1] = k;
+						return true;
+					}
+					return false;
+				}
+				case (OP_OR) :
+				case (OP_XOR) :
+				case (OP_SHL) :
+				case (OP_SHR) :
+				case (OP_USHR) : {
+					if (c == 0) {
+						to = x;
+						return true;
+					}
+					return false;
+				}
+				case (OP_MUL) : {
+					if (c == 1) {
+						to = x;
+						return true;
+					}
+					if (c == 0) {
+						becomeConstant(f, v, 0);
+						return true;
+					}
+					return false;
+				}
+				case (OP_DIV) :
+				case (OP_UDIV) : {
+					if (c == 1) {
+						to = x;
+						return true;
+					}
+					return false;
+				}
+				case (OP_AND) : {
+					if (c == 0) {
+						becomeConstant(f, v, 0);
+						return true;
+					}
+					if (c == -1) {
+						to = x;
+						return true;
+					}
+					return false;
+				}
+				default : {
+					return false;
+				}
+			}
+		}
+
+		// Loads from read-only data at a known offset, like a slot in a witness table, are replaced by what is there.
+		bool simplifyLoad(Function *f, ValueId v) {
+			Instruction &i = f->values[v];
+			ValueId address = i.operands[0];
+			long long offset = 0;
+			if (f->values[address].op == OP_ADD && f->isConstant(f->values[address].operands[1])) {
+				offset = f->values[f->values[address].operands[1]].imm;
+				address = f->values[address].operands[0];
+			}
+			if (f->values[address].op != OP_SYMBOL) {
+				return false;
+			}
+			const Symbol &symbol = module->symbols[f->values[address].imm];
+			if (symbol.kind != DATA_SYMBOL) {
+				return false;
+			}
+			const DataObject *d = module->data[symbol.index];
+			unsigned size = irSize(i.type);
+			if (irVector(i.type) || !d->readOnly || offset < 0 || (unsigned long long) offset + size > d->bytes.size()) {
+				return false;
+			}
+			for (const Relocation &r : d->relocations) {
+				if (r.offset == offset && i.type == IR_PTR && r.addend == 0) {
+					i.op = OP_SYMBOL;
+					i.count = 0;
+					i.imm = r.symbol;
+					return true;
+				}
+				if (r.offset < offset + size && offset < r.offset + 8) {
+					return false;
+				}
+			}
+			long long bits = 0;
+			memcpy(&bits, d->bytes.data() + offset, size);
+			if (i.type == IR_F32) {
+				float single;
+				memcpy(&single, &bits, sizeof(single));
+				bits = doubleBits(single, IR_F64);
+			}
+			else if (!irFloat(i.type)) {
+				bits = normalize(bits, i.type);
+			}
+			becomeConstant(f, v, bits);
+			return true;
+		}
+
+		bool simplifyPhi(Function *f, ValueId v, ValueId &to) {
+			const Instruction &i = f->values[v];
+			ValueId same = NO_VALUE;
+			bool identical = true;
+			bool constant = true;
+			for (unsigned j = 0; j < i.count; j++) {
+				ValueId o = i.operands[j];
+				if (o == v) {
+					continue;
+				}
+				if (same == NO_VALUE) {
+					same = o;
+				}
+				identical = identical && o == same;
+				constant = constant && f->isConstant(o) && f->values[o].imm == f->values[same].imm;
+			}
+			if (same == NO_VALUE) {
+				return false;
+			}
+			if (identical) {
+				to = same;
+				return true;
+			}
+			if (constant && f->isConstant(same)) {
+				// The constant may not dominate the phi, so a copy of it is made here.
+				to = insertConstant(f, v, i.type, f->values[same].imm);
+				return true;
+			}
+			return false;
+		}
+};
+
+
+// Dead code elimination.
+// Removes unreachable blocks, then instructions whose results are never used and which have no side effects,
+// and merges blocks that are joined by a jump with nothing else coming in.
+class DeadCodeElimination : public FunctionPass {
+
+	public:
+
+		const char* name() const {
+			return "dce";
+		}
+
+		bool runOnFunction(Function *f) {
+			bool changed = removeUnreachable(f);
+			changed = mergeBlocks(f) || changed;
+			changed = removeUnused(f) || changed;
+			return changed;
+		}
+
+	private:
+
+		static void clearBlock(Function *f, unsigned b) {
+			for (ValueId v : f->blocks[b].code) {
+				Instruction &i = f->values[v];
+				i.op = OP_NOP;
+				i.count = 0;
+				i.block = ~0u;
+			}
+			f->blocks[b].code.clear();
+			f->blocks[b].preds.clear();
+		}
+
+		bool removeUnreachable(Function *f) {
+			std::vector<unsigned> order = f->reversePostorder();
+			std::vector<bool> reachable(f->blocks.size(), false);
+			for (unsigned b : order) {
+				reachable[b] = true;
+			}
+			bool changed = false;
+			for (unsigned b = 0; b < f->blocks.size(); b++) {
+				if (reachable[b] || (f->blocks[b].code.empty() && f->blocks[b].preds.empty())) {
+					continue;
+				}
+				for (unsigned s : f->successors(b)) {
+					const std::vector<unsigned> &preds = f->blocks[s].preds;
+					while (std::find(preds.begin(), preds.end(), b) != preds.end()) {
+						f->removeEdge(b, s);
+					}
+				}
+				clearBlock(f, b);
+				changed = true;
+			}
+			return changed;
+		}
+
+		bool mergeBlocks(Function *f) {
+			bool changed = false;
+			std::vector<ValueId> replacement(f->values.size(), NO_VALUE);
+			for (unsigned b = 0; b < f->blocks.size(); b++) {
+				while (true) {
+					ValueId t = f->terminator(b);
+					if (t == NO_VALUE || f->values[t].op != OP_JUMP) {
+						break;
+					}
+					unsigned s = f->values[t].targets[0];
+					if (s == b || s == 0 || f->blocks[s].preds.size() != 1) {
+						break;
+					}
+					// s only runs after b, so its code can go at the end of b.
+					f->remove(t);
+					std::vector<ValueId> code;
+					code.swap(f->blocks[s].code);
+					for (ValueId v : code) {
+						Instruction &i = f->values[v];
+						if (i.op == OP_PHI) {
+							replacement[v] = i.operands[0];
+							i.op = OP_NOP;
+							i.count = 0;
+							i.block = ~0u;
+						}
+						else {
+							i.block = b;
+							f->blocks[b].code.push_back(v);
+						}
+					}
+					f->blocks[s].preds.clear();
+					for (unsigned succ : f->successors(b)) {
+						f->replacePredecessor(succ, s, b);
+					}
+					changed = true;
+				}
+			}
+
+			// Blocks that only jump on are skipped over when their target has no phis to keep straight.
+			for (unsigned b = 1; b < f->blocks.size(); b++) {
+				const std::vector<ValueId> &code = f->blocks[b].code;
+				if (code.size() != 1 || f->values[code[0]].op != OP_JUMP) {
+					continue;
+				}
+				unsigned target = f->values[code[0]].targets[0];
+				if (target == b || (!f->blocks[target].code.empty() && f->values[f->blocks[target].code[0]].op == OP_PHI)) {
+					continue;
+				}
+				std::vector<unsigned> preds = f->blocks[b].preds;
+				for (unsigned p : preds) {
+					if (f->terminator(p) == NO_VALUE) {
+						continue;
+					}
+					Instruction &t = f->values[f->terminator(p)];
+					for (unsigned j = 0; j < 2; j++) {
+						if (t.targets[j] == b) {
+							t.targets[j] = target;
+							f->blocks[target].preds.push_back(p);
+						}
+					}
+				}
+				f->removeEdge(b, target);
+				clearBlock(f, b);
+				changed = true;
+			}
+			if (changed) {
+				f->applyReplacements(replacement);
+			}
+			return changed;
+		}
+
+		bool removeUnused(Function *f) {
+			std::vector<bool> live(f->values.size(), false);
+			std::vector<ValueId> work;
+			for (const BasicBlock &b : f->blocks) {
+				for (ValueId v : b.code) {
+					if (hasSideEffects(f->values[v]) && !isPureCall(module, f, f->values[v])) {
+						live[v] = true;
+						work.push_back(v);
+					}
+				}
+			}
+			while (!work.empty()) {
+				const Instruction &i = f->values[work.back()];
+				work.pop_back();
+				for (unsigned j = 0; j < i.count; j++) {
+					if (!live[i.operands[j]]) {
+						live[i.operands[j]] = true;
+						work.push_back(i.operands[j]);
+					}
+				}
+			}
+			bool changed = false;
+			for (BasicBlock &b : f->blocks) {
+				unsigned kept = 0;
+				for (ValueId v : b.code) {
+					if (live[v]) {
+						b.code[kept++] = v;
+					}
+					else {
+						Instruction &i = f->values[v];
+						i.op = OP_NOP;
+						i.count = 0;
+						i.block = ~0u;
+						changed = true;
+					}
+				}
+				b.code.resize(kept);
+			}
+			return changed;
+		}
+};
+
+
+// Global value numbering.
+// Walks the dominator tree, replacing each computation with an identical one that dominates it.
+// Loads are left alone since memory may change in between.
+class ValueNumbering : public FunctionPass {
+
+	public:
+
+		const char* name() const {
+			return "gvn";
+		}
+
+		bool runOnFunction(Function *f) {
+			std::vector<unsigned> idom = immediateDominators(f);
+			std::vector<std::vector<unsigned>> children(f->blocks.size());
+			for (unsigned b = 1; b < f->blocks.size(); b++) {
+				if (idom[b] != ~0u) {
+					children[idom[b]].push_back(b);
+				}
+			}
+			std::vector<ValueId> replacement(f->values.size(), NO_VALUE);
+			std::map<std::vector<long long>, ValueId> table;
+			bool changed = false;
+
+			// Each block's entries are taken out of the table once its subtree has been visited.
+			std::vector<std::pair<unsigned, bool>> stack;
+			std::vector<std::vector<std::vector<long long>>> added(f->blocks.size());
+			stack.push_back(std::make_pair(0u, false));
+			while (!stack.empty()) {
+				unsigned b = stack.back().first;
+				bool leaving = stack.back().second;
+				stack.pop_back();
+				if (leaving) {
+					for (const std::vector<long long> &key : added[b]) {
+						table.erase(key);
+					}
+					continue;
+				}
+				stack.push_back(std::make_pair(b, true));
+				for (ValueId v : f->blocks[b].code) {
+					Instruction &i = f->values[v];
+					for (unsigned j = 0; j < i.count; j++) {
+						i.operands[j] = Function::resolve(replacement, i.operands[j]);
+					}
+					if (!numbered(i) && !isPureCall(module, f, i)) {
+						continue;
+					}
+					std::vector<long long> k = key(f, v);
+					auto found = table.find(k);
+					if (found != table.end()) {
+						replacement[v] = found->second;
+						changed = true;
+					}
+					else {
+						table[k] = v;
+						added[b].push_back(k);
+					}
+				}
+				for (unsigned c : children[b]) {
+					stack.push_back(std::make_pair(c, false));
+				}
+			}
+			if (changed) {
+				f->applyReplacements(replacement);
+				for (ValueId v = 0; v < replacement.size(); v++) {
+					if (replacement[v] != NO_VALUE && f->values[v].block != ~0u) {
+						f->remove(v);
+					}
+				}
+			}
+			return changed;
+		}
+
+	private:
+
+		static bool numbered(const Instruction &i) {
+			return isArithmetic(i.op) || i.op == OP_CONST || i.op == OP_SYMBOL || i.op == OP_STACK || i.op == OP_PARAM || i.op == OP_PHI;
+		}
+
+		static std::vector<long long> key(const Function *f, ValueId v) {
+			const Instruction &i = f->values[v];
+			std::vector<long long> ret;
+			ret.push_back(i.op);
+			ret.push_back(i.type);
+			ret.push_back(i.flags);
+			ret.push_back(i.imm);
+			if (i.op == OP_CONVERT) {
+				ret.push_back(f->values[i.operands[0]].type);
+			}
+			if (i.op == OP_PHI) {
+				// Phis only match others in the same block with the same value along each edge.
+				ret.push_back(i.block);
+				for (unsigned j = 0; j < i.count; j++) {
+					ret.push_back(i.operands[j]);
+					ret.push_back(i.incoming[j]);
+				}
+				return ret;
+			}
+			std::vector<ValueId> operands(i.operands, i.operands + i.count);
+			if (isCommutative(i.op)) {
+				std::sort(operands.begin(), operands.end());
+			}
+			ret.insert(ret.end(), operands.begin(), operands.end());
+			return ret;
+		}
+};
+
+
+// Loop invariant code motion.
+// Computations in a loop whose operands all come from outside it are moved to just before the loop, so they
+// are done once instead of on every iteration. Calls to funcs are moved too, as long as they are made on every
+// iteration and the func comes back for any arguments, so that calling it once more when the loop turns out to
+// run no times is harmless. A func might not: it can divide by zero, fail a bounds check or loop forever.
+class LoopInvariantMotion : public FunctionPass {
+
+	public:
+
+		const char* name() const {
+			return "licm";
+		}
+
+		bool runOnFunction(Function *f) {
+			comesBack.clear();
+			std::vector<unsigned> idom = immediateDominators(f);
+			std::map<unsigned, std::vector<unsigned>> latches;
+			for (unsigned b : f->reversePostorder()) {
+				for (unsigned s : f->successors(b)) {
+					if (dominates(idom, s, b)) {
+						latches[s].push_back(b);
+					}
+				}
+			}
+			bool changed = false;
+			for (const auto &l : latches) {
+				changed = hoist(f, idom, l.first, l.second) || changed;
+			}
+			return changed;
+		}
+
+	private:
+
+		bool hoist(Function *f, std::vector<unsigned> &idom, unsigned header, const std::vector<unsigned> &latches) {
+			// The loop is the header and every block that reaches a latch without going through the header.
+			std::vector<bool> inLoop(f->blocks.size(), false);
+			inLoop[header] = true;
+			std::vector<unsigned> work(latches);
+			while (!work.empty()) {
+				unsigned b = work.back();
+				work.pop_back();
+				if (!inLoop[b]) {
+					inLoop[b] = true;
+					work.insert(work.end(), f->blocks[b].preds.begin(), f->blocks[b].preds.end());
+				}
+			}
+
+			unsigned preheader = ~0u;
+			for (unsigned p : f->blocks[header].preds) {
+				if (!inLoop[p]) {
+					if (preheader != ~0u && preheader != p) {
+						return false;
+					}
+					preheader = p;
+				}
+			}
+			if (preheader == ~0u) {
+				return false;
+			}
+			if (f->successors(preheader).size() != 1) {
+				// The block before the loop goes elsewhere too, so a block is made on the edge into the loop.
+				unsigned nb = f->addBlock();
+				Instruction &t = f->values[f->terminator(preheader)];
+				for (unsigned j = 0; j < 2; j++) {
+					if (t.targets[j] == header) {
+						t.targets[j] = nb;
+					}
+				}
+				f->replacePredecessor(header, preheader, nb);
+				f->blocks[nb].preds.push_back(preheader);
+				ValueId jump = f->create(OP_JUMP, IR_VOID, nullptr, 0);
+				f->values[jump].block = nb;
+				f->values[jump].targets[0] = header;
+				f->blocks[nb].code.push_back(jump);
+				idom.push_back(preheader);
+				inLoop.push_back(false);
+				preheader = nb;
+			}
+
+			bool changed = false;
+			for (unsigned b : f->reversePostorder()) {
+				if (!inLoop[b]) {
+					continue;
+				}
+				bool everyIteration = true;
+				for (unsigned l : latches) {
+					everyIteration = everyIteration && dominates(idom, b, l);
+				}
+				std::vector<ValueId> code = f->blocks[b].code;
+				for (ValueId v : code) {
+					const Instruction &i = f->values[v];
+					if (i.op == OP_PHI || isTerminator(i.op) || !canHoist(f, i, everyIteration)) {
+						continue;
+					}
+					bool invariant = true;
+					for (unsigned j = 0; j < i.count && invariant; j++) {
+						invariant = !inLoop[f->values[i.operands[j]].block];
+					}
+					if (!invariant) {
+						continue;
+					}
+					std::vector<ValueId> &from = f->blocks[b].code;
+					from.erase(std::find(from.begin(), from.end(), v));
+					std::vector<ValueId> &to = f->blocks[preheader].code;
+					to.insert(to.end() - 1, v);
+					f->values[v].block = preheader;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+
+		bool canHoist(const Function *f, const Instruction &i, bool everyIteration) {
+			switch (i.op) {
+				case (OP_CONST) :
+				case (OP_SYMBOL) :
+				case (OP_STACK) : {
+					return true;
+				}
+				case (OP_CALL) : {
+					return everyIteration && isPureCall(module, f, i) && returns(f, i);
+				}
+				case (OP_DIV) :
+				case (OP_UDIV) :
+				case (OP_MOD) :
+				case (OP_UMOD) : {
+					return safeDivision(f, i);
+				}
+				default : {
+					return isArithmetic(i.op);
+				}
+			}
+		}
+
+		// Division might trap, so it only counts as safe when the divisor is a constant that can't make it.
+		static bool safeDivision(const Function *f, const Instruction &i) {
+			const Instruction &divisor = f->values[i.operands[1]];
+			return divisor.op == OP_CONST && !irFloat(i.type) && normalize(divisor.imm, divisor.type) != 0 && normalize(divisor.imm, divisor.type) != -1;
+		}
+
+		// Whether a call always comes back, whatever its arguments.
+		bool returns(const Function *f, const Instruction &call) {
+			const Instruction &callee = f->values[call.operands[0]];
+			const Function *target = callee.op == OP_SYMBOL ? module->functionFor(callee.imm) : nullptr;
+			return target != nullptr && !target->blocks.empty() && returns(target);
+		}
+
+		// Whether a function always comes back: it has no trap, no division that might trap and no loop, and calls
+		// only functions that come back. Recursion is taken as something that might not.
+		bool returns(const Function *f) {
+			auto known = comesBack.find(f);
+			if (known != comesBack.end()) {
+				return known->second;
+			}
+			comesBack[f] = false;
+			std::vector<unsigned> order = f->reversePostorder();
+			std::vector<unsigned> position(f->blocks.size(), ~0u);
+			for (unsigned k = 0; k < order.size(); k++) {
+				position[order[k]] = k;
+			}
+			bool ret = true;
+			for (unsigned k = 0; k < order.size() && ret; k++) {
+				for (unsigned s : f->successors(order[k])) {
+					ret = ret && position[s] > k;
+				}
+				for (ValueId v : f->blocks[order[k]].code) {
+					const Instruction &i = f->values[v];
+					if (i.op == OP_TRAP || (i.op == OP_CALL && !returns(f, i))) {
+						ret = false;
+					}
+					else if ((i.op == OP_DIV || i.op == OP_UDIV || i.op == OP_MOD || i.op == OP_UMOD) && !safeDivision(f, i)) {
+						ret = false;
+					}
+				}
+			}
+			comesBack[f] = ret;
+			return ret;
+		}
+
+		std::map<const Function*, bool> comesBack;		// Whether each function looked at always comes back.
+};
+
+
+// Runs calls to funcs whose arguments are all constants at compile time.
+// Results are remembered, so each function and set of arguments is only worked out once.
+class PureCallFolding : public FunctionPass {
+
+	public:
+
+		unsigned folded;			// Calls replaced by their results.
+
+		PureCallFolding() : folded(0) {}
+
+		const char* name() const {
+			return "purecall";
+		}
+
+		bool runOnFunction(Function *f) {
+			Interpreter interpreter(module);
+			bool changed = false;
+			for (const BasicBlock &b : f->blocks) {
+				for (ValueId v : b.code) {
+					Instruction &i = f->values[v];
+					if (!isPureCall(module, f, i) || f->values[i.operands[0]].op != OP_SYMBOL) {
+						continue;
+					}
+					const Function *target = module->functionFor(f->values[i.operands[0]].imm);
+					if (target == nullptr) {
+						continue;
+					}
+					std::vector<long long> args;
+					bool constant = true;
+					for (unsigned j = 1; j < i.count && constant; j++) {
+						const Instruction &a = f->values[i.operands[j]];
+						if (a.op == OP_CONST) {
+							args.push_back(a.imm);
+						}
+						else if (a.op == OP_SYMBOL) {
+							args.push_back(module->symbols[a.imm].kind == DATA_SYMBOL ? Interpreter::dataValue(a.imm) : Interpreter::routineValue(a.imm));
+						}
+						else {
+							constant = false;
+						}
+					}
+					if (!constant) {
+						continue;
+					}
+					std::pair<const Function*, std::vector<long long>> key(target, args);
+					auto m = memo.find(key);
+					if (m == memo.end()) {
+						long long result = 0;
+						bool ok = interpreter.call(target, args, result);
+						m = memo.insert(std::make_pair(key, std::make_pair(ok, result))).first;
+					}
+					if (!m->second.first) {
+						continue;
+					}
+					long long result = m->second.second;
+					if (i.type == IR_PTR) {
+						// A func can return a routine or read-only data, which becomes a reference to its symbol.
+						unsigned symbol = 0;
+						if (!Interpreter::isRoutine(result, symbol) && !Interpreter::isData(result, symbol)) {
+							continue;
+						}
+						i.op = OP_SYMBOL;
+						i.imm = symbol;
+					}
+					else {
+						i.op = OP_CONST;
+						i.imm = result;
+					}
+					i.count = 0;
+					i.flags = 0;
+					folded++;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+
+	private:
+
+		std::map<std::pair<const Function*, std::vector<long long>>, std::pair<bool, long long>> memo;
+};
+
+
+// Tail recursion elimination.
+// A function that calls itself and then only returns what the call returns, or nothing, jumps back to its
+// start instead, with its parameters becoming phis that take the arguments of each such call. The
+// recursion then runs in constant stack and the loop passes can work on it. Stack slots are reused by every
+// iteration, so this is only done when nothing can hold on to their addresses.
+class TailRecursionElimination : public FunctionPass {
+
+	public:
+
+		unsigned eliminated;		// Calls turned into jumps.
+
+		TailRecursionElimination() : eliminated(0) {}
+
+		const char* name() const {
+			return "tailrec";
+		}
+
+		bool runOnFunction(Function *f) {
+			std::vector<ValueId> calls;
+			for (unsigned b : f->reversePostorder()) {
+				const std::vector<ValueId> &code = f->blocks[b].code;
+				if (code.size() < 2) {
+					continue;
+				}
+				ValueId call = code[code.size() - 2];
+				const Instruction &c = f->values[call];
+				if (c.op == OP_CALL && c.count == f->params.size() + 1 && f->values[c.operands[0]].op == OP_SYMBOL && f->values[c.operands[0]].imm == f->symbol && returnsCall(f, call)) {
+					calls.push_back(call);
+				}
+			}
+			if (calls.empty() || frameEscapes(f)) {
+				return false;
+			}
+
+			// Everything but the parameters moves to a new block that the calls can jump back to.
+			unsigned header = f->addBlock();
+			std::vector<ValueId> params(f->params.size(), NO_VALUE);
+			std::vector<ValueId> kept;
+			for (ValueId v : f->blocks[0].code) {
+				if (f->values[v].op == OP_PARAM) {
+					params[f->values[v].imm] = v;
+					kept.push_back(v);
+				}
+				else {
+					f->values[v].block = header;
+					f->blocks[header].code.push_back(v);
+				}
+			}
+			f->blocks[0].code = kept;
+			for (unsigned s : f->successors(header)) {
+				f->replacePredecessor(s, 0, header);
+			}
+			f->jump(0, header);
+
+			std::vector<ValueId> phis(params.size(), NO_VALUE);
+			for (unsigned j = 0; j < params.size(); j++) {
+				if (params[j] != NO_VALUE) {
+					phis[j] = f->emitPhi(header, f->values[params[j]].type);
+					f->replaceUses(params[j], phis[j]);
+					f->addIncoming(phis[j], params[j], 0);
+				}
+			}
+			for (ValueId call : calls) {
+				unsigned b = f->values[call].block;
+				std::vector<ValueId> args(f->values[call].operands + 1, f->values[call].operands + f->values[call].count);
+				ValueId t = f->terminator(b);
+				if (f->values[t].op == OP_JUMP) {
+					f->removeEdge(b, f->values[t].targets[0]);
+				}
+				f->remove(t);
+				f->remove(call);
+				f->jump(b, header);
+				for (unsigned j = 0; j < params.size(); j++) {
+					if (phis[j] != NO_VALUE) {
+						f->addIncoming(phis[j], args[j], b);
+					}
+				}
+				eliminated++;
+			}
+			return true;
+		}
+};
+
+
+// Inlines calls to small functions.
+// A callee is inlined if its size, less a bonus for each constant argument that folding will be able to
+// exploit, is within the threshold; funcs, having no side effects, get a larger threshold. Functions are
+// handled callees first, so what gets inlined has already had its own calls inlined. Recursive functions are
+// never inlined, and callers stop taking more once they reach the growth limit.
+class Inliner : public Pass {
+
+	public:
+
+		unsigned threshold;			// The largest callee inlined, in instructions.
+		unsigned growthLimit;		// The largest a caller is allowed to grow to by inlining.
+		unsigned inlined;			// Calls inlined so far.
+
+		Inliner(unsigned limit = 24, unsigned growth = 4000) : threshold(limit), growthLimit(growth), inlined(0) {}
+
+		const char* name() const {
+			return "inline";
+		}
+
+		bool run(IRModule *module) {
+			unsigned n = module->functions.size();
+			std::vector<std::vector<unsigned>> callees(n);
+			for (unsigned f = 0; f < n; f++) {
+				Function *fn = module->functions[f];
+				for (const BasicBlock &b : fn->blocks) {
+					for (ValueId v : b.code) {
+						Function *callee = directCallee(module, fn, v);
+						if (callee != nullptr) {
+							callees[f].push_back(module->symbols[callee->symbol].index);
+						}
+					}
+				}
+			}
+			std::vector<bool> recursive(n, false);
+			for (unsigned f = 0; f < n; f++) {
+				recursive[f] = reaches(callees, f, f);
+			}
+
+			// Callees before callers.
+			std::vector<unsigned> order;
+			std::vector<bool> visited(n, false);
+			for (unsigned f = 0; f < n; f++) {
+				postorder(callees, f, visited, order);
+			}
+
+			bool changed = false;
+			for (unsigned f : order) {
+				changed = inlineInto(module, module->functions[f], recursive) || changed;
+			}
+			return changed;
+		}
+
+		// The function a call goes straight to, or nullptr if it is indirect or to another module.
+		static Function* directCallee(const IRModule *module, const Function *f, ValueId v) {
+			const Instruction &i = f->values[v];
+			if (i.op != OP_CALL) {
+				return nullptr;
+			}
+			const Instruction &callee = f->values[i.operands[0]];
+			if (callee.op != OP_SYMBOL) {
+				return nullptr;
+			}
+			Function *ret = module->functionFor(callee.imm);
+			return ret == nullptr || ret->blocks.empty() ? nullptr : ret;
+		}
+
+		// The number of instructions that will cost something once compiled.
+		static unsigned cost(const Function *f) {
+			unsigned ret = 0;
+			for (const BasicBlock &b : f->blocks) {
+				for (ValueId v : b.code) {
+					Opcode op = f->values[v].op;
+					if (op != OP_CONST && op != OP_PARAM && op != OP_SYMBOL && op != OP_STACK && op != OP_PHI && op != OP_JUMP && op != OP_RETURN) {
+						ret++;
+					}
+				}
+			}
+			return ret;
+		}
+
+	private:
+
+		static bool reaches(const std::vector<std::vector<unsigned>> &callees, unsigned from, unsigned to) {
+			std::vector<bool> seen(callees.size(), false);
+			std::vector<unsigned> work(callees[from].begin(), callees[from].end());
+			while (!work.empty()) {
+				unsigned f = work.back();
+				work.pop_back();
+				if (f == to) {
+					return true;
+				}
+				if (!seen[f]) {
+					seen[f] = true;
+					work.insert(work.end(), callees[f].begin(), callees[f].end());
+				}
+			}
+			return false;
+		}
+
+		static void postorder(const std::vector<std::vector<unsigned>> &callees, unsigned root, std::vector<bool> &visited, std::vector<unsigned> &order) {
+			if (visited[root]) {
+				return;
+			}
+			std::vector<std::pair<unsigned, unsigned>> stack;
+			stack.push_back(std::make_pair(root, 0u));
+			visited[root] = true;
+			while (!stack.empty()) {
+				unsigned f = stack.back().first;
+				if (stack.back().second < callees[f].size()) {
+					unsigned c = callees[f][stack.back().second++];
+					if (!visited[c]) {
+						visited[c] = true;
+						stack.push_back(std::make_pair(c, 0u));
+					}
+				}
+				else {
+					order.push_back(f);
+					stack.pop_back();
+				}
+			}
+		}
+
+		bool inlineInto(IRModule *module, Function *f, const std::vector<bool> &recursive) {
+			std::vector<ValueId> calls;
+			for (const BasicBlock &b : f->blocks) {
+				for (ValueId v : b.code) {
+					if (f->values[v].op == OP_CALL) {
+						calls.push_back(v);
+					}
+				}
+			}
+			bool changed = false;
+			for (ValueId call : calls) {
+				Function *callee = directCallee(module, f, call);
+				if (callee == nullptr || callee == f || recursive[module->symbols[callee->symbol].index] || !signatureMatches(f, f->values[call], callee)) {
+					continue;
+				}
+				unsigned bonus = 0;
+				for (unsigned j = 1; j < f->values[call].count; j++) {
+					Opcode op = f->values[f->values[call].operands[j]].op;
+					if (op == OP_CONST || op == OP_SYMBOL) {
+						bonus += 2;
+					}
+				}
+				unsigned limit = threshold + (callee->pure ? threshold / 2 : 0) + bonus;
+				unsigned size = cost(callee);
+				if (size > limit || f->size() + size > growthLimit) {
+					continue;
+				}
+				inlineCall(f, call, callee);
+				inlined++;
+				changed = true;
+			}
+			return changed;
+		}
+
+		// Replace a call with a copy of the callee's body.
+		// The block holding the call is split after it; the callee's returns jump to the second half.
+		static void inlineCall(Function *f, ValueId call, const Function *callee) {
+			unsigned b = f->values[call].block;
+			std::vector<ValueId> args(f->values[call].operands + 1, f->values[call].operands + f->values[call].count);
+
+			unsigned after = f->addBlock();
+			std::vector<ValueId> &code = f->blocks[b].code;
+			unsigned k = std::find(code.begin(), code.end(), call) - code.begin();
+			f->blocks[after].code.assign(code.begin() + k + 1, code.end());
+			code.resize(k + 1);
+			for (ValueId v : f->blocks[after].code) {
+				f->values[v].block = after;
+			}
+			for (unsigned s : f->successors(after)) {
+				f->replacePredecessor(s, b, after);
+			}
+
+			unsigned slotBase = f->slots.size();
+			f->slots.insert(f->slots.end(), callee->slots.begin(), callee->slots.end());
+
+			std::vector<unsigned> blockMap(callee->blocks.size(), ~0u);
+			for (unsigned cb = 0; cb < callee->blocks.size(); cb++) {
+				if (cb == 0 || !callee->blocks[cb].code.empty()) {
+					blockMap[cb] = f->addBlock();
+				}
+			}
+
+			std::vector<ValueId> valueMap(callee->values.size(), NO_VALUE);
+			std::vector<ValueId> copies;
+			std::vector<std::pair<ValueId, unsigned>> returns;
+			for (unsigned cb = 0; cb < callee->blocks.size(); cb++) {
+				if (blockMap[cb] == ~0u) {
+					continue;
+				}
+				unsigned nb = blockMap[cb];
+				for (ValueId v : callee->blocks[cb].code) {
+					const Instruction &ci = callee->values[v];
+					if (ci.op == OP_PARAM) {
+						valueMap[v] = args[ci.imm];
+						continue;
+					}
+					if (ci.op == OP_RETURN) {
+						if (ci.count > 0) {
+							returns.push_back(std::make_pair(ci.operands[0], nb));
+						}
+						ValueId j = f->create(OP_JUMP, IR_VOID, nullptr, 0);
+						f->values[j].block = nb;
+						f->values[j].targets[0] = after;
+						f->blocks[nb].code.push_back(j);
+						continue;
+					}
+					ValueId nv = f->create(ci.op, ci.type, ci.operands, ci.count, ci.imm);
+					Instruction &i = f->values[nv];
+					i.flags = ci.flags;
+					i.block = nb;
+					if (ci.op == OP_STACK) {
+						i.imm += slotBase;
+					}
+					if (ci.op == OP_PHI) {
+						i.incoming = f->arena.allocate<unsigned>(ci.count);
+						for (unsigned j = 0; j < ci.count; j++) {
+							i.incoming[j] = blockMap[ci.incoming[j]];
+						}
+					}
+					for (unsigned j = 0; j < 2; j++) {
+						i.targets[j] = ci.targets[j] == ~0u ? ~0u : blockMap[ci.targets[j]];
+					}
+					f->blocks[nb].code.push_back(nv);
+					valueMap[v] = nv;
+					copies.push_back(nv);
+				}
+				for (unsigned p : callee->blocks[cb].preds) {
+					f->blocks[nb].preds.push_back(blockMap[p]);
+				}
+			}
+			for (ValueId nv : copies) {
+				Instruction &i = f->values[nv];
+				for (unsigned j = 0; j < i.count; j++) {
+					i.operands[j] = valueMap[i.operands[j]];
+				}
+			}
+			for (unsigned cb = 0; cb < callee->blocks.size(); cb++) {
+				if (blockMap[cb] != ~0u && !callee->blocks[cb].code.empty() && callee->values[callee->blocks[cb].code.back()].op == OP_RETURN) {
+					f->blocks[after].preds.push_back(blockMap[cb]);
+				}
+			}
+
+			// Whatever used the call's result now uses the value returned.
+			ValueId result = NO_VALUE;
+			if (f->values[call].type != IR_VOID) {
+				if (returns.size() == 1) {
+					result = valueMap[returns[0].first];
+				}
+				else if (returns.empty()) {
+					result = f->create(OP_CONST, f->values[call].type, nullptr, 0, 0);
+					f->values[result].block = after;
+					f->blocks[after].code.insert(f->blocks[after].code.begin(), result);
+				}
+				else {
+					result = f->emitPhi(after, f->values[call].type);
+					for (const std::pair<ValueId, unsigned> &r : returns) {
+						f->addIncoming(result, valueMap[r.first], r.second);
+					}
+				}
+			}
+			f->remove(call);
+			f->jump(b, blockMap[0]);
+			if (result != NO_VALUE) {
+				f->replaceUses(call, result);
+			}
+		}
+};
+
+
+// Bounds check elimination.
+// Indexing an array branches to a block that traps unless the index is below the array's length. A check is
+// removed when the branches that dominate it prove it passes, as the test of a foreach loop does for its index,
+// or as a loop counter that starts at zero and stops below the length does. A check left in a counted loop that
+// runs on every iteration is hoisted in front of the loop as one test that covers every iteration. That makes
+// the program stop sooner than it would have, so it is only done when the loop calls nothing that could be
+// seen to happen in between and has no inner loop that might never finish.
+class BoundsCheckElimination : public FunctionPass {
+
+	public:
+
+		unsigned removed;			// Checks proved to pass.
+		unsigned hoisted;			// Checks moved out of loops.
+
+		BoundsCheckElimination() : removed(0), hoisted(0) {}
+
+		const char* name() const {
+			return "bounds";
+		}
+
+		bool runOnFunction(Function *f) {
+			bool changed = false;
+			std::vector<unsigned> idom = immediateDominators(f);
+			for (unsigned b : f->reversePostorder()) {
+				ValueId t = f->terminator(b);
+				if (isCheck(f, t) && proven(f, idom, b, f->values[t].operands[0])) {
+					pass(f, b);
+					removed++;
+					changed = true;
+				}
+			}
+
+			// Each hoist adds a block, so the loops are found again after every one.
+			while (hoistOne(f)) {
+				hoisted++;
+				changed = true;
+			}
+			return changed;
+		}
+
+	private:
+
+		// A fact of the form lhs < rhs, or lhs <= rhs if it isn't strict.
+		struct Order {
+			ValueId lhs;
+			ValueId rhs;
+			bool strict;
+			bool isSigned;
+		};
+
+		// Whether an instruction is a bounds check: a branch on an unsigned less than, or less or equal for the
+		// end of a view, whose false edge goes to a block that does nothing but trap.
+		static bool isCheck(const Function *f, ValueId t) {
+			if (t == NO_VALUE || f->values[t].op != OP_BRANCH || f->values[t].targets[0] == f->values[t].targets[1]) {
+				return false;
+			}
+			const std::vector<ValueId> &fail = f->blocks[f->values[t].targets[1]].code;
+			return fail.size() == 1 && f->values[fail[0]].op == OP_TRAP && (f->values[f->values[t].operands[0]].op == OP_ULT || f->values[f->values[t].operands[0]].op == OP_ULE);
+		}
+
+		// Make the check that ends a block into a jump to the code it guards.
+		static void pass(Function *f, unsigned b) {
+			Instruction &t = f->values[f->terminator(b)];
+			unsigned trap = t.targets[1];
+			t.op = OP_JUMP;
+			t.count = 0;
+			t.targets[1] = ~0u;
+			f->removeEdge(b, trap);
+		}
+
+		// Put what a comparison says, given whether it held, as an Order.
+		static bool order(const Function *f, ValueId condition, bool holds, Order &o) {
+			const Instruction &c = f->values[condition];
+			if (c.op < OP_LT || c.op > OP_UGE) {
+				return false;
+			}
+			bool isSigned = c.op <= OP_GE;
+			Opcode op = isSigned ? c.op : (Opcode) (c.op - OP_ULT + OP_LT);
+			bool flip = op == OP_GT || op == OP_GE;
+			if (!holds) {
+				// Not a < b is b <= a, and so on.
+				flip = !flip;
+			}
+			o.lhs = flip ? c.operands[1] : c.operands[0];
+			o.rhs = flip ? c.operands[0] : c.operands[1];
+			o.strict = (op == OP_LT || op == OP_GT) == holds;
+			o.isSigned = isSigned;
+			return true;
+		}
+
+		// What the branches that dominate a block say on the way to it. A branch counts when the block is reached
+		// by an edge from it that is the only way into the block it leads to.
+		static std::vector<Order> facts(const Function *f, const std::vector<unsigned> &idom, unsigned b) {
+			std::vector<Order> ret;
+			while (b != 0 && idom[b] != ~0u) {
+				const std::vector<unsigned> &preds = f->blocks[b].preds;
+				if (preds.size() == 1) {
+					const Instruction &t = f->values[f->terminator(preds[0])];
+					Order o;
+					if (t.op == OP_BRANCH && t.targets[0] != t.targets[1] && order(f, t.operands[0], t.targets[0] == b, o)) {
+						ret.push_back(o);
+					}
+				}
+				b = idom[b];
+			}
+			return ret;
+		}
+
+		// Whether x is a widening of y that keeps its value when y is read as signed or unsigned.
+		static bool widens(const Function *f, ValueId x, ValueId y, bool isSigned) {
+			const Instruction &i = f->values[x];
+			return i.op == OP_CONVERT && i.operands[0] == y && !irFloat(i.type) && !irFloat(f->values[y].type) &&
+				irSize(i.type) > irSize(f->values[y].type) && ((i.flags & CONVERT_UNSIGNED) == 0) == isSigned;
+		}
+
+		// Whether x has the value of y, read as signed or unsigned.
+		static bool same(const Function *f, ValueId x, ValueId y, bool isSigned) {
+			return x == y || widens(f, x, y, isSigned);
+		}
+
+		static long long value(const Function *f, ValueId v) {
+			return normalize(f->values[v].imm, f->values[v].type);
+		}
+
+		// Whether n is no more than the length m, for n read as signed or unsigned and known not to be negative.
+		static bool atMost(const Function *f, ValueId n, ValueId m, bool isSigned) {
+			if (same(f, m, n, isSigned)) {
+				return true;
+			}
+			if (!f->isConstant(n) || !f->isConstant(m)) {
+				return false;
+			}
+			unsigned long long bound = value(f, n);
+			if (!isSigned && irSize(f->values[n].type) < 8) {
+				bound &= (1ull << (8 * irSize(f->values[n].type))) - 1;
+			}
+			return bound <= (unsigned long long) value(f, m);
+		}
+
+		// Whether a value can't be negative when read as signed, on the way to block b.
+		bool nonNegative(const Function *f, const std::vector<unsigned> &idom, unsigned b, ValueId y, unsigned depth = 0) {
+			const Instruction &i = f->values[y];
+			if (depth > 4) {
+				return false;
+			}
+			if (i.op == OP_CONST) {
+				return value(f, y) >= 0;
+			}
+			if (i.op == OP_CONVERT && (i.flags & CONVERT_UNSIGNED) != 0 && !irFloat(f->values[i.operands[0]].type) && irSize(i.type) > irSize(f->values[i.operands[0]].type)) {
+				return true;
+			}
+			for (const Order &o : facts(f, idom, b)) {
+				if (o.isSigned && o.rhs == y && f->isConstant(o.lhs) && value(f, o.lhs) >= (o.strict ? -1 : 0)) {
+					return true;
+				}
+			}
+			return counter(f, idom, y, depth);
+		}
+
+		// Whether a phi counts up by one from values that aren't negative, stopping below a limit that keeps it
+		// from overflowing: the header it is in only goes on into the loop while it is less than the limit.
+		bool counter(const Function *f, const std::vector<unsigned> &idom, ValueId y, unsigned depth) {
+			const Instruction &phi = f->values[y];
+			if (phi.op != OP_PHI || irFloat(phi.type)) {
+				return false;
+			}
+			unsigned header = phi.block;
+			const Instruction &t = f->values[f->terminator(header)];
+			Order o;
+			if (t.op != OP_BRANCH || t.targets[0] == t.targets[1] || !order(f, t.operands[0], true, o) || o.lhs != y || !o.strict) {
+				return false;
+			}
+			unsigned inside = t.targets[0];
+			if (f->blocks[inside].preds.size() != 1) {
+				return false;
+			}
+			if (!o.isSigned && !nonNegative(f, idom, header, o.rhs, depth + 1)) {
+				return false;
+			}
+			for (unsigned j = 0; j < phi.count; j++) {
+				const Instruction &in = f->values[phi.operands[j]];
+				bool step = in.op == OP_ADD && dominates(idom, inside, in.block) &&
+					((in.operands[0] == y && f->isConstant(in.operands[1]) && value(f, in.operands[1]) == 1) ||
+					(in.operands[1] == y && f->isConstant(in.operands[0]) && value(f, in.operands[0]) == 1));
+				if (!step && !(in.op == OP_CONST && value(f, phi.operands[j]) >= 0)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Whether the branches on the way to block b prove that x < m, or x <= m for an inclusive check, where m
+		// is a length.
+		bool proven(const Function *f, const std::vector<unsigned> &idom, unsigned b, ValueId check) {
+			ValueId x = f->values[check].operands[0];
+			ValueId m = f->values[check].operands[1];
+			bool inclusive = f->values[check].op == OP_ULE;
+			// m - k is in range once m is known to be at least k, and a constant k once m is more than k.
+			const Instruction &i = f->values[x];
+			long long least = 0;
+			if (i.op == OP_SUB && i.operands[0] == m && f->isConstant(i.operands[1])) {
+				least = value(f, i.operands[1]);
+			}
+			else if (i.op == OP_CONST && value(f, x) >= 0) {
+				least = value(f, x) + (inclusive ? 0 : 1);
+			}
+			for (const Order &o : facts(f, idom, b)) {
+				if (least > 0 && o.rhs == m && f->isConstant(o.lhs) && value(f, o.lhs) + (o.strict ? 1 : 0) >= least) {
+					return true;
+				}
+			}
+			for (const Order &o : facts(f, idom, b)) {
+				if (!o.strict) {
+					if (inclusive && !o.isSigned && o.lhs == x && o.rhs == m) {
+						return true;
+					}
+					continue;
+				}
+				// If y < n and n <= m for y that is x, then x < m, as long as x isn't negative when read signed.
+				for (unsigned s = 0; s < 2; s++) {
+					bool isSigned = s == 1;
+					if (o.isSigned == isSigned && same(f, x, o.lhs, isSigned) && atMost(f, o.rhs, m, isSigned) && (!isSigned || nonNegative(f, idom, b, o.lhs))) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		// Hoist one check out of a loop, returning false if there are none that can be.
+		bool hoistOne(Function *f) {
+			std::vector<unsigned> idom = immediateDominators(f);
+			std::vector<unsigned> order = f->reversePostorder();
+			std::map<unsigned, std::vector<unsigned>> latches;
+			for (unsigned b : order) {
+				for (unsigned s : f->successors(b)) {
+					if (dominates(idom, s, b)) {
+						latches[s].push_back(b);
+					}
+				}
+			}
+			for (const auto &l : latches) {
+				unsigned header = l.first;
+				if (l.second.size() != 1) {
+					continue;
+				}
+				std::vector<bool> inLoop(f->blocks.size(), false);
+				inLoop[header] = true;
+				std::vector<unsigned> work(l.second);
+				while (!work.empty()) {
+					unsigned b = work.back();
+					work.pop_back();
+					if (!inLoop[b]) {
+						inLoop[b] = true;
+						work.insert(work.end(), f->blocks[b].preds.begin(), f->blocks[b].preds.end());
+					}
+				}
+				Loop loop;
+				loop.header = header;
+				loop.latch = l.second[0];
+				if (!counted(f, idom, inLoop, loop)) {
+					continue;
+				}
+				for (unsigned b : order) {
+					if (inLoop[b] && isCheck(f, f->terminator(b)) && dominates(idom, b, loop.latch) && hoist(f, inLoop, loop, b)) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		// A loop that counts from start up by one while below limit, and can only be left at the top.
+		struct Loop {
+			unsigned header;
+			unsigned latch;
+			unsigned preheader;
+			ValueId index;
+			ValueId start;
+			ValueId limit;
+			bool isSigned;
+		};
+
+		bool counted(const Function *f, const std::vector<unsigned> &idom, const std::vector<bool> &inLoop, Loop &loop) {
+			const std::vector<unsigned> &preds = f->blocks[loop.header].preds;
+			if (preds.size() != 2 || loop.header == 0) {
+				return false;
+			}
+			loop.preheader = preds[0] == loop.latch ? preds[1] : preds[0];
+			const Instruction &t = f->values[f->terminator(loop.header)];
+			if (t.op != OP_BRANCH || !inLoop[t.targets[0]] || inLoop[t.targets[1]]) {
+				return false;
+			}
+			const Instruction &c = f->values[t.operands[0]];
+			if ((c.op != OP_LT && c.op != OP_ULT) || inLoop[f->values[c.operands[1]].block]) {
+				return false;
+			}
+			loop.index = c.operands[0];
+			loop.limit = c.operands[1];
+			loop.isSigned = c.op == OP_LT;
+			const Instruction &phi = f->values[loop.index];
+			if (phi.op != OP_PHI || phi.block != loop.header) {
+				return false;
+			}
+			for (unsigned j = 0; j < phi.count; j++) {
+				if (phi.incoming[j] == loop.preheader) {
+					loop.start = phi.operands[j];
+					continue;
+				}
+				const Instruction &step = f->values[phi.operands[j]];
+				if (step.op != OP_ADD || !((step.operands[0] == loop.index && f->isConstant(step.operands[1]) && value(f, step.operands[1]) == 1) ||
+					(step.operands[1] == loop.index && f->isConstant(step.operands[0]) && value(f, step.operands[0]) == 1))) {
+					return false;
+				}
+			}
+
+			// Nothing leaves the loop but the header and failed checks, nothing in it can be seen to happen before a
+			// trap, and every path through it comes back round to the header.
+			for (unsigned b = 0; b < f->blocks.size(); b++) {
+				if (!inLoop[b]) {
+					continue;
+				}
+				for (unsigned s : f->successors(b)) {
+					if (b != loop.header && !inLoop[s] && !isCheck(f, f->terminator(b))) {
+						return false;
+					}
+					if (inLoop[s] && s != loop.header && dominates(idom, s, b)) {
+						return false;
+					}
+				}
+				for (ValueId v : f->blocks[b].code) {
+					if (f->values[v].op == OP_CALL && !isPureCall(module, f, f->values[v])) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		// If the check that ends block b passes on every iteration as long as a test made before the loop does,
+		// make that test and drop the check.
+		bool hoist(Function *f, const std::vector<bool> &inLoop, const Loop &loop, unsigned b) {
+			ValueId check = f->values[f->terminator(b)].operands[0];
+			ValueId x = f->values[check].operands[0];
+			ValueId m = f->values[check].operands[1];
+			bool invariant = !inLoop[f->values[check].block];
+			if (!invariant && (f->values[check].op != OP_ULT || inLoop[f->values[m].block] || !same(f, x, loop.index, loop.isSigned))) {
+				return false;
+			}
+			unsigned trap = f->values[f->terminator(b)].targets[1];
+
+			// A block on the edge into the loop holds the test.
+			unsigned nb = f->addBlock();
+			Instruction &t = f->values[f->terminator(loop.preheader)];
+			for (unsigned j = 0; j < 2; j++) {
+				if (t.targets[j] == loop.header) {
+					t.targets[j] = nb;
+				}
+			}
+			f->replacePredecessor(loop.header, loop.preheader, nb);
+			f->blocks[nb].preds.push_back(loop.preheader);
+
+			// The loop runs no times, or the check passes for the last index, which is limit - 1.
+			ValueId ok = f->emit(nb, loop.isSigned ? OP_GE : OP_UGE, IR_I8, {loop.start, loop.limit});
+			if (invariant) {
+				ok = f->emit(nb, OP_OR, IR_I8, {ok, check});
+			}
+			else {
+				ValueId limit = loop.limit;
+				if (x != loop.index) {
+					limit = f->emit(nb, OP_CONVERT, f->values[x].type, {limit});
+					f->values[limit].flags = f->values[x].flags;
+				}
+				ValueId fits = f->emit(nb, OP_ULE, IR_I8, {limit, m});
+				if (loop.isSigned) {
+					ValueId zero = f->emit(nb, OP_CONST, f->values[loop.start].type, {}, 0);
+					fits = f->emit(nb, OP_AND, IR_I8, {fits, f->emit(nb, OP_GE, IR_I8, {loop.start, zero})});
+				}
+				ok = f->emit(nb, OP_OR, IR_I8, {ok, fits});
+			}
+			ValueId branch = f->emit(nb, OP_BRANCH, IR_VOID, {ok});
+			f->values[branch].targets[0] = loop.header;
+			f->values[branch].targets[1] = trap;
+			f->blocks[trap].preds.push_back(nb);
+			pass(f, b);
+			return true;
+		}
+};
+
+
+// Closure optimization.
+// The record of a closure that captures something is allocated on the heap, with its code in the first word and
+// the captured values after it. Loads of the code from a record made in the same function become the routine
+// stored there, so that calls through the closure become direct calls that can be inlined. A record that
+// doesn't escape, because nothing but loads, stores and calls to its own code use its address, is moved onto
+// the stack. In memory of the function's own that doesn't escape and is only loaded and stored, a load covered
+// by exactly one store that dominates it becomes the value stored, and once nothing loads from it the stores go.
+class ClosureOptimization : public FunctionPass {
+
+	public:
+
+		unsigned forwarded;			// Loads replaced by the values stored.
+		unsigned moved;				// Records moved from the heap to the stack.
+
+		ClosureOptimization() : forwarded(0), moved(0) {}
+
+		const char* name() const {
+			return "closures";
+		}
+
+		bool runOnFunction(Function *f) {
+			std::vector<ValueId> objects;
+			for (const BasicBlock &b : f->blocks) {
+				for (ValueId v : b.code) {
+					if (f->values[v].op == OP_STACK || allocationSize(f, v) > 0) {
+						objects.push_back(v);
+					}
+				}
+			}
+			if (objects.empty()) {
+				return false;
+			}
+			std::vector<unsigned> idom = immediateDominators(f);
+			bool changed = false;
+			for (ValueId object : objects) {
+				changed = optimize(f, idom, object) || changed;
+			}
+			return changed;
+		}
+
+	private:
+
+		static const unsigned MAX_MOVED = 4096;		// The largest record moved onto the stack, in bytes.
+
+		struct Access {
+			ValueId v;
+			long long offset;
+			unsigned size;
+		};
+
+		// What uses a piece of memory.
+		struct Uses {
+			std::vector<Access> loads;
+			std::vector<Access> stores;
+			bool escapes;			// Its address goes somewhere it can't be followed.
+			bool opaque;			// Something other than loads and stores reads or writes it.
+		};
+
+		// The size of the record a call to malloc allocates, or 0 if v isn't such a call.
+		unsigned allocationSize(const Function *f, ValueId v) {
+			const Instruction &i = f->values[v];
+			if (i.op != OP_CALL || i.count != 2 || f->values[i.operands[0]].op != OP_SYMBOL || !f->isConstant(i.operands[1])) {
+				return 0;
+			}
+			const Symbol &s = module->symbols[f->values[i.operands[0]].imm];
+			long long size = f->values[i.operands[1]].imm;
+			return s.kind == EXTERNAL_SYMBOL && s.name == "malloc" && size > 0 && size <= MAX_MOVED ? size : 0;
+		}
+
+		// Follow the address of an object through constant offsets to everything that uses it.
+		Uses uses(const Function *f, ValueId object) {
+			std::vector<std::vector<ValueId>> users(f->values.size());
+			for (const BasicBlock &b : f->blocks) {
+				for (ValueId v : b.code) {
+					const Instruction &i = f->values[v];
+					for (unsigned j = 0; j < i.count; j++) {
+						if (users[i.operands[j]].empty() || users[i.operands[j]].back() != v) {
+							users[i.operands[j]].push_back(v);
+						}
+					}
+				}
+			}
+
+			Uses ret;
+			ret.escapes = false;
+			ret.opaque = false;
+			std::vector<ValueId> envCalls;
+			std::vector<std::pair<ValueId, long long>> work(1, std::make_pair(object, 0LL));
+			while (!work.empty() && !ret.escapes) {
+				ValueId address = work.back().first;
+				long long offset = work.back().second;
+				work.pop_back();
+				for (ValueId u : users[address]) {
+					const Instruction &i = f->values[u];
+					Access a;
+					a.v = u;
+					a.offset = offset;
+					a.size = 0;
+					if (i.op == OP_ADD && i.operands[0] == address && i.operands[1] != address && f->isConstant(i.operands[1])) {
+						work.push_back(std::make_pair(u, offset + f->values[i.operands[1]].imm));
+					}
+					else if (i.op == OP_LOAD) {
+						a.size = irSize(i.type);
+						ret.loads.push_back(a);
+					}
+					else if (i.op == OP_STORE && i.operands[1] != address) {
+						a.size = irSize(f->values[i.operands[1]].type);
+						ret.stores.push_back(a);
+					}
+					else if (i.op == OP_COPY) {
+						ret.opaque = true;
+					}
+					else if (i.op == OP_CALL && offset == 0 && i.operands[0] != address && i.operands[i.count - 1] == address && std::count(i.operands, i.operands + i.count, address) == 1) {
+						// Passed as the environment of a call, which is fine if the code called is its own.
+						envCalls.push_back(u);
+						ret.opaque = true;
+					}
+					else {
+						ret.escapes = true;
+						break;
+					}
+				}
+			}
+
+			ValueId code = storedCode(f, ret);
+			for (ValueId call : envCalls) {
+				ValueId callee = f->values[call].operands[0];
+				const Instruction &c = f->values[callee];
+				bool own = callee == code || (c.op == OP_LOAD && (c.flags & LOAD_INVARIANT) != 0 && c.operands[0] == object);
+				if (!own) {
+					ret.escapes = true;
+				}
+			}
+			return ret;
+		}
+
+		// The value of the only store to the first word of an object, or NO_VALUE.
+		static ValueId storedCode(const Function *f, const Uses &u) {
+			ValueId ret = NO_VALUE;
+			for (const Access &s : u.stores) {
+				if (s.offset < 8 && s.offset + s.size > 0) {
+					if (ret != NO_VALUE || s.offset != 0 || s.size != 8) {
+						return NO_VALUE;
+					}
+					ret = f->values[s.v].operands[1];
+				}
+			}
+			return ret;
+		}
+
+		// Whether instruction a runs before b wherever b runs.
+		static bool before(const Function *f, const std::vector<unsigned> &idom, ValueId a, ValueId b) {
+			unsigned ab = f->values[a].block;
+			unsigned bb = f->values[b].block;
+			if (ab != bb) {
+				return dominates(idom, ab, bb);
+			}
+			const std::vector<ValueId> &code = f->blocks[ab].code;
+			return std::find(code.begin(), code.end(), a) < std::find(code.begin(), code.end(), b);
+		}
+
+		bool optimize(Function *f, const std::vector<unsigned> &idom, ValueId object) {
+			bool changed = false;
+			Uses u = uses(f, object);
+
+			// The code of a closure never changes, so loading it gives what was stored even if the record escapes.
+			ValueId code = storedCode(f, u);
+			for (const Access &l : u.loads) {
+				const Instruction &i = f->values[l.v];
+				if (code != NO_VALUE && l.offset == 0 && (i.flags & LOAD_INVARIANT) != 0 && i.type == f->values[code].type && before(f, idom, code, l.v)) {
+					replace(f, l.v, code);
+					changed = true;
+				}
+			}
+			if (changed) {
+				u = uses(f, object);
+			}
+			if (u.escapes) {
+				return changed;
+			}
+
+			if (f->values[object].op == OP_CALL) {
+				Instruction &i = f->values[object];
+				unsigned slot = f->addSlot((unsigned) f->values[i.operands[1]].imm, 16);
+				i.op = OP_STACK;
+				i.count = 0;
+				i.flags = 0;
+				i.imm = slot;
+				moved++;
+				changed = true;
+			}
+			if (u.opaque) {
+				return changed;
+			}
+
+			unsigned kept = 0;
+			for (const Access &l : u.loads) {
+				ValueId value = NO_VALUE;
+				unsigned covering = 0;
+				for (const Access &s : u.stores) {
+					if (s.offset < l.offset + l.size && l.offset < s.offset + s.size) {
+						covering++;
+						value = s.offset == l.offset && s.size == l.size && before(f, idom, s.v, l.v) ? f->values[s.v].operands[1] : NO_VALUE;
+					}
+				}
+				if (covering == 1 && value != NO_VALUE && f->values[value].type == f->values[l.v].type) {
+					replace(f, l.v, value);
+					changed = true;
+				}
+				else {
+					kept++;
+				}
+			}
+			if (kept == 0) {
+				for (const Access &s : u.stores) {
+					f->remove(s.v);
+					changed = true;
+				}
+			}
+			return changed;
+		}
+
+		void replace(Function *f, ValueId load, ValueId value) {
+			f->replaceUses(load, value);
+			f->remove(load);
+			forwarded++;
+		}
+};
+
+
+// Loop vectorization.
+// Counted loops over the elements of arrays, which is what foreach loops become, are done with 16 byte SSE
+// vectors two or four iterations at a time, and the original loop is kept to do the iterations left over. A
+// loop qualifies if it counts from 0 by 1 up to a limit set before it, its body is a single block, it touches
+// memory only at the current element of arrays whose addresses are set before it, and the only values it
+// carries from one iteration to the next are integer sums. Where arrays might overlap, they are checked before
+// the loop, and if they do the vector loop runs no times.
+class LoopVectorizer : public FunctionPass {
+
+	public:
+
+		FILE *report;				// Where to say which loops were vectorized and why others weren't, if anywhere.
+		unsigned vectorized;		// Loops vectorized so far.
+
+		LoopVectorizer(FILE *out = nullptr) : report(out), vectorized(0) {}
+
+		const char* name() const {
+			return "vectorize";
+		}
+
+		bool runOnFunction(Function *f) {
+			std::vector<unsigned> idom = immediateDominators(f);
+			std::vector<std::pair<unsigned, unsigned>> loops;
+			for (unsigned b : f->reversePostorder()) {
+				for (unsigned s : f->successors(b)) {
+					if (dominates(idom, s, b)) {
+						loops.push_back(std::make_pair(s, b));
+					}
+				}
+			}
+			bool changed = false;
+			for (const std::pair<unsigned, unsigned> &l : loops) {
+				Loop loop;
+				std::string why;
+				if (!analyze(f, l.first, l.second, loop, why)) {
+					if (!why.empty()) {
+						note(f, l.first, "wasn't vectorized: " + why);
+					}
+					continue;
+				}
+				vectorize(f, loop);
+				note(f, l.first, "was vectorized, " + std::to_string(16 / irSize(loop.lane)) + " iterations at a time");
+				vectorized++;
+				changed = true;
+			}
+			return changed;
+		}
+
+	private:
+
+		// What a value in the body of a loop is.
+		enum Role {
+			OTHER,
+			INVARIANT,			// Set before the loop.
+			INDEX,
+			STEP,				// The index plus 1.
+			OFFSET,				// The index times the size of an element.
+			ADDRESS,			// The address of the current element of an array.
+			LANE,				// Something worked out for each element, which becomes a vector.
+			TOTAL,				// A sum carried from one iteration to the next.
+			SUM					// The next value of a total.
+		};
+
+		struct Loop {
+			unsigned header;
+			unsigned body;
+			unsigned preheader;
+			ValueId index;
+			ValueId compare;
+			ValueId limit;
+			IRType lane;						// The type of the lanes of the vectors; they are all the same size.
+			std::vector<Role> roles;
+			std::vector<ValueId> bases;			// The arrays used, each once.
+			std::vector<ValueId> stored;		// The arrays written to.
+		};
+
+		std::set<std::pair<const Function*, unsigned>> reported;
+
+		void note(const Function *f, unsigned header, const std::string &what) {
+			if (report != nullptr && reported.insert(std::make_pair(f, header)).second) {
+				fprintf(report, "%s: the loop at b%u %s.\n", f->name.c_str(), header, what.c_str());
+			}
+		}
+
+		// Whether there is a vector instruction for an operation on a type.
+		static bool supported(Opcode op, IRType type) {
+			switch (type) {
+				case (IR_I32) : {
+					return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_AND || op == OP_OR || op == OP_XOR;
+				}
+				case (IR_I64) : {
+					return op == OP_ADD || op == OP_SUB || op == OP_AND || op == OP_OR || op == OP_XOR;
+				}
+				case (IR_F32) :
+				case (IR_F64) : {
+					return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV;
+				}
+				default : {
+					return false;
+				}
+			}
+		}
+
+		// Why a value can't be used as an operand of a vector instruction, or "" if it can.
+		static std::string operandProblem(Role r) {
+			switch (r) {
+				case (INVARIANT) :
+				case (LANE) : {
+					return "";
+				}
+				case (TOTAL) :
+				case (SUM) : {
+					return "it uses a running total inside the loop";
+				}
+				case (INDEX) :
+				case (STEP) :
+				case (OFFSET) :
+				case (ADDRESS) : {
+					return "it uses the index as a value";
+				}
+				default : {
+					return "it uses a value that can't be vectorized";
+				}
+			}
+		}
+
+		// The lanes of every vector must be the same size, so that each vector covers the same iterations.
+		static bool setLane(Loop &loop, IRType type, std::string &why) {
+			if (irVectorOf(type) == IR_VOID) {
+				why = std::string("it works on elements of type ") + irTypeName(type) + ", which has no vector form";
+				return false;
+			}
+			if (loop.lane != IR_VOID && irSize(loop.lane) != irSize(type)) {
+				why = "it mixes elements of different sizes";
+				return false;
+			}
+			loop.lane = type;
+			return true;
+		}
+
+		bool analyze(const Function *f, unsigned header, unsigned body, Loop &loop, std::string &why) {
+			const BasicBlock &h = f->blocks[header];
+			ValueId back = f->terminator(body);
+			ValueId branch = f->terminator(header);
+			if (h.preds.size() != 2 || f->blocks[body].preds.size() != 1 || f->blocks[body].preds[0] != header || back == NO_VALUE || f->values[back].op != OP_JUMP || branch == NO_VALUE || f->values[branch].op != OP_BRANCH || f->values[branch].targets[0] != body || f->values[branch].targets[1] == body || f->values[branch].targets[1] == header) {
+				why = "its body isn't a single block";
+				return false;
+			}
+			loop.header = header;
+			loop.body = body;
+			loop.preheader = h.preds[0] == body ? h.preds[1] : h.preds[0];
+			loop.lane = IR_VOID;
+			loop.roles.assign(f->values.size(), OTHER);
+			for (ValueId v = 0; v < f->values.size(); v++) {
+				unsigned b = f->values[v].block;
+				if (b != ~0u && b != header && b != body) {
+					loop.roles[v] = INVARIANT;
+				}
+			}
+
+			// The header has to be nothing but phis and the comparison of the index with the limit.
+			if (vectorLoop(f, header)) {
+				return false;
+			}
+			loop.compare = f->values[branch].operands[0];
+			const Instruction &c = f->values[loop.compare];
+			unsigned phis = 0;
+			while (phis < h.code.size() && f->values[h.code[phis]].op == OP_PHI) {
+				phis++;
+			}
+			if (phis + 2 != h.code.size() || h.code[phis] != loop.compare || (c.op != OP_ULT && c.op != OP_LT) || loop.roles[c.operands[1]] != INVARIANT || f->values[c.operands[0]].op != OP_PHI || f->values[c.operands[0]].block != header || f->values[c.operands[0]].type != IR_I64) {
+				why = "it isn't a count up to a limit";
+				return false;
+			}
+			loop.index = c.operands[0];
+			loop.limit = c.operands[1];
+			loop.roles[loop.index] = INDEX;
+			ValueId start = incoming(f, loop.index, loop.preheader);
+			ValueId step = incoming(f, loop.index, body);
+			if (!f->isConstant(start) || f->values[start].imm != 0) {
+				// The loop left to finish what a vector loop started is quietly left alone.
+				if (f->values[start].op == OP_PHI && vectorLoop(f, f->values[start].block)) {
+					return false;
+				}
+				why = "its index doesn't start at 0";
+				return false;
+			}
+			const Instruction &s = f->values[step];
+			if (s.op != OP_ADD || s.block != body || s.operands[0] != loop.index || !f->isConstant(s.operands[1]) || f->values[s.operands[1]].imm != 1) {
+				why = "its index doesn't go up by 1";
+				return false;
+			}
+			loop.roles[step] = STEP;
+			for (unsigned k = 0; k < phis; k++) {
+				ValueId p = h.code[k];
+				if (p != loop.index) {
+					loop.roles[p] = TOTAL;
+				}
+			}
+
+			for (ValueId v : f->blocks[body].code) {
+				const Instruction &i = f->values[v];
+				if (v == step || v == back) {
+					continue;
+				}
+				if (!classify(f, loop, v, why)) {
+					if (why.empty()) {
+						switch (i.op) {
+							case (OP_CALL) : {
+								why = "it calls a routine";
+								break;
+							}
+							case (OP_COPY) : {
+								why = "it copies memory";
+								break;
+							}
+							case (OP_CONVERT) : {
+								why = "it converts between types";
+								break;
+							}
+							case (OP_LOAD) :
+							case (OP_STORE) : {
+								why = "it reads or writes memory other than the current element of an array";
+								break;
+							}
+							default : {
+								why = std::string("it does ") + opcodeName(i.op) + " on " + irTypeName(i.type) + ", which has no vector form";
+							}
+						}
+					}
+					return false;
+				}
+			}
+
+			// Every value carried around the loop has to be a sum.
+			for (unsigned k = 0; k < phis; k++) {
+				ValueId p = h.code[k];
+				if (p == loop.index) {
+					continue;
+				}
+				const Instruction &next = f->values[incoming(f, p, body)];
+				if (loop.roles[incoming(f, p, body)] != SUM || (next.operands[0] != p && next.operands[1] != p)) {
+					why = "it carries a value from one iteration to the next";
+					return false;
+				}
+				if (irFloat(f->values[p].type)) {
+					why = "adding up floating point numbers in a different order could change the result";
+					return false;
+				}
+			}
+			if (loop.lane == IR_VOID) {
+				why = "it doesn't work on any arrays";
+				return false;
+			}
+			const Instruction &limit = f->values[loop.limit];
+			if (limit.op == OP_CONST && limit.imm < 16 / irSize(loop.lane) && (c.op == OP_LT || limit.imm >= 0)) {
+				why = "it runs too few times to fill a vector";
+				return false;
+			}
+			return true;
+		}
+
+		// Work out the role of an instruction in the body. Returns false, with why set if there's more to say
+		// than what the instruction is, if it can't be vectorized.
+		bool classify(const Function *f, Loop &loop, ValueId v, std::string &why) {
+			const Instruction &i = f->values[v];
+			std::vector<Role> &roles = loop.roles;
+			if (i.op == OP_MUL && i.type == IR_I64 && i.count == 2) {
+				for (unsigned j = 0; j < 2; j++) {
+					if (roles[i.operands[j]] == INDEX && f->isConstant(i.operands[1 - j])) {
+						roles[v] = OFFSET;
+						return true;
+					}
+				}
+			}
+			if (i.op == OP_ADD && i.type == IR_PTR) {
+				for (unsigned j = 0; j < 2; j++) {
+					if (roles[i.operands[j]] == INVARIANT && roles[i.operands[1 - j]] == OFFSET) {
+						roles[v] = ADDRESS;
+						if (std::find(loop.bases.begin(), loop.bases.end(), i.operands[j]) == loop.bases.end()) {
+							loop.bases.push_back(i.operands[j]);
+						}
+						return true;
+					}
+				}
+			}
+			if (i.op == OP_LOAD) {
+				if (roles[i.operands[0]] != ADDRESS || stride(f, loop, i.operands[0]) != irSize(i.type)) {
+					return false;
+				}
+				if (!setLane(loop, i.type, why)) {
+					return false;
+				}
+				roles[v] = LANE;
+				return true;
+			}
+			if (i.op == OP_STORE) {
+				ValueId value = i.operands[1];
+				IRType type = f->values[value].type;
+				if (roles[i.operands[0]] != ADDRESS || stride(f, loop, i.operands[0]) != irSize(type)) {
+					return false;
+				}
+				why = operandProblem(roles[value]);
+				if (!why.empty() || !setLane(loop, type, why)) {
+					return false;
+				}
+				ValueId base = addressBase(f, loop, i.operands[0]);
+				if (std::find(loop.stored.begin(), loop.stored.end(), base) == loop.stored.end()) {
+					loop.stored.push_back(base);
+				}
+				return true;
+			}
+			if (i.op == OP_ADD && i.count == 2) {
+				for (unsigned j = 0; j < 2; j++) {
+					if (roles[i.operands[j]] == TOTAL && incoming(f, i.operands[j], loop.body) == v) {
+						Role other = roles[i.operands[1 - j]];
+						if (other != LANE && other != INVARIANT) {
+							why = operandProblem(other);
+							return false;
+						}
+						roles[v] = SUM;
+						return true;
+					}
+				}
+			}
+			if (isArithmetic(i.op) && i.op != OP_CONVERT) {
+				bool lane = false;
+				for (unsigned j = 0; j < i.count; j++) {
+					why = operandProblem(roles[i.operands[j]]);
+					if (!why.empty()) {
+						return false;
+					}
+					lane = lane || roles[i.operands[j]] == LANE;
+				}
+				if (!lane) {
+					why = "it works out something that doesn't depend on the element on every iteration";
+					return false;
+				}
+				if (!supported(i.op, i.type)) {
+					return false;
+				}
+				if (!setLane(loop, i.type, why)) {
+					return false;
+				}
+				roles[v] = LANE;
+				return true;
+			}
+			return false;
+		}
+
+		// Whether a block is the header of a loop this pass made, whose body uses vectors.
+		static bool vectorLoop(const Function *f, unsigned header) {
+			ValueId t = f->terminator(header);
+			if (t == NO_VALUE || f->values[t].op != OP_BRANCH) {
+				return false;
+			}
+			for (ValueId v : f->blocks[f->values[t].targets[0]].code) {
+				const Instruction &i = f->values[v];
+				if (irVector(i.type) || (i.op == OP_STORE && irVector(f->values[i.operands[1]].type))) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		static ValueId incoming(const Function *f, ValueId phi, unsigned from) {
+			const Instruction &i = f->values[phi];
+			for (unsigned j = 0; j < i.count; j++) {
+				if (i.incoming[j] == from) {
+					return i.operands[j];
+				}
+			}
+			return NO_VALUE;
+		}
+
+		// The element size of an ADDRESS, from the constant its OFFSET multiplies the index by.
+		static long long stride(const Function *f, const Loop &loop, ValueId address) {
+			const Instruction &a = f->values[address];
+			const Instruction &offset = f->values[loop.roles[a.operands[0]] == OFFSET ? a.operands[0] : a.operands[1]];
+			return f->values[loop.roles[offset.operands[0]] == INDEX ? offset.operands[1] : offset.operands[0]].imm;
+		}
+
+		static ValueId addressBase(const Function *f, const Loop &loop, ValueId address) {
+			const Instruction &a = f->values[address];
+			return loop.roles[a.operands[0]] == INVARIANT ? a.operands[0] : a.operands[1];
+		}
+
+		// The stack slot or global an address is a constant offset into, if it is one.
+		static ValueId root(const Function *f, ValueId address) {
+			while (f->values[address].op == OP_ADD && f->isConstant(f->values[address].operands[1])) {
+				address = f->values[address].operands[0];
+			}
+			return address;
+		}
+
+		// Whether two arrays are known to be in different memory: different stack slots or globals, or a stack
+		// slot and memory that existed before the function was called.
+		static bool distinct(const Function *f, ValueId a, ValueId b) {
+			const Instruction &x = f->values[root(f, a)];
+			const Instruction &y = f->values[root(f, b)];
+			if (x.op == OP_STACK || y.op == OP_STACK) {
+				bool other = x.op == OP_STACK ? (y.op == OP_STACK || y.op == OP_PARAM || y.op == OP_SYMBOL) : (x.op == OP_PARAM || x.op == OP_SYMBOL);
+				return other && !(x.op == y.op && x.imm == y.imm);
+			}
+			return x.op == OP_SYMBOL && y.op == OP_SYMBOL && x.imm != y.imm;
+		}
+
+		// Put an instruction at the end of a block, before its terminator.
+		static ValueId before(Function *f, unsigned block, Opcode op, IRType type, std::initializer_list<ValueId> operands, long long imm = 0) {
+			ValueId v = f->create(op, type, operands.begin(), operands.size(), imm);
+			f->values[v].block = block;
+			std::vector<ValueId> &code = f->blocks[block].code;
+			code.insert(code.end() - 1, v);
+			return v;
+		}
+
+		// The loop becomes:
+		//   preheader: work out the number of iterations to do with vectors, and the invariant vectors
+		//   vector header: vector index and totals; branch to the vector body or the vector exit
+		//   vector body: the body, a vector of iterations at a time
+		//   vector exit: add up the lanes of the totals, then go on to the original loop from where it got to
+		void vectorize(Function *f, Loop &loop) {
+			unsigned lanes = 16 / irSize(loop.lane);
+			unsigned preheader = loop.preheader;
+			if (f->values[f->terminator(preheader)].op != OP_JUMP) {
+				unsigned nb = f->addBlock();
+				Instruction &t = f->values[f->terminator(preheader)];
+				for (unsigned j = 0; j < 2; j++) {
+					if (t.targets[j] == loop.header) {
+						t.targets[j] = nb;
+					}
+				}
+				f->replacePredecessor(loop.header, preheader, nb);
+				f->blocks[nb].preds.push_back(preheader);
+				ValueId jump = f->create(OP_JUMP, IR_VOID, nullptr, 0);
+				f->values[jump].block = nb;
+				f->values[jump].targets[0] = loop.header;
+				f->blocks[nb].code.push_back(jump);
+				preheader = nb;
+			}
+
+			// The vector loop stops at the limit rounded down to a whole number of vectors, or doesn't run at all if
+			// an array written to overlaps another.
+			ValueId zero = before(f, preheader, OP_CONST, IR_I64, {}, 0);
+			ValueId count = before(f, preheader, OP_AND, IR_I64, {loop.limit, before(f, preheader, OP_CONST, IR_I64, {}, -(long long) lanes)});
+			ValueId separate = NO_VALUE;
+			ValueId bytes = before(f, preheader, OP_MUL, IR_I64, {loop.limit, before(f, preheader, OP_CONST, IR_I64, {}, irSize(loop.lane))});
+			for (ValueId s : loop.stored) {
+				for (ValueId b : loop.bases) {
+					// Two arrays that are both written to only need checking once.
+					if (b == s || distinct(f, s, b) || std::find(loop.stored.begin(), loop.stored.end(), b) < std::find(loop.stored.begin(), loop.stored.end(), s)) {
+						continue;
+					}
+					ValueId below = before(f, preheader, OP_ULE, IR_I8, {before(f, preheader, OP_ADD, IR_PTR, {s, bytes}), b});
+					ValueId above = before(f, preheader, OP_ULE, IR_I8, {before(f, preheader, OP_ADD, IR_PTR, {b, bytes}), s});
+					ValueId ok = before(f, preheader, OP_OR, IR_I8, {below, above});
+					separate = separate == NO_VALUE ? ok : before(f, preheader, OP_AND, IR_I8, {separate, ok});
+				}
+			}
+			if (separate != NO_VALUE) {
+				ValueId wide = before(f, preheader, OP_CONVERT, IR_I64, {separate});
+				f->values[wide].flags = CONVERT_UNSIGNED;
+				count = before(f, preheader, OP_AND, IR_I64, {count, before(f, preheader, OP_SUB, IR_I64, {zero, wide})});
+			}
+
+			unsigned vectorHeader = f->addBlock();
+			unsigned vectorBody = f->addBlock();
+			unsigned vectorExit = f->addBlock();
+			Instruction &t = f->values[f->terminator(preheader)];
+			t.targets[0] = vectorHeader;
+			f->blocks[vectorHeader].preds.push_back(preheader);
+
+			ValueId index = f->emitPhi(vectorHeader, IR_I64);
+			f->addIncoming(index, zero, preheader);
+			std::map<ValueId, ValueId> mapped;
+			std::map<ValueId, ValueId> splats;
+			auto splat = [&](ValueId v) {
+				auto s = splats.find(v);
+				if (s == splats.end()) {
+					s = splats.insert(std::make_pair(v, before(f, preheader, OP_SPLAT, irVectorOf(f->values[v].type), {v}))).first;
+				}
+				return s->second;
+			};
+			auto operand = [&](ValueId v) {
+				return loop.roles[v] == INVARIANT ? splat(v) : mapped[v];
+			};
+			std::vector<ValueId> totals;
+			for (ValueId v : f->blocks[loop.header].code) {
+				if (loop.roles[v] == TOTAL) {
+					ValueId phi = f->emitPhi(vectorHeader, irVectorOf(f->values[v].type));
+					f->addIncoming(phi, splat(before(f, preheader, OP_CONST, f->values[v].type, {}, 0)), preheader);
+					mapped[v] = phi;
+					totals.push_back(v);
+				}
+			}
+			f->branch(vectorHeader, f->emit(vectorHeader, f->values[loop.compare].op, IR_I8, {index, count}), vectorBody, vectorExit);
+
+			for (ValueId v : f->blocks[loop.body].code) {
+				// A copy, since adding instructions can move the original.
+				const Instruction i = f->values[v];
+				switch (loop.roles[v]) {
+					case (OFFSET) : {
+						unsigned j = loop.roles[i.operands[0]] == INDEX ? 1 : 0;
+						mapped[v] = f->emit(vectorBody, OP_MUL, IR_I64, {index, i.operands[j]});
+						break;
+					}
+					case (ADDRESS) : {
+						unsigned j = loop.roles[i.operands[0]] == INVARIANT ? 0 : 1;
+						mapped[v] = f->emit(vectorBody, OP_ADD, IR_PTR, {i.operands[j], mapped[i.operands[1 - j]]});
+						break;
+					}
+					case (LANE) :
+					case (SUM) : {
+						IRType type = irVectorOf(i.type);
+						if (i.op == OP_LOAD) {
+							mapped[v] = f->emit(vectorBody, OP_LOAD, type, {mapped[i.operands[0]]});
+						}
+						else {
+							std::vector<ValueId> operands;
+							for (unsigned j = 0; j < i.count; j++) {
+								operands.push_back(operand(i.operands[j]));
+							}
+							mapped[v] = f->emit(vectorBody, i.op, type, operands);
+							f->values[mapped[v]].flags = i.flags;
+						}
+						break;
+					}
+					default : {
+						if (i.op == OP_STORE) {
+							f->emit(vectorBody, OP_STORE, IR_VOID, {mapped[i.operands[0]], operand(i.operands[1])});
+						}
+					}
+				}
+			}
+			ValueId next = f->emit(vectorBody, OP_ADD, IR_I64, {index, before(f, preheader, OP_CONST, IR_I64, {}, lanes)});
+			f->jump(vectorBody, vectorHeader);
+			f->addIncoming(index, next, vectorBody);
+			for (ValueId v : totals) {
+				f->addIncoming(mapped[v], mapped[incoming(f, v, loop.body)], vectorBody);
+			}
+
+			// The original loop takes over from where the vector loop stopped, with the totals so far.
+			std::vector<std::pair<ValueId, ValueId>> resume;
+			resume.push_back(std::make_pair(loop.index, index));
+			for (ValueId v : totals) {
+				ValueId sum = f->emit(vectorExit, OP_REDUCE, f->values[v].type, {mapped[v]});
+				resume.push_back(std::make_pair(v, f->emit(vectorExit, OP_ADD, f->values[v].type, {incoming(f, v, preheader), sum})));
+			}
+			f->replacePredecessor(loop.header, preheader, vectorExit);
+			for (const std::pair<ValueId, ValueId> &r : resume) {
+				Instruction &phi = f->values[r.first];
+				for (unsigned j = 0; j < phi.count; j++) {
+					if (phi.incoming[j] == vectorExit) {
+						phi.operands[j] = r.second;
+					}
+				}
+			}
+			ValueId jump = f->emit(vectorExit, OP_JUMP, IR_VOID);
+			f->values[jump].targets[0] = loop.header;
+		}
+};
+
+
+// Devirtualization, for a whole program.
+// A call through an interface value loads the routine from a slot of the value's witness table. When every witness
+// table in the program that has a routine in that slot which could take the call has the same one, the call can
+// only go there, so it is made to go straight there, where the inliner can see it. That is only so when the module
+// is the whole program, as it is when objects are linked with --lto-link, so this isn't one of the standard passes.
+class Devirtualization : public FunctionPass {
+
+	public:
+
+		unsigned devirtualized;			// Loads from witness tables replaced so far.
+
+		Devirtualization() : devirtualized(0) {}
+
+		const char* name() const {
+			return "devirtualize";
+		}
+
+		bool runOnFunction(Function *f) {
+			std::map<ValueId, std::vector<ValueId>> calls;			// The calls made through each load from a witness table.
+			std::set<ValueId> escaped;								// Loads whose routine is used some other way.
+			for (const BasicBlock &b : f->blocks) {
+				for (ValueId v : b.code) {
+					const Instruction &i = f->values[v];
+					for (unsigned j = 0; j < i.count; j++) {
+						const Instruction &o = f->values[i.operands[j]];
+						if (o.op != OP_LOAD || (o.flags & LOAD_WITNESS) == 0) {
+							continue;
+						}
+						if (i.op == OP_CALL && j == 0) {
+							calls[i.operands[j]].push_back(v);
+						}
+						else {
+							escaped.insert(i.operands[j]);
+						}
+					}
+				}
+			}
+			bool changed = false;
+			for (const auto &c : calls) {
+				unsigned target;
+				if (escaped.count(c.first) == 0 && onlyTarget(f, c.first, c.second, target)) {
+					Instruction &i = f->values[c.first];
+					i.op = OP_SYMBOL;
+					i.count = 0;
+					i.flags = 0;
+					i.imm = target;
+					devirtualized++;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+
+	private:
+
+		// Whether the routine that a load from a witness table finds has to be one symbol, and if it is, which.
+		// A table with nothing in the slot, because what implements it is generic, can't be what the calls use.
+		bool onlyTarget(const Function *f, ValueId load, const std::vector<ValueId> &calls, unsigned &target) {
+			ValueId address = f->values[load].operands[0];
+			long long offset = 0;
+			if (f->values[address].op == OP_ADD && f->isConstant(f->values[address].operands[1])) {
+				offset = f->values[f->values[address].operands[1]].imm;
+			}
+			std::set<unsigned> targets;
+			for (const DataObject *d : module->data) {
+				if (!WitnessTable::isWitnessTable(d->name)) {
+					continue;
+				}
+				for (const Relocation &r : d->relocations) {
+					if (r.offset != offset || r.addend != 0) {
+						continue;
+					}
+					const Function *callee = module->functionFor(r.symbol);
+					bool possible = true;
+					for (unsigned k = 0; k < calls.size() && callee != nullptr; k++) {
+						possible = possible && signatureMatches(f, f->values[calls[k]], callee);
+					}
+					if (possible) {
+						targets.insert(r.symbol);
+					}
+				}
+			}
+			if (targets.size() != 1) {
+				return false;
+			}
+			target = *targets.begin();
+			return true;
+		}
+};
+
+
+// Dead routine elimination, for a whole program.
+// Only the routines and data that main reaches, through what they call and refer to, are kept, as a linker that
+// collects unused sections would keep them, but before any code is generated for them. A module without a main is a
+// library, so everything that another object could refer to is kept too.
+class DeadRoutineElimination : public Pass {
+
+	public:
+
+		unsigned removed;			// Functions and data removed so far.
+
+		DeadRoutineElimination() : removed(0) {}
+
+		const char* name() const {
+			return "strip";
+		}
+
+		bool run(IRModule *module) {
+			std::vector<bool> live(module->symbols.size(), false);
+			std::vector<unsigned> work;
+			const Function *main = module->functionFor(module->findSymbol("main"));
+			for (unsigned s = 0; s < module->symbols.size(); s++) {
+				const Symbol &symbol = module->symbols[s];
+				if (main != nullptr ? s == main->symbol : symbol.kind != EXTERNAL_SYMBOL && !IRModule::isLocal(symbol.name)) {
+					work.push_back(s);
+				}
+			}
+			while (!work.empty()) {
+				unsigned s = work.back();
+				work.pop_back();
+				if (live[s]) {
+					continue;
+				}
+				live[s] = true;
+				const Symbol &symbol = module->symbols[s];
+				if (symbol.kind == ROUTINE_SYMBOL) {
+					for (const Instruction &i : module->functions[symbol.index]->values) {
+						if (i.op == OP_SYMBOL) {
+							work.push_back(i.imm);
+						}
+					}
+				}
+				else if (symbol.kind == DATA_SYMBOL) {
+					for (const Relocation &r : module->data[symbol.index]->relocations) {
+						work.push_back(r.symbol);
+					}
+				}
+			}
+			unsigned dead = 0;
+			for (unsigned s = 0; s < module->symbols.size(); s++) {
+				dead += !live[s] && module->symbols[s].kind != EXTERNAL_SYMBOL;
+			}
+			if (dead == 0) {
+				return false;
+			}
+			module->strip(live);
+			removed += dead;
+			return true;
+		}
+};
+
+
+// Runs passes over a module, timing each one.
+class PassManager {
+
+	public:
+
+		// The total time spent in a pass over every time it was run.
+		struct Timing {
+			std::string pass;
+			double seconds;
+			unsigned runs;
+			unsigned changes;		// The number of runs that changed something.
+		};
+
+		bool verifyEach;			// Check every function after each pass, to find a pass that breaks something.
+
+		PassManager() : verifyEach(false) {}
+
+		~PassManager() {
+			for (Pass *p : passes) {
+				delete p;
+			}
+		}
+
+		// Add a pass to the end of the pipeline. The manager takes ownership of it.
+		void add(Pass *p) {
+			passes.push_back(p);
+			Timing t;
+			t.pass = p->name();
+			t.seconds = 0;
+			t.runs = 0;
+			t.changes = 0;
+			timings.push_back(t);
+		}
+
+		// Run the pipeline repeatedly until it stops changing the module, at most maxRounds times.
+		// Returns false if verification was on and found a problem.
+		bool run(IRModule *module, unsigned maxRounds = 8) {
+			TraceScope trace("optimize");
+			for (unsigned round = 0; round < maxRounds; round++) {
+				bool changed = false;
+				for (unsigned p = 0; p < passes.size(); p++) {
+					auto start = std::chrono::steady_clock::now();
+					bool c;
+					{
+						TraceScope trace(passes[p]->name());
+						c = passes[p]->run(module);
+					}
+					std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+					timings[p].seconds += elapsed.count();
+					timings[p].runs++;
+					if (c) {
+						timings[p].changes++;
+						changed = true;
+					}
+					if (verifyEach) {
+						bool ok = true;
+						for (const Function *f : module->functions) {
+							ok = f->blocks.empty() || verifyFunction(f, stderr) ? ok : false;
+						}
+						if (!ok) {
+							fprintf(stderr, "The IR was broken by pass %s.\n", passes[p]->name());
+							return false;
+						}
+					}
+				}
+				if (!changed) {
+					break;
+				}
+			}
+			return true;
+		}
+
+		const std::vector<Timing>& times() const {
+			return timings;
+		}
+
+		void printTimings(FILE *out) const {
+			double total = 0;
+			for (const Timing &t : timings) {
+				total += t.seconds;
+			}
+			fprintf(out, "%-12s %10s %6s %8s %7s\n", "pass", "time (ms)", "%", "runs", "changed");
+			for (const Timing &t : timings) {
+				fprintf(out, "%-12s %10.3f %6.1f %8u %7u\n", t.pass.c_str(), t.seconds * 1000, total > 0 ? 100 * t.seconds / total : 0.0, t.runs, t.changes);
+			}
+			fprintf(out, "%-12s %10.3f\n", "total", total * 1000);
+		}
+
+	private:
+
+		std::vector<Pass*> passes;
+		std::vector<Timing> timings;
+};
+
+
+// Set up the standard optimization pipeline. The vectorizer says what it did to vectorizeReport, if it's given.
+void addStandardPasses(PassManager &pm, FILE *vectorizeReport = nullptr) {
+	pm.add(new ConstantFolding());
+	pm.add(new TailRecursionElimination());
+	pm.add(new PureCallFolding());
+	pm.add(new ValueNumbering());
+	pm.add(new LoopInvariantMotion());
+	pm.add(new BoundsCheckElimination());
+	pm.add(new ClosureOptimization());
+	pm.add(new DeadCodeElimination());
+	pm.add(new Inliner());
+	pm.add(new LoopVectorizer(vectorizeReport));
+}
+
+#endif
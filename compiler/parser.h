@@ -4,124 +4,1528 @@
 #include "includes.h"
 
 
-struct Import {
+struct TypeName;
+struct Expression;
+struct Statement;
+struct Routine;
+
+
+// An import of a module, such as "import pointer as p from stdlib".
+struct Import : AllocatedFrom<syntaxMemory> {
+	std::string module;		// The module being imported.
+	std::string alias;		// The name the module is referred to by; the module name if there is no "as".
+	std::string source;		// The library named after "from".
+	bool global;			// Whether the module's names are imported into the global scope.
+};
+
+
+// A parameter in a routine signature or a routine type.
+// Either half may be missing: "proc(int, int)" has no names and "proc(impl)" has no separate type.
+struct Parameter : AllocatedFrom<syntaxMemory> {
+	TypeName *type;
+	std::string name;
+
+	Parameter(TypeName *t = nullptr) : type(t) {}
+	~Parameter();
+};
+
+
+// The kinds of type that can be written in source.
+enum TypeKind {
+	NAMED_TYPE,		// int, B, T as Ord
+	ARRAY_TYPE,		// [10] int, [] T
+	POINTER_TYPE,	// B&
+	ROUTINE_TYPE,	// proc(int, int) -> int
+	IMPL_TYPE,		// impl, the class implementing an interface
+	INFERRED_TYPE	// var
+};
+
+
+// A type as it is written in source.
+struct TypeName : AllocatedFrom<syntaxMemory> {
+	TypeKind kind;
+	std::string name;					// The name of a NAMED_TYPE.
+	std::string constraint;				// The interface in "T as A"; empty if the type is unconstrained.
+	TypeName *element;					// The element type of an ARRAY_TYPE or the target of a POINTER_TYPE.
+	long long length;					// The length of an ARRAY_TYPE; -1 for [] and -2 if it is only known at runtime.
+	Expression *lengthExpr;				// The length of an ARRAY_TYPE that is only known at runtime.
+	bool pure;							// Whether a ROUTINE_TYPE is a func rather than a proc.
+	std::vector<Parameter*> params;		// The parameters of a ROUTINE_TYPE.
+	TypeName *returnType;				// The return type of a ROUTINE_TYPE.
+
+	TypeName(TypeKind k = NAMED_TYPE, std::string n = "") : kind(k), name(n), element(nullptr), length(-1), lengthExpr(nullptr), pure(false), returnType(nullptr) {}
+
+	~TypeName();
+
+	// A deep copy of the type.
+	// A length that is only known at runtime isn't copied, so the copy just records that the length is dynamic.
+	TypeName* clone() const;
+
+	// The type as it would be written in source, used for diagnostics and for naming instantiations.
+	std::string spelling() const {
+		std::string ret;
+		switch (kind) {
+			case (NAMED_TYPE) : {
+				ret = name;
+				if (!constraint.empty()) {
+					ret += " as " + constraint;
+				}
+				break;
+			}
+			case (ARRAY_TYPE) : {
+				ret = length >= 0 ? "[" + std::to_string(length) + "]" : (length == -1 ? "[]" : "[?]");
+				ret += element->spelling();
+				break;
+			}
+			case (POINTER_TYPE) : {
+				ret = element->spelling() + "&";
+				break;
+			}
+			case (ROUTINE_TYPE) : {
+				ret = pure ? "func(" : "proc(";
+				for (unsigned i = 0; i < params.size(); i++) {
+					if (i > 0) {
+						ret += ",";
+					}
+					ret += params[i]->type->spelling();
+				}
+				ret += ")->" + returnType->spelling();
+				break;
+			}
+			case (IMPL_TYPE) : {
+				ret = "impl";
+				break;
+			}
+			case (INFERRED_TYPE) : {
+				ret = "var";
+				break;
+			}
+		}
+		return ret;
+	}
 };
 
+Parameter::~Parameter() {
+	delete type;
+}
+
 
-struct Namespace {
+// The kinds of expression.
+enum ExpressionKind {
+	INTEGER_EXPR,
+	FLOAT_EXPR,
+	CHARACTER_EXPR,
+	STRING_EXPR,
+	NAME_EXPR,
+	UNARY_EXPR,			// -a, !a, ~a, &a, *a, ++a, --a
+	POSTFIX_EXPR,		// a++, a--
+	BINARY_EXPR,
+	ASSIGN_EXPR,		// a = b, a += b, ...
+	CALL_EXPR,			// operands are the callee followed by the arguments
+	INDEX_EXPR,			// a[i]
+	MEMBER_EXPR,		// a.name
+	CAST_EXPR,			// CAST(type, a)
+	IF_EXPR,			// if (a) {b} else {c}
+	ROUTINE_EXPR,		// an anonymous proc, or a lambda such as \a, b -> a + b
+	ARRAY_EXPR			// {a, b, c}
 };
 
-struct VariableDeclaration {
+
+struct Expression : AllocatedFrom<syntaxMemory> {
+	ExpressionKind kind;
+	TokenType op;						// The operator of a unary, postfix, binary or assignment expression.
+	unsigned long long intValue;		// The value of an integer or character literal.
+	double floatValue;
+	std::string name;					// The name referred to, the member selected or the contents of a string literal.
+	std::vector<Expression*> operands;
+	TypeName *type;						// The type converted to by a cast.
+	Routine *routine;					// The routine defined by a ROUTINE_EXPR.
+	unsigned linenum;
+	unsigned colnum;
+
+	Expression(ExpressionKind k = NAME_EXPR) : kind(k), op(ERROR), intValue(0), floatValue(0.0), type(nullptr), routine(nullptr), linenum(0), colnum(0) {}
+	~Expression();
 };
 
-struct TypeDeclaraion {
+
+TypeName::~TypeName() {
+	delete element;
+	delete returnType;
+	delete lengthExpr;
+	for (Parameter *p : params) {
+		delete p;
+	}
+}
+
+TypeName* TypeName::clone() const {
+	TypeName *ret = new TypeName(kind, name);
+	ret->constraint = constraint;
+	ret->length = length;
+	ret->pure = pure;
+	ret->element = element == nullptr ? nullptr : element->clone();
+	ret->returnType = returnType == nullptr ? nullptr : returnType->clone();
+	for (const Parameter *p : params) {
+		Parameter *copy = new Parameter(p->type == nullptr ? nullptr : p->type->clone());
+		copy->name = p->name;
+		ret->params.push_back(copy);
+	}
+	return ret;
+}
+
+
+struct VariableDeclaration : AllocatedFrom<syntaxMemory> {
+	TypeName *type;
+	std::string name;
+	bool isConst;
+	bool isStatic;
+	Expression *initializer;
+	unsigned linenum;
+	unsigned colnum;
+
+	VariableDeclaration() : type(nullptr), isConst(false), isStatic(false), initializer(nullptr), linenum(0), colnum(0) {}
+
+	~VariableDeclaration() {
+		delete type;
+		delete initializer;
+	}
 };
 
-struct Routine {
+
+// The kinds of statement.
+enum StatementKind {
+	BLOCK_STMT,
+	EXPRESSION_STMT,
+	DECLARATION_STMT,
+	IF_STMT,
+	WHILE_STMT,
+	FOR_STMT,
+	FOREACH_STMT,
+	SWITCH_STMT,
+	RETURN_STMT,
+	BREAK_STMT,
+	CONTINUE_STMT
 };
 
-struct Program {
-	std::vector<Import> imports;
-	std::vector<Namespace> namespaces;
-	std::vector<Routine> routines;
-	std::vector<VariableDeclaration> varDecls;
-	std::vector<TypeDeclaration> typeDecls;
+
+// How a foreach loop binds its variable.
+enum ForeachKind {
+	FOREACH_INDEX,		// for (var i ind arr), i is each index of arr
+	FOREACH_VALUE,		// for (var v val arr), v is a copy of each element
+	FOREACH_REFERENCE	// for (var r ref arr), r points to each element
 };
 
+
+struct Statement : AllocatedFrom<syntaxMemory> {
+	StatementKind kind;
+	std::vector<Statement*> body;			// The statements of a block, or the body of each case of a switch.
+	std::vector<Expression*> cases;			// The value of each case of a switch; nullptr for the else case.
+	Expression *expr;						// The expression, condition, returned value, iterated array or switched value.
+	VariableDeclaration *decl;				// The variable declared by a declaration or a foreach loop.
+	Statement *init;						// The first clause of a for loop.
+	Expression *step;						// The last clause of a for loop.
+	Statement *then;						// The body of a loop or an if statement.
+	Statement *otherwise;					// The else branch of an if statement.
+	ForeachKind foreach;
+	unsigned linenum;
+	unsigned colnum;
+
+	Statement(StatementKind k = BLOCK_STMT) : kind(k), expr(nullptr), decl(nullptr), init(nullptr), step(nullptr), then(nullptr), otherwise(nullptr), foreach(FOREACH_VALUE), linenum(0), colnum(0) {}
+
+	~Statement() {
+		for (Statement *s : body) {
+			delete s;
+		}
+		for (Expression *e : cases) {
+			delete e;
+		}
+		delete expr;
+		delete decl;
+		delete init;
+		delete step;
+		delete then;
+		delete otherwise;
+	}
+};
+
+
+// A proc or a func.
+// Routines declared in an interface without a body are requirements that instances must fill in.
+struct Routine : AllocatedFrom<syntaxMemory> {
+	std::string name;
+	bool pure;							// func rather than proc.
+	std::vector<Parameter*> params;
+	TypeName *returnType;
+	bool hasBody;
+	Statement *body;					// The body of a proc.
+	Expression *value;					// The body of a func.
+	unsigned linenum;
+	unsigned colnum;
+
+	Routine() : pure(false), returnType(nullptr), hasBody(false), body(nullptr), value(nullptr), linenum(0), colnum(0) {}
+
+	~Routine() {
+		delete returnType;
+		delete body;
+		delete value;
+		for (Parameter *p : params) {
+			delete p;
+		}
+	}
+
+	// A copy of the routine's signature.
+	// The body isn't copied; it stays with the original, which code generated from the copy refers back to.
+	Routine* clone() const {
+		Routine *ret = new Routine();
+		ret->name = name;
+		ret->pure = pure;
+		ret->returnType = returnType == nullptr ? nullptr : returnType->clone();
+		ret->hasBody = hasBody;
+		ret->linenum = linenum;
+		ret->colnum = colnum;
+		for (const Parameter *p : params) {
+			Parameter *copy = new Parameter(p->type == nullptr ? nullptr : p->type->clone());
+			copy->name = p->name;
+			ret->params.push_back(copy);
+		}
+		return ret;
+	}
+};
+
+
+// Operator chains like a + b + c nest to the left as deep as they are long, so the first operands down a chain are
+// taken from their parents and freed in a loop, rather than each by the destructor of the one above it.
+Expression::~Expression() {
+	Expression *next = operands.empty() ? nullptr : operands[0];
+	for (unsigned j = 1; j < operands.size(); j++) {
+		delete operands[j];
+	}
+	while (next != nullptr) {
+		Expression *e = next;
+		next = e->operands.empty() ? nullptr : e->operands[0];
+		if (next != nullptr) {
+			e->operands[0] = nullptr;
+		}
+		delete e;
+	}
+	delete type;
+	delete routine;
+}
+
+
+// The kinds of user defined type.
+enum TypeDeclarationKind {
+	CLASS_DECL,
+	STRUCT_DECL,
+	UNION_DECL,
+	ENUM_DECL,
+	ALIAS_DECL,
+	INTERFACE_DECL,
+	INSTANCE_DECL		// "B : A { ... }", the routines with which class B implements interface A
+};
+
+
+struct TypeDeclaration : AllocatedFrom<syntaxMemory> {
+	TypeDeclarationKind kind;
+	std::string name;							// The declared type, or the implementing class of an instance.
+	std::string interfaceName;					// The interface that an instance implements.
+	std::vector<VariableDeclaration*> fields;
+	std::vector<Routine*> routines;				// The methods of an interface or an instance.
+	std::vector<std::string> enumerators;
+	TypeName *aliased;
+	unsigned linenum;
+	unsigned colnum;
+
+	TypeDeclaration() : kind(CLASS_DECL), aliased(nullptr), linenum(0), colnum(0) {}
+
+	~TypeDeclaration() {
+		delete aliased;
+		for (VariableDeclaration *v : fields) {
+			delete v;
+		}
+		for (Routine *r : routines) {
+			delete r;
+		}
+	}
+};
+
+
+struct Program;
+
+// "namespace name { ... }", or "module name;" which names the module the file defines.
+struct Namespace : AllocatedFrom<syntaxMemory> {
+	std::string name;
+	bool isModule;
+	Program *contents;
+
+	Namespace() : isModule(false), contents(nullptr) {}
+	~Namespace();
+};
+
+
+struct Program : AllocatedFrom<syntaxMemory> {
+	std::vector<Import*> imports;
+	std::vector<Namespace*> namespaces;
+	std::vector<Routine*> routines;
+	std::vector<VariableDeclaration*> varDecls;
+	std::vector<TypeDeclaration*> typeDecls;
+	std::set<std::string> structOfArrays;		// The classes whose arrays are laid out as a struct of arrays.
+
+	~Program() {
+		for (Import *i : imports) {
+			delete i;
+		}
+		for (Namespace *n : namespaces) {
+			delete n;
+		}
+		for (Routine *r : routines) {
+			delete r;
+		}
+		for (VariableDeclaration *v : varDecls) {
+			delete v;
+		}
+		for (TypeDeclaration *t : typeDecls) {
+			delete t;
+		}
+	}
+};
+
+Namespace::~Namespace() {
+	delete contents;
+}
+
+
 class Parser {
 	public:
-		Parser(std::string *filename) : lex(filename) {}
-		~Parser(){}
+		// Syntax errors and the lexer's warnings are added to diagnostics.
+		Parser(std::string *filename, std::string &diagnostics) : lex(filename, diagnostics), failed(false), previous(ERROR), depth(0) {}
 
-		Import parseImport() {
-			return Import();
-		}
+		Parser(FILE *in, const std::string &name, std::string &diagnostics) : lex(in, name, diagnostics), failed(false), previous(ERROR), depth(0) {}
 
-		Namespace parseNamespace() {
-			return Namespace();
+		// How deeply syntax may nest, counting a level for each statement, type and primary expression, and for
+		// each unary, postfix or assignment operator, so ((x)) is three deep. The later passes walk the syntax
+		// tree recursively, so input nested deeper than this is a syntax error rather than a stack overflow.
+		static const unsigned MAX_NESTING = 2048;
+
+		~Parser() {
+			for (Token *t : lookahead) {
+				delete t;
+			}
+			// The lexer reads a token ahead, which is only shared with the lookahead at the end of the input.
+			if (lookahead.empty() || lookahead.back() != lex.nextToken) {
+				delete lex.nextToken;
+			}
 		}
 
-		VariableDeclaration parseVarDecl() {
-			return VariableDeclaration();
+		// import name [as alias] [globally] from source
+		Import* parseImport() {
+			TraceScope trace("parseImport");
+			Import *ret = new Import();
+			ret->global = false;
+			consume();
+			ret->module = identifier("module name");
+			ret->alias = ret->module;
+			if (accept(AS)) {
+				ret->alias = identifier("module alias");
+			}
+			if (accept(GLOBALLY)) {
+				ret->global = true;
+			}
+			if (expect(FROM, "\'from\'")) {
+				ret->source = identifier("library name");
+			}
+			accept(SEMI_COLON);
+			return ret;
 		}
 
-		TypeDeclaration parseTypeDecl() {
-			return TypeDeclaration();
+		// namespace name { declarations }
+		// module name;
+		Namespace* parseNamespace() {
+			TraceScope trace("parseNamespace");
+			Nesting nesting(this);
+			Namespace *ret = new Namespace();
+			if (!nesting.deeper()) {
+				return ret;
+			}
+			ret->isModule = (peek()->type == MODULE);
+			consume();
+			ret->name = identifier("namespace name");
+			if (ret->isModule) {
+				expect(SEMI_COLON, "\';\'");
+			}
+			else if (expect(LEFT_BRACE, "\'{\'")) {
+				ret->contents = new Program();
+				parseDeclarations(ret->contents, RIGHT_BRACE);
+				expect(RIGHT_BRACE, "\'}\'");
+			}
+			return ret;
 		}
 
-		Routine parseRoutine() {
-			return Routine();
+		// [const] [static] type name [= initializer];
+		VariableDeclaration* parseVarDecl() {
+			TraceScope trace("parseVarDecl");
+			VariableDeclaration *ret = new VariableDeclaration();
+			ret->linenum = peek()->startLinenum;
+			ret->colnum = peek()->startColnum;
+			while (peek()->type == CONST || peek()->type == STATIC) {
+				if (peek()->type == CONST) {
+					ret->isConst = true;
+				}
+				else {
+					ret->isStatic = true;
+				}
+				consume();
+			}
+			ret->type = parseType();
+			ret->name = identifier("variable name");
+			finishVarDecl(ret);
+			return ret;
 		}
 
-		Program* parse() {
-			Program *ret = new Program();
-			
-			while (lex.nextToken->type != END_OF_FILE && lex.nextToken->type != ERROR) {
-				Token *nToken = lex.nextToken;
-				switch(nToken->type) {
-					case (LEFT_BRACKET):
-					case (AMPERSAND):
-					case (VAR):
-					case (CONST):
-					case (STATIC):
-					case (IDENTIFIER) : {
-						ret->varDecls.push_back(parseVarDecl());
+		// class name { fields }, struct name { fields }, union name { fields }
+		// enum name { enumerators }
+		// alias name = type;
+		// interface name { routines }
+		// [instance] class : interface { routines }
+		TypeDeclaration* parseTypeDecl() {
+			TraceScope trace("parseTypeDecl");
+			TypeDeclaration *ret = new TypeDeclaration();
+			Token *first = peek();
+			ret->linenum = first->startLinenum;
+			ret->colnum = first->startColnum;
+
+			switch (first->type) {
+				case (CLASS) : {
+					ret->kind = CLASS_DECL;
+					break;
+				}
+				case (STRUCT) : {
+					ret->kind = STRUCT_DECL;
+					break;
+				}
+				case (UNION) : {
+					ret->kind = UNION_DECL;
+					break;
+				}
+				case (ENUM) : {
+					ret->kind = ENUM_DECL;
+					break;
+				}
+				case (ALIAS) : {
+					ret->kind = ALIAS_DECL;
+					break;
+				}
+				case (INTERFACE) : {
+					ret->kind = INTERFACE_DECL;
+					break;
+				}
+				default : {
+					ret->kind = INSTANCE_DECL;
+				}
+			}
+			if (first->type != IDENTIFIER) {
+				consume();
+			}
+
+			ret->name = identifier("type name");
+
+			switch (ret->kind) {
+				case (ALIAS_DECL) : {
+					expect(ASSIGNMENT, "\'=\'");
+					ret->aliased = parseType();
+					expect(SEMI_COLON, "\';\'");
+					return ret;
+				}
+				case (INSTANCE_DECL) : {
+					expect(COLON, "\':\'");
+					ret->interfaceName = identifier("interface name");
+					break;
+				}
+				default : {}
+			}
+
+			if (!expect(LEFT_BRACE, "\'{\'")) {
+				return ret;
+			}
+			while (!failed && peek()->type != RIGHT_BRACE && peek()->type != END_OF_FILE && peek()->type != ERROR) {
+				switch (ret->kind) {
+					case (ENUM_DECL) : {
+						ret->enumerators.push_back(identifier("enumerator"));
+						if (peek()->type != RIGHT_BRACE) {
+							expect(COMMA, "\',\'");
+						}
 						break;
 					}
-					case (ALIAS):
-					case (STRUCT):
-					case (ENUM):
-					case (CLASS):
-					case (UNION):
-					case (INTERFACE):
-					case (INSTANCE) : {
-						ret->typeDecls.push_back(parseTypeDecl());
+					case (INTERFACE_DECL) :
+					case (INSTANCE_DECL) : {
+						if (peek()->type != FUNC && peek()->type != PROC) {
+							error("expected a routine");
+							break;
+						}
+						ret->routines.push_back(parseRoutine());
 						break;
 					}
-					case (FUNC):
-					case (PROC): {
-						ret->routines.push_back(parseRoutine());
+					default : {
+						ret->fields.push_back(parseVarDecl());
 					}
-					case (NAMESPACE):
-					case (MODULE) : {
-						ret->namespaces.push_back(parseNamespace());
-						break;
+				}
+			}
+			expect(RIGHT_BRACE, "\'}\'");
+			return ret;
+		}
+
+		// proc(parameters) -> type name { statements }
+		// func(parameters) -> type name = expression;
+		// Inside an interface a routine may have no body, in which case it ends with a semicolon.
+		Routine* parseRoutine() {
+			TraceScope trace("parseRoutine");
+			Routine *ret = new Routine();
+			ret->linenum = peek()->startLinenum;
+			ret->colnum = peek()->startColnum;
+			TypeName *signature = parseType();
+			ret->pure = signature->pure;
+			ret->params.swap(signature->params);
+			ret->returnType = signature->returnType;
+			signature->returnType = nullptr;
+			delete signature;
+			ret->name = identifier("routine name");
+			finishRoutine(ret);
+			return ret;
+		}
+
+		// type := [ length ] type
+		//       | ( type )
+		//       | proc ( parameters ) [-> type]
+		//       | func ( parameters ) [-> type]
+		//       | name [as interface]
+		//       | impl
+		//       | var
+		//       | type &
+		TypeName* parseType() {
+			TraceScope trace("parseType");
+			Nesting nesting(this);
+			if (!nesting.deeper()) {
+				return new TypeName(INFERRED_TYPE);
+			}
+			TypeName *ret = nullptr;
+			Token *t = peek();
+			switch (t->type) {
+				case (LEFT_BRACKET) : {
+					consume();
+					ret = new TypeName(ARRAY_TYPE);
+					if (peek()->type == INTEGER && peek(1)->type == RIGHT_BRACKET) {
+						ret->length = (long long) *(unsigned long long*)(peek()->data);
+						consume();
 					}
-					case (IMPORT) : {
-						ret->imports.push_back(parseImport());
-						break;
+					else if (peek()->type != RIGHT_BRACKET) {
+						ret->length = -2;
+						ret->lengthExpr = parseExpression();
 					}
-					case (LINE_COMMENT):
-					case (BLOCK_COMMENT):
-					case (OPEN_COMMENT):{
-						lex.getNextToken();
+					expect(RIGHT_BRACKET, "\']\'");
+					ret->element = parseType();
+					break;
+				}
+				case (LEFT_PAREN) : {
+					consume();
+					ret = parseType();
+					expect(RIGHT_PAREN, "\')\'");
+					break;
+				}
+				case (FUNC) :
+				case (PROC) : {
+					ret = new TypeName(ROUTINE_TYPE);
+					ret->pure = (t->type == FUNC);
+					consume();
+					if (!expect(LEFT_PAREN, "\'(\'")) {
 						break;
 					}
-					default : {
-						printf("Syntax error: unexpected token \'");
-						printToken(nToken);
-						printf("\' in global scope in %s (%u:%u).\n",  nToken->filename->c_str(), nToken->startLinenum, nToken->startColnum);
-						delete ret;
-						return nullptr;
+					while (!failed && peek()->type != RIGHT_PAREN) {
+						Parameter *param = new Parameter(parseType());
+						if (peek()->type == IDENTIFIER) {
+							param->name = identifier("parameter name");
+						}
+						ret->params.push_back(param);
+						if (peek()->type != RIGHT_PAREN && !expect(COMMA, "\',\'")) {
+							break;
+						}
 					}
+					expect(RIGHT_PAREN, "\')\'");
+					if (accept(ARROW)) {
+						ret->returnType = parseType();
+					}
+					else {
+						ret->returnType = new TypeName(NAMED_TYPE, "void");
+					}
+					break;
+				}
+				case (IDENTIFIER) : {
+					ret = new TypeName(NAMED_TYPE, identifier("type name"));
+					if (accept(AS)) {
+						ret->constraint = identifier("interface name");
+					}
+					break;
+				}
+				case (IMPL) : {
+					consume();
+					ret = new TypeName(IMPL_TYPE);
+					break;
+				}
+				case (VAR) : {
+					consume();
+					ret = new TypeName(INFERRED_TYPE);
+					break;
+				}
+				default : {
+					error("expected a type");
+					return new TypeName(INFERRED_TYPE);
+				}
+			}
+			while (peek()->type == AMPERSAND) {
+				consume();
+				TypeName *pointer = new TypeName(POINTER_TYPE);
+				pointer->element = ret;
+				ret = pointer;
+			}
+			return ret;
+		}
+
+		// { statements }
+		Statement* parseBlock() {
+			TraceScope trace("parseBlock");
+			Statement *ret = newStatement(BLOCK_STMT);
+			if (!expect(LEFT_BRACE, "\'{\'")) {
+				return ret;
+			}
+			while (!failed && peek()->type != RIGHT_BRACE && peek()->type != END_OF_FILE && peek()->type != ERROR) {
+				ret->body.push_back(parseStatement());
+			}
+			expect(RIGHT_BRACE, "\'}\'");
+			return ret;
+		}
+
+		// statement := { statements }
+		//            | if ( expression ) statement [else statement]
+		//            | while ( expression ) statement
+		//            | for ( [statement] ; [expression] ; [expression] ) statement
+		//            | for ( type name ind|val|ref expression ) statement
+		//            | switch ( expression ) { case expression : statements ... [else : statements] }
+		//            | return [expression] ;
+		//            | break ;
+		//            | continue ;
+		//            | type name [= expression] ;
+		//            | expression ;
+		Statement* parseStatement() {
+			TraceScope trace("parseStatement");
+			Nesting nesting(this);
+			if (!nesting.deeper()) {
+				return newStatement(BLOCK_STMT);
+			}
+			Token *t = peek();
+			switch (t->type) {
+				case (LEFT_BRACE) : {
+					return parseBlock();
+				}
+				case (IF) : {
+					Statement *ret = newStatement(IF_STMT);
+					consume();
+					ret->expr = parseCondition();
+					ret->then = parseStatement();
+					if (accept(ELSE)) {
+						ret->otherwise = parseStatement();
+					}
+					return ret;
+				}
+				case (WHILE) : {
+					Statement *ret = newStatement(WHILE_STMT);
+					consume();
+					ret->expr = parseCondition();
+					ret->then = parseStatement();
+					return ret;
+				}
+				case (FOR) :
+				case (FOREACH) : {
+					return parseFor();
+				}
+				case (SWITCH) : {
+					return parseSwitch();
+				}
+				case (RETURN) : {
+					Statement *ret = newStatement(RETURN_STMT);
+					consume();
+					if (peek()->type != SEMI_COLON) {
+						ret->expr = parseExpression();
+					}
+					expect(SEMI_COLON, "\';\'");
+					return ret;
+				}
+				case (BREAK) :
+				case (CONT) : {
+					Statement *ret = newStatement(t->type == BREAK ? BREAK_STMT : CONTINUE_STMT);
+					consume();
+					expect(SEMI_COLON, "\';\'");
+					return ret;
+				}
+				default : {
+					if (startsDeclaration()) {
+						Statement *ret = newStatement(DECLARATION_STMT);
+						ret->decl = parseVarDecl();
+						return ret;
+					}
+					Statement *ret = newStatement(EXPRESSION_STMT);
+					ret->expr = parseExpression();
+
+					// An expression ending in a block, like an anonymous proc, needs no semicolon.
+					if (previous != RIGHT_BRACE) {
+						expect(SEMI_COLON, "\';\'");
+					}
+					else {
+						accept(SEMI_COLON);
+					}
+					return ret;
+				}
+			}
+		}
+
+		// expression := assignment
+		Expression* parseExpression() {
+			TraceScope trace("parseExpression");
+			return parseAssignment();
+		}
+
+		// assignment := binary [assignment operator assignment]
+		//             | \name, name... -> assignment
+		Expression* parseAssignment() {
+			TraceScope trace("parseAssignment");
+			Nesting nesting(this);
+			Token *t = peek();
+			if (t->type == IDENTIFIER && ((std::string*)(t->data))->size() > 1 && (*(std::string*)(t->data))[0] == '\\') {
+				return nesting.deeper() ? parseLambda() : newExpression(INTEGER_EXPR);
+			}
+			Expression *ret = parseBinary(0);
+			switch (peek()->type) {
+				case (ASSIGNMENT) :
+				case (ADD_ASSIGN) :
+				case (SUBTRACT_ASSIGN) :
+				case (MULTIPLY_ASSIGN) :
+				case (DIV_ASSIGN) :
+				case (MOD_ASSIGN) :
+				case (OR_ASSIGN) :
+				case (XOR_ASSIGN) :
+				case (AND_ASSIGN) :
+				case (LEFT_SHIFT_ASSIGN) :
+				case (RIGHT_SHIFT_ASSIGN) : {
+					Expression *assign = newExpression(ASSIGN_EXPR);
+					assign->op = peek()->type;
+					consume();
+					assign->operands.push_back(ret);
+					assign->operands.push_back(nesting.deeper() ? parseAssignment() : newExpression(INTEGER_EXPR));
+					return assign;
+				}
+				default : {
+					return ret;
 				}
 			}
-			if (lex.nextToken->type == END_OF_FILE) {
+		}
+
+
+		Program* parse() {
+			TraceScope trace("parse");
+			Program *ret = new Program();
+			parseDeclarations(ret, END_OF_FILE);
+			if (!failed && peek()->type == END_OF_FILE) {
 				return ret;
 			}
 			else {
-				printToken(lex.nextToken);
+				if (peek()->type == ERROR) {
+					printToken(peek(), lex.diagnostics);
+				}
 				delete ret;
 				return nullptr;
 			}
 		}
 
+		// Parse the global declarations one at a time, handing each to visit in a program of its own that is freed
+		// once visit returns, so that a file of any size can be gone through in constant memory.
+		// Returns false if there was a syntax error.
+		bool parseEach(const std::function<void(const Program*)> &visit) {
+			TraceScope trace("parse");
+			while (!failed && peek()->type != END_OF_FILE && peek()->type != ERROR) {
+				Program *one = new Program();
+				parseDeclaration(one);
+				if (!failed) {
+					visit(one);
+				}
+				delete one;
+			}
+			if (!failed && peek()->type == END_OF_FILE) {
+				return true;
+			}
+			if (peek()->type == ERROR) {
+				printToken(peek(), lex.diagnostics);
+			}
+			return false;
+		}
+
 	private:
 		Lexer lex;
+
+		// Tokens that have been lexed but not yet consumed, with comments already removed.
+		// Once the end of the input or an error is reached, that token stays at the back for good.
+		std::deque<Token*> lookahead;
+
+		bool failed;
+
+		TokenType previous;		// The type of the last token consumed.
+
+		unsigned depth;			// How deeply the syntax being parsed is nested.
+
+		// Counts the levels of nesting entered in the routine it is declared in, and leaves them when it returns.
+		class Nesting {
+
+			public:
+
+				Nesting(Parser *p) : parser(p), saved(p->depth) {}
+
+				~Nesting() {
+					parser->depth = saved;
+				}
+
+				// Go a level deeper, reporting an error if that is too deep. Returns false once there is an error.
+				bool deeper() {
+					if (++parser->depth > MAX_NESTING && !parser->failed) {
+						Token *t = parser->peek();
+						std::string &diagnostics = parser->lex.diagnostics;
+						diagnose(diagnostics, "Syntax error: nested more than %u deep at \'", MAX_NESTING);
+						printToken(t, diagnostics);
+						diagnose(diagnostics, "\' in %s (%u:%u).\n", t->filename->c_str(), t->startLinenum, t->startColnum);
+						parser->failed = true;
+					}
+					return !parser->failed;
+				}
+
+			private:
+
+				Parser *parser;
+				unsigned saved;
+		};
+
+		// Parse global scope declarations into ret until the terminator is reached.
+		void parseDeclarations(Program *ret, TokenType terminator) {
+			TraceScope trace("parseDeclarations");
+			while (!failed && peek()->type != terminator && peek()->type != END_OF_FILE && peek()->type != ERROR) {
+				parseDeclaration(ret);
+			}
+		}
+
+		// Parse one global scope declaration into ret.
+		void parseDeclaration(Program *ret) {
+			TraceScope trace("parseDeclaration");
+			Token *nToken = peek();
+			switch(nToken->type) {
+				case (IDENTIFIER) : {
+					if (peek(1)->type == COLON) {
+						ret->typeDecls.push_back(parseTypeDecl());
+					}
+					else {
+						ret->varDecls.push_back(parseVarDecl());
+					}
+					break;
+				}
+				case (LEFT_BRACKET):
+				case (AMPERSAND):
+				case (VAR):
+				case (CONST):
+				case (STATIC): {
+					ret->varDecls.push_back(parseVarDecl());
+					break;
+				}
+				case (ALIAS):
+				case (STRUCT):
+				case (ENUM):
+				case (CLASS):
+				case (UNION):
+				case (INTERFACE):
+				case (INSTANCE) : {
+					ret->typeDecls.push_back(parseTypeDecl());
+					break;
+				}
+				case (FUNC):
+				case (PROC): {
+					// A routine type followed by a name is either a routine or a variable holding one.
+					unsigned linenum = nToken->startLinenum;
+					unsigned colnum = nToken->startColnum;
+					TypeName *type = parseType();
+					std::string name = identifier("routine name");
+					if (peek()->type == LEFT_BRACE || (type->pure && peek()->type == ASSIGNMENT)) {
+						Routine *routine = new Routine();
+						routine->name = name;
+						routine->pure = type->pure;
+						routine->params.swap(type->params);
+						routine->returnType = type->returnType;
+						routine->linenum = linenum;
+						routine->colnum = colnum;
+						type->returnType = nullptr;
+						delete type;
+						finishRoutine(routine);
+						ret->routines.push_back(routine);
+					}
+					else {
+						VariableDeclaration *var = new VariableDeclaration();
+						var->type = type;
+						var->name = name;
+						var->linenum = linenum;
+						var->colnum = colnum;
+						finishVarDecl(var);
+						ret->varDecls.push_back(var);
+					}
+					break;
+				}
+				case (NAMESPACE):
+				case (MODULE) : {
+					ret->namespaces.push_back(parseNamespace());
+					break;
+				}
+				case (IMPORT) : {
+					ret->imports.push_back(parseImport());
+					break;
+				}
+				default : {
+					lex.diagnostics += "Syntax error: unexpected token \'";
+					printToken(nToken, lex.diagnostics);
+					diagnose(lex.diagnostics, "\' in global scope in %s (%u:%u).\n",  nToken->filename->c_str(), nToken->startLinenum, nToken->startColnum);
+					failed = true;
+				}
+			}
+		}
+
+		// Parse whatever follows the name of a routine.
+		void finishRoutine(Routine *routine) {
+			if (peek()->type == LEFT_BRACE) {
+				routine->hasBody = true;
+				routine->body = parseBlock();
+			}
+			else if (routine->pure && accept(ASSIGNMENT)) {
+				routine->hasBody = true;
+				routine->value = parseExpression();
+				expect(SEMI_COLON, "\';\'");
+			}
+			else {
+				expect(SEMI_COLON, "\';\'");
+			}
+		}
+
+		// Parse whatever follows the name in a variable declaration.
+		void finishVarDecl(VariableDeclaration *decl) {
+			if (accept(ASSIGNMENT)) {
+				decl->initializer = parseExpression();
+			}
+			expect(SEMI_COLON, "\';\'");
+		}
+
+		// The binding strength of a binary operator, or -1 if the token isn't one.
+		static int precedence(TokenType type) {
+			switch (type) {
+				case (LOGICAL_OR) :
+				case (LOGICAL_XOR) : {
+					return 0;
+				}
+				case (LOGICAL_AND) : {
+					return 1;
+				}
+				case (BITWISE_OR) : {
+					return 2;
+				}
+				case (BITWISE_XOR) : {
+					return 3;
+				}
+				case (AMPERSAND) : {
+					return 4;
+				}
+				case (COMPARE) :
+				case (NOT_EQUAL) : {
+					return 5;
+				}
+				case (LESS_THAN) :
+				case (GREATER_THAN) :
+				case (LESS_EQUAL) :
+				case (GREATER_EQUAL) : {
+					return 6;
+				}
+				case (LEFT_SHIFT) :
+				case (RIGHT_SHIFT) : {
+					return 7;
+				}
+				case (ADDITION) :
+				case (SUBTRACT) : {
+					return 8;
+				}
+				case (ASTERISK) :
+				case (SLASH) :
+				case (MODULO) : {
+					return 9;
+				}
+				default : {
+					return -1;
+				}
+			}
+		}
+
+		// Parse binary operators that bind at least as tightly as minimum, left associatively.
+		// A chain like a + b + c is parsed in a loop and isn't nested however long it is, so it doesn't count
+		// towards MAX_NESTING; the passes after parsing go down such chains in loops too.
+		Expression* parseBinary(int minimum) {
+			TraceScope trace("parseBinary");
+			Expression *ret = parseUnary();
+			int p = precedence(peek()->type);
+			while (!failed && p >= minimum) {
+				Expression *binary = newExpression(BINARY_EXPR);
+				binary->op = peek()->type;
+				consume();
+				binary->operands.push_back(ret);
+				binary->operands.push_back(parseBinary(p + 1));
+				ret = binary;
+				p = precedence(peek()->type);
+			}
+			return ret;
+		}
+
+		// unary := (- | ! | ~ | & | * | ++ | --) unary
+		//        | postfix
+		Expression* parseUnary() {
+			TraceScope trace("parseUnary");
+			Nesting nesting(this);
+			switch (peek()->type) {
+				case (SUBTRACT) :
+				case (LOGICAL_NOT) :
+				case (BITWISE_NOT) :
+				case (AMPERSAND) :
+				case (ASTERISK) :
+				case (INCREMENT) :
+				case (DECREMENT) : {
+					Expression *ret = newExpression(UNARY_EXPR);
+					ret->op = peek()->type;
+					consume();
+					ret->operands.push_back(nesting.deeper() ? parseUnary() : newExpression(INTEGER_EXPR));
+					return ret;
+				}
+				default : {
+					return parsePostfix();
+				}
+			}
+		}
+
+		static bool isPostfix(TokenType type) {
+			return type == LEFT_PAREN || type == LEFT_BRACKET || type == DOT || type == INCREMENT || type == DECREMENT;
+		}
+
+		// postfix := primary
+		//          | postfix ( arguments )
+		//          | postfix [ expression ]
+		//          | postfix . name
+		//          | postfix ++
+		//          | postfix --
+		Expression* parsePostfix() {
+			TraceScope trace("parsePostfix");
+			Nesting nesting(this);
+			Expression *ret = parsePrimary();
+			while (!failed && isPostfix(peek()->type) && nesting.deeper()) {
+				switch (peek()->type) {
+					case (LEFT_PAREN) : {
+						Expression *call = newExpression(CALL_EXPR);
+						consume();
+						call->operands.push_back(ret);
+						while (!failed && peek()->type != RIGHT_PAREN) {
+							call->operands.push_back(parseExpression());
+							if (peek()->type != RIGHT_PAREN && !expect(COMMA, "\',\'")) {
+								break;
+							}
+						}
+						expect(RIGHT_PAREN, "\')\'");
+						ret = call;
+						break;
+					}
+					case (LEFT_BRACKET) : {
+						Expression *index = newExpression(INDEX_EXPR);
+						consume();
+						index->operands.push_back(ret);
+						index->operands.push_back(parseExpression());
+						expect(RIGHT_BRACKET, "\']\'");
+						ret = index;
+						break;
+					}
+					case (DOT) : {
+						Expression *member = newExpression(MEMBER_EXPR);
+						consume();
+						member->operands.push_back(ret);
+						member->name = identifier("member name");
+						ret = member;
+						break;
+					}
+					case (INCREMENT) :
+					case (DECREMENT) : {
+						Expression *postfix = newExpression(POSTFIX_EXPR);
+						postfix->op = peek()->type;
+						consume();
+						postfix->operands.push_back(ret);
+						ret = postfix;
+						break;
+					}
+					default : {
+						return ret;
+					}
+				}
+			}
+			return ret;
+		}
+
+		// primary := literal | name | ( expression )
+		//          | CAST ( type , expression )
+		//          | if ( expression ) { expression } else { expression }
+		//          | proc ( parameters ) [-> type] { statements }
+		//          | { expressions }
+		Expression* parsePrimary() {
+			TraceScope trace("parsePrimary");
+			Nesting nesting(this);
+			if (!nesting.deeper()) {
+				return newExpression(INTEGER_EXPR);
+			}
+			Token *t = peek();
+			switch (t->type) {
+				case (INTEGER) :
+				case (CHARACTER_LITERAL) : {
+					Expression *ret = newExpression(t->type == INTEGER ? INTEGER_EXPR : CHARACTER_EXPR);
+					ret->intValue = t->type == INTEGER ? *(unsigned long long*)(t->data) : *(unsigned*)(t->data);
+					consume();
+					return ret;
+				}
+				case (FLOAT) : {
+					Expression *ret = newExpression(FLOAT_EXPR);
+					ret->floatValue = *(double*)(t->data);
+					consume();
+					return ret;
+				}
+				case (STRING_LITERAL) : {
+					Expression *ret = newExpression(STRING_EXPR);
+					ret->name = *(std::string*)(t->data);
+					consume();
+					return ret;
+				}
+				case (IDENTIFIER) : {
+					Expression *ret = newExpression(NAME_EXPR);
+					ret->name = identifier("name");
+					return ret;
+				}
+				case (LEFT_PAREN) : {
+					consume();
+					Expression *ret = parseExpression();
+					expect(RIGHT_PAREN, "\')\'");
+					return ret;
+				}
+				case (CAST) : {
+					Expression *ret = newExpression(CAST_EXPR);
+					consume();
+					expect(LEFT_PAREN, "\'(\'");
+					ret->type = parseType();
+					expect(COMMA, "\',\'");
+					ret->operands.push_back(parseExpression());
+					expect(RIGHT_PAREN, "\')\'");
+					return ret;
+				}
+				case (IF) : {
+					Expression *ret = newExpression(IF_EXPR);
+					consume();
+					ret->operands.push_back(parseCondition());
+					ret->operands.push_back(parseBracedExpression());
+					expect(ELSE, "\'else\'");
+					if (peek()->type == IF) {
+						ret->operands.push_back(parsePrimary());
+					}
+					else {
+						ret->operands.push_back(parseBracedExpression());
+					}
+					return ret;
+				}
+				case (PROC) :
+				case (FUNC) : {
+					Expression *ret = newExpression(ROUTINE_EXPR);
+					ret->routine = new Routine();
+					ret->routine->linenum = t->startLinenum;
+					ret->routine->colnum = t->startColnum;
+					TypeName *signature = parseType();
+					ret->routine->pure = signature->pure;
+					ret->routine->params.swap(signature->params);
+					ret->routine->returnType = signature->returnType;
+					signature->returnType = nullptr;
+					delete signature;
+					if (ret->routine->pure && peek()->type != LEFT_BRACE) {
+						expect(ASSIGNMENT, "\'=\'");
+						ret->routine->value = parseExpression();
+					}
+					else {
+						ret->routine->body = parseBlock();
+					}
+					ret->routine->hasBody = true;
+					return ret;
+				}
+				case (LEFT_BRACE) : {
+					Expression *ret = newExpression(ARRAY_EXPR);
+					consume();
+					while (!failed && peek()->type != RIGHT_BRACE) {
+						ret->operands.push_back(parseExpression());
+						if (peek()->type != RIGHT_BRACE && !expect(COMMA, "\',\'")) {
+							break;
+						}
+					}
+					expect(RIGHT_BRACE, "\'}\'");
+					return ret;
+				}
+				default : {
+					error("expected an expression");
+					return newExpression(INTEGER_EXPR);
+				}
+			}
+		}
+
+		// \name, name... -> expression
+		// The parameter types are worked out from where the lambda is used.
+		Expression* parseLambda() {
+			TraceScope trace("parseLambda");
+			Expression *ret = newExpression(ROUTINE_EXPR);
+			ret->routine = new Routine();
+			ret->routine->pure = true;
+			ret->routine->hasBody = true;
+			ret->routine->linenum = ret->linenum;
+			ret->routine->colnum = ret->colnum;
+			std::string first = identifier("parameter name");
+			Parameter *param = new Parameter(new TypeName(INFERRED_TYPE));
+			param->name = first.substr(1);
+			ret->routine->params.push_back(param);
+			while (accept(COMMA)) {
+				param = new Parameter(new TypeName(INFERRED_TYPE));
+				param->name = identifier("parameter name");
+				ret->routine->params.push_back(param);
+			}
+			expect(ARROW, "\'->\'");
+			ret->routine->returnType = new TypeName(INFERRED_TYPE);
+			ret->routine->value = parseAssignment();
+			return ret;
+		}
+
+		// { expression }
+		Expression* parseBracedExpression() {
+			TraceScope trace("parseBracedExpression");
+			expect(LEFT_BRACE, "\'{\'");
+			Expression *ret = parseExpression();
+			expect(RIGHT_BRACE, "\'}\'");
+			return ret;
+		}
+
+		// ( expression )
+		Expression* parseCondition() {
+			TraceScope trace("parseCondition");
+			expect(LEFT_PAREN, "\'(\'");
+			Expression *ret = parseExpression();
+			expect(RIGHT_PAREN, "\')\'");
+			return ret;
+		}
+
+		// for ( [statement] ; [expression] ; [expression] ) statement
+		// for ( type name ind|val|ref expression ) statement
+		Statement* parseFor() {
+			TraceScope trace("parseFor");
+			Statement *ret = newStatement(FOR_STMT);
+			consume();
+			expect(LEFT_PAREN, "\'(\'");
+
+			// The foreach forms are a declaration without an initializer followed by ind, val or ref.
+			unsigned n = 0;
+			if (startsDeclaration() && typeEnd(n) && peek(n)->type == IDENTIFIER && peek(n + 1)->type == IDENTIFIER) {
+				std::string how = *(std::string*)(peek(n + 1)->data);
+				if (how == "ind" || how == "val" || how == "ref") {
+					ret->kind = FOREACH_STMT;
+					ret->foreach = how == "ind" ? FOREACH_INDEX : (how == "val" ? FOREACH_VALUE : FOREACH_REFERENCE);
+					ret->decl = new VariableDeclaration();
+					ret->decl->linenum = peek()->startLinenum;
+					ret->decl->colnum = peek()->startColnum;
+					ret->decl->type = parseType();
+					ret->decl->name = identifier("variable name");
+					consume();
+					ret->expr = parseExpression();
+					expect(RIGHT_PAREN, "\')\'");
+					ret->then = parseStatement();
+					return ret;
+				}
+			}
+
+			if (!accept(SEMI_COLON)) {
+				ret->init = parseStatement();
+			}
+			if (peek()->type != SEMI_COLON) {
+				ret->expr = parseExpression();
+			}
+			expect(SEMI_COLON, "\';\'");
+			if (peek()->type != RIGHT_PAREN) {
+				ret->step = parseExpression();
+			}
+			expect(RIGHT_PAREN, "\')\'");
+			ret->then = parseStatement();
+			return ret;
+		}
+
+		// switch ( expression ) { case expression : statements ... [else : statements] }
+		// Cases don't fall through into each other.
+		Statement* parseSwitch() {
+			TraceScope trace("parseSwitch");
+			Statement *ret = newStatement(SWITCH_STMT);
+			consume();
+			ret->expr = parseCondition();
+			expect(LEFT_BRACE, "\'{\'");
+			while (!failed && (peek()->type == CASE || peek()->type == ELSE)) {
+				if (accept(ELSE)) {
+					ret->cases.push_back(nullptr);
+				}
+				else {
+					consume();
+					ret->cases.push_back(parseExpression());
+				}
+				expect(COLON, "\':\'");
+				Statement *body = newStatement(BLOCK_STMT);
+				while (!failed && peek()->type != CASE && peek()->type != ELSE && peek()->type != RIGHT_BRACE && peek()->type != END_OF_FILE && peek()->type != ERROR) {
+					body->body.push_back(parseStatement());
+				}
+				ret->body.push_back(body);
+			}
+			expect(RIGHT_BRACE, "\'}\'");
+			return ret;
+		}
+
+		// Whether the next tokens begin a variable declaration rather than an expression.
+		bool startsDeclaration() {
+			switch (peek()->type) {
+				case (VAR) :
+				case (CONST) :
+				case (STATIC) :
+				case (LEFT_BRACKET) :
+				case (PROC) :
+				case (FUNC) : {
+					return true;
+				}
+				case (IDENTIFIER) : {
+					TokenType next = peek(1)->type;
+					return next == IDENTIFIER || (next == AMPERSAND && peek(2)->type == IDENTIFIER && (peek(3)->type == ASSIGNMENT || peek(3)->type == SEMI_COLON));
+				}
+				default : {
+					return false;
+				}
+			}
+		}
+
+		// Find how many tokens a simple type at the front of the input takes up: a name or var, possibly followed by &s.
+		// Returns false for types that are more complicated than that.
+		bool typeEnd(unsigned &n) {
+			if (peek()->type != VAR && peek()->type != IDENTIFIER) {
+				return false;
+			}
+			n = 1;
+			while (peek(n)->type == AMPERSAND) {
+				n++;
+			}
+			return true;
+		}
+
+		Expression* newExpression(ExpressionKind kind) {
+			Expression *ret = new Expression(kind);
+			ret->linenum = peek()->startLinenum;
+			ret->colnum = peek()->startColnum;
+			return ret;
+		}
+
+		Statement* newStatement(StatementKind kind) {
+			Statement *ret = new Statement(kind);
+			ret->linenum = peek()->startLinenum;
+			ret->colnum = peek()->startColnum;
+			return ret;
+		}
+
+		// Look n tokens ahead of the next unconsumed token, skipping comments.
+		Token* peek(unsigned n = 0) {
+			while (lookahead.size() <= n) {
+				if (!lookahead.empty() && (lookahead.back()->type == END_OF_FILE || lookahead.back()->type == ERROR)) {
+					return lookahead.back();
+				}
+				Token *t = lex.nextToken;
+				if (t->type != END_OF_FILE && t->type != ERROR) {
+					lex.getNextToken();
+				}
+				if (t->type == LINE_COMMENT || t->type == BLOCK_COMMENT || t->type == OPEN_COMMENT) {
+					delete t;
+				}
+				else {
+					lookahead.push_back(t);
+				}
+			}
+			return lookahead[n];
+		}
+
+		// Discard the next token.
+		void consume() {
+			Token *t = peek();
+			previous = t->type;
+			if (t->type != END_OF_FILE && t->type != ERROR) {
+				lookahead.pop_front();
+				delete t;
+			}
+		}
+
+		// Consume the next token if it has the given type.
+		bool accept(TokenType type) {
+			if (peek()->type == type) {
+				consume();
+				return true;
+			}
+			return false;
+		}
+
+		// Consume the next token, reporting an error if it does not have the given type.
+		bool expect(TokenType type, const char *description) {
+			if (accept(type)) {
+				return true;
+			}
+			error((std::string("expected ") + description).c_str());
+			return false;
+		}
+
+		// Consume an identifier and return its name.
+		std::string identifier(const char *description) {
+			if (peek()->type != IDENTIFIER) {
+				error((std::string("expected ") + description).c_str());
+				return "";
+			}
+			std::string ret = *(std::string*)(peek()->data);
+			consume();
+			return ret;
+		}
+
+		// Report a syntax error at the next token.
+		// Only the first error is reported since the parser does not attempt to recover.
+		void error(const char *message) {
+			if (failed) {
+				return;
+			}
+			Token *t = peek();
+			if (t->type == ERROR) {
+				printToken(t, lex.diagnostics);
+			}
+			else {
+				diagnose(lex.diagnostics, "Syntax error: %s but found \'", message);
+				printToken(t, lex.diagnostics);
+				diagnose(lex.diagnostics, "\' in %s (%u:%u).\n", t->filename->c_str(), t->startLinenum, t->startColnum);
+			}
+			failed = true;
+		}
 };
 
-Program *parse(std::string *filename) {
-	Parser p(filename);
+Program *parse(std::string *filename, std::string &diagnostics) {
+	Parser p(filename, diagnostics);
 	return p.parse();
 }
 
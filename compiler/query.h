@@ -0,0 +1,1194 @@
+#ifndef QUERY
+#define QUERY
+
+#include "includes.h"
+
+
+// What the compiler works out from a file is a set of queries: the file's text, where its declarations are, its
+// syntax tree, its interface tables, the IR of each routine and the linked module. Each is worked out when it is
+// first needed and kept, along with the queries it used, so that when a file changes only what depends on the change
+// is worked out again. The compile server and the language server keep their queries from one compile or edit to
+// the next; a compile from the command line goes through the same queries once, though with --cache it can find
+// the IR of routines that haven't changed since the last one.
+
+
+/* Environments */
+
+std::string signatureOf(const Routine *r) {
+	std::string ret = r->pure ? "func(" : "proc(";
+	for (const Parameter *p : r->params) {
+		ret += (p->type == nullptr ? "var" : p->type->spelling()) + " " + p->name + ",";
+	}
+	return ret + ")->" + (r->returnType == nullptr ? "void" : r->returnType->spelling()) + " " + r->name;
+}
+
+std::string signatureOf(const VariableDeclaration *v) {
+	return std::string(v->isConst ? "const " : "") + (v->isStatic ? "static " : "") + v->type->spelling() + " " + v->name;
+}
+
+// What lowering a routine can see of the rest of its program: the signatures of routines, the types of globals, and
+// all of the imports and type declarations but the bodies of the routines of instances, which are lowered on their
+// own. Generic routines are lowered wherever they are instantiated, so their bodies count as well, by the
+// fingerprint of the piece they are declared in.
+Fingerprint environmentOf(const Program *p, const std::unordered_map<const void*, Fingerprint> &declaredIn, Fingerprint hash) {
+	for (const Import *i : p->imports) {
+		hash = fingerprint("import " + i->module + " as " + i->alias + " from " + i->source + (i->global ? " globally" : ""), hash);
+	}
+	for (const Routine *r : p->routines) {
+		hash = fingerprint(signatureOf(r), hash);
+		if (Monomorphizer::isGeneric(r)) {
+			hash = fingerprint(declaredIn.at(r), hash);
+		}
+	}
+	for (const VariableDeclaration *v : p->varDecls) {
+		hash = fingerprint(signatureOf(v), hash);
+	}
+	for (const TypeDeclaration *t : p->typeDecls) {
+		hash = fingerprint((unsigned long long) t->kind, fingerprint(t->name + " : " + t->interfaceName, hash));
+		for (const VariableDeclaration *f : t->fields) {
+			hash = fingerprint(signatureOf(f), hash);
+		}
+		for (const std::string &e : t->enumerators) {
+			hash = fingerprint(e, hash);
+		}
+		if (t->aliased != nullptr) {
+			hash = fingerprint(t->aliased->spelling(), hash);
+		}
+		for (const Routine *r : t->routines) {
+			hash = fingerprint(signatureOf(r), hash);
+			if (Monomorphizer::isGeneric(r)) {
+				hash = fingerprint(declaredIn.at(t), hash);
+			}
+		}
+	}
+	for (const Namespace *n : p->namespaces) {
+		hash = fingerprint((n->isModule ? "module " : "namespace ") + n->name, hash);
+		if (n->contents != nullptr) {
+			hash = environmentOf(n->contents, declaredIn, hash);
+		}
+	}
+	for (const std::string &name : p->structOfArrays) {
+		hash = fingerprint("soa " + name, hash);
+	}
+	return hash;
+}
+
+
+/* Queries */
+
+class QueryEngine;
+
+// A result that is worked out on demand and kept, with the queries it was worked out from.
+class Query {
+
+	public:
+
+		const char *name;
+		std::string detail;						// What the query is about, such as the routine it lowers, for tracing.
+		Fingerprint fingerprint;
+		unsigned long long changedAt;			// The revision in which the fingerprint last changed.
+		unsigned long long verifiedAt;			// The last revision in which the result was known to be up to date; 0 before it is worked out.
+		std::vector<Query*> dependencies;		// In the order they were asked for.
+
+		Query(const char *n, const std::string &d = "") : name(n), detail(d), fingerprint(0), changedAt(0), verifiedAt(0) {}
+
+		virtual ~Query() {}
+
+		// Work out the result, asking the engine for the queries it uses, and set the fingerprint.
+		virtual void compute(QueryEngine &engine) = 0;
+
+		// An input, like the text of a file, depends on nothing and is looked at again in every revision.
+		virtual bool input() const {
+			return false;
+		}
+};
+
+
+// Brings queries up to date with the red-green algorithm. A query that was up to date in an earlier revision is
+// still up to date if none of its dependencies has changed since, which is found by bringing them up to date in
+// turn; otherwise it is worked out again. If it then has the same fingerprint as before, the queries that depend
+// on it still count it as unchanged, so a change stops spreading as soon as it stops making a difference.
+class QueryEngine {
+
+	public:
+
+		unsigned long long revision;
+		unsigned long long computed;		// How many times queries have been worked out.
+		unsigned long long reused;			// How many times queries have been found to be up to date without that.
+
+		QueryEngine() : revision(1), computed(0), reused(0) {}
+
+		// Start a new revision, in which inputs are looked at again the next time they are needed.
+		void advance() {
+			revision++;
+		}
+
+		// Bring a query up to date, and record that the query being worked out, if any, depends on it.
+		void demand(Query *q) {
+			if (!active.empty()) {
+				active.back()->dependencies.push_back(q);
+			}
+			update(q);
+		}
+
+		// Bring a query up to date without the query being worked out depending on it. That query must depend
+		// instead on queries that change whenever the part of this one it uses does, which is how the IR of one
+		// routine depends on the routine and the signatures it can see rather than on the whole syntax tree.
+		void peek(Query *q) {
+			update(q);
+		}
+
+	private:
+
+		std::vector<Query*> active;		// The queries being worked out, innermost last.
+
+		void update(Query *q) {
+			if (q->verifiedAt == revision) {
+				return;
+			}
+			if (q->verifiedAt != 0 && !q->input() && unchanged(q)) {
+				q->verifiedAt = revision;
+				reused++;
+				return;
+			}
+			Fingerprint before = q->fingerprint;
+			bool first = q->verifiedAt == 0;
+			q->dependencies.clear();
+			active.push_back(q);
+			{
+				TraceScope trace(q->name, q->detail.empty() ? nullptr : q->detail.c_str());
+				q->compute(*this);
+			}
+			active.pop_back();
+			computed++;
+			if (first || q->fingerprint != before) {
+				q->changedAt = revision;
+			}
+			q->verifiedAt = revision;
+		}
+
+		bool unchanged(Query *q) {
+			for (Query *d : q->dependencies) {
+				update(d);
+				if (d->changedAt > q->verifiedAt) {
+					return false;
+				}
+			}
+			return true;
+		}
+};
+
+
+/* Pieces */
+
+// Where the pieces of a file start. Only brackets, strings and comments are followed, so this is much faster than
+// parsing. A piece ends with the line on which a declaration ends, at a ; or } outside any brackets, unless
+// something else follows on that line; once a declaration has had an = outside brackets, as the body of a func or
+// an initializer does, only a ; ends it. Broken code just makes bigger pieces, as an unclosed bracket runs on to
+// the end of the file.
+std::vector<size_t> splitDeclarations(const std::string &text) {
+	std::vector<size_t> ret(1, 0);
+	size_t n = text.size();
+	unsigned depth = 0;
+	bool ended = false;
+	bool assigned = false;
+	size_t i = 0;
+	while (i < n) {
+		char c = text[i];
+		if (c == '/' && i + 1 < n && text[i + 1] == '/') {
+			size_t newline = text.find('\n', i);
+			i = newline == std::string::npos ? n : newline;
+			continue;
+		}
+		if (c == '/' && i + 1 < n && text[i + 1] == '*') {
+			size_t close = text.find("*/", i + 2);
+			i = close == std::string::npos ? n : close + 2;
+			continue;
+		}
+		if (c == '"' || c == '\'') {
+			i++;
+			while (i < n && text[i] != c && text[i] != '\n') {
+				i += text[i] == '\\' ? 2 : 1;
+			}
+			i++;
+			ended = false;
+			continue;
+		}
+		switch (c) {
+			case ('{') :
+			case ('(') :
+			case ('[') : {
+				depth++;
+				ended = false;
+				break;
+			}
+			case ('}') :
+			case (')') :
+			case (']') : {
+				depth -= depth > 0 ? 1 : 0;
+				ended = depth == 0 && c == '}' && !assigned;
+				break;
+			}
+			case ('=') : {
+				assigned = assigned || depth == 0;
+				ended = false;
+				break;
+			}
+			case (';') : {
+				ended = depth == 0;
+				assigned = assigned && !ended;
+				break;
+			}
+			case ('\n') : {
+				if (ended && i + 1 < n) {
+					ret.push_back(i + 1);
+				}
+				ended = false;
+				break;
+			}
+			default : {
+				if (!isspace((unsigned char) c)) {
+					ended = false;
+				}
+			}
+		}
+		i++;
+	}
+	return ret;
+}
+
+void shiftLines(Expression *e, int delta);
+void shiftLines(Statement *s, int delta);
+
+void shiftLines(TypeName *t, int delta) {
+	if (t == nullptr) {
+		return;
+	}
+	shiftLines(t->element, delta);
+	shiftLines(t->returnType, delta);
+	shiftLines(t->lengthExpr, delta);
+	for (Parameter *p : t->params) {
+		shiftLines(p->type, delta);
+	}
+}
+
+void shiftLines(VariableDeclaration *v, int delta) {
+	if (v == nullptr) {
+		return;
+	}
+	v->linenum += delta;
+	shiftLines(v->type, delta);
+	shiftLines(v->initializer, delta);
+}
+
+void shiftLines(Routine *r, int delta) {
+	if (r == nullptr) {
+		return;
+	}
+	r->linenum += delta;
+	for (Parameter *p : r->params) {
+		shiftLines(p->type, delta);
+	}
+	shiftLines(r->returnType, delta);
+	shiftLines(r->body, delta);
+	shiftLines(r->value, delta);
+}
+
+// Operator chains like a + b + c nest to the left as deep as they are long, so first operands are gone down in a loop.
+void shiftLines(Expression *e, int delta) {
+	for (; e != nullptr; e = e->operands.empty() ? nullptr : e->operands[0]) {
+		e->linenum += delta;
+		for (unsigned j = 1; j < e->operands.size(); j++) {
+			shiftLines(e->operands[j], delta);
+		}
+		shiftLines(e->type, delta);
+		shiftLines(e->routine, delta);
+	}
+}
+
+void shiftLines(Statement *s, int delta) {
+	if (s == nullptr) {
+		return;
+	}
+	s->linenum += delta;
+	for (Statement *b : s->body) {
+		shiftLines(b, delta);
+	}
+	for (Expression *c : s->cases) {
+		shiftLines(c, delta);
+	}
+	shiftLines(s->expr, delta);
+	shiftLines(s->decl, delta);
+	shiftLines(s->init, delta);
+	shiftLines(s->step, delta);
+	shiftLines(s->then, delta);
+	shiftLines(s->otherwise, delta);
+}
+
+// Move the positions in a syntax tree down by delta lines, or up if it is negative.
+void shiftLines(Program *p, int delta) {
+	for (Routine *r : p->routines) {
+		shiftLines(r, delta);
+	}
+	for (VariableDeclaration *v : p->varDecls) {
+		shiftLines(v, delta);
+	}
+	for (TypeDeclaration *t : p->typeDecls) {
+		t->linenum += delta;
+		for (VariableDeclaration *f : t->fields) {
+			shiftLines(f, delta);
+		}
+		for (Routine *r : t->routines) {
+			shiftLines(r, delta);
+		}
+		shiftLines(t->aliased, delta);
+	}
+	for (Namespace *n : p->namespaces) {
+		if (n->contents != nullptr) {
+			shiftLines(n->contents, delta);
+		}
+	}
+}
+
+// Move the positions that diagnostics end with, as in "Semantic error: unknown name x (3:12).", by delta lines.
+std::string shiftDiagnostics(const std::string &printed, int delta) {
+	std::string ret;
+	size_t start = 0;
+	while (start < printed.size()) {
+		size_t newline = printed.find('\n', start);
+		size_t end = newline == std::string::npos ? printed.size() : newline + 1;
+		std::string line = printed.substr(start, end - start);
+		start = end;
+		size_t paren = line.rfind('(');
+		unsigned linenum;
+		unsigned colnum;
+		int length;
+		if (paren != std::string::npos && sscanf(line.c_str() + paren, "(%u:%u)%n", &linenum, &colnum, &length) == 2) {
+			line.replace(paren, length, "(" + std::to_string(linenum + delta) + ":" + std::to_string(colnum) + ")");
+		}
+		ret += line;
+	}
+	return ret;
+}
+
+
+// A piece of a file, made of whole lines that hold one or more whole global declarations, which is parsed on its
+// own. Pieces are kept by their text, so one that an edit leaves alone is never parsed again, even if the edit moves
+// it: its positions are just moved to where it is now.
+struct Piece {
+	unsigned long long id;			// Which parse of its file made it, so that it can't be mistaken for a piece freed before.
+	Fingerprint fingerprint;		// Of the text.
+	unsigned line;					// The line of the file it starts on, which its positions count from.
+	Program *ast;					// nullptr if the piece has a syntax error.
+	std::string diagnostics;		// What parsing it reported.
+	bool live;
+
+	Piece() : id(0), fingerprint(0), line(0), ast(nullptr), live(false) {}
+
+	~Piece() {
+		delete ast;
+	}
+
+	void moveTo(unsigned to) {
+		if (to == line) {
+			return;
+		}
+		if (ast != nullptr) {
+			shiftLines(ast, (int) (to - line));
+		}
+		diagnostics = shiftDiagnostics(diagnostics, (int) (to - line));
+		line = to;
+	}
+};
+
+
+/* The queries of a file */
+
+class SourceFile;
+
+// The text of a file: what an editor has sent for it, if it is open in one, or else what is on disk, which is only
+// read again when the file's status says it has changed. Standard input is read in every revision that needs it.
+class SourceQuery : public Query {
+
+	public:
+
+		std::string text;
+		bool missing;
+
+		SourceQuery(SourceFile *f) : Query("source"), missing(true), file(f), read(false) {}
+
+		bool input() const {
+			return true;
+		}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+		bool read;
+		struct stat status;			// Of the file when it was read.
+};
+
+// The classes of the file that are laid out as a struct of arrays, as --soa asks.
+class LayoutQuery : public Query {
+
+	public:
+
+		std::set<std::string> structOfArrays;
+		std::set<std::string> requested;
+
+		LayoutQuery() : Query("layout") {}
+
+		bool input() const {
+			return true;
+		}
+
+		void compute(QueryEngine&) {
+			structOfArrays = requested;
+			fingerprint = NO_FINGERPRINT;
+			for (const std::string &name : structOfArrays) {
+				fingerprint = ::fingerprint(name, fingerprint);
+			}
+		}
+};
+
+// Where the pieces of the file are.
+class DeclarationsQuery : public Query {
+
+	public:
+
+		struct Declaration {
+			size_t start;
+			size_t size;
+			unsigned line;
+			unsigned occurrence;		// How many pieces before this one have the same text.
+		};
+
+		std::vector<Declaration> declarations;
+
+		DeclarationsQuery(SourceFile *f) : Query("declarations"), file(f) {}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// Where each piece starts, which only the positions in diagnostics depend on.
+class PositionsQuery : public Query {
+
+	public:
+
+		PositionsQuery(SourceFile *f) : Query("positions"), file(f) {}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// Every piece of the file, parsed and moved to where it is now, for the language server.
+class PiecesQuery : public Query {
+
+	public:
+
+		std::vector<Piece*> pieces;
+
+		PiecesQuery(SourceFile *f) : Query("pieces"), file(f) {}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// The whole program in the file, made of the syntax trees of its pieces, which it borrows. Like parsing the file in
+// one go, this stops at the first syntax error, having reported only that.
+class ProgramQuery : public Query {
+
+	public:
+
+		Program *ast;										// nullptr if there is a syntax error.
+		ProgramScope *scope;
+		std::string diagnostics;
+		std::vector<std::pair<std::string, const Routine*>> units;	// The routines lowered on their own, by symbol.
+		std::unordered_map<std::string, const Routine*> unitRoutines;
+		std::unordered_map<const void*, Fingerprint> declaredIn;	// The piece each routine and type declaration is in.
+
+		ProgramQuery(SourceFile *f) : Query("program"), ast(nullptr), scope(nullptr), file(f) {}
+
+		~ProgramQuery() {
+			release();
+		}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+
+		void release();
+		void record(const Program *p, Fingerprint piece);
+};
+
+class InterfacesQuery : public Query {
+
+	public:
+
+		InterfaceTables *tables;			// nullptr if the program has errors.
+		std::string diagnostics;
+
+		InterfacesQuery(SourceFile *f) : Query("interfaces"), tables(nullptr), file(f) {}
+
+		~InterfacesQuery() {
+			delete tables;
+		}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// The instantiations of generic routines, which the units lowered in one revision share.
+class GenericsQuery : public Query {
+
+	public:
+
+		Monomorphizer *generics;			// nullptr if the program has errors.
+
+		GenericsQuery(SourceFile *f) : Query("generics"), generics(nullptr), file(f) {}
+
+		~GenericsQuery() {
+			delete generics;
+		}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// What lowering a routine can see of the rest of the program, as environmentOf works it out.
+class EnvironmentQuery : public Query {
+
+	public:
+
+		EnvironmentQuery(SourceFile *f) : Query("environment"), file(f) {}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// The text of the piece a routine is declared in, so that the routine's unit only depends on that.
+class RoutineQuery : public Query {
+
+	public:
+
+		RoutineQuery(SourceFile *f, const std::string &symbol) : Query("routine", symbol), file(f) {}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// The unit of one routine, or of the globals if there is no symbol, lowered on its own. A routine's unit depends on
+// the routine and what it can see of the rest of the program, and on where the pieces are only if it has errors to
+// report. The globals' unit depends on the whole program.
+class UnitQuery : public Query {
+
+	public:
+
+		LoweredUnit *lowered;				// nullptr if the program has errors.
+		std::string diagnostics;
+		Fingerprint key;					// What a build cache keeps a routine's unit under, or 0 for the globals.
+
+		UnitQuery(SourceFile *f, const std::string &symbol) : Query(symbol.empty() ? "lowerGlobals" : "lowerUnit", symbol), lowered(nullptr), key(0), file(f) {}
+
+		~UnitQuery() {
+			delete lowered;
+		}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+// The program's units linked into one module, with its globals initialized.
+class ModuleQuery : public Query {
+
+	public:
+
+		IRModule *module;					// nullptr if there are errors.
+		std::string diagnostics;			// What lowering and linking reported.
+
+		ModuleQuery(SourceFile *f) : Query("lower"), module(nullptr), file(f) {}
+
+		~ModuleQuery() {
+			delete module;
+		}
+
+		void compute(QueryEngine &engine);
+
+	private:
+
+		SourceFile *file;
+};
+
+
+// A file and the queries about it.
+class SourceFile {
+
+	public:
+
+		std::string name;
+		bool edited;					// Whether an editor has the file open, with text in place of the file's.
+		std::string editorText;
+		unsigned long long parsed;		// How many pieces have been parsed.
+		BuildCache *cache;				// Where units lowered in earlier compiles may be found, if anywhere.
+
+		SourceQuery source;
+		LayoutQuery layout;
+		DeclarationsQuery declarations;
+		PositionsQuery positions;
+		PiecesQuery pieces;
+		ProgramQuery program;
+		InterfacesQuery interfaces;
+		GenericsQuery generics;
+		EnvironmentQuery environment;
+		UnitQuery globals;
+		ModuleQuery module;
+
+		SourceFile(const std::string &n) : name(n), edited(false), parsed(0), cache(nullptr), source(this), declarations(this), positions(this), pieces(this), program(this), interfaces(this), generics(this), environment(this), globals(this, ""), module(this) {}
+
+		~SourceFile() {
+			for (auto &u : units) {
+				delete u.second;
+			}
+			for (auto &r : routines) {
+				delete r.second;
+			}
+			for (auto &same : parsedPieces) {
+				for (Piece *p : same.second) {
+					delete p;
+				}
+			}
+		}
+
+		// The piece for a declaration, parsed if no piece of the file had its text before, and moved to its line.
+		Piece* piece(const DeclarationsQuery::Declaration &d) {
+			std::string text = source.text.substr(d.start, d.size);
+			std::vector<Piece*> &same = parsedPieces[text];
+			if (same.size() <= d.occurrence) {
+				same.resize(d.occurrence + 1, nullptr);
+			}
+			if (same[d.occurrence] == nullptr) {
+				same[d.occurrence] = parse(text);
+			}
+			same[d.occurrence]->moveTo(d.line);
+			return same[d.occurrence];
+		}
+
+		// Free the pieces that are no longer in the file.
+		void collectPieces() {
+			for (const DeclarationsQuery::Declaration &d : declarations.declarations) {
+				auto i = parsedPieces.find(source.text.substr(d.start, d.size));
+				if (i != parsedPieces.end() && d.occurrence < i->second.size() && i->second[d.occurrence] != nullptr) {
+					i->second[d.occurrence]->live = true;
+				}
+			}
+			for (auto i = parsedPieces.begin(); i != parsedPieces.end();) {
+				std::vector<Piece*> &same = i->second;
+				for (Piece *&p : same) {
+					if (p != nullptr && !p->live) {
+						delete p;
+						p = nullptr;
+					}
+					else if (p != nullptr) {
+						p->live = false;
+					}
+				}
+				while (!same.empty() && same.back() == nullptr) {
+					same.pop_back();
+				}
+				i = same.empty() ? parsedPieces.erase(i) : std::next(i);
+			}
+		}
+
+		RoutineQuery* routine(const std::string &symbol) {
+			RoutineQuery *&q = routines[symbol];
+			if (q == nullptr) {
+				q = new RoutineQuery(this, symbol);
+			}
+			return q;
+		}
+
+		UnitQuery* unit(const std::string &symbol) {
+			UnitQuery *&q = units[symbol];
+			if (q == nullptr) {
+				q = new UnitQuery(this, symbol);
+			}
+			return q;
+		}
+
+		// Free the units of routines that are no longer in the program. Only the module depends on units, and only
+		// units on routines, so this is done once the module has asked for the units it needs now.
+		void collectUnits() {
+			for (auto i = units.begin(); i != units.end();) {
+				if (program.unitRoutines.count(i->first) == 0) {
+					delete i->second;
+					delete routines[i->first];
+					routines.erase(i->first);
+					i = units.erase(i);
+				}
+				else {
+					i++;
+				}
+			}
+		}
+
+	private:
+
+		std::unordered_map<std::string, std::vector<Piece*>> parsedPieces;		// By text, then occurrence.
+		std::map<std::string, UnitQuery*> units;
+		std::map<std::string, RoutineQuery*> routines;
+
+		Piece* parse(const std::string &text) {
+			TraceScope trace("parsePiece");
+			Piece *p = new Piece();
+			p->id = ++parsed;
+			p->fingerprint = fingerprint(text);
+			if (text.empty()) {
+				p->ast = new Program();
+			}
+			else {
+				FILE *in = fmemopen((void*) text.data(), text.size(), "r");
+				if (in == nullptr) {
+					p->diagnostics = "Error: could not open " + name + "\n";
+				}
+				else {
+					Parser parser(in, name, p->diagnostics);
+					p->ast = parser.parse();
+				}
+			}
+			return p;
+		}
+};
+
+
+void SourceQuery::compute(QueryEngine&) {
+	if (file->edited) {
+		text = file->editorText;
+		missing = false;
+	}
+	else if (file->name == "-") {
+		text.clear();
+		clearerr(stdin);
+		char buffer[1 << 16];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+			text.append(buffer, n);
+		}
+		missing = false;
+	}
+	else {
+		struct stat now;
+		if (stat(file->name.c_str(), &now) != 0) {
+			missing = true;
+			read = false;
+		}
+		else if (!read || now.st_dev != status.st_dev || now.st_ino != status.st_ino || now.st_size != status.st_size ||
+			now.st_mtim.tv_sec != status.st_mtim.tv_sec || now.st_mtim.tv_nsec != status.st_mtim.tv_nsec) {
+			TraceScope trace("open file", file->name.c_str());
+			FILE *f = fopen(file->name.c_str(), "r");
+			missing = f == nullptr;
+			read = f != nullptr;
+			text.clear();
+			if (f != nullptr) {
+				char buffer[1 << 16];
+				size_t n;
+				while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+					text.append(buffer, n);
+				}
+				fclose(f);
+				status = now;
+				trace.bytes = text.size();
+			}
+		}
+	}
+	fingerprint = missing ? 0 : ::fingerprint(text);
+}
+
+void DeclarationsQuery::compute(QueryEngine &engine) {
+	engine.demand(&file->source);
+	declarations.clear();
+	const std::string &text = file->source.text;
+	std::vector<size_t> starts = splitDeclarations(text);
+	std::unordered_map<std::string_view, unsigned> seen;
+	unsigned line = 0;
+	for (unsigned i = 0; i < starts.size(); i++) {
+		Declaration d;
+		d.start = starts[i];
+		d.size = (i + 1 < starts.size() ? starts[i + 1] : text.size()) - d.start;
+		d.line = line;
+		d.occurrence = seen[std::string_view(text.data() + d.start, d.size)]++;
+		declarations.push_back(d);
+		line += std::count(text.begin() + d.start, text.begin() + d.start + d.size, '\n');
+	}
+	fingerprint = file->source.fingerprint;
+	file->collectPieces();
+}
+
+void PositionsQuery::compute(QueryEngine &engine) {
+	engine.demand(&file->declarations);
+	fingerprint = NO_FINGERPRINT;
+	for (const DeclarationsQuery::Declaration &d : file->declarations.declarations) {
+		fingerprint = ::fingerprint((unsigned long long) d.line, fingerprint);
+	}
+}
+
+void PiecesQuery::compute(QueryEngine &engine) {
+	engine.demand(&file->declarations);
+	pieces.clear();
+	for (const DeclarationsQuery::Declaration &d : file->declarations.declarations) {
+		pieces.push_back(file->piece(d));
+	}
+	fingerprint = file->declarations.fingerprint;
+}
+
+void ProgramQuery::compute(QueryEngine &engine) {
+	release();
+	engine.demand(&file->declarations);
+	engine.demand(&file->layout);
+	diagnostics.clear();
+	fingerprint = 0;
+	if (file->source.missing) {
+		diagnostics = "Error: could not open " + file->name + "\n";
+		return;
+	}
+	Program *assembled = new Program();
+	for (const DeclarationsQuery::Declaration &d : file->declarations.declarations) {
+		Piece *p = file->piece(d);
+		diagnostics += p->diagnostics;
+		if (p->ast == nullptr) {
+			ast = assembled;
+			release();
+			fingerprint = ::fingerprint(diagnostics);
+			return;
+		}
+		assembled->imports.insert(assembled->imports.end(), p->ast->imports.begin(), p->ast->imports.end());
+		assembled->namespaces.insert(assembled->namespaces.end(), p->ast->namespaces.begin(), p->ast->namespaces.end());
+		assembled->routines.insert(assembled->routines.end(), p->ast->routines.begin(), p->ast->routines.end());
+		assembled->varDecls.insert(assembled->varDecls.end(), p->ast->varDecls.begin(), p->ast->varDecls.end());
+		assembled->typeDecls.insert(assembled->typeDecls.end(), p->ast->typeDecls.begin(), p->ast->typeDecls.end());
+		record(p->ast, p->fingerprint);
+	}
+	assembled->structOfArrays = file->layout.structOfArrays;
+	ast = assembled;
+	scope = new ProgramScope(ast);
+	units = scope->units();
+	for (auto &u : units) {
+		unitRoutines.insert(u);
+	}
+	fingerprint = ::fingerprint(file->layout.fingerprint, file->declarations.fingerprint);
+}
+
+// Give the syntax trees back to their pieces.
+void ProgramQuery::release() {
+	if (ast != nullptr) {
+		ast->imports.clear();
+		ast->namespaces.clear();
+		ast->routines.clear();
+		ast->varDecls.clear();
+		ast->typeDecls.clear();
+		delete ast;
+		ast = nullptr;
+	}
+	delete scope;
+	scope = nullptr;
+	units.clear();
+	unitRoutines.clear();
+	declaredIn.clear();
+}
+
+void ProgramQuery::record(const Program *p, Fingerprint piece) {
+	for (const Routine *r : p->routines) {
+		declaredIn[r] = piece;
+	}
+	for (const TypeDeclaration *t : p->typeDecls) {
+		declaredIn[t] = piece;
+		for (const Routine *r : t->routines) {
+			declaredIn[r] = piece;
+		}
+	}
+	for (const Namespace *n : p->namespaces) {
+		if (n->contents != nullptr) {
+			record(n->contents, piece);
+		}
+	}
+}
+
+void InterfacesQuery::compute(QueryEngine &engine) {
+	delete tables;
+	tables = nullptr;
+	diagnostics.clear();
+	engine.demand(&file->program);
+	fingerprint = 0;
+	if (file->program.ast == nullptr) {
+		return;
+	}
+	tables = new InterfaceTables();
+	if (!tables->build(file->program.ast, diagnostics)) {
+		delete tables;
+		tables = nullptr;
+	}
+	fingerprint = ::fingerprint(diagnostics, file->program.fingerprint);
+}
+
+void GenericsQuery::compute(QueryEngine &engine) {
+	delete generics;
+	generics = nullptr;
+	engine.demand(&file->program);
+	engine.demand(&file->interfaces);
+	if (file->interfaces.tables != nullptr) {
+		generics = new Monomorphizer(file->program.ast, file->interfaces.tables);
+	}
+	fingerprint = file->interfaces.fingerprint;
+}
+
+void EnvironmentQuery::compute(QueryEngine &engine) {
+	engine.demand(&file->program);
+	fingerprint = file->program.ast == nullptr ? 0 : environmentOf(file->program.ast, file->program.declaredIn, NO_FINGERPRINT);
+}
+
+void RoutineQuery::compute(QueryEngine &engine) {
+	engine.demand(&file->program);
+	auto r = file->program.unitRoutines.find(detail);
+	fingerprint = r == file->program.unitRoutines.end() ? 0 : file->program.declaredIn.at(r->second);
+}
+
+void UnitQuery::compute(QueryEngine &engine) {
+	delete lowered;
+	lowered = nullptr;
+	diagnostics.clear();
+	const Routine *routine = nullptr;
+	if (detail.empty()) {
+		engine.demand(&file->program);
+		engine.demand(&file->generics);
+	}
+	else {
+		engine.demand(file->routine(detail));
+		engine.demand(&file->environment);
+		engine.peek(&file->program);
+		engine.peek(&file->generics);
+		auto r = file->program.unitRoutines.find(detail);
+		routine = r == file->program.unitRoutines.end() ? nullptr : r->second;
+	}
+	fingerprint = 0;
+	key = 0;
+	if (file->generics.generics == nullptr || (!detail.empty() && routine == nullptr)) {
+		return;
+	}
+
+	// A routine's unit only depends on what its key covers, so a build cache can give what an earlier compile
+	// lowered under the same key.
+	if (routine != nullptr) {
+		key = ::fingerprint(detail, ::fingerprint(file->routine(detail)->fingerprint, file->environment.fingerprint));
+	}
+	if (file->cache != nullptr && key != 0) {
+		lowered = file->cache->findUnit(detail, key);
+	}
+	if (lowered == nullptr) {
+		lowered = lowerUnit(file->program.ast, file->program.scope, file->interfaces.tables, file->generics.generics, routine, diagnostics);
+	}
+	if (!diagnostics.empty() && !detail.empty()) {
+		engine.demand(&file->positions);
+	}
+	fingerprint = ::fingerprint(*lowered->module, ::fingerprint(diagnostics, lowered->ok));
+	for (auto &i : lowered->initializers) {
+		fingerprint = ::fingerprint(*lowered->module, i.second, ::fingerprint(i.first->name, fingerprint));
+	}
+}
+
+void ModuleQuery::compute(QueryEngine &engine) {
+	delete module;
+	module = nullptr;
+	diagnostics.clear();
+	engine.demand(&file->program);
+	engine.demand(&file->interfaces);
+	fingerprint = 0;
+	if (file->program.ast == nullptr) {
+		return;
+	}
+	if (file->interfaces.tables == nullptr) {
+		return;
+	}
+
+	// Units that use the same instantiation report its errors alike, so each is only reported once.
+	std::set<std::string> reported;
+	auto report = [&](const std::string &printed) {
+		std::set<std::string> lines;
+		size_t start = 0;
+		while (start < printed.size()) {
+			size_t end = printed.find('\n', start);
+			end = end == std::string::npos ? printed.size() : end + 1;
+			std::string line = printed.substr(start, end - start);
+			if (reported.count(line) == 0) {
+				diagnostics += line;
+			}
+			lines.insert(line);
+			start = end;
+		}
+		reported.insert(lines.begin(), lines.end());
+	};
+
+	std::vector<const LoweredUnit*> units;
+	bool ok = true;
+	fingerprint = NO_FINGERPRINT;
+	std::vector<UnitQuery*> queries(1, &file->globals);
+	for (auto &u : file->program.units) {
+		queries.push_back(file->unit(u.first));
+	}
+	for (UnitQuery *q : queries) {
+		engine.demand(q);
+		report(q->diagnostics);
+		if (file->cache != nullptr && q->key != 0 && q->lowered != nullptr && q->lowered->ok && q->diagnostics.empty()) {
+			file->cache->keepUnit(q->detail, q->key, q->lowered);
+		}
+		ok = ok && q->lowered != nullptr && q->lowered->ok;
+		units.push_back(q->lowered);
+		fingerprint = ::fingerprint(q->fingerprint, fingerprint);
+	}
+	file->collectUnits();
+	if (ok) {
+		module = linkUnits(units, diagnostics);
+	}
+	fingerprint = ::fingerprint(diagnostics, fingerprint);
+}
+
+
+// The queries of every file the compiler has been asked about.
+class CompilationDatabase {
+
+	public:
+
+		QueryEngine engine;
+
+		CompilationDatabase() : cache(nullptr) {}
+
+		~CompilationDatabase() {
+			for (auto &f : files) {
+				delete f.second;
+			}
+		}
+
+		// Start a new revision, after which files are looked at again the next time they are needed.
+		void advance() {
+			engine.advance();
+		}
+
+		// Use the given text for a file in place of what is on disk, as for a file open in an editor.
+		void setText(const std::string &file, const std::string &text) {
+			SourceFile *f = fileFor(file);
+			f->edited = true;
+			f->editorText = text;
+			advance();
+		}
+
+		// Forget a file and everything worked out from it.
+		void forget(const std::string &file) {
+			auto i = files.find(file);
+			if (i != files.end()) {
+				delete i->second;
+				files.erase(i);
+			}
+		}
+
+		// Look for the units of routines in a build cache before lowering them, and keep the ones lowered in it.
+		// Changing the cache doesn't start a new revision, since what it gives is what lowering would.
+		void setCache(BuildCache *c) {
+			cache = c;
+			for (auto &f : files) {
+				f.second->cache = c;
+			}
+		}
+
+		void setStructOfArrays(const std::string &file, const std::set<std::string> &classes) {
+			SourceFile *f = fileFor(file);
+			if (f->layout.requested != classes) {
+				f->layout.requested = classes;
+				advance();
+			}
+		}
+
+		// Every piece of a file, parsed and with its positions moved to where it is now.
+		const std::vector<Piece*>& pieces(const std::string &file) {
+			SourceFile *f = fileFor(file);
+			engine.demand(&f->pieces);
+			return f->pieces.pieces;
+		}
+
+		// The program in a file, or nullptr if it has a syntax error. What parsing reported is added to diagnostics.
+		const Program* program(const std::string &file, std::string &diagnostics) {
+			SourceFile *f = fileFor(file);
+			engine.demand(&f->program);
+			diagnostics += f->program.diagnostics;
+			return f->program.ast;
+		}
+
+		// Build the interface tables of the program in a file, returning false if it has errors or a syntax error.
+		// What building them reported is added to diagnostics.
+		bool interfaces(const std::string &file, std::string &diagnostics) {
+			SourceFile *f = fileFor(file);
+			engine.demand(&f->interfaces);
+			diagnostics += f->interfaces.diagnostics;
+			return f->interfaces.tables != nullptr;
+		}
+
+		// The program in a file, lowered and linked, or nullptr if it has errors. What lowering and linking reported is
+		// added to diagnostics; what parsing and building the interface tables reported is given by program() and
+		// interfaces().
+		const IRModule* module(const std::string &file, std::string &diagnostics) {
+			SourceFile *f = fileFor(file);
+			engine.demand(&f->module);
+			diagnostics += f->module.diagnostics;
+			return f->module.module;
+		}
+
+		unsigned long long piecesParsed() const {
+			unsigned long long ret = 0;
+			for (auto &f : files) {
+				ret += f.second->parsed;
+			}
+			return ret;
+		}
+
+	private:
+
+		std::map<std::string, SourceFile*> files;
+		BuildCache *cache;
+
+		SourceFile* fileFor(const std::string &file) {
+			SourceFile *&f = files[file];
+			if (f == nullptr) {
+				f = new SourceFile(file);
+				f->cache = cache;
+			}
+			return f;
+		}
+};
+
+#endif
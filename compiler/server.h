@@ -0,0 +1,400 @@
+#ifndef SERVER
+#define SERVER
+
+#include "includes.h"
+
+
+// A compile server, which runs in the background and compiles the command lines that clients send it over a
+// Unix domain socket, keeping what it has worked out from each file between compiles.
+//
+// A client sends the descriptors of its standard input, output and error, with the length of the request, then
+// its working directory and command line as strings that each end in a NUL. The server compiles in the client's
+// directory with the client's descriptors standing in for its own, and answers with the exit status as an int.
+// The server lowers the file itself, through its compilation database, so that the next compile of the file only
+// parses and lowers again what has changed. Everything after lowering happens in a child process, on a copy of the
+// module, so that a program that is run can't disturb the server, and the client is answered when the child exits;
+// meanwhile the server goes on to other clients. Dumps, links and compiles of a file read from standard input don't
+// use what the server keeps, so they are done wholly in a child.
+class CompileServer {
+
+	public:
+
+		CompileServer(const char *p) : path(p), listener(-1) {}
+
+		~CompileServer() {
+			if (listener >= 0) {
+				close(listener);
+				unlink(path.c_str());
+			}
+		}
+
+		// Start listening. Returns false, having said why, if the socket can't be made.
+		bool listen() {
+			sockaddr_un address;
+			if (!socketAddress(path.c_str(), address)) {
+				return false;
+			}
+			listener = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (listener < 0) {
+				printf("Error: could not make a socket.\n");
+				return false;
+			}
+
+			// A socket left behind by a server that was killed would stop this one from binding.
+			int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (probe >= 0 && connect(probe, (sockaddr*) &address, sizeof(address)) != 0) {
+				unlink(path.c_str());
+			}
+			if (probe >= 0) {
+				close(probe);
+			}
+			if (bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || ::listen(listener, 16) != 0) {
+				printf("Error: could not listen on %s.\n", path.c_str());
+				close(listener);
+				listener = -1;
+				return false;
+			}
+			return true;
+		}
+
+		// Serve clients until the server is killed. Their requests are taken one at a time, and each is answered
+		// when the child process doing it exits.
+		void serve() {
+			if (pipe2(exited, O_NONBLOCK | O_CLOEXEC) != 0) {
+				printf("Error: the compile server could not make a pipe.\n");
+				return;
+			}
+			signal(SIGPIPE, SIG_IGN);
+			signal(SIGCHLD, childExited);
+			while (true) {
+				pollfd waiting[2] = {{listener, POLLIN, 0}, {exited[0], POLLIN, 0}};
+				if (poll(waiting, 2, -1) < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					printf("Error: could not wait for connections on %s.\n", path.c_str());
+					return;
+				}
+				if (waiting[1].revents != 0) {
+					char drained[64];
+					while (read(exited[0], drained, sizeof(drained)) > 0) {}
+					answerExited();
+				}
+				if (waiting[0].revents == 0) {
+					continue;
+				}
+				int client = accept(listener, nullptr, nullptr);
+				if (client < 0) {
+					if (errno == EINTR || errno == ECONNABORTED) {
+						continue;
+					}
+					printf("Error: could not accept a connection on %s.\n", path.c_str());
+					return;
+				}
+				// Requests are taken one at a time, so one that connects and sends nothing mustn't hold up the rest.
+				timeval timeout = {REQUEST_SECONDS, 0};
+				setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				if (handle(client) != ANSWERED_LATER) {
+					close(client);
+				}
+			}
+		}
+
+		// Fill in the address of a socket. Returns false, having said why, if the path is too long for one.
+		static bool socketAddress(const char *path, sockaddr_un &address) {
+			memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if (strlen(path) >= sizeof(address.sun_path)) {
+				printf("Error: %s is too long to be the path of a socket.\n", path);
+				return false;
+			}
+			strcpy(address.sun_path, path);
+			return true;
+		}
+
+		static bool sendAll(int socket, const void *data, size_t size) {
+			const char *at = (const char*) data;
+			while (size > 0) {
+				ssize_t sent = send(socket, at, size, 0);
+				if (sent < 0 && errno == EINTR) {
+					continue;
+				}
+				if (sent <= 0) {
+					return false;
+				}
+				at += sent;
+				size -= sent;
+			}
+			return true;
+		}
+
+		static bool receiveAll(int socket, void *data, size_t size) {
+			char *at = (char*) data;
+			while (size > 0) {
+				ssize_t received = recv(socket, at, size, 0);
+				if (received < 0 && errno == EINTR) {
+					continue;
+				}
+				if (received <= 0) {
+					return false;
+				}
+				at += received;
+				size -= received;
+			}
+			return true;
+		}
+
+	private:
+
+		static const unsigned MAX_REQUEST = 1 << 20;
+		static const unsigned REQUEST_SECONDS = 5;		// How long a client may take to send its request.
+		static const int ANSWERED_LATER = -1;			// The status of a compile that a child process will answer.
+
+		std::string path;
+		int listener;
+		CompilationDatabase db;
+		std::map<pid_t, int> answering;		// The client that each child process is to answer, by its process id.
+
+		static int exited[2];				// A pipe written to whenever a child process exits, to wake serve().
+
+		static void childExited(int) {
+			int saved = errno;
+			char c = 0;
+			if (write(exited[1], &c, 1) < 0) {
+				// The pipe is full, so serve() will wake anyway.
+			}
+			errno = saved;
+		}
+
+		// Answer the clients of the child processes that have exited.
+		void answerExited() {
+			pid_t child;
+			int status;
+			while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
+				auto i = answering.find(child);
+				if (i != answering.end()) {
+					int answer = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+					sendAll(i->second, &answer, sizeof(answer));
+					close(i->second);
+					answering.erase(i);
+				}
+			}
+		}
+
+		// Run work in a child process, which the client is answered with the exit status of once it exits. Returns
+		// ANSWERED_LATER, or 1, having said why, if the child couldn't be started. Without a client, as in a child
+		// that is already doing a whole compile, the work is done here and its status returned.
+		int spawn(int client, const std::function<int()> &work) {
+			if (client < 0) {
+				return work();
+			}
+			fflush(stdout);
+			fflush(stderr);
+			std::cout.flush();
+			pid_t child = fork();
+			if (child == 0) {
+				close(listener);
+				close(exited[0]);
+				close(exited[1]);
+				close(client);
+				for (auto &a : answering) {
+					close(a.second);
+				}
+				signal(SIGPIPE, SIG_DFL);
+				signal(SIGCHLD, SIG_DFL);
+				int status = work();
+				fflush(stdout);
+				fflush(stderr);
+				std::cout.flush();
+				_exit(status);
+			}
+			if (child < 0) {
+				printf("Error: the compile server could not start a compile.\n");
+				return 1;
+			}
+			answering[child] = client;
+			return ANSWERED_LATER;
+		}
+
+		// Take one client's request and start on it. Returns ANSWERED_LATER if a child process will answer the
+		// client; otherwise the client has been answered, or broke off and was dropped.
+		int handle(int client) {
+			unsigned size;
+			int descriptors[3];
+			if (!receiveRequest(client, size, descriptors)) {
+				return 1;
+			}
+			std::vector<char> request(size + 1, '\0');
+			if (!receiveAll(client, request.data(), size)) {
+				for (int d : descriptors) {
+					close(d);
+				}
+				return 1;
+			}
+
+			// The working directory comes first, then the command line.
+			std::vector<char*> strings;
+			for (unsigned i = 0; i < size; i += strlen(&request[i]) + 1) {
+				strings.push_back(&request[i]);
+			}
+			int saved[3];
+			for (int i = 0; i < 3; i++) {
+				saved[i] = dup(i);
+				dup2(descriptors[i], i);
+				close(descriptors[i]);
+			}
+			int status = 1;
+			if (strings.empty() || chdir(strings[0]) != 0) {
+				printf("Error: the compile server could not go to the client's directory.\n");
+			}
+			else {
+				status = compile(readOptions(strings.size() - 1, strings.data() + 1), client);
+			}
+			fflush(stdout);
+			fflush(stderr);
+			std::cout.flush();
+			for (int i = 0; i < 3; i++) {
+				dup2(saved[i], i);
+				close(saved[i]);
+			}
+			if (status != ANSWERED_LATER) {
+				sendAll(client, &status, sizeof(status));
+			}
+			return status;
+		}
+
+		// Receive the length of a request, and the descriptors that come with it.
+		bool receiveRequest(int client, unsigned &size, int descriptors[3]) {
+			char control[CMSG_SPACE(3 * sizeof(int))];
+			iovec data = {&size, sizeof(size)};
+			msghdr message;
+			memset(&message, 0, sizeof(message));
+			message.msg_iov = &data;
+			message.msg_iovlen = 1;
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+			if (recvmsg(client, &message, 0) != (ssize_t) sizeof(size)) {
+				return false;
+			}
+			cmsghdr *header = CMSG_FIRSTHDR(&message);
+			if (header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+				return false;
+			}
+			if (header->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+				int count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				for (int i = 0; i < count; i++) {
+					close(((int*) CMSG_DATA(header))[i]);
+				}
+				return false;
+			}
+			memcpy(descriptors, CMSG_DATA(header), 3 * sizeof(int));
+			if (size > MAX_REQUEST) {
+				for (int i = 0; i < 3; i++) {
+					close(descriptors[i]);
+				}
+				return false;
+			}
+			return true;
+		}
+
+		// Do what a command line asks, as compile() does, but with what the server has already worked out.
+		// Files are known by the names clients give them; a name that now means another file, as it can from
+		// another directory, is noticed by its status like any other change. Returns the exit status, or
+		// ANSWERED_LATER if a child process will answer the client.
+		int compile(const Options &options, int client) {
+			if (options.file == nullptr) {
+				return 0;
+			}
+
+			// These would read the client's standard input, or take long without needing the database, here.
+			if (client >= 0 && (options.dumpTokensOnly || options.dumpAst || options.ltoLink || strcmp(options.file, "-") == 0)) {
+				return spawn(client, [&]() {
+					return compile(options, -1);
+				});
+			}
+			startReport(options);
+			if (options.dumpTokensOnly || options.dumpAst) {
+				return finishReport(options, dump(options), true);
+			}
+			if (options.ltoLink) {
+				return finishReport(options, linkObjects(options), true);
+			}
+			db.advance();
+			BuildCache *cache = openCache(options, db);
+			const IRModule *lowered = lowerFile(options, db);
+			db.setCache(nullptr);
+			if (options.stats) {
+				fprintf(stderr, "queries: %llu computed, %llu reused, %llu pieces parsed\n", db.engine.computed, db.engine.reused, db.piecesParsed());
+			}
+			if (lowered == nullptr) {
+				return finishReport(options, closeCache(options, cache, 1), true);
+			}
+			int status = spawn(client, [&]() {
+				return finishReport(options, closeCache(options, cache, generate(options, lowered, cache)), true);
+			});
+
+			// The child reports on the compile, with what the tracer had seen of lowering, and writes the cache.
+			if (client >= 0) {
+				delete tracer;
+				tracer = nullptr;
+				delete cache;
+			}
+			return status;
+		}
+};
+
+int CompileServer::exited[2] = {-1, -1};
+
+
+// Send a command line to the compile server listening at path, and wait for the exit status it answers with.
+// Returns false if no server could be reached, so that the caller can compile it itself.
+bool forwardToServer(const char *path, int argc, char **argv, int &status) {
+	sockaddr_un address;
+	if (!CompileServer::socketAddress(path, address)) {
+		return false;
+	}
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0) {
+		return false;
+	}
+	if (connect(server, (sockaddr*) &address, sizeof(address)) != 0) {
+		close(server);
+		return false;
+	}
+	char directory[PATH_MAX];
+	if (getcwd(directory, sizeof(directory)) == nullptr) {
+		close(server);
+		return false;
+	}
+	std::string request(directory, strlen(directory) + 1);
+	for (int i = 0; i < argc; i++) {
+		request.append(argv[i], strlen(argv[i]) + 1);
+	}
+	unsigned size = request.size();
+
+	// The descriptors go along with the length.
+	int descriptors[3] = {0, 1, 2};
+	char control[CMSG_SPACE(sizeof(descriptors))];
+	memset(control, 0, sizeof(control));
+	iovec data = {&size, sizeof(size)};
+	msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	cmsghdr *header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(descriptors));
+	memcpy(CMSG_DATA(header), descriptors, sizeof(descriptors));
+	if (sendmsg(server, &message, 0) != (ssize_t) sizeof(size) || !CompileServer::sendAll(server, request.data(), request.size()) ||
+		!CompileServer::receiveAll(server, &status, sizeof(status))) {
+		printf("Error: lost the compile server at %s.\n", path);
+		status = 1;
+	}
+	close(server);
+	return true;
+}
+
+#endif
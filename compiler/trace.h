@@ -0,0 +1,174 @@
+#ifndef TRACE
+#define TRACE
+
+#include "includes.h"
+
+
+// Records where compilation spends its time, for --time-trace.
+// Phases are timed by putting a TraceScope in them. Every span counts towards the summary, but only the ones that
+// take at least the granularity are written to the trace, as with clang's -ftime-trace, so that the spans around
+// each token and expression don't swamp it.
+// Only the thread that made the tracer records spans. Work handed to other threads is timed by the span of the
+// thread that waits for it.
+class Tracer {
+
+	public:
+
+		Tracer(double granularityMicroseconds) : granularity(granularityMicroseconds), origin(std::chrono::steady_clock::now()), own(0),
+			owner(std::this_thread::get_id()) {}
+
+		bool recording() const {
+			return std::this_thread::get_id() == owner;
+		}
+
+		// Microseconds since the tracer was made.
+		double now() const {
+			std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - origin;
+			return elapsed.count();
+		}
+
+		// The allocations made so far, other than the tracer's own.
+		unsigned long long allocations() const {
+			return allocationCount - own;
+		}
+
+		void begin(const char *name) {
+			unsigned long long before = allocationCount;
+			active[name]++;
+			own += allocationCount - before;
+		}
+
+		// A span has ended. Time spent in a span nested in one with the same name, as in a recursive routine, is
+		// already counted by the outer one, so it only adds to the count.
+		void end(const char *name, const char *detail, double start, unsigned long long bytes, unsigned long long allocations) {
+			double finish = now();
+			unsigned long long before = allocationCount;
+			Total &t = totals[name];
+			t.count++;
+			t.bytes += bytes;
+			if (--active[name] == 0) {
+				t.microseconds += finish - start;
+				t.allocations += allocations;
+			}
+			if (finish - start >= granularity) {
+				Span s;
+				s.name = name;
+				s.detail = detail == nullptr ? "" : detail;
+				s.start = start;
+				s.duration = finish - start;
+				s.bytes = bytes;
+				s.allocations = allocations;
+				spans.push_back(s);
+			}
+			own += allocationCount - before;
+		}
+
+		// Write the spans in Chrome's trace event format, which chrome://tracing and Perfetto can show.
+		bool write(const char *path) const {
+			FILE *out = fopen(path, "w");
+			if (out == nullptr) {
+				return false;
+			}
+			fprintf(out, "{\"traceEvents\":[\n");
+			for (unsigned i = 0; i < spans.size(); i++) {
+				const Span &s = spans[i];
+				fprintf(out, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{", escape(s.name).c_str(), s.start, s.duration);
+				if (!s.detail.empty()) {
+					fprintf(out, "\"detail\":\"%s\",", escape(s.detail).c_str());
+				}
+				fprintf(out, "\"bytes\":%llu,\"allocations\":%llu}},\n", s.bytes, s.allocations);
+			}
+			fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"compiler\"}}\n]}\n");
+			return fclose(out) == 0;
+		}
+
+		// A table of every kind of span, the slowest first.
+		void printSummary(FILE *out) const {
+			std::vector<std::pair<std::string, Total>> rows(totals.begin(), totals.end());
+			std::stable_sort(rows.begin(), rows.end(), [](const std::pair<std::string, Total> &a, const std::pair<std::string, Total> &b) {
+				return a.second.microseconds > b.second.microseconds;
+			});
+			fprintf(out, "%-20s %10s %10s %12s %12s\n", "span", "time (ms)", "count", "bytes", "allocations");
+			for (const auto &r : rows) {
+				fprintf(out, "%-20s %10.3f %10llu %12llu %12llu\n", r.first.c_str(), r.second.microseconds / 1000, r.second.count, r.second.bytes, r.second.allocations);
+			}
+			fprintf(out, "%-20s %10.3f %10s %12s %12llu\n", "total", now() / 1000, "", "", allocations());
+		}
+
+	private:
+
+		struct Span {
+			std::string name;
+			std::string detail;			// What the span was working on, such as the function being compiled.
+			double start;
+			double duration;
+			unsigned long long bytes;
+			unsigned long long allocations;
+		};
+
+		struct Total {
+			unsigned long long count = 0;
+			double microseconds = 0;
+			unsigned long long bytes = 0;
+			unsigned long long allocations = 0;
+		};
+
+		double granularity;
+		std::chrono::steady_clock::time_point origin;
+		std::vector<Span> spans;
+		std::map<std::string, Total> totals;
+		std::map<std::string, unsigned> active;		// How many spans of each name are open.
+		unsigned long long own;						// The allocations made by the tracer itself.
+		std::thread::id owner;
+
+		static std::string escape(const std::string &s) {
+			std::string ret;
+			for (char c : s) {
+				if (c == '"' || c == '\\') {
+					ret += '\\';
+				}
+				if ((unsigned char) c < 0x20) {
+					continue;
+				}
+				ret += c;
+			}
+			return ret;
+		}
+};
+
+// The tracer, if --time-trace was given. Spans cost nothing but a test when there isn't one.
+Tracer *tracer = nullptr;
+
+
+// Times the scope it is declared in as a span. Bytes can be set to say how much input or output the span handled.
+class TraceScope {
+
+	public:
+
+		unsigned long long bytes;
+
+		TraceScope(const char *n, const char *d = nullptr) : bytes(0), name(n), detail(d), start(0), allocations(0),
+			recording(tracer != nullptr && tracer->recording()) {
+			if (recording) {
+				tracer->begin(name);
+				allocations = tracer->allocations();
+				start = tracer->now();
+			}
+		}
+
+		~TraceScope() {
+			if (recording) {
+				tracer->end(name, detail, start, bytes, tracer->allocations() - allocations);
+			}
+		}
+
+	private:
+
+		const char *name;
+		const char *detail;
+		double start;
+		unsigned long long allocations;
+		bool recording;
+};
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef TYPES
+#define TYPES
+
+#include "includes.h"
+
+
+// The size in bytes of a built in type, or 0 if the name isn't a built in type.
+unsigned primitiveSize(const std::string &name) {
+	if (name == "bool" || name == "char" || name == "uchar" || name == "byte") {
+		return 1;
+	}
+	else if (name == "short" || name == "ushort") {
+		return 2;
+	}
+	else if (name == "int" || name == "unsigned" || name == "uint" || name == "float") {
+		return 4;
+	}
+	else if (name == "long" || name == "ulong" || name == "double") {
+		return 8;
+	}
+	return 0;
+}
+
+bool isFloatingPoint(const std::string &name) {
+	return name == "float" || name == "double";
+}
+
+bool isUnsigned(const std::string &name) {
+	return name == "bool" || name == "uchar" || name == "byte" || name == "ushort" || name == "unsigned" || name == "uint" || name == "ulong";
+}
+
+
+// Find a user defined type by name, including those declared in namespaces.
+// Instances aren't types, so they are never returned.
+const TypeDeclaration* findTypeDeclaration(const Program *program, const std::string &name) {
+	for (const TypeDeclaration *t : program->typeDecls) {
+		if (t->name == name && t->kind != INSTANCE_DECL) {
+			return t;
+		}
+	}
+	for (const Namespace *n : program->namespaces) {
+		if (n->contents != nullptr) {
+			const TypeDeclaration *t = findTypeDeclaration(n->contents, name);
+			if (t != nullptr) {
+				return t;
+			}
+		}
+	}
+	return nullptr;
+}
+
+// Find a class, struct or union by name.
+const TypeDeclaration* findClass(const Program *program, const std::string &name) {
+	const TypeDeclaration *t = findTypeDeclaration(program, name);
+	if (t != nullptr && (t->kind == CLASS_DECL || t->kind == STRUCT_DECL || t->kind == UNION_DECL)) {
+		return t;
+	}
+	return nullptr;
+}
+
+
+unsigned typeSize(const TypeName *type, const Program *program);
+unsigned typeAlign(const TypeName *type, const Program *program);
+
+
+// Where each field of a class is in memory.
+struct ClassLayout {
+	unsigned size;
+	unsigned align;
+	std::vector<unsigned> offsets;		// The offset of each field, in declaration order.
+	std::vector<unsigned> order;		// The fields in the order they are laid out.
+};
+
+// Lay out a class's fields, each aligned to its natural alignment.
+// A class's fields are placed from the most to the least aligned, which leaves no padding between them since a
+// type's size is a multiple of its alignment. Fields with the same alignment keep their declaration order. A struct,
+// or any class if declarationOrder is set, is laid out in declaration order as C would, and the fields of a union
+// all start at the beginning.
+ClassLayout classLayout(const TypeDeclaration *decl, const Program *program, bool declarationOrder = false) {
+	ClassLayout ret;
+	ret.size = 0;
+	ret.align = 1;
+	std::vector<unsigned> sizes;
+	std::vector<unsigned> aligns;
+	for (const VariableDeclaration *field : decl->fields) {
+		sizes.push_back(typeSize(field->type, program));
+		aligns.push_back(typeAlign(field->type, program));
+		ret.order.push_back(ret.order.size());
+	}
+	if (decl->kind == CLASS_DECL && !declarationOrder) {
+		std::stable_sort(ret.order.begin(), ret.order.end(), [&](unsigned a, unsigned b) {
+			return aligns[a] > aligns[b];
+		});
+	}
+	ret.offsets.assign(decl->fields.size(), 0);
+	for (unsigned f : ret.order) {
+		if (aligns[f] > ret.align) {
+			ret.align = aligns[f];
+		}
+		if (decl->kind == UNION_DECL) {
+			ret.size = sizes[f] > ret.size ? sizes[f] : ret.size;
+		}
+		else {
+			ret.size = (ret.size + aligns[f] - 1) & ~(aligns[f] - 1);
+			ret.offsets[f] = ret.size;
+			ret.size += sizes[f];
+		}
+	}
+	ret.size = (ret.size + ret.align - 1) & ~(ret.align - 1);
+	return ret;
+}
+
+// Whether an array is laid out as a struct of arrays: an array for each field of its element class rather than
+// the elements one after another, so that a loop over one field of the elements touches only that field's memory.
+// This is chosen per class with --soa, and only applies to arrays with a fixed length.
+bool isStructOfArrays(const TypeName *type, const Program *program) {
+	return type != nullptr && type->kind == ARRAY_TYPE && type->length >= 0 && type->element != nullptr && type->element->kind == NAMED_TYPE && program->structOfArrays.count(type->element->name) != 0;
+}
+
+// Where field f of every element of a struct of arrays starts. The field arrays are placed in the order the fields
+// are placed in an element, so each starts aligned.
+unsigned fieldArrayOffset(const TypeDeclaration *decl, unsigned f, unsigned long long length, const Program *program) {
+	ClassLayout layout = classLayout(decl, program);
+	unsigned long long offset = 0;
+	for (unsigned g : layout.order) {
+		if (g == f) {
+			break;
+		}
+		offset += length * typeSize(decl->fields[g]->type, program);
+	}
+	return offset;
+}
+
+// The number of bytes a value of the type takes up.
+// Arrays without a fixed length and interface values are a pair of words: a pointer and a length or witness table.
+unsigned typeSize(const TypeName *type, const Program *program) {
+	if (type == nullptr) {
+		return 0;
+	}
+	switch (type->kind) {
+		case (NAMED_TYPE) : {
+			unsigned size = primitiveSize(type->name);
+			if (size != 0) {
+				return size;
+			}
+			const TypeDeclaration *decl = findTypeDeclaration(program, type->name);
+			if (decl == nullptr) {
+				return 0;
+			}
+			switch (decl->kind) {
+				case (ENUM_DECL) : {
+					return 4;
+				}
+				case (ALIAS_DECL) : {
+					return typeSize(decl->aliased, program);
+				}
+				case (INTERFACE_DECL) : {
+					return 16;
+				}
+				default : {
+					return classLayout(decl, program).size;
+				}
+			}
+		}
+		case (ARRAY_TYPE) : {
+			if (type->length < 0) {
+				return 16;
+			}
+			// A struct of arrays has no padding at the end of each element.
+			if (isStructOfArrays(type, program)) {
+				const TypeDeclaration *decl = findClass(program, type->element->name);
+				unsigned size = 0;
+				for (const VariableDeclaration *field : decl->fields) {
+					size += type->length * typeSize(field->type, program);
+				}
+				return size;
+			}
+			return type->length * typeSize(type->element, program);
+		}
+		case (POINTER_TYPE) :
+		case (ROUTINE_TYPE) : {
+			return 8;
+		}
+		default : {
+			return 0;
+		}
+	}
+}
+
+unsigned typeAlign(const TypeName *type, const Program *program) {
+	if (type == nullptr) {
+		return 1;
+	}
+	switch (type->kind) {
+		case (NAMED_TYPE) : {
+			unsigned size = primitiveSize(type->name);
+			if (size != 0) {
+				return size;
+			}
+			const TypeDeclaration *decl = findTypeDeclaration(program, type->name);
+			if (decl == nullptr) {
+				return 1;
+			}
+			switch (decl->kind) {
+				case (ENUM_DECL) : {
+					return 4;
+				}
+				case (ALIAS_DECL) : {
+					return typeAlign(decl->aliased, program);
+				}
+				case (INTERFACE_DECL) : {
+					return 8;
+				}
+				default : {
+					return classLayout(decl, program).align;
+				}
+			}
+		}
+		case (ARRAY_TYPE) : {
+			return type->length < 0 ? 8 : typeAlign(type->element, program);
+		}
+		case (POINTER_TYPE) :
+		case (ROUTINE_TYPE) : {
+			return 8;
+		}
+		default : {
+			return 1;
+		}
+	}
+}
+
+
+// A string describing how a type is laid out in memory, without regard to what it is called.
+// Two types with the same layout signature can share machine code that only moves them around.
+// Returns an empty string if the layout can't be determined, e.g. for an unbound generic parameter.
+std::string layoutSignature(const TypeName *type, const Program *program, unsigned depth = 0) {
+	if (type == nullptr || depth > 32) {
+		return "";
+	}
+	switch (type->kind) {
+		case (NAMED_TYPE) : {
+			unsigned size = primitiveSize(type->name);
+			if (size != 0) {
+				// Signedness is kept because built in types are compared with different instructions.
+				return std::string(isFloatingPoint(type->name) ? "f" : (isUnsigned(type->name) ? "u" : "i")) + std::to_string(size);
+			}
+			const TypeDeclaration *decl = findClass(program, type->name);
+			if (decl == nullptr) {
+				return "";
+			}
+			std::string ret = decl->kind == UNION_DECL ? "<" : "{";
+			for (const VariableDeclaration *field : decl->fields) {
+				std::string f = layoutSignature(field->type, program, depth + 1);
+				if (f.empty()) {
+					return "";
+				}
+				ret += f + ",";
+			}
+			ret += decl->kind == UNION_DECL ? ">" : "}";
+			return ret;
+		}
+		case (ARRAY_TYPE) : {
+			// Arrays without a fixed length are passed around as a pointer and a length.
+			if (type->length < 0) {
+				return "p8i8";
+			}
+			std::string element = layoutSignature(type->element, program, depth + 1);
+			return element.empty() ? "" : "[" + std::to_string(type->length) + (isStructOfArrays(type, program) ? "s]" : "]") + element;
+		}
+		case (POINTER_TYPE) :
+		case (ROUTINE_TYPE) : {
+			return "p8";
+		}
+		default : {
+			return "";
+		}
+	}
+}
+
+// Describe how each class, struct and union is laid out: where its fields are, where the padding is, and what
+// reordering the fields of a class saved.
+void reportLayouts(const Program *program, const Program *top, FILE *out) {
+	for (const TypeDeclaration *t : program->typeDecls) {
+		if (t->kind != CLASS_DECL && t->kind != STRUCT_DECL && t->kind != UNION_DECL) {
+			continue;
+		}
+		ClassLayout layout = classLayout(t, top);
+		const char *kind = t->kind == CLASS_DECL ? "class" : (t->kind == STRUCT_DECL ? "struct" : "union");
+		fprintf(out, "%s %s: %u bytes, aligned to %u", kind, t->name.c_str(), layout.size, layout.align);
+		if (t->kind == CLASS_DECL) {
+			unsigned declared = classLayout(t, top, true).size;
+			if (declared > layout.size) {
+				fprintf(out, ", %u fewer than in declaration order", declared - layout.size);
+			}
+		}
+		fprintf(out, ".\n");
+		unsigned end = 0;
+		for (unsigned f : layout.order) {
+			unsigned size = typeSize(t->fields[f]->type, top);
+			if (layout.offsets[f] > end) {
+				fprintf(out, "\t%u: %u byte%s of padding\n", end, layout.offsets[f] - end, layout.offsets[f] - end == 1 ? "" : "s");
+			}
+			fprintf(out, "\t%u: %s %s, %u byte%s\n", layout.offsets[f], t->fields[f]->type->spelling().c_str(), t->fields[f]->name.c_str(), size, size == 1 ? "" : "s");
+			end = std::max(end, layout.offsets[f] + size);
+		}
+		if (layout.size > end) {
+			fprintf(out, "\t%u: %u byte%s of padding\n", end, layout.size - end, layout.size - end == 1 ? "" : "s");
+		}
+		if (top->structOfArrays.count(t->name) != 0) {
+			fprintf(out, "\tArrays of %s are laid out as a struct of arrays.\n", t->name.c_str());
+		}
+	}
+	for (const Namespace *n : program->namespaces) {
+		if (n->contents != nullptr) {
+			reportLayouts(n->contents, top, out);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,2037 @@
+#ifndef X86
+#define X86
+
+#include "includes.h"
+
+
+/* Machine code */
+
+// General purpose registers are numbered as the hardware encodes them; XMM registers follow from 16.
+enum X86Register {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15,
+	XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7, XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15
+};
+
+bool isXmm(unsigned reg) {
+	return reg >= XMM0;
+}
+
+// Condition codes, as encoded in jcc and setcc.
+enum Condition {
+	CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A, CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+};
+
+Condition invert(Condition c) {
+	return (Condition) (c ^ 1);
+}
+
+enum CodeRelocationKind {
+	RELOC_ABS64,			// The symbol's address.
+	RELOC_PC32,				// The symbol's address relative to the field.
+	RELOC_PLT32,			// A call to the symbol, which may go through the procedure linkage table.
+	RELOC_GOTPCREL			// The address of the symbol's global offset table entry, relative to the field.
+};
+
+// A field in the code to be filled in with a symbol's address.
+struct CodeRelocation {
+	unsigned offset;
+	unsigned symbol;		// A module symbol.
+	CodeRelocationKind kind;
+	long long addend;
+};
+
+// The machine code of one function, apart from the module it was generated for: offsets count from the start of
+// the function, and each relocation's symbol is an index into names.
+struct FunctionCode {
+	std::vector<unsigned char> code;
+	std::vector<CodeRelocation> relocations;
+	std::vector<std::string> names;
+};
+
+// A memory operand: a base register and displacement, or an address relative to the next instruction.
+struct Memory {
+	int base;				// A register, or -1 for an address relative to a symbol.
+	int displacement;
+	unsigned symbol;
+	CodeRelocationKind kind;
+
+	static Memory at(int base, int displacement) {
+		Memory m;
+		m.base = base;
+		m.displacement = displacement;
+		m.symbol = 0;
+		m.kind = RELOC_PC32;
+		return m;
+	}
+
+	static Memory symbolic(unsigned symbol, int displacement, CodeRelocationKind kind = RELOC_PC32) {
+		Memory m;
+		m.base = -1;
+		m.displacement = displacement;
+		m.symbol = symbol;
+		m.kind = kind;
+		return m;
+	}
+};
+
+
+// Encodes x86-64 instructions into a buffer.
+// Operand sizes are in bytes. Jumps go to labels, which are patched once every label has been placed.
+class Assembler {
+
+	public:
+
+		std::vector<unsigned char> code;
+		std::vector<CodeRelocation> relocations;
+
+		unsigned newLabel() {
+			labels.push_back(-1);
+			return labels.size() - 1;
+		}
+
+		void bind(unsigned label) {
+			labels[label] = code.size();
+		}
+
+		// Fill in the jumps to labels. Every label that was jumped to must have been bound.
+		void resolveLabels() {
+			for (const std::pair<unsigned, unsigned> &f : fixups) {
+				int rel = labels[f.second] - (int) (f.first + 4);
+				memcpy(code.data() + f.first, &rel, 4);
+			}
+			fixups.clear();
+			labels.clear();
+		}
+
+		// Pad with int3 up to a multiple of the alignment.
+		void align(unsigned alignment) {
+			while (code.size() % alignment != 0) {
+				code.push_back(0xcc);
+			}
+		}
+
+		void movRR(unsigned dst, unsigned src) {
+			if (dst == src) {
+				return;
+			}
+			if (isXmm(dst) && isXmm(src)) {
+				// movaps copies the whole register, so nothing depends on what dst held.
+				rex(false, dst, 0, src);
+				byte(0x0f);
+				byte(0x28);
+				modrmReg(dst, src);
+			}
+			else if (isXmm(dst)) {
+				movq(dst, src);
+			}
+			else if (isXmm(src)) {
+				movq(dst, src);
+			}
+			else {
+				rex(true, src, 0, dst);
+				byte(0x89);
+				modrmReg(src, dst);
+			}
+		}
+
+		// Load a constant into a general purpose register.
+		void movRI(unsigned dst, long long imm) {
+			if (imm >= 0 && imm <= 0xffffffffLL) {
+				rex(false, 0, 0, dst);
+				byte(0xb8 + (dst & 7));
+				dword((unsigned) imm);
+			}
+			else if (imm >= INT_MIN && imm <= INT_MAX) {
+				rex(true, 0, 0, dst);
+				byte(0xc7);
+				modrmReg(0, dst);
+				dword((unsigned) imm);
+			}
+			else {
+				rex(true, 0, 0, dst);
+				byte(0xb8 + (dst & 7));
+				qword(imm);
+			}
+		}
+
+		// Load size bytes into a general purpose register, sign or zero extending them to 64 bits.
+		void load(unsigned size, bool signExtend, unsigned dst, const Memory &m) {
+			switch (size) {
+				case (1) : {
+					rex(signExtend, dst, 0, m);
+					byte(0x0f);
+					byte(signExtend ? 0xbe : 0xb6);
+					break;
+				}
+				case (2) : {
+					rex(signExtend, dst, 0, m);
+					byte(0x0f);
+					byte(signExtend ? 0xbf : 0xb7);
+					break;
+				}
+				case (4) : {
+					rex(signExtend, dst, 0, m);
+					byte(signExtend ? 0x63 : 0x8b);
+					break;
+				}
+				default : {
+					rex(true, dst, 0, m);
+					byte(0x8b);
+				}
+			}
+			modrmMemory(dst, m, 0);
+		}
+
+		// Store the low size bytes of a general purpose register.
+		void store(unsigned size, const Memory &m, unsigned src) {
+			if (size == 2) {
+				byte(0x66);
+			}
+			rex(size == 8, src, 0, m, size == 1 && src >= RSP && src <= RDI);
+			byte(size == 1 ? 0x88 : 0x89);
+			modrmMemory(src, m, 0);
+		}
+
+		void lea(unsigned dst, const Memory &m) {
+			rex(true, dst, 0, m);
+			byte(0x8d);
+			modrmMemory(dst, m, 0);
+		}
+
+		// The ALU operations that have the same encoding pattern. The values are the /digit of the immediate forms.
+		enum AluOp {
+			ALU_ADD = 0,
+			ALU_OR = 1,
+			ALU_AND = 4,
+			ALU_SUB = 5,
+			ALU_XOR = 6,
+			ALU_CMP = 7
+		};
+
+		void alu(AluOp op, unsigned dst, unsigned src) {
+			rex(true, src, 0, dst);
+			byte(op * 8 + 1);
+			modrmReg(src, dst);
+		}
+
+		void aluImm(AluOp op, unsigned dst, int imm) {
+			rex(true, 0, 0, dst);
+			if (imm >= -128 && imm <= 127) {
+				byte(0x83);
+				modrmReg(op, dst);
+				byte((unsigned char) imm);
+			}
+			else {
+				byte(0x81);
+				modrmReg(op, dst);
+				dword((unsigned) imm);
+			}
+		}
+
+		void imul(unsigned dst, unsigned src) {
+			rex(true, dst, 0, src);
+			byte(0x0f);
+			byte(0xaf);
+			modrmReg(dst, src);
+		}
+
+		// The one-operand group 3 instructions: not /2, neg /3, div /6 and idiv /7.
+		void unary(unsigned digit, unsigned reg) {
+			rex(true, 0, 0, reg);
+			byte(0xf7);
+			modrmReg(digit, reg);
+		}
+
+		// Shifts by cl: shl /4, shr /5 and sar /7.
+		void shift(unsigned digit, unsigned reg) {
+			rex(true, 0, 0, reg);
+			byte(0xd3);
+			modrmReg(digit, reg);
+		}
+
+		void shiftImm(unsigned digit, unsigned reg, unsigned char amount) {
+			rex(true, 0, 0, reg);
+			byte(0xc1);
+			modrmReg(digit, reg);
+			byte(amount);
+		}
+
+		void cqo() {
+			byte(0x48);
+			byte(0x99);
+		}
+
+		void test(unsigned a, unsigned b) {
+			rex(true, b, 0, a);
+			byte(0x85);
+			modrmReg(b, a);
+		}
+
+		// Set the low byte of a register to whether a condition holds.
+		void setcc(Condition c, unsigned reg) {
+			rex(false, 0, 0, reg, reg >= RSP && reg <= RDI);
+			byte(0x0f);
+			byte(0x90 + c);
+			modrmReg(0, reg);
+		}
+
+		// Sign extend the low size bytes of a register in place.
+		void signExtend(unsigned size, unsigned reg) {
+			if (size == 4) {
+				rex(true, reg, 0, reg);
+				byte(0x63);
+				modrmReg(reg, reg);
+			}
+			else if (size == 1 || size == 2) {
+				rex(true, reg, 0, reg);
+				byte(0x0f);
+				byte(size == 1 ? 0xbe : 0xbf);
+				modrmReg(reg, reg);
+			}
+		}
+
+		// Zero extend the low size bytes of a register in place.
+		void zeroExtend(unsigned size, unsigned reg) {
+			if (size == 4) {
+				rex(false, reg, 0, reg);
+				byte(0x8b);
+				modrmReg(reg, reg);
+			}
+			else if (size == 1 || size == 2) {
+				rex(false, reg, 0, reg, size == 1 && reg >= RSP && reg <= RDI);
+				byte(0x0f);
+				byte(size == 1 ? 0xb6 : 0xb7);
+				modrmReg(reg, reg);
+			}
+		}
+
+		void jmp(unsigned label) {
+			byte(0xe9);
+			fixup(label);
+		}
+
+		void jcc(Condition c, unsigned label) {
+			byte(0x0f);
+			byte(0x80 + c);
+			fixup(label);
+		}
+
+		void call(unsigned symbol) {
+			byte(0xe8);
+			relocate(symbol, RELOC_PLT32, -4);
+			dword(0);
+		}
+
+		void callR(unsigned reg) {
+			rex(false, 0, 0, reg);
+			byte(0xff);
+			modrmReg(2, reg);
+		}
+
+		void jmpSymbol(unsigned symbol) {
+			byte(0xe9);
+			relocate(symbol, RELOC_PLT32, -4);
+			dword(0);
+		}
+
+		void jmpR(unsigned reg) {
+			rex(false, 0, 0, reg);
+			byte(0xff);
+			modrmReg(4, reg);
+		}
+
+		void ret() {
+			byte(0xc3);
+		}
+
+		void ud2() {
+			byte(0x0f);
+			byte(0x0b);
+		}
+
+		void push(unsigned reg) {
+			rex(false, 0, 0, reg);
+			byte(0x50 + (reg & 7));
+		}
+
+		void pop(unsigned reg) {
+			rex(false, 0, 0, reg);
+			byte(0x58 + (reg & 7));
+		}
+
+		// Scalar SSE arithmetic: add 0x58, mul 0x59, sub 0x5c and div 0x5e, on doubles or, if single, floats.
+		void sse(unsigned char op, bool single, unsigned dst, unsigned src) {
+			byte(single ? 0xf3 : 0xf2);
+			rex(false, dst, 0, src);
+			byte(0x0f);
+			byte(op);
+			modrmReg(dst, src);
+		}
+
+		void loadFloat(bool single, unsigned dst, const Memory &m) {
+			byte(single ? 0xf3 : 0xf2);
+			rex(false, dst, 0, m);
+			byte(0x0f);
+			byte(0x10);
+			modrmMemory(dst, m, 0);
+		}
+
+		void storeFloat(bool single, const Memory &m, unsigned src) {
+			byte(single ? 0xf3 : 0xf2);
+			rex(false, src, 0, m);
+			byte(0x0f);
+			byte(0x11);
+			modrmMemory(src, m, 0);
+		}
+
+		void ucomis(bool single, unsigned a, unsigned b) {
+			if (!single) {
+				byte(0x66);
+			}
+			rex(false, a, 0, b);
+			byte(0x0f);
+			byte(0x2e);
+			modrmReg(a, b);
+		}
+
+		// Load or store a whole XMM register, with no need for the memory to be aligned.
+		void loadVector(unsigned dst, const Memory &m) {
+			rex(false, dst, 0, m);
+			byte(0x0f);
+			byte(0x10);
+			modrmMemory(dst, m, 0);
+		}
+
+		void storeVector(const Memory &m, unsigned src) {
+			rex(false, src, 0, m);
+			byte(0x0f);
+			byte(0x11);
+			modrmMemory(src, m, 0);
+		}
+
+		// Packed SSE and SSE2 instructions on whole registers: prefix is 0x66 for integer and double lanes and 0
+		// for float ones.
+		void packed(unsigned char prefix, unsigned char op, unsigned dst, unsigned src) {
+			if (prefix != 0) {
+				byte(prefix);
+			}
+			rex(false, dst, 0, src);
+			byte(0x0f);
+			byte(op);
+			modrmReg(dst, src);
+		}
+
+		// Rearrange the dwords of src into dst; each two bits of order picks the source of a dword.
+		void pshufd(unsigned dst, unsigned src, unsigned char order) {
+			packed(0x66, 0x70, dst, src);
+			byte(order);
+		}
+
+		// Shift each qword right, bringing in zeros.
+		void psrlq(unsigned reg, unsigned char bits) {
+			byte(0x66);
+			rex(false, 0, 0, reg);
+			byte(0x0f);
+			byte(0x73);
+			modrmReg(2, reg);
+			byte(bits);
+		}
+
+		// Convert a 64 bit integer to a float or double.
+		void cvtsi2s(bool single, unsigned dst, unsigned src) {
+			byte(single ? 0xf3 : 0xf2);
+			rex(true, dst, 0, src);
+			byte(0x0f);
+			byte(0x2a);
+			modrmReg(dst, src);
+		}
+
+		// Convert a float or double to a 64 bit integer, rounding toward zero.
+		void cvtts2si(bool single, unsigned dst, unsigned src) {
+			byte(single ? 0xf3 : 0xf2);
+			rex(true, dst, 0, src);
+			byte(0x0f);
+			byte(0x2c);
+			modrmReg(dst, src);
+		}
+
+		// Convert between float and double; toDouble says which way.
+		void cvtFloat(bool toDouble, unsigned dst, unsigned src) {
+			byte(toDouble ? 0xf3 : 0xf2);
+			rex(false, dst, 0, src);
+			byte(0x0f);
+			byte(0x5a);
+			modrmReg(dst, src);
+		}
+
+		// Move the bits of a general purpose register to an XMM register or back, 4 bytes if single and 8 otherwise.
+		void movq(unsigned dst, unsigned src, bool single = false) {
+			unsigned xmm = isXmm(dst) ? dst : src;
+			unsigned gpr = isXmm(dst) ? src : dst;
+			byte(0x66);
+			rex(!single, xmm, 0, gpr);
+			byte(0x0f);
+			byte(isXmm(dst) ? 0x6e : 0x7e);
+			modrmReg(xmm, gpr);
+		}
+
+		void relocate(unsigned symbol, CodeRelocationKind kind, long long addend) {
+			CodeRelocation r;
+			r.offset = code.size();
+			r.symbol = symbol;
+			r.kind = kind;
+			r.addend = addend;
+			relocations.push_back(r);
+		}
+
+	private:
+
+		std::vector<int> labels;
+		std::vector<std::pair<unsigned, unsigned>> fixups;		// Where a label's displacement goes, and the label.
+
+		void byte(unsigned char b) {
+			code.push_back(b);
+		}
+
+		void dword(unsigned d) {
+			for (unsigned i = 0; i < 4; i++) {
+				code.push_back((d >> (8 * i)) & 0xff);
+			}
+		}
+
+		void qword(long long q) {
+			for (unsigned i = 0; i < 8; i++) {
+				code.push_back(((unsigned long long) q >> (8 * i)) & 0xff);
+			}
+		}
+
+		void fixup(unsigned label) {
+			fixups.push_back(std::make_pair((unsigned) code.size(), label));
+			dword(0);
+		}
+
+		// A REX prefix, if one is needed. byteRegister forces one so that spl, bpl, sil and dil can be named.
+		void rex(bool wide, unsigned reg, unsigned index, unsigned rm, bool byteRegister = false) {
+			unsigned char r = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((rm & 8) ? 1 : 0);
+			if (r != 0x40 || byteRegister) {
+				byte(r);
+			}
+		}
+
+		void rex(bool wide, unsigned reg, unsigned index, const Memory &m, bool byteRegister = false) {
+			rex(wide, reg, index, m.base < 0 ? 0 : (unsigned) m.base, byteRegister);
+		}
+
+		void modrmReg(unsigned reg, unsigned rm) {
+			byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+		}
+
+		// The ModRM byte and whatever follows it for a memory operand. trailing is the number of immediate
+		// bytes after the displacement, which addresses relative to the next instruction have to allow for.
+		void modrmMemory(unsigned reg, const Memory &m, unsigned trailing) {
+			if (m.base < 0) {
+				byte(((reg & 7) << 3) | 5);
+				relocate(m.symbol, m.kind, (long long) m.displacement - 4 - trailing);
+				dword(0);
+				return;
+			}
+			unsigned base = m.base & 7;
+			unsigned mod = m.displacement == 0 && base != RBP ? 0 : (m.displacement >= -128 && m.displacement <= 127 ? 1 : 2);
+			byte((mod << 6) | ((reg & 7) << 3) | base);
+			if (base == RSP) {
+				byte(0x24);
+			}
+			if (mod == 1) {
+				byte((unsigned char) m.displacement);
+			}
+			else if (mod == 2) {
+				dword((unsigned) m.displacement);
+			}
+		}
+};
+
+
+/* Register allocation */
+
+// Where a value lives while a function runs.
+struct ValueLocation {
+	enum Kind {
+		NOWHERE,			// Never needed, or recomputed wherever it is used.
+		REGISTER,
+		STACK				// A spill slot at an offset from rbp.
+	};
+	Kind kind;
+	int where;
+
+	bool operator==(const ValueLocation &other) const {
+		return kind == other.kind && where == other.where;
+	}
+
+	static ValueLocation reg(unsigned r) {
+		ValueLocation l;
+		l.kind = REGISTER;
+		l.where = r;
+		return l;
+	}
+
+	static ValueLocation stack(int offset) {
+		ValueLocation l;
+		l.kind = STACK;
+		l.where = offset;
+		return l;
+	}
+};
+
+
+// Linear scan register allocation, after Poletto and Sarkar, "Linear Scan Register Allocation".
+// Blocks are laid out in reverse postorder and each value gets one interval, from its first to its last point
+// of life in that order. Intervals are handed registers in order of their start, and when none is free the one
+// that lives longest is spilled. rax, rcx, rdx, r10, r11, xmm0, xmm1 and xmm15 are left for instruction
+// selection, and values that live across a call only get callee saved registers, of which SSE has none.
+class LinearScan {
+
+	public:
+
+		std::vector<unsigned> order;				// Blocks in layout order.
+		std::vector<ValueLocation> locations;
+		std::vector<bool> fused;					// Comparisons done by the branch that uses them.
+		std::vector<unsigned> saved;				// Callee saved registers that are used.
+		std::vector<ValueId> spilled;				// Given stack slots once the frame is laid out.
+		unsigned spills;
+
+		LinearScan(const Function *function) : spills(0), f(function) {}
+
+		// Whether a value is worked out again wherever it is used, rather than kept somewhere.
+		static bool rematerialized(const Function *f, ValueId v) {
+			const Instruction &i = f->values[v];
+			if (i.op == OP_CONST || i.op == OP_STACK || i.op == OP_SYMBOL) {
+				return true;
+			}
+			// A constant offset from a stack slot or symbol folds into the addressing of whatever uses it.
+			if (i.op == OP_ADD && i.type == IR_PTR) {
+				const Instruction &base = f->values[i.operands[0]];
+				const Instruction &offset = f->values[i.operands[1]];
+				return (base.op == OP_STACK || base.op == OP_SYMBOL) && offset.op == OP_CONST && offset.imm >= INT_MIN / 2 && offset.imm <= INT_MAX / 2;
+			}
+			return false;
+		}
+
+		void run() {
+			order = f->reversePostorder();
+			locations.assign(f->values.size(), ValueLocation());
+			fused.assign(f->values.size(), false);
+			number();
+			findFused();
+			std::vector<Interval> intervals = buildIntervals();
+			allocate(intervals);
+		}
+
+		// The -O0 alternative to run: no liveness and no intervals. Every value that isn't worked out where it is
+		// used gets a frame slot of its own, so a function is compiled in a single walk over its code, at the cost of
+		// a load or store around almost every instruction.
+		void spillAll() {
+			order = f->reversePostorder();
+			locations.assign(f->values.size(), ValueLocation());
+			fused.assign(f->values.size(), false);
+			for (ValueId v = 0; v < f->values.size(); v++) {
+				if (f->values[v].type != IR_VOID && !rematerialized(f, v)) {
+					spilled.push_back(v);
+				}
+			}
+			spills = spilled.size();
+		}
+
+	private:
+
+		struct Interval {
+			ValueId value;
+			unsigned from;
+			unsigned to;
+			bool xmm;
+			bool crossesCall;
+			int reg;
+		};
+
+		const Function *f;
+		std::vector<unsigned> position;				// Of each instruction; phis are at their block's start.
+		std::vector<unsigned> blockStart;
+		std::vector<unsigned> blockEnd;				// After the terminator, where moves into successor phis happen.
+		std::vector<unsigned> calls;
+		std::vector<unsigned> uses;
+
+		bool allocated(ValueId v) const {
+			const Instruction &i = f->values[v];
+			return i.type != IR_VOID && uses[v] > 0 && !fused[v] && !rematerialized(f, v);
+		}
+
+		void number() {
+			position.assign(f->values.size(), 0);
+			blockStart.assign(f->blocks.size(), 0);
+			blockEnd.assign(f->blocks.size(), 0);
+			uses.assign(f->values.size(), 0);
+			unsigned p = 2;
+			for (unsigned b : order) {
+				blockStart[b] = p;
+				p += 2;
+				for (ValueId v : f->blocks[b].code) {
+					const Instruction &i = f->values[v];
+					for (unsigned j = 0; j < i.count; j++) {
+						uses[i.operands[j]]++;
+					}
+					if (i.op == OP_PHI) {
+						position[v] = blockStart[b];
+					}
+					else {
+						position[v] = i.op == OP_PARAM ? 0 : p;
+						if (i.op == OP_CALL) {
+							calls.push_back(p);
+						}
+						p += 2;
+					}
+				}
+				blockEnd[b] = p;
+				p += 2;
+			}
+		}
+
+		// An integer comparison used only by the branch right after it becomes a compare and conditional jump.
+		void findFused() {
+			for (unsigned b : order) {
+				const std::vector<ValueId> &code = f->blocks[b].code;
+				if (code.size() < 2) {
+					continue;
+				}
+				const Instruction &t = f->values[code.back()];
+				ValueId c = code[code.size() - 2];
+				const Instruction &i = f->values[c];
+				if (t.op == OP_BRANCH && t.operands[0] == c && uses[c] == 1 && i.op >= OP_EQ && i.op <= OP_UGE && !irFloat(f->values[i.operands[0]].type)) {
+					fused[c] = true;
+				}
+			}
+		}
+
+		// Extend the ranges of values over the blocks they are live into and out of. Values are in SSA form, so a
+		// value is live into the blocks on the paths back from each of its uses to its definition: each use is
+		// followed up through predecessors until the definition or a block already found is reached, as in
+		// Brandner et al., "Computing Liveness Sets for SSA-Form Programs". That takes time in proportion to the
+		// size of the live ranges, where iterating live sets to a fixed point takes a pass for each level of loop
+		// nesting. Fused and rematerialized values are worked out where they are used, from their own operands.
+		void liveness(std::vector<unsigned> &from, std::vector<unsigned> &to) {
+			std::vector<std::vector<unsigned>> preds(f->blocks.size());
+			for (unsigned b : order) {
+				for (unsigned s : f->successors(b)) {
+					preds[s].push_back(b);
+				}
+			}
+
+			// The blocks that each value is live at the end of or used in, other than the one defining it.
+			std::vector<std::pair<ValueId, unsigned>> starts;
+			auto use = [&](ValueId v, unsigned b) {
+				if (allocated(v) && f->values[v].block != b) {
+					starts.push_back(std::make_pair(v, b));
+				}
+			};
+			for (unsigned b : order) {
+				for (ValueId v : f->blocks[b].code) {
+					const Instruction &i = f->values[v];
+					for (unsigned j = 0; j < i.count; j++) {
+						ValueId operand = i.operands[j];
+						unsigned at = i.op == OP_PHI ? i.incoming[j] : b;
+						use(operand, at);
+						if (i.op != OP_PHI && (fused[operand] || rematerialized(f, operand))) {
+							const Instruction &inner = f->values[operand];
+							for (unsigned q = 0; q < inner.count; q++) {
+								use(inner.operands[q], at);
+							}
+						}
+					}
+				}
+			}
+			std::sort(starts.begin(), starts.end());
+
+			std::vector<ValueId> liveIn(f->blocks.size(), NO_VALUE);		// The value last found live into each block.
+			std::vector<unsigned> work;
+			for (const std::pair<ValueId, unsigned> &start : starts) {
+				ValueId v = start.first;
+				unsigned definedIn = f->values[v].block;
+				work.push_back(start.second);
+				while (!work.empty()) {
+					unsigned b = work.back();
+					work.pop_back();
+					if (b == definedIn || liveIn[b] == v) {
+						continue;
+					}
+					liveIn[b] = v;
+					from[v] = std::min(from[v], blockStart[b]);
+					to[v] = std::max(to[v], blockStart[b]);
+					for (unsigned p : preds[b]) {
+						to[v] = std::max(to[v], blockEnd[p]);
+						work.push_back(p);
+					}
+				}
+			}
+		}
+
+		std::vector<Interval> buildIntervals() {
+			std::vector<Interval> ret;
+			std::vector<unsigned> from(f->values.size(), ~0u);
+			std::vector<unsigned> to(f->values.size(), 0);
+			liveness(from, to);
+			for (unsigned b : order) {
+				for (ValueId v : f->blocks[b].code) {
+					const Instruction &i = f->values[v];
+					if (allocated(v)) {
+						from[v] = std::min(from[v], position[v]);
+						to[v] = std::max(to[v], position[v]);
+					}
+					for (unsigned j = 0; j < i.count; j++) {
+						ValueId operand = i.operands[j];
+						unsigned at = i.op == OP_PHI ? blockEnd[i.incoming[j]] : position[v];
+						if (allocated(operand)) {
+							to[operand] = std::max(to[operand], at);
+						}
+						else if (fused[operand] || rematerialized(f, operand)) {
+							const Instruction &inner = f->values[operand];
+							for (unsigned q = 0; q < inner.count; q++) {
+								if (allocated(inner.operands[q])) {
+									to[inner.operands[q]] = std::max(to[inner.operands[q]], at);
+								}
+							}
+						}
+					}
+				}
+			}
+			for (ValueId v = 0; v < f->values.size(); v++) {
+				if (from[v] == ~0u) {
+					continue;
+				}
+				Interval i;
+				i.value = v;
+				i.from = from[v];
+				i.to = to[v];
+				i.xmm = irFloat(f->values[v].type) || irVector(f->values[v].type);
+				auto c = std::upper_bound(calls.begin(), calls.end(), i.from);
+				i.crossesCall = c != calls.end() && *c < i.to;
+				i.reg = -1;
+				ret.push_back(i);
+			}
+			std::sort(ret.begin(), ret.end(), [](const Interval &a, const Interval &b) {
+				return a.from < b.from || (a.from == b.from && a.value < b.value);
+			});
+			return ret;
+		}
+
+		// The registers an interval may have, in order of preference.
+		static std::vector<unsigned> candidates(const Interval &i) {
+			if (i.xmm) {
+				if (i.crossesCall) {
+					return std::vector<unsigned>();
+				}
+				return {XMM2, XMM3, XMM4, XMM5, XMM6, XMM7, XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14};
+			}
+			if (i.crossesCall) {
+				return {RBX, R12, R13, R14, R15};
+			}
+			return {RSI, RDI, R8, R9, RBX, R12, R13, R14, R15};
+		}
+
+		void allocate(std::vector<Interval> &intervals) {
+			std::vector<Interval*> active;
+			std::vector<bool> busy(32, false);
+			std::vector<bool> used(32, false);
+			for (Interval &current : intervals) {
+				for (unsigned k = 0; k < active.size();) {
+					if (active[k]->to < current.from) {
+						busy[active[k]->reg] = false;
+						active.erase(active.begin() + k);
+					}
+					else {
+						k++;
+					}
+				}
+				std::vector<unsigned> allowed = candidates(current);
+				for (unsigned r : allowed) {
+					if (!busy[r]) {
+						current.reg = r;
+						break;
+					}
+				}
+				if (current.reg < 0) {
+					// Take the register of whichever allowed interval lives longest, if it outlives this one.
+					Interval *victim = nullptr;
+					for (Interval *a : active) {
+						if (std::find(allowed.begin(), allowed.end(), (unsigned) a->reg) != allowed.end() && (victim == nullptr || a->to > victim->to)) {
+							victim = a;
+						}
+					}
+					if (victim != nullptr && victim->to > current.to) {
+						current.reg = victim->reg;
+						victim->reg = -1;
+						spilled.push_back(victim->value);
+						active.erase(std::find(active.begin(), active.end(), victim));
+					}
+					else {
+						spilled.push_back(current.value);
+						continue;
+					}
+				}
+				busy[current.reg] = true;
+				used[current.reg] = true;
+				active.push_back(&current);
+			}
+			for (const Interval &i : intervals) {
+				if (i.reg >= 0) {
+					locations[i.value] = ValueLocation::reg(i.reg);
+				}
+			}
+			for (unsigned r : {RBX, R12, R13, R14, R15}) {
+				if (used[r]) {
+					saved.push_back(r);
+				}
+			}
+			spills = spilled.size();
+		}
+};
+
+
+/* Code generation */
+
+// Generates x86-64 code for the functions of a module, following the System V calling convention: the first
+// six integer and pointer arguments go in rdi, rsi, rdx, rcx, r8 and r9, the first eight floating point ones in
+// xmm0 to xmm7, and the rest on the stack; results come back in rax or xmm0. Pairs and aggregates are passed the
+// way the IR has them, as words and addresses.
+// Integers are kept in registers sign extended to 64 bits, whatever their width, the same as IR constants.
+class X86CodeGenerator {
+
+	public:
+
+		Assembler code;
+		std::vector<std::pair<unsigned, unsigned>> functionExtents;		// The offset and size of each function.
+
+		// With fast set, registers aren't allocated and values live in the frame, which is what -O0 uses.
+		X86CodeGenerator(const IRModule *m, bool fast = false) : module(m), fast(fast), f(nullptr), allocation(nullptr) {}
+
+		void generate() {
+			generate(std::vector<const FunctionCode*>());
+		}
+
+		// Generate code for the functions of the module, except that where reuse has code for a function, as a
+		// build cache keeps it from an earlier compile, that code is placed instead.
+		// The functions are shared out between as many threads as jobs says. Each is generated on its own, and then
+		// they are put together in the order of the module, so the code is the same whatever the number of threads.
+		void generate(const std::vector<const FunctionCode*> &reuse, unsigned jobs = 1) {
+			TraceScope trace("codegen");
+			std::vector<unsigned> pending;
+			for (unsigned k = 0; k < module->functions.size(); k++) {
+				if (k >= reuse.size() || reuse[k] == nullptr) {
+					pending.push_back(k);
+				}
+			}
+			std::vector<Assembler> generated(module->functions.size());
+			std::atomic<unsigned> next(0);
+			auto work = [&]() {
+				X86CodeGenerator worker(module, fast);
+				for (unsigned k = next++; k < pending.size(); k = next++) {
+					const Function *fn = module->functions[pending[k]];
+					TraceScope function("generateFunction", fn->name.c_str());
+					worker.generate(fn);
+					function.bytes = worker.code.code.size();
+					std::swap(generated[pending[k]], worker.code);
+				}
+			};
+			jobs = std::max(1u, std::min(jobs, (unsigned) pending.size()));
+			std::vector<std::thread> threads;
+			for (unsigned t = 1; t < jobs; t++) {
+				threads.push_back(std::thread(work));
+			}
+			work();
+			for (std::thread &t : threads) {
+				t.join();
+			}
+
+			for (unsigned k = 0; k < module->functions.size(); k++) {
+				code.align(16);
+				unsigned start = code.code.size();
+				if (k < reuse.size() && reuse[k] != nullptr) {
+					place(*reuse[k]);
+				}
+				else {
+					append(generated[k]);
+				}
+				functionExtents.push_back(std::make_pair(start, (unsigned) code.code.size() - start));
+			}
+			trace.bytes = code.code.size();
+		}
+
+		// The code generated for a function, apart from this module.
+		FunctionCode codeOf(unsigned function) const {
+			FunctionCode ret;
+			unsigned start = functionExtents[function].first;
+			unsigned end = start + functionExtents[function].second;
+			ret.code.assign(code.code.begin() + start, code.code.begin() + end);
+			std::map<unsigned, unsigned> names;
+			for (const CodeRelocation &r : code.relocations) {
+				if (r.offset < start || r.offset >= end) {
+					continue;
+				}
+				auto found = names.find(r.symbol);
+				if (found == names.end()) {
+					found = names.insert(std::make_pair(r.symbol, (unsigned) ret.names.size())).first;
+					ret.names.push_back(module->symbols[r.symbol].name);
+				}
+				CodeRelocation moved = r;
+				moved.offset -= start;
+				moved.symbol = found->second;
+				ret.relocations.push_back(moved);
+			}
+			return ret;
+		}
+
+	private:
+
+		// A move from wherever a value is to somewhere else, as one of a set that happen all at once.
+		struct Move {
+			ValueLocation to;
+			ValueLocation from;
+			ValueId value;			// The value moved, for ones that are rematerialized.
+			bool xmm;
+			bool vector;			// All 16 bytes of an XMM register are moved.
+		};
+
+		const IRModule *module;
+		bool fast;
+		const Function *f;
+		LinearScan *allocation;
+		std::vector<int> slotOffsets;
+		std::vector<unsigned> blockLabels;
+		unsigned epilogue;
+		bool frameShared;			// Something may use the stack slots after a call, so calls can't replace the frame.
+		bool tailJumped;			// The last instruction was a call made as a jump, so the block is done.
+
+		static const unsigned argumentRegisters[6];
+
+		// Append code generated for a function in an earlier compile, giving its relocations this module's symbols.
+		void place(const FunctionCode &reused) {
+			unsigned start = code.code.size();
+			code.code.insert(code.code.end(), reused.code.begin(), reused.code.end());
+			for (const CodeRelocation &r : reused.relocations) {
+				CodeRelocation moved = r;
+				moved.offset += start;
+				moved.symbol = module->findSymbol(reused.names[r.symbol]);
+				code.relocations.push_back(moved);
+			}
+		}
+
+		// Append a function generated by another generator for the same module.
+		void append(const Assembler &generated) {
+			unsigned start = code.code.size();
+			code.code.insert(code.code.end(), generated.code.begin(), generated.code.end());
+			for (const CodeRelocation &r : generated.relocations) {
+				CodeRelocation moved = r;
+				moved.offset += start;
+				code.relocations.push_back(moved);
+			}
+		}
+
+		void generate(const Function *function) {
+			f = function;
+			LinearScan scan(f);
+			if (fast) {
+				scan.spillAll();
+			}
+			else {
+				scan.run();
+			}
+			allocation = &scan;
+			layOutFrame();
+			frameShared = frameEscapes(f);
+			tailJumped = false;
+
+			blockLabels.clear();
+			for (unsigned b = 0; b < f->blocks.size(); b++) {
+				blockLabels.push_back(code.newLabel());
+			}
+			epilogue = code.newLabel();
+
+			code.push(RBP);
+			code.movRR(RBP, RSP);
+			for (unsigned r : scan.saved) {
+				code.push(r);
+			}
+			if (frameSize > 0) {
+				code.aluImm(Assembler::ALU_SUB, RSP, frameSize);
+			}
+			receiveParameters();
+
+			for (unsigned k = 0; k < scan.order.size(); k++) {
+				unsigned b = scan.order[k];
+				code.bind(blockLabels[b]);
+				unsigned next = k + 1 < scan.order.size() ? scan.order[k + 1] : ~0u;
+				for (ValueId v : f->blocks[b].code) {
+					instruction(v, b, next);
+				}
+			}
+
+			code.bind(epilogue);
+			leaveFrame();
+			code.ret();
+			code.resolveLabels();
+			allocation = nullptr;
+		}
+
+		// Restore the caller's registers and stack pointer.
+		void leaveFrame() {
+			code.lea(RSP, Memory::at(RBP, -8 * (int) allocation->saved.size()));
+			for (unsigned k = allocation->saved.size(); k-- > 0;) {
+				code.pop(allocation->saved[k]);
+			}
+			code.pop(RBP);
+		}
+
+		unsigned frameSize;
+
+		// Stack slots and spills go below the saved registers, and the frame keeps rsp 16 byte aligned.
+		void layOutFrame() {
+			unsigned top = 8 * allocation->saved.size();
+			unsigned cursor = top;
+			slotOffsets.clear();
+			for (const StackSlot &s : f->slots) {
+				unsigned align = s.align == 0 ? 1 : s.align;
+				cursor += s.size;
+				cursor = (cursor + align - 1) & ~(align - 1);
+				slotOffsets.push_back(-(int) cursor);
+			}
+			for (ValueId v : allocation->spilled) {
+				cursor = (cursor + (isVector(v) ? 16 : 8) + 7) & ~7u;
+				allocation->locations[v] = ValueLocation::stack(-(int) cursor);
+			}
+			cursor = (cursor + 15) & ~15u;
+			frameSize = cursor - top;
+		}
+
+		ValueLocation location(ValueId v) const {
+			return allocation->locations[v];
+		}
+
+		bool isFloat(ValueId v) const {
+			return irFloat(f->values[v].type);
+		}
+
+		bool isVector(ValueId v) const {
+			return irVector(f->values[v].type);
+		}
+
+		bool isSingle(ValueId v) const {
+			return f->values[v].type == IR_F32;
+		}
+
+		// Whether a symbol is defined in this module, and so can be reached relative to the code.
+		bool local(unsigned symbol) const {
+			return module->symbols[symbol].kind != EXTERNAL_SYMBOL;
+		}
+
+		// The memory at an address, folding stack slots, symbols and constant offsets into the operand.
+		// Other addresses go through a register, which is scratch if the address isn't in one already.
+		Memory memory(ValueId address, unsigned scratch) {
+			const Instruction &i = f->values[address];
+			int offset = 0;
+			ValueId base = address;
+			if (i.op == OP_ADD && LinearScan::rematerialized(f, address)) {
+				base = i.operands[0];
+				offset = (int) f->values[i.operands[1]].imm;
+			}
+			const Instruction &b = f->values[base];
+			if (b.op == OP_STACK) {
+				return Memory::at(RBP, slotOffsets[b.imm] + offset);
+			}
+			if (b.op == OP_SYMBOL && local(b.imm)) {
+				return Memory::symbolic(b.imm, offset);
+			}
+			return Memory::at(use(address, scratch), 0);
+		}
+
+		// Put a value in a register and return it. If it's already in one, that one is returned instead.
+		unsigned use(ValueId v, unsigned scratch) {
+			ValueLocation l = location(v);
+			if (l.kind == ValueLocation::REGISTER) {
+				return l.where;
+			}
+			get(scratch, v);
+			return scratch;
+		}
+
+		// Put a value in a particular register.
+		void get(unsigned reg, ValueId v) {
+			const Instruction &i = f->values[v];
+			ValueLocation l = location(v);
+			if (l.kind == ValueLocation::REGISTER) {
+				code.movRR(reg, l.where);
+			}
+			else if (l.kind == ValueLocation::STACK) {
+				if (isVector(v)) {
+					code.loadVector(reg, Memory::at(RBP, l.where));
+				}
+				else if (isXmm(reg)) {
+					code.loadFloat(false, reg, Memory::at(RBP, l.where));
+				}
+				else {
+					code.load(8, false, reg, Memory::at(RBP, l.where));
+				}
+			}
+			else if (i.op == OP_CONST) {
+				if (isXmm(reg)) {
+					if (i.type == IR_F32) {
+						float single = (float) constantDouble(i.imm);
+						unsigned bits;
+						memcpy(&bits, &single, sizeof(bits));
+						code.movRI(R11, bits);
+						code.movq(reg, R11, true);
+					}
+					else {
+						code.movRI(R11, i.imm);
+						code.movq(reg, R11);
+					}
+				}
+				else {
+					code.movRI(reg, i.imm);
+				}
+			}
+			else if (i.op == OP_SYMBOL && !local(i.imm)) {
+				code.load(8, false, reg, Memory::symbolic(i.imm, 0, RELOC_GOTPCREL));
+			}
+			else if (i.op == OP_ADD && f->values[i.operands[0]].op == OP_SYMBOL && !local(f->values[i.operands[0]].imm)) {
+				get(reg, i.operands[0]);
+				code.aluImm(Assembler::ALU_ADD, reg, (int) f->values[i.operands[1]].imm);
+			}
+			else if (i.op == OP_STACK || i.op == OP_SYMBOL || i.op == OP_ADD) {
+				code.lea(reg, memory(v, reg));
+			}
+		}
+
+		// Store a register into where a value lives.
+		void put(ValueId v, unsigned reg) {
+			ValueLocation l = location(v);
+			if (l.kind == ValueLocation::REGISTER) {
+				code.movRR(l.where, reg);
+			}
+			else if (l.kind == ValueLocation::STACK) {
+				if (isVector(v)) {
+					code.storeVector(Memory::at(RBP, l.where), reg);
+				}
+				else if (isXmm(reg)) {
+					code.storeFloat(false, Memory::at(RBP, l.where), reg);
+				}
+				else {
+					code.store(8, Memory::at(RBP, l.where), reg);
+				}
+			}
+		}
+
+		// Bring an integer result back to its type's width.
+		void normalizeRegister(unsigned reg, IRType type) {
+			if (type != IR_I64 && type != IR_PTR) {
+				code.signExtend(irSize(type), reg);
+			}
+		}
+
+		/* Moves */
+
+		void moveOne(const Move &m) {
+			if (m.to.kind == ValueLocation::REGISTER) {
+				if (m.from.kind == ValueLocation::NOWHERE) {
+					get(m.to.where, m.value);
+				}
+				else if (m.from.kind == ValueLocation::REGISTER) {
+					code.movRR(m.to.where, m.from.where);
+				}
+				else if (m.vector) {
+					code.loadVector(m.to.where, Memory::at(RBP, m.from.where));
+				}
+				else if (isXmm(m.to.where)) {
+					code.loadFloat(false, m.to.where, Memory::at(RBP, m.from.where));
+				}
+				else {
+					code.load(8, false, m.to.where, Memory::at(RBP, m.from.where));
+				}
+			}
+			else if (m.from.kind == ValueLocation::REGISTER) {
+				if (m.vector) {
+					code.storeVector(Memory::at(RBP, m.to.where), m.from.where);
+				}
+				else if (isXmm(m.from.where)) {
+					code.storeFloat(false, Memory::at(RBP, m.to.where), m.from.where);
+				}
+				else {
+					code.store(8, Memory::at(RBP, m.to.where), m.from.where);
+				}
+			}
+			else if (m.vector) {
+				code.loadVector(XMM0, Memory::at(RBP, m.from.where));
+				code.storeVector(Memory::at(RBP, m.to.where), XMM0);
+			}
+			else {
+				// Memory to memory goes through rax, whatever the type, since only the bits matter.
+				if (m.from.kind == ValueLocation::NOWHERE) {
+					if (m.xmm) {
+						get(XMM0, m.value);
+						code.movq(RAX, XMM0);
+					}
+					else {
+						get(RAX, m.value);
+					}
+				}
+				else {
+					code.load(8, false, RAX, Memory::at(RBP, m.from.where));
+				}
+				code.store(8, Memory::at(RBP, m.to.where), RAX);
+			}
+		}
+
+		// Do a set of moves as though they all happened at once.
+		// Moves whose destination no other move still needs go first; what is left is cycles, which are broken by
+		// copying one of their values to r11 or xmm15. Rematerialized values read nothing, so they go last.
+		void parallelMove(std::vector<Move> moves) {
+			std::vector<Move> last;
+			std::vector<Move> pending;
+			for (const Move &m : moves) {
+				if (m.from.kind == ValueLocation::NOWHERE) {
+					last.push_back(m);
+				}
+				else if (!(m.from == m.to)) {
+					pending.push_back(m);
+				}
+			}
+			while (!pending.empty()) {
+				bool progress = false;
+				for (unsigned k = 0; k < pending.size();) {
+					bool needed = false;
+					for (const Move &other : pending) {
+						needed = needed || other.from == pending[k].to;
+					}
+					if (!needed) {
+						moveOne(pending[k]);
+						pending.erase(pending.begin() + k);
+						progress = true;
+					}
+					else {
+						k++;
+					}
+				}
+				if (!progress) {
+					Move save;
+					save.from = pending[0].to;
+					save.to = ValueLocation::reg(pending[0].xmm ? XMM15 : R11);
+					save.xmm = pending[0].xmm;
+					save.vector = pending[0].vector;
+					save.value = NO_VALUE;
+					for (const Move &other : pending) {
+						if (other.from == save.from) {
+							save.xmm = other.xmm;
+							save.vector = other.vector;
+							save.to = ValueLocation::reg(other.xmm ? XMM15 : R11);
+						}
+					}
+					moveOne(save);
+					for (Move &other : pending) {
+						if (other.from == save.from) {
+							other.from = save.to;
+						}
+					}
+				}
+			}
+			for (const Move &m : last) {
+				moveOne(m);
+			}
+		}
+
+		Move moveOf(ValueId v, ValueLocation to) {
+			Move m;
+			m.to = to;
+			m.from = location(v);
+			m.value = v;
+			m.xmm = isFloat(v) || isVector(v);
+			m.vector = isVector(v);
+			return m;
+		}
+
+		// Move the arguments from where the caller put them to where the allocator wants them.
+		void receiveParameters() {
+			std::vector<Move> moves;
+			std::vector<ValueId> narrow;
+			unsigned ints = 0;
+			unsigned floats = 0;
+			unsigned stack = 0;
+			std::vector<ValueId> params(f->params.size(), NO_VALUE);
+			for (ValueId v : f->blocks[0].code) {
+				if (f->values[v].op == OP_PARAM) {
+					params[f->values[v].imm] = v;
+				}
+			}
+			for (unsigned p = 0; p < f->params.size(); p++) {
+				ValueLocation from;
+				if (irFloat(f->params[p]) && floats < 8) {
+					from = ValueLocation::reg(XMM0 + floats++);
+				}
+				else if (!irFloat(f->params[p]) && ints < 6) {
+					from = ValueLocation::reg(argumentRegisters[ints++]);
+				}
+				else {
+					from = ValueLocation::stack(16 + 8 * stack++);
+				}
+				ValueId v = params[p];
+				if (v == NO_VALUE || location(v).kind == ValueLocation::NOWHERE) {
+					continue;
+				}
+				Move m = moveOf(v, location(v));
+				m.from = from;
+				moves.push_back(m);
+				if (f->params[p] == IR_I8 || f->params[p] == IR_I16 || f->params[p] == IR_I32) {
+					narrow.push_back(v);
+				}
+			}
+			parallelMove(moves);
+			// Callers following the convention needn't have extended narrow arguments.
+			for (ValueId v : narrow) {
+				unsigned r = use(v, RAX);
+				normalizeRegister(r, f->values[v].type);
+				put(v, r);
+			}
+		}
+
+		// The moves into a successor's phis along the edge from a block.
+		std::vector<Move> phiMoves(unsigned from, unsigned to) {
+			std::vector<Move> ret;
+			for (ValueId v : f->blocks[to].code) {
+				const Instruction &phi = f->values[v];
+				if (phi.op != OP_PHI) {
+					break;
+				}
+				if (location(v).kind == ValueLocation::NOWHERE) {
+					continue;
+				}
+				for (unsigned j = 0; j < phi.count; j++) {
+					if (phi.incoming[j] == from) {
+						Move m = moveOf(phi.operands[j], location(v));
+						m.xmm = isFloat(v) || isVector(v);
+						m.vector = isVector(v);
+						ret.push_back(m);
+						break;
+					}
+				}
+			}
+			return ret;
+		}
+
+		// Take an edge: move into the successor's phis, then jump unless the successor comes next.
+		void edge(unsigned from, unsigned to, unsigned next) {
+			parallelMove(phiMoves(from, to));
+			if (to != next) {
+				code.jmp(blockLabels[to]);
+			}
+		}
+
+		/* Instructions */
+
+		// Compare two integers, setting the flags.
+		void compare(const Instruction &i) {
+			unsigned a = use(i.operands[0], RAX);
+			const Instruction &b = f->values[i.operands[1]];
+			if (b.op == OP_CONST && b.imm >= INT_MIN && b.imm <= INT_MAX) {
+				code.aluImm(Assembler::ALU_CMP, a, (int) b.imm);
+			}
+			else {
+				code.alu(Assembler::ALU_CMP, a, use(i.operands[1], RCX));
+			}
+		}
+
+		static Condition condition(Opcode op) {
+			switch (op) {
+				case (OP_EQ) : {
+					return CC_E;
+				}
+				case (OP_NE) : {
+					return CC_NE;
+				}
+				case (OP_LT) : {
+					return CC_L;
+				}
+				case (OP_LE) : {
+					return CC_LE;
+				}
+				case (OP_GT) : {
+					return CC_G;
+				}
+				case (OP_GE) : {
+					return CC_GE;
+				}
+				case (OP_ULT) : {
+					return CC_B;
+				}
+				case (OP_ULE) : {
+					return CC_BE;
+				}
+				case (OP_UGT) : {
+					return CC_A;
+				}
+				default : {
+					return CC_AE;
+				}
+			}
+		}
+
+		void instruction(ValueId v, unsigned block, unsigned next) {
+			const Instruction &i = f->values[v];
+			if (allocation->fused[v]) {
+				return;
+			}
+			if (tailJumped) {
+				tailJumped = false;
+				return;
+			}
+			switch (i.op) {
+				case (OP_CONST) :
+				case (OP_SYMBOL) :
+				case (OP_STACK) :
+				case (OP_PARAM) :
+				case (OP_PHI) :
+				case (OP_NOP) : {
+					return;
+				}
+				case (OP_LOAD) : {
+					if (location(v).kind == ValueLocation::NOWHERE) {
+						return;
+					}
+					Memory m = memory(i.operands[0], R11);
+					if (irVector(i.type)) {
+						code.loadVector(XMM0, m);
+						put(v, XMM0);
+					}
+					else if (irFloat(i.type)) {
+						code.loadFloat(i.type == IR_F32, XMM0, m);
+						put(v, XMM0);
+					}
+					else {
+						code.load(irSize(i.type), true, RAX, m);
+						put(v, RAX);
+					}
+					return;
+				}
+				case (OP_STORE) : {
+					ValueId value = i.operands[1];
+					// A float constant is made in R11, so it has to be made before the address is.
+					if (isFloat(value) && !isVector(value)) {
+						unsigned r = use(value, XMM0);
+						code.storeFloat(isSingle(value), memory(i.operands[0], R11), r);
+						return;
+					}
+					Memory m = memory(i.operands[0], R11);
+					if (isVector(value)) {
+						code.storeVector(m, use(value, XMM0));
+					}
+					else {
+						code.store(irSize(f->values[value].type), m, use(value, RAX));
+					}
+					return;
+				}
+				case (OP_COPY) : {
+					copy(i);
+					return;
+				}
+				case (OP_CALL) : {
+					if (isTailCall(v)) {
+						tailJump(v);
+					}
+					else {
+						call(v);
+					}
+					return;
+				}
+				case (OP_JUMP) : {
+					edge(block, i.targets[0], next);
+					return;
+				}
+				case (OP_BRANCH) : {
+					branch(v, block, next);
+					return;
+				}
+				case (OP_RETURN) : {
+					if (i.count > 0) {
+						get(isFloat(i.operands[0]) ? XMM0 : RAX, i.operands[0]);
+					}
+					code.jmp(epilogue);
+					return;
+				}
+				case (OP_TRAP) : {
+					code.ud2();
+					return;
+				}
+				default : {
+					if (location(v).kind == ValueLocation::NOWHERE) {
+						return;
+					}
+					if (i.op == OP_CONVERT) {
+						convert(v);
+					}
+					else if (i.op == OP_SPLAT || i.op == OP_REDUCE || irVector(i.type)) {
+						vectorArithmetic(v);
+					}
+					else if (irFloat(f->values[i.operands[0]].type)) {
+						floatArithmetic(v);
+					}
+					else {
+						integerArithmetic(v);
+					}
+				}
+			}
+		}
+
+		void integerArithmetic(ValueId v) {
+			const Instruction &i = f->values[v];
+			IRType operandType = f->values[i.operands[0]].type;
+			unsigned width = irSize(operandType);
+			if (i.op >= OP_EQ && i.op <= OP_UGE) {
+				compare(i);
+				code.setcc(condition(i.op), RAX);
+				code.zeroExtend(1, RAX);
+				put(v, RAX);
+				return;
+			}
+			get(RAX, i.operands[0]);
+			switch (i.op) {
+				case (OP_NEG) : {
+					code.unary(3, RAX);
+					break;
+				}
+				case (OP_NOT) : {
+					code.unary(2, RAX);
+					break;
+				}
+				case (OP_ADD) :
+				case (OP_SUB) :
+				case (OP_AND) :
+				case (OP_OR) :
+				case (OP_XOR) : {
+					static const Assembler::AluOp ops[] = {Assembler::ALU_AND, Assembler::ALU_OR, Assembler::ALU_XOR};
+					Assembler::AluOp op = i.op == OP_ADD ? Assembler::ALU_ADD : (i.op == OP_SUB ? Assembler::ALU_SUB : ops[i.op - OP_AND]);
+					const Instruction &b = f->values[i.operands[1]];
+					if (b.op == OP_CONST && b.imm >= INT_MIN && b.imm <= INT_MAX) {
+						code.aluImm(op, RAX, (int) b.imm);
+					}
+					else {
+						code.alu(op, RAX, use(i.operands[1], RCX));
+					}
+					break;
+				}
+				case (OP_MUL) : {
+					code.imul(RAX, use(i.operands[1], RCX));
+					break;
+				}
+				case (OP_DIV) :
+				case (OP_MOD) : {
+					unsigned divisor = use(i.operands[1], RCX);
+					code.cqo();
+					code.unary(7, divisor);
+					if (i.op == OP_MOD) {
+						code.movRR(RAX, RDX);
+					}
+					break;
+				}
+				case (OP_UDIV) :
+				case (OP_UMOD) : {
+					get(RCX, i.operands[1]);
+					code.zeroExtend(width, RAX);
+					code.zeroExtend(width, RCX);
+					code.movRI(RDX, 0);
+					code.unary(6, RCX);
+					if (i.op == OP_UMOD) {
+						code.movRR(RAX, RDX);
+					}
+					break;
+				}
+				case (OP_SHL) :
+				case (OP_SHR) :
+				case (OP_USHR) : {
+					get(RCX, i.operands[1]);
+					if (i.op == OP_USHR) {
+						code.zeroExtend(width, RAX);
+					}
+					code.shift(i.op == OP_SHL ? 4 : (i.op == OP_SHR ? 7 : 5), RAX);
+					break;
+				}
+				default : {}
+			}
+			normalizeRegister(RAX, i.type);
+			put(v, RAX);
+		}
+
+		void floatArithmetic(ValueId v) {
+			const Instruction &i = f->values[v];
+			bool single = f->values[i.operands[0]].type == IR_F32;
+			if (i.op == OP_NEG) {
+				// Flip the sign bit.
+				get(XMM0, i.operands[0]);
+				code.movq(RAX, XMM0, single);
+				code.movRI(RCX, 1);
+				code.shiftImm(4, RCX, single ? 31 : 63);
+				code.alu(Assembler::ALU_XOR, RAX, RCX);
+				code.movq(XMM0, RAX, single);
+				put(v, XMM0);
+				return;
+			}
+			if (i.op >= OP_EQ && i.op <= OP_GE) {
+				// ucomis sets the flags as an unsigned comparison would, and the parity flag if either is NaN.
+				bool swap = i.op == OP_LT || i.op == OP_LE;
+				unsigned a = use(i.operands[swap ? 1 : 0], XMM0);
+				unsigned b = use(i.operands[swap ? 0 : 1], XMM1);
+				code.ucomis(single, a, b);
+				switch (i.op) {
+					case (OP_EQ) : {
+						code.setcc(CC_E, RAX);
+						code.setcc(CC_NP, RCX);
+						code.alu(Assembler::ALU_AND, RAX, RCX);
+						break;
+					}
+					case (OP_NE) : {
+						code.setcc(CC_NE, RAX);
+						code.setcc(CC_P, RCX);
+						code.alu(Assembler::ALU_OR, RAX, RCX);
+						break;
+					}
+					case (OP_LT) :
+					case (OP_GT) : {
+						code.setcc(CC_A, RAX);
+						break;
+					}
+					default : {
+						code.setcc(CC_AE, RAX);
+					}
+				}
+				code.zeroExtend(1, RAX);
+				put(v, RAX);
+				return;
+			}
+			get(XMM0, i.operands[0]);
+			unsigned b = use(i.operands[1], XMM1);
+			static const unsigned char ops[] = {0x58, 0x5c, 0x59, 0x5e};
+			code.sse(ops[i.op - OP_ADD], single, XMM0, b);
+			put(v, XMM0);
+		}
+
+		// Vectors have the SSE2 instructions the vectorizer asks for. SSE2 has no multiplication of 32 bit lanes, so
+		// that is done as two multiplications of 64 bit lanes, the even lanes and then the odd ones.
+		void vectorArithmetic(ValueId v) {
+			const Instruction &i = f->values[v];
+			if (i.op == OP_SPLAT) {
+				IRType lane = f->values[i.operands[0]].type;
+				if (irFloat(lane)) {
+					get(XMM0, i.operands[0]);
+				}
+				else {
+					get(RAX, i.operands[0]);
+					code.movq(XMM0, RAX);
+				}
+				code.pshufd(XMM0, XMM0, irSize(lane) == 4 ? 0x00 : 0x44);
+				put(v, XMM0);
+				return;
+			}
+			if (i.op == OP_REDUCE) {
+				// Fold the top half onto the bottom, then for 32 bit lanes the top quarter onto the bottom one.
+				bool dwords = irSize(i.type) == 4;
+				get(XMM0, i.operands[0]);
+				code.pshufd(XMM1, XMM0, 0x4e);
+				code.packed(0x66, dwords ? 0xfe : 0xd4, XMM0, XMM1);
+				if (dwords) {
+					code.pshufd(XMM1, XMM0, 0xb1);
+					code.packed(0x66, 0xfe, XMM0, XMM1);
+				}
+				code.movq(RAX, XMM0);
+				normalizeRegister(RAX, i.type);
+				put(v, RAX);
+				return;
+			}
+			get(XMM0, i.operands[0]);
+			if (i.op == OP_MUL && i.type == IR_V4I32) {
+				get(XMM1, i.operands[1]);
+				code.movRR(XMM15, XMM0);
+				code.packed(0x66, 0xf4, XMM0, XMM1);
+				code.psrlq(XMM15, 32);
+				code.psrlq(XMM1, 32);
+				code.packed(0x66, 0xf4, XMM15, XMM1);
+				code.pshufd(XMM0, XMM0, 0x08);
+				code.pshufd(XMM15, XMM15, 0x08);
+				code.packed(0x66, 0x62, XMM0, XMM15);
+				put(v, XMM0);
+				return;
+			}
+			unsigned b = use(i.operands[1], XMM1);
+			unsigned char op = 0;
+			unsigned char prefix = 0x66;
+			switch (i.op) {
+				case (OP_AND) : {
+					op = 0xdb;
+					break;
+				}
+				case (OP_OR) : {
+					op = 0xeb;
+					break;
+				}
+				case (OP_XOR) : {
+					op = 0xef;
+					break;
+				}
+				default : {
+					if (i.type == IR_V4I32 || i.type == IR_V2I64) {
+						bool dwords = i.type == IR_V4I32;
+						op = i.op == OP_ADD ? (dwords ? 0xfe : 0xd4) : (dwords ? 0xfa : 0xfb);
+					}
+					else {
+						static const unsigned char ops[] = {0x58, 0x5c, 0x59, 0x5e};
+						op = ops[i.op - OP_ADD];
+						prefix = i.type == IR_V4F32 ? 0 : 0x66;
+					}
+				}
+			}
+			code.packed(prefix, op, XMM0, b);
+			put(v, XMM0);
+		}
+
+		void convert(ValueId v) {
+			const Instruction &i = f->values[v];
+			ValueId a = i.operands[0];
+			IRType from = f->values[a].type;
+			bool unsignedSource = (i.flags & CONVERT_UNSIGNED) != 0;
+			if (irFloat(from) && irFloat(i.type)) {
+				get(XMM0, a);
+				if (from != i.type) {
+					code.cvtFloat(i.type == IR_F64, XMM0, XMM0);
+				}
+				put(v, XMM0);
+			}
+			else if (irFloat(from)) {
+				code.cvtts2si(from == IR_F32, RAX, use(a, XMM0));
+				normalizeRegister(RAX, i.type);
+				put(v, RAX);
+			}
+			else if (irFloat(i.type)) {
+				bool single = i.type == IR_F32;
+				get(RAX, a);
+				if (unsignedSource && irSize(from) < 8) {
+					code.zeroExtend(irSize(from), RAX);
+				}
+				if (unsignedSource && irSize(from) == 8) {
+					// Numbers with the top bit set are halved, keeping the low bit so rounding is right, and doubled.
+					unsigned big = code.newLabel();
+					unsigned done = code.newLabel();
+					code.test(RAX, RAX);
+					code.jcc(CC_S, big);
+					code.cvtsi2s(single, XMM0, RAX);
+					code.jmp(done);
+					code.bind(big);
+					code.movRR(RCX, RAX);
+					code.shiftImm(5, RCX, 1);
+					code.aluImm(Assembler::ALU_AND, RAX, 1);
+					code.alu(Assembler::ALU_OR, RCX, RAX);
+					code.cvtsi2s(single, XMM0, RCX);
+					code.sse(0x58, single, XMM0, XMM0);
+					code.bind(done);
+				}
+				else {
+					code.cvtsi2s(single, XMM0, RAX);
+				}
+				put(v, XMM0);
+			}
+			else {
+				get(RAX, a);
+				if (unsignedSource && irSize(from) < irSize(i.type)) {
+					code.zeroExtend(irSize(from), RAX);
+				}
+				normalizeRegister(RAX, i.type);
+				put(v, RAX);
+			}
+		}
+
+		// Copy a block of memory, a word at a time, with a loop for large blocks.
+		void copy(const Instruction &i) {
+			unsigned size = (unsigned) i.imm;
+			Memory to = memory(i.operands[0], RDX);
+			Memory from = memory(i.operands[1], RCX);
+			unsigned done = 0;
+			if (size > 128) {
+				code.lea(RDX, to);
+				code.lea(RCX, from);
+				code.movRI(R11, size / 8);
+				unsigned loop = code.newLabel();
+				code.bind(loop);
+				code.load(8, false, RAX, Memory::at(RCX, 0));
+				code.store(8, Memory::at(RDX, 0), RAX);
+				code.aluImm(Assembler::ALU_ADD, RCX, 8);
+				code.aluImm(Assembler::ALU_ADD, RDX, 8);
+				code.aluImm(Assembler::ALU_SUB, R11, 1);
+				code.jcc(CC_NE, loop);
+				to = Memory::at(RDX, 0);
+				from = Memory::at(RCX, 0);
+				size %= 8;
+			}
+			for (unsigned chunk : {8u, 4u, 2u, 1u}) {
+				while (size - done >= chunk) {
+					Memory s = from;
+					Memory d = to;
+					s.displacement += done;
+					d.displacement += done;
+					code.load(chunk, false, RAX, s);
+					code.store(chunk, d, RAX);
+					done += chunk;
+				}
+			}
+		}
+
+		void call(ValueId v) {
+			const Instruction &i = f->values[v];
+			std::vector<Move> moves;
+			std::vector<ValueId> stack;
+			unsigned ints = 0;
+			unsigned floats = 0;
+			for (unsigned j = 1; j < i.count; j++) {
+				ValueId a = i.operands[j];
+				if (isFloat(a) && floats < 8) {
+					moves.push_back(moveOf(a, ValueLocation::reg(XMM0 + floats++)));
+				}
+				else if (!isFloat(a) && ints < 6) {
+					moves.push_back(moveOf(a, ValueLocation::reg(argumentRegisters[ints++])));
+				}
+				else {
+					stack.push_back(a);
+				}
+			}
+
+			// Arguments on the stack are pushed last first, keeping rsp 16 byte aligned at the call.
+			unsigned pushed = stack.size() + stack.size() % 2;
+			if (stack.size() % 2 != 0) {
+				code.aluImm(Assembler::ALU_SUB, RSP, 8);
+			}
+			for (unsigned k = stack.size(); k-- > 0;) {
+				if (isFloat(stack[k])) {
+					code.movq(RAX, use(stack[k], XMM0));
+				}
+				else {
+					get(RAX, stack[k]);
+				}
+				code.push(RAX);
+			}
+
+			const Instruction &callee = f->values[i.operands[0]];
+			bool direct = callee.op == OP_SYMBOL && module->symbols[callee.imm].kind != DATA_SYMBOL;
+			if (!direct) {
+				moves.push_back(moveOf(i.operands[0], ValueLocation::reg(R10)));
+			}
+			parallelMove(moves);
+			// Variadic callees are told in al how many vector registers hold arguments.
+			code.movRI(RAX, floats);
+			if (direct) {
+				code.call(callee.imm);
+			}
+			else {
+				code.callR(R10);
+			}
+			if (pushed > 0) {
+				code.aluImm(Assembler::ALU_ADD, RSP, 8 * pushed);
+			}
+
+			if (i.type != IR_VOID && location(v).kind != ValueLocation::NOWHERE) {
+				if (irFloat(i.type)) {
+					put(v, XMM0);
+				}
+				else {
+					normalizeRegister(RAX, i.type);
+					put(v, RAX);
+				}
+			}
+		}
+
+		// A call that is followed by nothing but returning its result, or nothing, is made by jumping to the
+		// callee once the frame is gone, so that the callee returns straight to the caller and a chain of such calls runs in
+		// constant stack. That needs every argument in a register and nothing left pointing into the frame.
+		bool isTailCall(ValueId v) {
+			const Instruction &i = f->values[v];
+			if (frameShared || !returnsCall(f, v)) {
+				return false;
+			}
+			unsigned ints = 0;
+			unsigned floats = 0;
+			for (unsigned j = 1; j < i.count; j++) {
+				if (isFloat(i.operands[j])) {
+					floats++;
+				}
+				else {
+					ints++;
+				}
+			}
+			return ints <= 6 && floats <= 8;
+		}
+
+		void tailJump(ValueId v) {
+			const Instruction &i = f->values[v];
+			std::vector<Move> moves;
+			unsigned ints = 0;
+			unsigned floats = 0;
+			for (unsigned j = 1; j < i.count; j++) {
+				ValueId a = i.operands[j];
+				if (isFloat(a)) {
+					moves.push_back(moveOf(a, ValueLocation::reg(XMM0 + floats++)));
+				}
+				else {
+					moves.push_back(moveOf(a, ValueLocation::reg(argumentRegisters[ints++])));
+				}
+			}
+			const Instruction &callee = f->values[i.operands[0]];
+			bool direct = callee.op == OP_SYMBOL && module->symbols[callee.imm].kind != DATA_SYMBOL;
+			if (!direct) {
+				moves.push_back(moveOf(i.operands[0], ValueLocation::reg(R10)));
+			}
+			parallelMove(moves);
+			code.movRI(RAX, floats);
+			leaveFrame();
+			if (direct) {
+				code.jmpSymbol(callee.imm);
+			}
+			else {
+				code.jmpR(R10);
+			}
+			tailJumped = true;
+		}
+
+		void branch(ValueId v, unsigned block, unsigned next) {
+			const Instruction &i = f->values[v];
+			ValueId c = i.operands[0];
+			Condition taken = CC_NE;
+			if (allocation->fused[c]) {
+				compare(f->values[c]);
+				taken = condition(f->values[c].op);
+			}
+			else {
+				unsigned r = use(c, RAX);
+				code.test(r, r);
+			}
+			unsigned t = i.targets[0];
+			unsigned e = i.targets[1];
+			if (phiMoves(block, t).empty()) {
+				code.jcc(taken, blockLabels[t]);
+				edge(block, e, next);
+			}
+			else if (phiMoves(block, e).empty()) {
+				code.jcc(invert(taken), blockLabels[e]);
+				edge(block, t, next);
+			}
+			else {
+				unsigned other = code.newLabel();
+				code.jcc(invert(taken), other);
+				edge(block, t, ~0u);
+				code.bind(other);
+				edge(block, e, next);
+			}
+		}
+};
+
+const unsigned X86CodeGenerator::argumentRegisters[6] = {RDI, RSI, RDX, RCX, R8, R9};
+
+#endif